@@ -0,0 +1,215 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfDataGenerator.h"
+#include "Log.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <sstream>
+
+extern "C"
+{
+    InputModule* CreateInputModule();
+    void RegisterLogger(void(*log)(int, const char*, ...));
+}
+
+// names of phases in report, indexed by PerfLoadPhase
+static const char* benchmarkPhaseNames[PLP_COUNT] = {
+    "read", "sort", "symbols", "samples", "flat_profile", "call_graph", "call_tree", "heat_map", "snapshot"
+};
+
+// heat map bin widths requested after the heat map is built
+static const uint32_t benchmarkHeatMapWidths[] = { 100, 1000, 10000, 60000 };
+
+// stands in for core logger; just errors are reported, so they do not disturb timing
+static void BenchmarkLog(int level, const char* fmt, ...)
+{
+    if (level != LOG_ERROR)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+}
+
+// best (lowest) timings of all runs at one scale
+struct BenchmarkResult
+{
+    double wallMs[PLP_COUNT];
+    double cpuMs[PLP_COUNT];
+    double heatMapFillMs;
+    uint64_t peakMemory;
+};
+
+// loads recording and requests all outputs; returns false if it could not be loaded
+static bool RunBenchmark(const char* recording, const char* binary, BenchmarkResult &result)
+{
+    PerfInputModule* module = (PerfInputModule*)CreateInputModule();
+    module->SetSnapshotCache(false);
+
+    if (!module->LoadFile(recording, binary))
+    {
+        delete module;
+        return false;
+    }
+
+    // every output is aggregated on first request, which is timed by the module itself
+    std::vector<FlatProfileRecord> flat;
+    CallGraphMap callGraph;
+    CallTreeMap callTree;
+    TimeHistogramVector heatMap;
+
+    module->GetFlatProfileData(flat);
+    module->GetCallGraphMap(callGraph);
+    module->GetCallTreeMap(callTree);
+    module->GetHeatMapData(heatMap);
+
+    // fills from built heat map levels are timed here
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t width : benchmarkHeatMapWidths)
+        module->GetHeatMapData(heatMap, width);
+    auto end = std::chrono::steady_clock::now();
+
+    PerfLoadStats stats;
+    module->GetLoadStats(stats);
+
+    for (uint32_t i = 0; i < PLP_COUNT; i++)
+    {
+        result.wallMs[i] = std::min(result.wallMs[i], stats.phases[i].wallMs);
+        result.cpuMs[i] = std::min(result.cpuMs[i], stats.phases[i].cpuMs);
+    }
+    result.heatMapFillMs = std::min(result.heatMapFillMs, std::chrono::duration<double, std::milli>(end - start).count());
+
+    uint64_t memory = 0;
+    for (uint32_t i = 0; i < PMS_COUNT; i++)
+        memory += stats.peakMemory[i];
+    result.peakMemory = std::max(result.peakMemory, memory);
+
+    delete module;
+
+    return true;
+}
+
+static void PrintUsage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [options]\n"
+        "  --scales LIST       comma separated sample counts (default 1e4,1e5,1e6; up to 1e8 takes tens of GB)\n"
+        "  --repeat N          runs at every scale, the best one is reported (default 3)\n"
+        "  --dir PATH          directory of generated recordings (default /tmp)\n"
+        "  --keep              keep generated recordings\n"
+        "  --seed N            seed of recording generator (default 1)\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<uint64_t> scales;
+    std::string scaleList = "1e4,1e5,1e6";
+    std::string directory = "/tmp";
+    uint32_t repeat = 3;
+    uint64_t seed = 1;
+    bool keep = false;
+    char exePath[4096];
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+
+        if (arg == "--keep")
+            keep = true;
+        else if (i + 1 < argc && arg == "--scales")
+            scaleList = argv[++i];
+        else if (i + 1 < argc && arg == "--repeat")
+            repeat = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (i + 1 < argc && arg == "--dir")
+            directory = argv[++i];
+        else if (i + 1 < argc && arg == "--seed")
+            seed = strtoull(argv[++i], nullptr, 10);
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::stringstream scaleStream(scaleList);
+    std::string scale;
+    while (std::getline(scaleStream, scale, ','))
+        scales.push_back((uint64_t)strtod(scale.c_str(), nullptr));
+
+    RegisterLogger(BenchmarkLog);
+
+    // samples are spread over text section of this executable, so it serves as application binary
+    ssize_t len = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+    exePath[len > 0 ? len : 0] = '\0';
+
+    PerfGeneratorOptions options;
+    options.binaryPath = exePath;
+    options.seed = seed;
+    PerfDataGenerator::ReadTextRange(exePath, options.textStart, options.textEnd);
+
+    printf("%-12s", "samples");
+    for (uint32_t i = 0; i < PLP_COUNT; i++)
+        printf(" %12s", benchmarkPhaseNames[i]);
+    printf(" %13s %10s\n", "heat_map_fill", "peak_mb");
+
+    for (uint64_t samples : scales)
+    {
+        options.sampleCount = samples;
+
+        const std::string recording = directory + "/pivo-bench-" + std::to_string(samples) + ".data";
+        if (!PerfDataGenerator(options).Write(recording.c_str()))
+        {
+            fprintf(stderr, "Could not write %s\n", recording.c_str());
+            return 1;
+        }
+
+        BenchmarkResult result;
+        for (uint32_t i = 0; i < PLP_COUNT; i++)
+            result.wallMs[i] = result.cpuMs[i] = 1e300;
+        result.heatMapFillMs = 1e300;
+        result.peakMemory = 0;
+
+        for (uint32_t r = 0; r < repeat; r++)
+        {
+            if (!RunBenchmark(recording.c_str(), exePath, result))
+            {
+                fprintf(stderr, "Could not load %s\n", recording.c_str());
+                return 1;
+            }
+        }
+
+        // wall times in milliseconds
+        printf("%-12llu", (unsigned long long)samples);
+        for (uint32_t i = 0; i < PLP_COUNT; i++)
+            printf(" %12.2f", result.wallMs[i]);
+        printf(" %13.2f %10.1f\n", result.heatMapFillMs, (double)result.peakMemory / (1024.0 * 1024.0));
+
+        if (!keep)
+            unlink(recording.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "PerfDataGenerator.h"
+
+// parses count given either as integer or in exponent notation (1e6)
+static uint64_t ParseCount(const char* str)
+{
+    return (uint64_t)strtod(str, nullptr);
+}
+
+static void PrintUsage(const char* name)
+{
+    fprintf(stderr, "Usage: %s <output> [options]\n"
+        "  --samples N         count of samples (default 1e4)\n"
+        "  --mean-depth N      mean stack depth (default 12)\n"
+        "  --max-depth N       maximum stack depth (default 127)\n"
+        "  --functions N       functions within binary, every library and JIT region (default 2000)\n"
+        "  --dsos N            mapped shared libraries (default 4)\n"
+        "  --dso PATH          real shared library to be mapped (may be repeated)\n"
+        "  --dso-fraction F    fraction of frames within libraries (default 0.3)\n"
+        "  --jit-fraction F    fraction of frames within unmapped JIT regions (default 0.05)\n"
+        "  --processes N       count of processes (default 1)\n"
+        "  --threads N         threads of every process (default 4)\n"
+        "  --cpus N            count of CPUs (default 4)\n"
+        "  --switch-ratio F    context switch pairs per sample (default 0)\n"
+        "  --interval NS       sampling interval in nanoseconds (default 1000000)\n"
+        "  --binary PATH       application binary (default this executable)\n"
+        "  --seed N            seed of pseudo-random generator (default 1)\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    PerfGeneratorOptions options;
+    char exePath[4096];
+
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    ssize_t len = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+    exePath[len > 0 ? len : 0] = '\0';
+    options.binaryPath = exePath;
+
+    for (int i = 2; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+
+        if (i + 1 >= argc)
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+
+        const char* value = argv[++i];
+
+        if (arg == "--samples")
+            options.sampleCount = ParseCount(value);
+        else if (arg == "--mean-depth")
+            options.meanDepth = (uint32_t)ParseCount(value);
+        else if (arg == "--max-depth")
+            options.maxDepth = (uint32_t)ParseCount(value);
+        else if (arg == "--functions")
+            options.functionCount = (uint32_t)ParseCount(value);
+        else if (arg == "--dsos")
+            options.dsoCount = (uint32_t)ParseCount(value);
+        else if (arg == "--dso")
+            options.dsoPaths.push_back(value);
+        else if (arg == "--dso-fraction")
+            options.dsoFraction = strtod(value, nullptr);
+        else if (arg == "--jit-fraction")
+            options.jitFraction = strtod(value, nullptr);
+        else if (arg == "--processes")
+            options.processCount = (uint32_t)ParseCount(value);
+        else if (arg == "--threads")
+            options.threadCount = (uint32_t)ParseCount(value);
+        else if (arg == "--cpus")
+            options.cpuCount = (uint32_t)ParseCount(value);
+        else if (arg == "--switch-ratio")
+            options.switchRatio = strtod(value, nullptr);
+        else if (arg == "--interval")
+            options.sampleInterval = ParseCount(value);
+        else if (arg == "--binary")
+            options.binaryPath = value;
+        else if (arg == "--seed")
+            options.seed = ParseCount(value);
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // frames within the binary have to fall to its text section to be resolved
+    if (!PerfDataGenerator::ReadTextRange(options.binaryPath.c_str(), options.textStart, options.textEnd))
+        fprintf(stderr, "Could not read text section of %s, using default range\n", options.binaryPath.c_str());
+
+    PerfDataGenerator generator(options);
+    if (!generator.Write(argv[1]))
+    {
+        fprintf(stderr, "Could not write %s\n", argv[1]);
+        return 1;
+    }
+
+    printf("Written %s: %llu samples, %llu bytes of data; load it with binary %s\n", argv[1], (unsigned long long)options.sampleCount,
+        (unsigned long long)generator.GetDataSize(), options.binaryPath.c_str());
+
+    return 0;
+}
@@ -0,0 +1,439 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "PerfFileStructs.h"
+#include "PerfDataGenerator.h"
+
+#include <elf.h>
+#include <sys/stat.h>
+
+// pid of the first generated process
+#define PERF_GENERATOR_FIRST_PID 1000
+// callees of every function (and count of stack roots)
+#define PERF_GENERATOR_FANOUT 4
+// time of the first sample
+#define PERF_GENERATOR_TIME_BASE 1000000000ULL
+
+PerfGeneratorOptions::PerfGeneratorOptions()
+{
+    sampleCount = 10000;
+    meanDepth = 12;
+    maxDepth = 127;
+    functionCount = PERF_GENERATOR_DEFAULT_FUNCTIONS;
+    dsoCount = 4;
+    dsoFraction = 0.3;
+    jitFraction = 0.05;
+    processCount = 1;
+    threadCount = 4;
+    cpuCount = 4;
+    switchRatio = 0.0;
+    sampleInterval = 1000000;
+    textStart = 0x400000;
+    textEnd = 0x500000;
+    seed = 1;
+}
+
+PerfDataGenerator::PerfDataGenerator(const PerfGeneratorOptions &options) : m_options(options)
+{
+    m_file = nullptr;
+    m_dataSize = 0;
+    m_random = 0;
+    m_binaryFunctions = 0;
+    m_dsoFunctions = 0;
+
+    if (m_options.maxDepth > PERF_GENERATOR_MAX_DEPTH)
+        m_options.maxDepth = PERF_GENERATOR_MAX_DEPTH;
+    if (m_options.maxDepth == 0)
+        m_options.maxDepth = 1;
+    if (m_options.meanDepth == 0)
+        m_options.meanDepth = 1;
+    if (m_options.functionCount == 0)
+        m_options.functionCount = 1;
+    if (m_options.processCount == 0)
+        m_options.processCount = 1;
+    if (m_options.threadCount == 0)
+        m_options.threadCount = 1;
+    if (m_options.cpuCount == 0)
+        m_options.cpuCount = 1;
+    if (m_options.dsoCount < m_options.dsoPaths.size())
+        m_options.dsoCount = (uint32_t)m_options.dsoPaths.size();
+}
+
+bool PerfDataGenerator::ReadTextRange(const char* path, uint64_t &start, uint64_t &end)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    Elf64_Ehdr ehdr;
+    std::vector<Elf64_Shdr> sections;
+    std::vector<char> names;
+    bool found = false;
+
+    if (fread(&ehdr, sizeof(ehdr), 1, f) == 1 && memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0
+        && ehdr.e_ident[EI_CLASS] == ELFCLASS64 && ehdr.e_shentsize == sizeof(Elf64_Shdr) && ehdr.e_shstrndx < ehdr.e_shnum)
+    {
+        sections.resize(ehdr.e_shnum);
+        if (fseek(f, (long)ehdr.e_shoff, SEEK_SET) == 0 && fread(sections.data(), sizeof(Elf64_Shdr), sections.size(), f) == sections.size())
+        {
+            const Elf64_Shdr &strtab = sections[ehdr.e_shstrndx];
+            names.resize(strtab.sh_size + 1, '\0');
+            if (fseek(f, (long)strtab.sh_offset, SEEK_SET) == 0 && fread(names.data(), 1, strtab.sh_size, f) == strtab.sh_size)
+            {
+                for (const Elf64_Shdr &sec : sections)
+                {
+                    if (sec.sh_name < strtab.sh_size && strcmp(&names[sec.sh_name], ".text") == 0 && sec.sh_size > 0)
+                    {
+                        start = sec.sh_addr;
+                        end = sec.sh_addr + sec.sh_size;
+                        found = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    fclose(f);
+
+    return found;
+}
+
+uint64_t PerfDataGenerator::NextRandom()
+{
+    m_random ^= m_random >> 12;
+    m_random ^= m_random << 25;
+    m_random ^= m_random >> 27;
+
+    return m_random * 2685821657736338717ULL;
+}
+
+double PerfDataGenerator::NextUniform()
+{
+    return (double)(NextRandom() >> 11) / (double)(1ULL << 53);
+}
+
+void PerfDataGenerator::PlaceFunctions()
+{
+    const uint32_t count = m_options.functionCount;
+    const uint64_t textLength = m_options.textEnd - m_options.textStart;
+
+    m_functions.clear();
+
+    // application functions are spread evenly over text section, so every one of them resolves to some symbol
+    for (uint32_t i = 0; i < count; i++)
+        m_functions.push_back(m_options.textStart + (textLength * i) / count);
+    m_binaryFunctions = count;
+
+    for (uint32_t d = 0; d < m_options.dsoCount; d++)
+    {
+        for (uint32_t i = 0; i < count; i++)
+            m_functions.push_back(PERF_GENERATOR_DSO_BASE + d * PERF_GENERATOR_DSO_SLOT + ((PERF_GENERATOR_DSO_SLOT / 2) * i) / count);
+    }
+    m_dsoFunctions = count * m_options.dsoCount;
+
+    for (uint32_t i = 0; i < count; i++)
+        m_functions.push_back(PERF_GENERATOR_JIT_BASE + i * PERF_GENERATOR_JIT_STRIDE);
+}
+
+uint32_t PerfDataGenerator::DrawDepth()
+{
+    // geometric distribution with given mean, at least one frame
+    const double p = 1.0 / (double)m_options.meanDepth;
+    uint32_t depth = 1;
+
+    while (depth < m_options.maxDepth && NextUniform() >= p)
+        depth++;
+
+    return depth;
+}
+
+uint64_t PerfDataGenerator::DrawFunction(int64_t parent)
+{
+    const uint32_t count = m_options.functionCount;
+    const uint64_t pick = NextRandom() % PERF_GENERATOR_FANOUT;
+
+    // stacks start in just a few application functions
+    if (parent < 0)
+        return (pick * 7919) % m_binaryFunctions;
+
+    // callees are given by caller, so the stacks repeat like in real programs
+    uint64_t callee = ((uint64_t)parent * 2654435761ULL + pick * 40503ULL + 1) % count;
+
+    const double region = NextUniform();
+    if (region < m_options.jitFraction)
+        return m_binaryFunctions + m_dsoFunctions + callee;
+    if (region < m_options.jitFraction + m_options.dsoFraction && m_options.dsoCount > 0)
+        return m_binaryFunctions + (((uint64_t)parent + pick) % m_options.dsoCount) * count + callee;
+
+    return callee;
+}
+
+void PerfDataGenerator::Append(const void* data, size_t size)
+{
+    m_event.insert(m_event.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+void PerfDataGenerator::AppendString(const char* str)
+{
+    const size_t length = strlen(str) + 1;
+
+    Append(str, length);
+    m_event.resize(m_event.size() + ((8 - length % 8) % 8), 0);
+}
+
+void PerfDataGenerator::AppendSampleId(uint32_t pid, uint32_t tid, uint64_t time, uint32_t cpu)
+{
+    // sample_id layout follows sample type (PERF_SAMPLE_TID, PERF_SAMPLE_TIME, PERF_SAMPLE_CPU)
+    const uint32_t ids[2] = { pid, tid };
+    const uint32_t cpus[2] = { cpu, 0 };
+
+    Append(ids, sizeof(ids));
+    Append(&time, sizeof(time));
+    Append(cpus, sizeof(cpus));
+}
+
+void PerfDataGenerator::WriteEvent(uint32_t type, uint16_t misc, const void* data, size_t size)
+{
+    perf_event_header header;
+    header.type = type;
+    header.misc = misc;
+    header.size = (uint16_t)(sizeof(header) + size);
+
+    fwrite(&header, sizeof(header), 1, m_file);
+    fwrite(data, 1, size, m_file);
+
+    m_dataSize += header.size;
+}
+
+void PerfDataGenerator::WriteMappings(uint64_t time)
+{
+    struct stat st;
+    char name[64];
+
+    for (uint32_t p = 0; p < m_options.processCount; p++)
+    {
+        const uint32_t pid = PERF_GENERATOR_FIRST_PID + p * (m_options.threadCount + 1);
+
+        // application binary
+        m_event.clear();
+        const uint32_t ids[2] = { pid, pid };
+        const uint64_t binary[3] = { m_options.textStart, m_options.textEnd - m_options.textStart, 0 };
+        Append(ids, sizeof(ids));
+        Append(binary, sizeof(binary));
+        AppendString(m_options.binaryPath.c_str());
+        AppendSampleId(pid, pid, time, 0);
+        WriteEvent(PERF_RECORD_MMAP, PERF_RECORD_MISC_USER, m_event.data(), m_event.size());
+
+        // shared libraries; the synthetic ones do not exist, so their frames stay unresolved
+        for (uint32_t d = 0; d < m_options.dsoCount; d++)
+        {
+            std::string path;
+            uint64_t length = PERF_GENERATOR_DSO_SLOT / 2;
+
+            if (d < m_options.dsoPaths.size())
+            {
+                path = m_options.dsoPaths[d];
+                if (stat(path.c_str(), &st) == 0 && (uint64_t)st.st_size < length)
+                    length = (uint64_t)st.st_size;
+            }
+            else
+            {
+                snprintf(name, sizeof(name), "/pivo-synthetic/lib%u.so", d);
+                path = name;
+            }
+
+            m_event.clear();
+            const uint64_t range[3] = { PERF_GENERATOR_DSO_BASE + d * PERF_GENERATOR_DSO_SLOT, length, 0 };
+            const uint32_t device[2] = { 0, 0 };
+            const uint64_t inode[2] = { 0, 0 };
+            const uint32_t protection[2] = { 5, 2 };
+            Append(ids, sizeof(ids));
+            Append(range, sizeof(range));
+            Append(device, sizeof(device));
+            Append(inode, sizeof(inode));
+            Append(protection, sizeof(protection));
+            AppendString(path.c_str());
+            AppendSampleId(pid, pid, time, 0);
+            WriteEvent(PERF_RECORD_MMAP2, PERF_RECORD_MISC_USER, m_event.data(), m_event.size());
+        }
+
+        for (uint32_t t = 0; t < m_options.threadCount; t++)
+        {
+            const uint32_t tid = pid + t;
+
+            // threads other than the main one are forked from it
+            if (t > 0)
+            {
+                m_event.clear();
+                const uint32_t fork[4] = { pid, pid, tid, pid };
+                Append(fork, sizeof(fork));
+                Append(&time, sizeof(time));
+                AppendSampleId(pid, tid, time, 0);
+                WriteEvent(PERF_RECORD_FORK, 0, m_event.data(), m_event.size());
+            }
+
+            m_event.clear();
+            const uint32_t comm[2] = { pid, tid };
+            snprintf(name, sizeof(name), "worker-%u", t);
+            Append(comm, sizeof(comm));
+            AppendString(name);
+            AppendSampleId(pid, tid, time, 0);
+            WriteEvent(PERF_RECORD_COMM, 0, m_event.data(), m_event.size());
+        }
+    }
+}
+
+void PerfDataGenerator::WriteSample(uint64_t index, uint64_t time)
+{
+    const uint32_t thread = (uint32_t)(NextRandom() % (m_options.processCount * m_options.threadCount));
+    const uint32_t pid = PERF_GENERATOR_FIRST_PID + (thread / m_options.threadCount) * (m_options.threadCount + 1);
+    const uint32_t tid = pid + thread % m_options.threadCount;
+    const uint32_t cpu = thread % m_options.cpuCount;
+    const uint32_t depth = DrawDepth();
+
+    // stack is drawn from root down to leaf, callchain is stored leaf first
+    m_callchain.assign(depth + 1, 0);
+    m_callchain[0] = PERF_CONTEXT_USER;
+
+    int64_t function = -1;
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        function = (int64_t)DrawFunction(function);
+        // return addresses point a bit into caller, the leaf IP anywhere in the first bytes
+        m_callchain[depth - i] = m_functions[function] + ((i + 1 == depth) ? (index % 64) : 0x20);
+    }
+
+    const uint32_t ids[2] = { pid, tid };
+    const uint32_t cpus[2] = { cpu, 0 };
+    const uint64_t period = m_options.sampleInterval;
+    const uint64_t chainLength = m_callchain.size();
+
+    m_event.clear();
+    Append(&m_callchain[1], sizeof(uint64_t));
+    Append(ids, sizeof(ids));
+    Append(&time, sizeof(time));
+    Append(cpus, sizeof(cpus));
+    Append(&period, sizeof(period));
+    Append(&chainLength, sizeof(chainLength));
+    Append(m_callchain.data(), m_callchain.size() * sizeof(uint64_t));
+    WriteEvent(PERF_RECORD_SAMPLE, PERF_RECORD_MISC_USER, m_event.data(), m_event.size());
+}
+
+void PerfDataGenerator::WriteSwitch(uint32_t pid, uint32_t tid, uint32_t cpu, uint64_t time)
+{
+    m_event.clear();
+    AppendSampleId(pid, tid, time, cpu);
+    WriteEvent(PERF_RECORD_SWITCH, PERF_RECORD_MISC_SWITCH_OUT, m_event.data(), m_event.size());
+
+    m_event.clear();
+    AppendSampleId(pid, tid, time + m_options.sampleInterval / 2, cpu);
+    WriteEvent(PERF_RECORD_SWITCH, 0, m_event.data(), m_event.size());
+}
+
+bool PerfDataGenerator::Write(const char* path)
+{
+    perf_file_header header;
+    perf_file_attr attr;
+
+    m_file = fopen(path, "wb");
+    if (!m_file)
+        return false;
+
+    // xorshift state must not be zero
+    m_random = m_options.seed * 0x9E3779B97F4A7C15ULL + 1;
+    m_dataSize = 0;
+    PlaceFunctions();
+
+    memset(&attr, 0, sizeof(attr));
+    attr.attr.type = PERF_TYPE_HARDWARE;
+    attr.attr.size = sizeof(attr.attr);
+    attr.attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.attr.sample_period = m_options.sampleInterval;
+    attr.attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU | PERF_SAMPLE_PERIOD | PERF_SAMPLE_CALLCHAIN;
+    attr.attr.sample_id_all = 1;
+    attr.attr.mmap = 1;
+    attr.attr.mmap2 = 1;
+    attr.attr.comm = 1;
+    attr.attr.task = 1;
+    attr.attr.context_switch = (m_options.switchRatio > 0.0) ? 1 : 0;
+
+    // data section size is filled in when all the events are written
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "PERFILE2", PERF_FILE_MAGIC_LENGTH);
+    header.size = sizeof(header);
+    header.attr_size = sizeof(attr);
+    header.attrs.offset = sizeof(header);
+    header.attrs.size = sizeof(attr);
+    header.data.offset = sizeof(header) + sizeof(attr);
+
+    fwrite(&header, sizeof(header), 1, m_file);
+    fwrite(&attr, sizeof(attr), 1, m_file);
+
+    WriteMappings(PERF_GENERATOR_TIME_BASE - 1000);
+
+    double switches = 0.0;
+    uint64_t time = PERF_GENERATOR_TIME_BASE;
+    for (uint64_t i = 0; i < m_options.sampleCount; i++)
+    {
+        WriteSample(i, time);
+
+        switches += m_options.switchRatio;
+        if (switches >= 1.0)
+        {
+            switches -= 1.0;
+            const uint32_t thread = (uint32_t)(i % (m_options.processCount * m_options.threadCount));
+            const uint32_t pid = PERF_GENERATOR_FIRST_PID + (thread / m_options.threadCount) * (m_options.threadCount + 1);
+            WriteSwitch(pid, pid + thread % m_options.threadCount, thread % m_options.cpuCount, time + 1000);
+        }
+
+        time += m_options.sampleInterval;
+    }
+
+    // all threads exit at the end
+    for (uint32_t p = 0; p < m_options.processCount; p++)
+    {
+        const uint32_t pid = PERF_GENERATOR_FIRST_PID + p * (m_options.threadCount + 1);
+        for (uint32_t t = m_options.threadCount; t-- > 0; )
+        {
+            m_event.clear();
+            const uint32_t exit[4] = { pid, pid, pid + t, pid };
+            Append(exit, sizeof(exit));
+            Append(&time, sizeof(time));
+            AppendSampleId(pid, pid + t, time, 0);
+            WriteEvent(PERF_RECORD_EXIT, 0, m_event.data(), m_event.size());
+        }
+    }
+
+    header.data.size = m_dataSize;
+
+    bool ok = (fseek(m_file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, m_file) == 1);
+    if (fclose(m_file) != 0)
+        ok = false;
+    m_file = nullptr;
+
+    return ok;
+}
+
+uint64_t PerfDataGenerator::GetDataSize() const
+{
+    return m_dataSize;
+}
@@ -0,0 +1,139 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef PIVO_PERF_DATA_GENERATOR_H
+#define PIVO_PERF_DATA_GENERATOR_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+
+// count of synthetic functions within every region of generated recording
+#define PERF_GENERATOR_DEFAULT_FUNCTIONS 2000
+// base address of synthetic shared libraries (every one of them gets its own slot)
+#define PERF_GENERATOR_DSO_BASE 0x7f0000000000ULL
+#define PERF_GENERATOR_DSO_SLOT 0x10000000ULL
+// base address of JIT-style code regions, which are not covered by any mapping
+#define PERF_GENERATOR_JIT_BASE 0x7e0000000000ULL
+// distance of JIT-style functions
+#define PERF_GENERATOR_JIT_STRIDE 0x1000ULL
+// maximum stack depth (perf event size is limited to 64 kB)
+#define PERF_GENERATOR_MAX_DEPTH 1024
+
+// parameters of synthetic recording; the same parameters (and seed) always produce the same file
+struct PerfGeneratorOptions
+{
+    PerfGeneratorOptions();
+
+    // count of samples
+    uint64_t sampleCount;
+    // mean and maximum depth of sampled stacks (depths are geometrically distributed)
+    uint32_t meanDepth;
+    uint32_t maxDepth;
+    // count of distinct functions within application binary, every shared library and JIT region
+    uint32_t functionCount;
+    // count of mapped shared libraries; the ones without path given are synthetic (and thus not resolved)
+    uint32_t dsoCount;
+    // paths of real shared libraries to be mapped
+    std::vector<std::string> dsoPaths;
+    // fraction of frames within shared libraries
+    double dsoFraction;
+    // fraction of frames within JIT-style regions without mapping (resolved as unknown symbols)
+    double jitFraction;
+    // count of processes and threads within every process
+    uint32_t processCount;
+    uint32_t threadCount;
+    // count of CPUs samples are spread over
+    uint32_t cpuCount;
+    // context switch pairs per sample (0 for none)
+    double switchRatio;
+    // sampling interval in nanoseconds
+    uint64_t sampleInterval;
+    // application binary and its text range; frames within the binary fall into the range
+    std::string binaryPath;
+    uint64_t textStart;
+    uint64_t textEnd;
+    // seed of pseudo-random generator
+    uint64_t seed;
+};
+
+// writes valid perf.data (PERFILE2) recordings made of synthetic records
+class PerfDataGenerator
+{
+    public:
+        PerfDataGenerator(const PerfGeneratorOptions &options);
+
+        // reads text section range of ELF binary; returns false if it's not 64-bit ELF with text section
+        static bool ReadTextRange(const char* path, uint64_t &start, uint64_t &end);
+
+        // writes recording to file; returns false if the file could not be written
+        bool Write(const char* path);
+        // retrieves count of bytes written to data section by the last write
+        uint64_t GetDataSize() const;
+
+    protected:
+        // next pseudo-random number (xorshift64*)
+        uint64_t NextRandom();
+        // pseudo-random number in range <0; 1)
+        double NextUniform();
+        // places synthetic functions of all regions
+        void PlaceFunctions();
+        // draws depth of next stack
+        uint32_t DrawDepth();
+        // draws function (root of stack if parent is negative, its callee otherwise)
+        uint64_t DrawFunction(int64_t parent);
+
+        // writes event header and data
+        void WriteEvent(uint32_t type, uint16_t misc, const void* data, size_t size);
+        // appends sample_id trailer (tid, time, cpu) to event buffer
+        void AppendSampleId(uint32_t pid, uint32_t tid, uint64_t time, uint32_t cpu);
+        // appends value to event buffer
+        void Append(const void* data, size_t size);
+        // appends string padded to 8 bytes to event buffer
+        void AppendString(const char* str);
+
+        // writes mappings and thread names preceding samples
+        void WriteMappings(uint64_t time);
+        // writes single sample with stack
+        void WriteSample(uint64_t index, uint64_t time);
+        // writes context switch pair of thread
+        void WriteSwitch(uint32_t pid, uint32_t tid, uint32_t cpu, uint64_t time);
+
+    private:
+        PerfGeneratorOptions m_options;
+        // file being written
+        FILE* m_file;
+        // bytes written to data section
+        uint64_t m_dataSize;
+        // pseudo-random generator state
+        uint64_t m_random;
+        // data of event being composed
+        std::vector<uint8_t> m_event;
+        // entry addresses of synthetic functions; application functions first, then libraries, then JIT regions
+        std::vector<uint64_t> m_functions;
+        // count of functions of application binary and of shared libraries
+        uint32_t m_binaryFunctions;
+        uint32_t m_dsoFunctions;
+        // callchain being composed (leaf first)
+        std::vector<uint64_t> m_callchain;
+};
+
+#endif
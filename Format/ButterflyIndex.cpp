@@ -0,0 +1,124 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "ButterflyIndex.h"
+
+#include <algorithm>
+
+// sorts callers or callees by weight, the heaviest first
+struct PerfButterflyEdgeSortPredicate
+{
+    bool operator()(const PerfButterflyEdge &a, const PerfButterflyEdge &b) const
+    {
+        if (a.weight != b.weight)
+            return a.weight > b.weight;
+        return a.functionId < b.functionId;
+    }
+};
+
+ButterflyIndex::ButterflyIndex()
+{
+    m_stamp = 0;
+}
+
+void ButterflyIndex::Reset(uint32_t functionCount)
+{
+    m_entries.clear();
+    m_entries.resize(functionCount);
+    for (uint32_t i = 0; i < functionCount; i++)
+    {
+        m_entries[i].functionId = i;
+        m_entries[i].selfWeight = 0;
+        m_entries[i].inclusiveWeight = 0;
+    }
+
+    m_edges.clear();
+    m_counted.assign(functionCount, 0);
+    m_stamp = 0;
+}
+
+void ButterflyIndex::Add(const uint32_t* frames, uint32_t count, uint64_t weight)
+{
+    if (count == 0)
+        return;
+
+    m_stamp++;
+
+    m_entries[frames[0]].selfWeight += weight;
+
+    // inclusive weight leaves out the leaf frame, the same way flat profile inclusive time does
+    for (uint32_t i = 1; i < count; i++)
+    {
+        if (m_counted[frames[i]] != m_stamp)
+        {
+            m_counted[frames[i]] = m_stamp;
+            m_entries[frames[i]].inclusiveWeight += weight;
+        }
+    }
+
+    // recursion repeats the same pairs, they count just once as well
+    m_stackEdges.clear();
+    for (uint32_t i = 1; i < count; i++)
+        m_stackEdges.push_back(((uint64_t)frames[i] << 32) | frames[i - 1]);
+
+    std::sort(m_stackEdges.begin(), m_stackEdges.end());
+
+    for (size_t i = 0; i < m_stackEdges.size(); i++)
+    {
+        if (i == 0 || m_stackEdges[i] != m_stackEdges[i - 1])
+            m_edges[m_stackEdges[i]] += weight;
+    }
+}
+
+void ButterflyIndex::Finish()
+{
+    PerfButterflyEdge edge;
+
+    for (auto &itr : m_edges)
+    {
+        const uint32_t caller = (uint32_t)(itr.first >> 32);
+        const uint32_t callee = (uint32_t)(itr.first & 0xFFFFFFFF);
+
+        edge.weight = itr.second;
+
+        edge.functionId = caller;
+        m_entries[callee].callers.push_back(edge);
+
+        edge.functionId = callee;
+        m_entries[caller].callees.push_back(edge);
+    }
+
+    m_edges.clear();
+
+    for (PerfButterflyEntry &entry : m_entries)
+    {
+        std::sort(entry.callers.begin(), entry.callers.end(), PerfButterflyEdgeSortPredicate());
+        std::sort(entry.callees.begin(), entry.callees.end(), PerfButterflyEdgeSortPredicate());
+    }
+}
+
+const PerfButterflyEntry* ButterflyIndex::Get(uint32_t functionId) const
+{
+    if (functionId >= m_entries.size() || (m_entries[functionId].selfWeight == 0 && m_entries[functionId].inclusiveWeight == 0))
+        return nullptr;
+
+    return &m_entries[functionId];
+}
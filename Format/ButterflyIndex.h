@@ -0,0 +1,58 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef PIVO_BUTTERFLY_INDEX_H
+#define PIVO_BUTTERFLY_INDEX_H
+
+#include "PerfQueryStructs.h"
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+// direct callers and callees of every function, aggregated from weighted stacks
+class ButterflyIndex
+{
+    public:
+        ButterflyIndex();
+
+        // removes all entries and prepares index for function table of given size
+        void Reset(uint32_t functionCount);
+        // adds weighted stack (sampled function first); every function and caller-callee pair counts once per stack
+        void Add(const uint32_t* frames, uint32_t count, uint64_t weight);
+        // moves accumulated caller-callee weights to entries, the heaviest first
+        void Finish();
+        // retrieves entry of function, nullptr if the function is not within any added stack
+        const PerfButterflyEntry* Get(uint32_t functionId) const;
+
+    private:
+        // self and inclusive weights and (after finishing) callers and callees of every function
+        std::vector<PerfButterflyEntry> m_entries;
+        // weight of every caller-callee pair (caller in upper half of key)
+        std::unordered_map<uint64_t, uint64_t> m_edges;
+        // caller-callee pairs of stack being added
+        std::vector<uint64_t> m_stackEdges;
+        // last stack the function was counted in
+        std::vector<uint32_t> m_counted;
+        // number of stack being added
+        uint32_t m_stamp;
+};
+
+#endif
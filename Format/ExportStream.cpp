@@ -0,0 +1,172 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "ExportStream.h"
+#include "PerfInputModule.h"
+#include "Log.h"
+#include "../config_perf.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+ExportStream::ExportStream(int fd, bool compress)
+{
+    m_fd = fd;
+    m_failed = false;
+    m_compressor = nullptr;
+
+    m_buffer.reserve(EXPORT_BUFFER_SIZE * 2);
+
+#ifdef HAVE_ZLIB
+    if (compress)
+    {
+        z_stream* zs = new z_stream;
+        memset(zs, 0, sizeof(z_stream));
+
+        // 16 added to window bits means gzip header and trailer instead of zlib ones
+        if (deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+        {
+            m_compressor = zs;
+            m_compressed.resize(EXPORT_BUFFER_SIZE);
+        }
+        else
+        {
+            LogFunc(LOG_ERROR, "Could not initialize compression, exported data will not be compressed");
+            delete zs;
+        }
+    }
+#else
+    if (compress)
+        LogFunc(LOG_VERBOSE, "Built without zlib, exported data will not be compressed");
+#endif
+}
+
+ExportStream::~ExportStream()
+{
+#ifdef HAVE_ZLIB
+    if (m_compressor)
+    {
+        deflateEnd((z_stream*)m_compressor);
+        delete (z_stream*)m_compressor;
+    }
+#endif
+}
+
+bool ExportStream::IsCompressed() const
+{
+    return (m_compressor != nullptr);
+}
+
+bool ExportStream::Write(const void* data, size_t size)
+{
+    if (m_failed)
+        return false;
+
+    m_buffer.insert(m_buffer.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+
+    if (m_buffer.size() >= EXPORT_BUFFER_SIZE)
+        return FlushBuffer(false);
+
+    return true;
+}
+
+bool ExportStream::Write(const std::string &data)
+{
+    return Write(data.data(), data.size());
+}
+
+bool ExportStream::Finish()
+{
+    if (m_failed)
+        return false;
+
+    return FlushBuffer(true);
+}
+
+bool ExportStream::FlushBuffer(bool finish)
+{
+#ifdef HAVE_ZLIB
+    if (m_compressor)
+    {
+        z_stream* zs = (z_stream*)m_compressor;
+        int ret;
+
+        zs->next_in = m_buffer.data();
+        zs->avail_in = (uInt)m_buffer.size();
+
+        // compress until the input is consumed (and, when finishing, until the stream is closed)
+        do
+        {
+            zs->next_out = m_compressed.data();
+            zs->avail_out = (uInt)m_compressed.size();
+
+            ret = deflate(zs, finish ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR)
+            {
+                LogFunc(LOG_ERROR, "Compression of exported data failed");
+                m_failed = true;
+                return false;
+            }
+
+            if (!WriteAll(m_compressed.data(), m_compressed.size() - zs->avail_out))
+                return false;
+        }
+        while (zs->avail_out == 0 || (finish && ret != Z_STREAM_END));
+
+        m_buffer.clear();
+        return true;
+    }
+#endif
+
+    if (!WriteAll(m_buffer.data(), m_buffer.size()))
+        return false;
+
+    m_buffer.clear();
+    return true;
+}
+
+bool ExportStream::WriteAll(const uint8_t* data, size_t size)
+{
+    ssize_t wr;
+
+    while (size > 0)
+    {
+        wr = write(m_fd, data, size);
+        if (wr < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            LogFunc(LOG_ERROR, "Could not write exported data (errno %i)", errno);
+            m_failed = true;
+            return false;
+        }
+
+        data += wr;
+        size -= (size_t)wr;
+    }
+
+    return true;
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef PIVO_EXPORT_STREAM_H
+#define PIVO_EXPORT_STREAM_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// exported data are written in blocks of this size
+#define EXPORT_BUFFER_SIZE (64 * 1024)
+
+// buffered output to file descriptor, optionally gzip-compressed on the fly
+class ExportStream
+{
+    public:
+        // compression is used only when the module is built with zlib
+        ExportStream(int fd, bool compress);
+        ~ExportStream();
+
+        // appends data to stream
+        bool Write(const void* data, size_t size);
+        // appends string contents to stream
+        bool Write(const std::string &data);
+        // writes everything buffered and finishes compressed stream
+        bool Finish();
+        // is the output compressed?
+        bool IsCompressed() const;
+
+    protected:
+        // passes buffered data to output (through compressor, if any)
+        bool FlushBuffer(bool finish);
+        // writes whole block to file descriptor
+        bool WriteAll(const uint8_t* data, size_t size);
+
+    private:
+        // output file descriptor
+        int m_fd;
+        // did any write fail?
+        bool m_failed;
+        // data waiting to be written
+        std::vector<uint8_t> m_buffer;
+        // compressor state (nullptr if not compressing)
+        void* m_compressor;
+        // compressed data waiting to be written
+        std::vector<uint8_t> m_compressed;
+};
+
+#endif
@@ -21,13 +21,16 @@
 #include "General.h"
 #include "Helpers.h"
 
+#include <fcntl.h>
+
 int ForkProcessForReading(const char** params)
 {
     int pipes[NUM_PIPES][2];
 
-    // pipes for parent to write and read
-    pipe(pipes[PARENT_READ_PIPE]);
-    pipe(pipes[PARENT_WRITE_PIPE]);
+    // pipes for parent to write and read; they are not inherited by processes forked concurrently by other threads
+    // (the ends duplicated to standard input and output lose the flag)
+    pipe2(pipes[PARENT_READ_PIPE], O_CLOEXEC);
+    pipe2(pipes[PARENT_WRITE_PIPE], O_CLOEXEC);
 
     int status = fork();
 
@@ -42,6 +45,9 @@ int ForkProcessForReading(const char** params)
         close(PARENT_WRITE_FD(pipes));
 
         execv(params[0], (char* const*)params);
+
+        // the child must not continue as a copy of the caller
+        _exit(127);
     }
     else if (status > 0)
     {
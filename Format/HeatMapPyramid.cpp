@@ -0,0 +1,214 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "HeatMapPyramid.h"
+
+#include <algorithm>
+
+// multipliers of bin width between two consecutive levels (100ms -> 1s -> 10s -> 1min for default base)
+static const uint32_t heatMapLevelFactors[] = { 10, 10, 6 };
+
+HeatMapBinAccumulator::HeatMapBinAccumulator(uint32_t functionCount)
+{
+    m_self.resize(functionCount, 0);
+    m_inclusive.resize(functionCount, 0);
+    m_selfPeriod.resize(functionCount, 0);
+    m_inclusivePeriod.resize(functionCount, 0);
+}
+
+void HeatMapBinAccumulator::Add(uint32_t functionId, uint32_t self, uint32_t inclusive, uint64_t selfPeriod, uint64_t inclusivePeriod)
+{
+    // inclusive time always covers self time, so zero inclusive value means untouched function
+    if (m_inclusive[functionId] == 0)
+        m_touched.push_back(functionId);
+
+    m_self[functionId] += self;
+    m_inclusive[functionId] += inclusive;
+    m_selfPeriod[functionId] += selfPeriod;
+    m_inclusivePeriod[functionId] += inclusivePeriod;
+}
+
+void HeatMapBinAccumulator::Flush(HeatMapBin &dst)
+{
+    dst.clear();
+
+    if (m_touched.empty())
+        return;
+
+    // sort just touched functions, to keep bin sorted by function ID
+    std::sort(m_touched.begin(), m_touched.end());
+
+    dst.reserve(m_touched.size());
+    for (uint32_t fid : m_touched)
+    {
+        dst.push_back({ fid, m_self[fid], m_inclusive[fid], 0, m_selfPeriod[fid], m_inclusivePeriod[fid] });
+        m_self[fid] = 0;
+        m_inclusive[fid] = 0;
+        m_selfPeriod[fid] = 0;
+        m_inclusivePeriod[fid] = 0;
+    }
+
+    m_touched.clear();
+}
+
+HeatMapPyramid::HeatMapPyramid()
+{
+    m_functionCount = 0;
+}
+
+void HeatMapPyramid::Reset(uint32_t baseBinWidthMs)
+{
+    m_levels.clear();
+    m_levels.resize(1);
+    m_levels[0].binWidthMs = (baseBinWidthMs > 0) ? baseBinWidthMs : 1;
+    m_functionCount = 0;
+}
+
+std::vector<HeatMapBin>& HeatMapPyramid::GetBaseBins()
+{
+    return m_levels[0].bins;
+}
+
+uint32_t HeatMapPyramid::GetFunctionBound(const std::vector<HeatMapBin> &bins)
+{
+    uint32_t bound = 0;
+
+    // bins are sorted, so the last entry always holds the highest ID
+    for (const HeatMapBin &bin : bins)
+    {
+        if (!bin.empty() && bin.back().functionId >= bound)
+            bound = bin.back().functionId + 1;
+    }
+
+    return bound;
+}
+
+void HeatMapPyramid::MergeBins(const std::vector<HeatMapBin> &src, uint32_t factor, std::vector<HeatMapBin> &dst, uint32_t functionCount)
+{
+    HeatMapBinAccumulator acc(functionCount);
+
+    dst.resize((src.size() + factor - 1) / factor);
+
+    for (size_t i = 0; i < dst.size(); i++)
+    {
+        for (size_t j = i * factor; j < (i + 1) * factor && j < src.size(); j++)
+        {
+            for (const HeatMapBinEntry &entry : src[j])
+                acc.Add(entry.functionId, entry.sampleCount, entry.inclusiveCount, entry.period, entry.inclusivePeriod);
+        }
+
+        acc.Flush(dst[i]);
+    }
+}
+
+void HeatMapPyramid::BuildLevels()
+{
+    if (m_levels.empty())
+        return;
+
+    m_levels.resize(1);
+    m_functionCount = GetFunctionBound(m_levels[0].bins);
+
+    for (uint32_t factor : heatMapLevelFactors)
+    {
+        const HeatMapLevel &prev = m_levels.back();
+
+        // no need to go coarser, when there's just a single bin left
+        if (prev.bins.size() <= 1)
+            break;
+
+        HeatMapLevel next;
+        next.binWidthMs = prev.binWidthMs * factor;
+        MergeBins(prev.bins, factor, next.bins, m_functionCount);
+
+        m_levels.push_back(std::move(next));
+    }
+}
+
+bool HeatMapPyramid::IsBuilt() const
+{
+    return !m_levels.empty();
+}
+
+uint32_t HeatMapPyramid::GetBaseBinWidth() const
+{
+    return m_levels.empty() ? 0 : m_levels[0].binWidthMs;
+}
+
+void HeatMapPyramid::GetLevelWidths(std::vector<uint32_t> &dst) const
+{
+    dst.clear();
+    for (const HeatMapLevel &level : m_levels)
+        dst.push_back(level.binWidthMs);
+}
+
+void HeatMapPyramid::Fill(TimeHistogramVector &dst, uint32_t binWidthMs, PerfSampleWeighting weighting) const
+{
+    dst.clear();
+
+    if (m_levels.empty())
+        return;
+
+    // round requested width to multiple of finest bin width
+    const uint32_t baseWidth = m_levels[0].binWidthMs;
+    if (binWidthMs < baseWidth)
+        binWidthMs = baseWidth;
+    binWidthMs = ((binWidthMs + baseWidth / 2) / baseWidth) * baseWidth;
+
+    // select the coarsest level, which is able to compose requested width
+    const HeatMapLevel* level = &m_levels[0];
+    for (const HeatMapLevel &itr : m_levels)
+    {
+        if (itr.binWidthMs <= binWidthMs && (binWidthMs % itr.binWidthMs) == 0)
+            level = &itr;
+    }
+
+    std::vector<HeatMapBin> merged;
+    const std::vector<HeatMapBin>* bins = &level->bins;
+
+    // merge level bins when the width does not match exactly
+    if (level->binWidthMs != binWidthMs)
+    {
+        MergeBins(level->bins, binWidthMs / level->binWidthMs, merged, m_functionCount);
+        bins = &merged;
+    }
+
+    dst.resize(bins->size());
+
+    for (size_t i = 0; i < bins->size(); i++)
+    {
+        // bins are sorted by function ID, so every insertion goes to the end of map
+        for (const HeatMapBinEntry &entry : (*bins)[i])
+        {
+            auto& rec = dst[i].insert(dst[i].end(), std::make_pair(entry.functionId, TimeHistogramVector::value_type::mapped_type()))->second;
+            if (weighting == PSW_PERIOD)
+            {
+                rec.timeTotal = (double)entry.period;
+                rec.timeTotalInclusive = (double)entry.inclusivePeriod;
+            }
+            else
+            {
+                rec.timeTotal = (double)entry.sampleCount;
+                rec.timeTotalInclusive = (double)entry.inclusiveCount;
+            }
+        }
+    }
+}
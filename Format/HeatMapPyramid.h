@@ -0,0 +1,107 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef PIVO_HEAT_MAP_PYRAMID_H
+#define PIVO_HEAT_MAP_PYRAMID_H
+
+#include "HeatMapStructs.h"
+#include "PerfQueryStructs.h"
+
+#include <vector>
+#include <stdint.h>
+
+// single function record within one heat map bin
+struct HeatMapBinEntry
+{
+    uint32_t functionId;
+    uint32_t sampleCount;
+    uint32_t inclusiveCount;
+    uint32_t reserved;
+    uint64_t period;
+    uint64_t inclusivePeriod;
+};
+
+// sparse heat map bin - entries sorted by function ID
+typedef std::vector<HeatMapBinEntry> HeatMapBin;
+
+// one resolution level of heat map
+struct HeatMapLevel
+{
+    uint32_t binWidthMs;
+    std::vector<HeatMapBin> bins;
+};
+
+// accumulates one bin at a time using dense arrays, and emits sparse sorted bins
+class HeatMapBinAccumulator
+{
+    public:
+        HeatMapBinAccumulator(uint32_t functionCount);
+
+        // adds self and inclusive sample count and period sum to function (inclusive count has to cover self count)
+        void Add(uint32_t functionId, uint32_t self, uint32_t inclusive, uint64_t selfPeriod, uint64_t inclusivePeriod);
+        // moves accumulated values to sparse bin and nullifies accumulator
+        void Flush(HeatMapBin &dst);
+
+    private:
+        std::vector<uint32_t> m_self;
+        std::vector<uint32_t> m_inclusive;
+        std::vector<uint64_t> m_selfPeriod;
+        std::vector<uint64_t> m_inclusivePeriod;
+        // functions touched since last flush
+        std::vector<uint32_t> m_touched;
+};
+
+// multi-resolution heat map - finest level is built once, coarser levels are merged from it
+class HeatMapPyramid
+{
+    public:
+        HeatMapPyramid();
+
+        // discards all levels and prepares finest level with given bin width
+        void Reset(uint32_t baseBinWidthMs);
+        // retrieves finest level bin vector to be filled by caller
+        std::vector<HeatMapBin>& GetBaseBins();
+        // derives coarser levels from the finest one
+        void BuildLevels();
+
+        // is there anything built?
+        bool IsBuilt() const;
+        // retrieves bin width of finest level
+        uint32_t GetBaseBinWidth() const;
+        // retrieves bin widths of all prebuilt levels
+        void GetLevelWidths(std::vector<uint32_t> &dst) const;
+
+        // fills heat map histogram with requested bin width (rounded to multiple of finest width), weighted as requested
+        void Fill(TimeHistogramVector &dst, uint32_t binWidthMs, PerfSampleWeighting weighting = PSW_SAMPLES) const;
+
+    protected:
+        // merges groups of bins of source level into destination bins
+        static void MergeBins(const std::vector<HeatMapBin> &src, uint32_t factor, std::vector<HeatMapBin> &dst, uint32_t functionCount);
+        // finds highest function ID used in bins (plus one)
+        static uint32_t GetFunctionBound(const std::vector<HeatMapBin> &bins);
+
+    private:
+        // levels from the finest to the coarsest
+        std::vector<HeatMapLevel> m_levels;
+        // count of function IDs used (for accumulator sizing)
+        uint32_t m_functionCount;
+};
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "General.h"
+#include "PerfCallchain.h"
+
+#include "linux/perf_event.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PERF_CALLCHAIN_AVX2
+#include <immintrin.h>
+#endif
+
+// both loops below avoid branches on frame values; markers are written as well, but not counted, so the next frame
+// overwrites them
+
+static uint32_t perf_callchain__copy_scalar(const uint64_t *src, uint64_t nr, uint64_t *dst, uint32_t *kernel_nr)
+{
+    uint32_t count = 0, kernel = 0;
+    uint64_t marker;
+
+    for (uint64_t i = 0; i < nr; i++)
+    {
+        marker = (src[i] >= PERF_CONTEXT_MAX) ? 1 : 0;
+        dst[count] = src[i];
+        count += (uint32_t)(1 - marker);
+        kernel += (uint32_t)((src[i] >= PERF_CALLCHAIN_KERNEL_START) ? 1 - marker : 0);
+    }
+
+    *kernel_nr = kernel;
+    return count;
+}
+
+#ifdef PERF_CALLCHAIN_AVX2
+
+__attribute__((target("avx2,popcnt")))
+static uint32_t perf_callchain__copy_avx2(const uint64_t *src, uint64_t nr, uint64_t *dst, uint32_t *kernel_nr)
+{
+    // kernel addresses are negative when compared as signed; markers are the highest values, i.e. the negative ones
+    // above the bound
+    const __m256i marker_bound = _mm256_set1_epi64x((int64_t)PERF_CONTEXT_MAX - 1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    uint32_t count = 0, kernel = 0, tail_kernel;
+    uint64_t i = 0;
+    __m256i v;
+    int markers, kernels;
+
+    for (; i + 4 <= nr; i += 4)
+    {
+        v = _mm256_loadu_si256((const __m256i*)(src + i));
+        kernels = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(zero, v)));
+        markers = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, marker_bound))) & kernels;
+
+        // markers are rare (one or two per callchain), so their blocks are just left to scalar loop
+        if (markers != 0)
+        {
+            count += perf_callchain__copy_scalar(src + i, 4, dst + count, &tail_kernel);
+            kernel += tail_kernel;
+            continue;
+        }
+
+        _mm256_storeu_si256((__m256i*)(dst + count), v);
+        count += 4;
+        kernel += (uint32_t)__builtin_popcount(kernels);
+    }
+
+    count += perf_callchain__copy_scalar(src + i, nr - i, dst + count, &tail_kernel);
+    *kernel_nr = kernel + tail_kernel;
+
+    return count;
+}
+
+// verifies, that vector copy gives the same frames as scalar one on callchain mixing kernel and user frames
+static bool perf_callchain__check_avx2()
+{
+    const uint64_t src[] = {
+        PERF_CONTEXT_KERNEL, 0xffffffff81000000ULL, 0xffffffff81234567ULL, 0xffffffff8100abcdULL,
+        0xffffffff81fedcbaULL, PERF_CONTEXT_USER, 0x401000ULL, 0x7fff12345678ULL,
+        0x400abcULL, 0x7f0012345678ULL, 0x401234ULL, 0x402345ULL,
+        0xffffffff81000010ULL, 0x401000ULL, PERF_CONTEXT_USER, 0x7fff00000000ULL,
+        0x1ULL, 0x7fffffffffffffffULL, 0x8000000000000000ULL, PERF_CONTEXT_MAX - 1
+    };
+    const uint64_t nr = sizeof(src) / sizeof(src[0]);
+    uint64_t scalar[nr], vector[nr];
+    uint32_t scalar_kernel, vector_kernel, scalar_count, vector_count;
+
+    scalar_count = perf_callchain__copy_scalar(src, nr, scalar, &scalar_kernel);
+    vector_count = perf_callchain__copy_avx2(src, nr, vector, &vector_kernel);
+
+    return scalar_count == vector_count && scalar_kernel == vector_kernel
+        && memcmp(scalar, vector, scalar_count * sizeof(uint64_t)) == 0;
+}
+
+#endif
+
+uint32_t perf_callchain__copy(const uint64_t *src, uint64_t nr, uint64_t *dst, uint32_t *kernel_nr)
+{
+#ifdef PERF_CALLCHAIN_AVX2
+    // CPU features are checked just once; vector copy is used just when it agrees with scalar one
+    static const bool has_avx2 = __builtin_cpu_supports("avx2") && perf_callchain__check_avx2();
+
+    if (has_avx2)
+        return perf_callchain__copy_avx2(src, nr, dst, kernel_nr);
+#endif
+
+    return perf_callchain__copy_scalar(src, nr, dst, kernel_nr);
+}
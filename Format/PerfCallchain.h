@@ -0,0 +1,34 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#ifndef PIVO_PERF_CALLCHAIN_H
+#define PIVO_PERF_CALLCHAIN_H
+
+#include <stdint.h>
+
+// kernel occupies the upper half of address space (x86-64, arm64), user space never reaches it
+#define PERF_CALLCHAIN_KERNEL_START 0x8000000000000000ULL
+
+// copies callchain frames to destination (with room for all of them), leaving out context markers (PERF_CONTEXT_*);
+// returns count of frames copied; kernel frames (which precede user ones) are counted to kernel_nr
+uint32_t perf_callchain__copy(const uint64_t *src, uint64_t nr, uint64_t *dst, uint32_t *kernel_nr);
+
+#endif
@@ -0,0 +1,237 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "PerfDiff.h"
+#include "PerfFile.h"
+#include "PerfInputModule.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <stack>
+
+// structure used for sorting function differences by inclusive time delta
+struct PerfDiffFunctionSortPredicate
+{
+    inline bool operator() (const PerfDiffFunctionRecord &a, const PerfDiffFunctionRecord &b)
+    {
+        return (a.deltaInclusive > b.deltaInclusive);
+    }
+};
+
+PerfDiff::PerfDiff(PerfFile* baseline, PerfFile* candidate)
+{
+    m_files[0] = baseline;
+    m_files[1] = candidate;
+
+    // names are mapped just once, everything else works with name IDs
+    for (int side = 0; side < 2; side++)
+    {
+        MapFunctionNames(m_files[side], m_functionNames[side]);
+        m_totals[side] = GetTotalSamples(m_files[side]);
+    }
+}
+
+uint32_t PerfDiff::InternName(const std::string &name)
+{
+    auto itr = m_nameIds.find(name);
+    if (itr != m_nameIds.end())
+        return itr->second;
+
+    uint32_t id = (uint32_t)m_names.size();
+    m_names.push_back(name);
+    m_nameIds[name] = id;
+
+    return id;
+}
+
+void PerfDiff::MapFunctionNames(PerfFile* pfile, std::vector<uint32_t> &dst)
+{
+    const std::vector<FunctionEntry> &functions = pfile->GetFunctionTable();
+
+    dst.resize(functions.size());
+    for (size_t i = 0; i < functions.size(); i++)
+        dst[i] = InternName(functions[i].name);
+}
+
+double PerfDiff::GetTotalSamples(PerfFile* pfile)
+{
+    double total = 0.0;
+
+    for (const FlatProfileRecord &rec : pfile->GetFlatProfile())
+        total += rec.timeTotal;
+
+    // avoid division by zero on empty recordings
+    return (total > 0.0) ? total : 1.0;
+}
+
+void PerfDiff::FillFunctionDiff(std::vector<PerfDiffFunctionRecord> &dst)
+{
+    std::vector<uint32_t> recordIndex(m_names.size(), PERF_DIFF_NO_FUNCTION);
+
+    LogFunc(LOG_VERBOSE, "Comparing flat profiles...");
+
+    dst.clear();
+
+    for (int side = 0; side < 2; side++)
+    {
+        for (const FlatProfileRecord &rec : m_files[side]->GetFlatProfile())
+        {
+            const uint32_t nameId = m_functionNames[side][rec.functionId];
+
+            if (recordIndex[nameId] == PERF_DIFF_NO_FUNCTION)
+            {
+                recordIndex[nameId] = (uint32_t)dst.size();
+
+                PerfDiffFunctionRecord diff;
+                diff.name = m_names[nameId];
+                diff.baselineFunctionId = PERF_DIFF_NO_FUNCTION;
+                diff.candidateFunctionId = PERF_DIFF_NO_FUNCTION;
+                diff.baselineSelf = 0.0;
+                diff.candidateSelf = 0.0;
+                diff.baselineInclusive = 0.0;
+                diff.candidateInclusive = 0.0;
+                dst.push_back(diff);
+            }
+
+            PerfDiffFunctionRecord &diff = dst[recordIndex[nameId]];
+
+            // more functions of the same name (i.e. static ones) are summed up, the first ID is kept
+            if (side == 0)
+            {
+                if (diff.baselineFunctionId == PERF_DIFF_NO_FUNCTION)
+                    diff.baselineFunctionId = rec.functionId;
+                diff.baselineSelf += rec.timeTotal / m_totals[side];
+                diff.baselineInclusive += rec.timeTotalInclusive / m_totals[side];
+            }
+            else
+            {
+                if (diff.candidateFunctionId == PERF_DIFF_NO_FUNCTION)
+                    diff.candidateFunctionId = rec.functionId;
+                diff.candidateSelf += rec.timeTotal / m_totals[side];
+                diff.candidateInclusive += rec.timeTotalInclusive / m_totals[side];
+            }
+        }
+    }
+
+    for (PerfDiffFunctionRecord &diff : dst)
+    {
+        diff.deltaSelf = diff.candidateSelf - diff.baselineSelf;
+        diff.deltaInclusive = diff.candidateInclusive - diff.baselineInclusive;
+    }
+
+    std::sort(dst.begin(), dst.end(), PerfDiffFunctionSortPredicate());
+}
+
+void PerfDiff::AddStacks(PerfFile* pfile, const std::vector<uint32_t> &names, int side)
+{
+    StackWeightVector stacks;
+    const uint32_t* frames;
+    uint32_t count, nameId, nodeIdx;
+    const double norm = 1.0 / m_totals[side];
+    double weight;
+
+    pfile->FillStackWeights(stacks);
+
+    for (const StackWeight &sw : stacks)
+    {
+        frames = pfile->GetTreeFrames(sw.stackId, count);
+
+        // the same samples (and frames) as in call tree are considered
+        if (!pfile->SelectStackFrames(frames, count))
+            continue;
+
+        nodeIdx = PERF_DIFF_NO_PARENT;
+        weight = (double)pfile->GetStackWeight(sw) * norm;
+
+        // go from root (the last frame) to sampled function and add inclusive time on the way
+        for (uint32_t i = count; i-- > 0; )
+        {
+            nameId = names[frames[i]];
+
+            std::map<uint32_t, uint32_t> &children = (nodeIdx == PERF_DIFF_NO_PARENT) ? m_roots : m_nodes[nodeIdx].children;
+
+            auto itr = children.find(nameId);
+            if (itr == children.end())
+            {
+                PerfDiffTreeNode node;
+                node.nameId = nameId;
+                node.parent = nodeIdx;
+                node.weight[0] = 0.0;
+                node.weight[1] = 0.0;
+
+                children[nameId] = (uint32_t)m_nodes.size();
+                nodeIdx = (uint32_t)m_nodes.size();
+                m_nodes.push_back(node);
+            }
+            else
+                nodeIdx = itr->second;
+
+            m_nodes[nodeIdx].weight[side] += weight;
+        }
+    }
+}
+
+void PerfDiff::FillCallTreeDiff(std::vector<PerfDiffPathRecord> &dst)
+{
+    LogFunc(LOG_VERBOSE, "Comparing call trees...");
+
+    dst.clear();
+
+    m_nodes.clear();
+    m_roots.clear();
+
+    for (int side = 0; side < 2; side++)
+        AddStacks(m_files[side], m_functionNames[side], side);
+
+    // traverse using iterative DFS to emit nodes in preorder; pair of node and its output parent
+    std::stack< std::pair<uint32_t, uint32_t> > dstack;
+
+    for (auto itr = m_roots.rbegin(); itr != m_roots.rend(); ++itr)
+        dstack.push(std::make_pair(itr->second, PERF_DIFF_NO_PARENT));
+
+    while (!dstack.empty())
+    {
+        const uint32_t nodeIdx = dstack.top().first;
+        const uint32_t parent = dstack.top().second;
+        dstack.pop();
+
+        const PerfDiffTreeNode &node = m_nodes[nodeIdx];
+
+        // exclude paths with less than THRESHOLD percentage of inclusive time in both recordings
+        if (node.weight[0] < CALL_TREE_INCLUSIVE_TIME_THRESHOLD && node.weight[1] < CALL_TREE_INCLUSIVE_TIME_THRESHOLD)
+            continue;
+
+        PerfDiffPathRecord rec;
+        rec.name = m_names[node.nameId];
+        rec.parent = parent;
+        rec.depth = (parent == PERF_DIFF_NO_PARENT) ? 0 : dst[parent].depth + 1;
+        rec.baseline = node.weight[0];
+        rec.candidate = node.weight[1];
+        rec.delta = node.weight[1] - node.weight[0];
+
+        const uint32_t outIdx = (uint32_t)dst.size();
+        dst.push_back(rec);
+
+        // push in reverse to keep children sorted by name ID in output
+        for (auto itr = node.children.rbegin(); itr != node.children.rend(); ++itr)
+            dstack.push(std::make_pair(itr->second, outIdx));
+    }
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef PIVO_PERF_DIFF_H
+#define PIVO_PERF_DIFF_H
+
+#include "PerfQueryStructs.h"
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+class PerfFile;
+
+// node of call tree keyed by function names, holding weights of both recordings
+struct PerfDiffTreeNode
+{
+    uint32_t nameId;
+    uint32_t parent;
+    double weight[2];
+    std::map<uint32_t, uint32_t> children;
+};
+
+// compares two loaded recordings; functions and call paths are matched by name, not address
+class PerfDiff
+{
+    public:
+        PerfDiff(PerfFile* baseline, PerfFile* candidate);
+
+        // fills per-function differences, sorted by inclusive time delta (the most grown first)
+        void FillFunctionDiff(std::vector<PerfDiffFunctionRecord> &dst);
+        // fills per-path differences of call trees
+        void FillCallTreeDiff(std::vector<PerfDiffPathRecord> &dst);
+
+    protected:
+        // retrieves ID of function name, assigns a new one when not known yet
+        uint32_t InternName(const std::string &name);
+        // maps function IDs of recording to name IDs
+        void MapFunctionNames(PerfFile* pfile, std::vector<uint32_t> &dst);
+        // retrieves total count of samples shown in recording outputs
+        static double GetTotalSamples(PerfFile* pfile);
+        // adds all stacks of recording into name-keyed call tree
+        void AddStacks(PerfFile* pfile, const std::vector<uint32_t> &names, int side);
+
+    private:
+        // 0 = baseline, 1 = candidate
+        PerfFile* m_files[2];
+
+        // all known function names
+        std::vector<std::string> m_names;
+        // function name lookup
+        std::unordered_map<std::string, uint32_t> m_nameIds;
+        // name IDs of functions of both recordings
+        std::vector<uint32_t> m_functionNames[2];
+        // total sample counts of both recordings
+        double m_totals[2];
+
+        // name-keyed call tree nodes
+        std::vector<PerfDiffTreeNode> m_nodes;
+        // root nodes of name-keyed call tree
+        std::map<uint32_t, uint32_t> m_roots;
+};
+
+#endif
@@ -23,9 +23,8 @@
 #include "PerfInputModule.h"
 #include "PerfFile.h"
 #include "PerfRecords.h"
+#include "PerfCallchain.h"
 #include "Log.h"
-#include "Helpers.h"
-#include "../config_perf.h"
 
 #include <set>
 #include <algorithm>
@@ -37,13 +36,97 @@
 
 PerfFile::PerfFile()
 {
-    //
+    m_file = nullptr;
+    m_samplingType = 0;
+    m_uniformLayout = true;
+    m_sampleIdPosition = 0;
+    m_trailerIdPosition = 0;
+    m_binaryInode = 0;
+    m_eventNumber = 0;
+    m_symbolCache = nullptr;
+    m_firstSwitchTime = 0;
+
+    m_previewFraction = 1.0;
+    m_previewChunkCount = 0;
+
+    m_liveFd = -1;
+    m_liveRegularFile = false;
+    m_liveStream = false;
+    m_liveHeaderRead = false;
+    m_liveFinished = false;
+    m_liveOffset = 0;
+    m_liveDataEnd = 0;
+    m_liveSkip = 0;
+    m_liveFlushTime = 0;
+    m_liveMaxTime = 0;
+
+    // nothing is aggregated until requested
+    m_flatProfileStale = true;
+    m_callGraphStale = true;
+    m_callTreeStale = true;
+    m_callTreeViewsStale = true;
+    m_heatMapStale = false;
+    m_heatMapBaseWidth = HEATMAP_GROUP_BY_MS_AMOUNT;
+    m_weighting = PSW_SAMPLES;
+    m_stackMode = PSM_USER;
+    m_foldRecursion = false;
+
+    memset(m_loadStats.phases, 0, sizeof(m_loadStats.phases));
+    memset(m_loadStats.peakMemory, 0, sizeof(m_loadStats.peakMemory));
+    m_loadStats.bytesRead = 0;
+    m_loadStats.uniqueIps = 0;
+    m_loadStats.uniqueStacks = 0;
+    m_loadStats.unresolvedIps = 0;
+    m_loadStats.spilledSamples = 0;
+    m_loadStats.spillRuns = 0;
+    m_loadStats.spilledBytes = 0;
+    m_recordMemory = 0;
+    m_memoryBudget = 0;
+    m_sampleMemory = 0;
+    m_spill = nullptr;
+    m_snapshot = nullptr;
 }
 
-PerfFile* PerfFile::Load(const char* filename, const char* binaryfilename)
+PerfFile::~PerfFile()
+{
+    // standard input is not ours to close
+    if (m_liveFd > STDIN_FILENO)
+        close(m_liveFd);
+
+    for (record_t* rec : m_records)
+        ReleaseRecord(rec);
+    for (record_t* rec : m_livePending)
+        ReleaseRecord(rec);
+
+    ReleaseCallTree(m_callTree);
+    ReleaseCallTree(m_invertedCallTree);
+    for (CallTreeMap &retired : m_retiredCallTrees)
+        ReleaseCallTree(retired);
+
+    delete m_spill;
+    delete m_snapshot;
+}
+
+PerfFile* PerfFile::Load(const char* filename, const char* binaryfilename, const PerfPreviewOptions* preview, bool snapshotCache,
+                         PerfSymbolCache* symbolCache, uint64_t memoryBudget)
 {
     LogFunc(LOG_DEBUG, "Loading perf record file %s", filename);
 
+    // preview is quick on its own, and its snapshot would not be the complete profile
+    PerfSnapshotKey snapshotKey;
+    std::string snapshotPath = std::string(filename) + PERF_SNAPSHOT_SUFFIX;
+    bool useSnapshot = snapshotCache && !preview && PerfSnapshot::ComputeKey(filename, binaryfilename, snapshotKey);
+
+    if (useSnapshot)
+    {
+        PerfFile* cached = LoadSnapshot(snapshotPath.c_str(), snapshotKey);
+        if (cached)
+        {
+            cached->LogLoadStats();
+            return cached;
+        }
+    }
+
     FILE* pf = fopen(filename, "rb");
     if (!pf)
     {
@@ -53,339 +136,1176 @@ PerfFile* PerfFile::Load(const char* filename, const char* binaryfilename)
 
     PerfFile* pfile = new PerfFile();
     pfile->m_file = pf;
+    pfile->m_symbolCache = symbolCache;
+
+    if (!pfile->ReadAndCheckHeader())
+    {
+        fclose(pf);
+        delete pfile;
+        return nullptr;
+    }
+
+    // pipe-mode output stored to file has no sections; it's read the same way as live stream, just at once
+    if (pfile->m_fileHeader.size == sizeof(perf_pipe_file_header))
+    {
+        if (preview)
+            LogFunc(LOG_INFO, "Pipe-mode recording can't be previewed, loading whole recording");
+
+        fclose(pf);
+        delete pfile;
+
+        pfile = OpenLive(filename, binaryfilename, symbolCache);
+        if (pfile)
+        {
+            pfile->FinishLive();
+
+            if (useSnapshot)
+                pfile->SaveSnapshot(snapshotPath.c_str(), snapshotKey);
+
+            pfile->LogLoadStats();
+        }
+
+        return pfile;
+    }
+
+    // preview chunk of every record (stays empty, when all data are read)
+    std::vector<uint32_t> recordChunks;
+
+    // preview decodes just a fraction of recording, so it always fits
+    if (!preview)
+        pfile->m_memoryBudget = memoryBudget;
 
     // perform all reading
-    if (!pfile->ReadAndCheckHeader() ||
-        !pfile->ReadAttributes() ||
+    pfile->BeginPhase(PLP_READ);
+    if (!pfile->ReadAttributes() ||
         !pfile->ReadTypes() ||
-        !pfile->ReadData())
+        !(preview ? pfile->ReadPreviewData(*preview, recordChunks) : pfile->ReadData()))
     {
         fclose(pf);
         delete pfile;
         return nullptr;
     }
 
-    // sort records by time
-    std::sort(pfile->m_records.begin(), pfile->m_records.end(), PerfRecordTimeSortPredicate());
+    // event names are optional, they just help to recognize tracepoints
+    pfile->ReadEventDescriptions();
+    pfile->EndPhase();
+
+    // sort records by time; once any samples were spilled, the rest of them is spilled as well, and the sorted runs
+    // are merged with the other records to the same order
+    pfile->BeginPhase(PLP_SORT);
+    if (pfile->m_spill)
+    {
+        pfile->SpillSamples();
+        std::sort(pfile->m_records.begin(), pfile->m_records.end(), PerfRecordOrderSortPredicate());
+    }
+    else if (recordChunks.empty())
+        std::sort(pfile->m_records.begin(), pfile->m_records.end(), PerfRecordTimeSortPredicate());
+    else
+        pfile->SortPreviewRecords(recordChunks);
+    pfile->EndPhase();
 
+    pfile->BeginPhase(PLP_SYMBOLS);
     pfile->ResolveSymbols(binaryfilename);
-    pfile->ProcessMemoryMapping();
-    pfile->FilterUsedSymbols();
+    pfile->EndPhase();
+
+    pfile->BeginPhase(PLP_SAMPLES);
+    pfile->ProcessMemoryMapping(0);
+
+    pfile->BuildSampleTable(0);
+
+    if (!recordChunks.empty())
+        pfile->ComputePreviewErrorBounds(recordChunks);
+    pfile->EndPhase();
 
-    pfile->ProcessFlatProfile();
-    pfile->ProcessCallGraph();
-    pfile->ProcessCallTree();
+    // flat profile, call graph, call tree and heat map are aggregated from interned stacks on first request
 
     fclose(pf);
 
+    if (useSnapshot)
+        pfile->SaveSnapshot(snapshotPath.c_str(), snapshotKey);
+
+    pfile->LogLoadStats();
+
     return pfile;
 }
 
-void PerfFile::ProcessFlatProfile()
+void PerfFile::BuildSampleTable(size_t firstRecord)
 {
-    m_flatProfile.resize(m_functionTable.size());
-
-    FlatProfileRecord *fp;
+    std::vector<uint32_t> frames;
 
-    LogFunc(LOG_INFO, "Processing flat profile data...");
+    LogFunc(LOG_INFO, "Resolving sampled call stacks...");
 
-    // prepare flat profile table, it will match function table at first stage of filling
-    for (int i = 0; i < m_functionTable.size(); i++)
+    if (m_spill)
+        MergeSpilledSamples(firstRecord, frames);
+    else
     {
-        fp = &m_flatProfile[i];
-
-        fp->functionId = i;
-        fp->timeTotal = 0;
-        fp->timeTotalPct = 0.0f;
+        for (size_t r = firstRecord; r < m_records.size(); r++)
+            AddToSampleTable(m_records[r], frames);
     }
 
-    record_sample* sample;
-    FunctionEntry* fet;
+    LogFunc(LOG_VERBOSE, "Used symbols: %u", m_functionTable.size());
+    LogFunc(LOG_VERBOSE, "Samples: %llu, unique stacks: %u", (uint64_t)m_samples.size(), m_stacks.GetStackCount());
+
+    if (!m_switchIntervals.empty())
+        LogFunc(LOG_VERBOSE, "Context switch intervals: %llu", (uint64_t)m_switchIntervals.size());
+
+    if (!m_branchPool.empty())
+        LogFunc(LOG_VERBOSE, "Branch stack entries: %llu, taken branches: %llu, basic blocks: %llu",
+            (uint64_t)m_branchPool.size(), (uint64_t)m_branchEdges.size(), (uint64_t)m_basicBlocks.size());
+}
+
+void PerfFile::AddToSampleTable(const record_t* itr, std::vector<uint32_t> &frames)
+{
+    const record_sample* sample;
+    int32_t attr;
+    PerfSample ps;
+    uint32_t sampleIndex;
 
-    uint32_t findex, childindex;
-    for (record_t* itr : m_records)
+    // remember thread names; the latest one wins (i.e. after exec)
+    if (itr->type == PERF_RECORD_COMM)
+    {
+        m_threadComms[itr->tid] = std::string(((const record_comm*)itr)->comm, strnlen(((const record_comm*)itr)->comm, sizeof(((const record_comm*)itr)->comm)));
+        m_threadPids[itr->tid] = itr->pid;
+    }
+    else if (itr->type == PERF_RECORD_SWITCH || itr->type == PERF_RECORD_SWITCH_CPU_WIDE)
+    {
+        // preview misses switches between its chunks, so the intervals would be made up
+        if (m_previewFraction >= 1.0)
+            ProcessContextSwitch((const record_switch*)itr);
+    }
+    else if (itr->type == PERF_RECORD_SAMPLE)
     {
-        if (itr->type == PERF_RECORD_SAMPLE)
+        sample = ((const record_sample*)itr);
+
+        ps.time = itr->time;
+        ps.pid = itr->pid;
+        ps.tid = itr->tid;
+        ps.cpu = itr->cpu;
+        ps.stackId = ResolveStack(sample->ip, sample->callchainIndex, sample->callchainCount, sample->kernelFrameCount, frames);
+        ps.period = sample->period;
+
+        // samples of fixed period events do not need to carry it
+        if (ps.period == 0)
+        {
+            attr = FindEventAttribute(itr->id);
+            if (attr >= 0 && !m_eventAttr[attr].attr.freq)
+                ps.period = m_eventAttr[attr].attr.sample_period;
+            if (ps.period == 0)
+                ps.period = 1;
+        }
+
+        if (ps.stackId != INVALID_STACK_ID)
         {
-            sample = ((record_sample*)itr);
+            m_stackCounts[ps.stackId]++;
+            m_stackPeriods[ps.stackId] += ps.period;
 
-            fet = GetFunctionByAddress(sample->ip, &findex);
-            // for now, exclude kernel symbols (for sanity reasons)
-            if (fet && fet->functionType != FET_KERNEL)
+            // switch records do not carry stack, so the latest sampled one stands for it; threads running since
+            // before the recording started are sampled before their first switch
+            auto ins = m_threadSwitchStates.insert(std::make_pair(ps.tid, PerfThreadSwitchState()));
+            if (ins.second)
             {
-                m_flatProfile[findex].timeTotal += 1.0;
+                ins.first->second.since = 0;
+                ins.first->second.state = PTS_RUNNING;
+                ins.first->second.cpu = ps.cpu;
+                ins.first->second.stackId = INVALID_STACK_ID;
+            }
+            ins.first->second.lastSampleStackId = ps.stackId;
+        }
 
-                // now calculate inclusive time
+        if (sample->branchCount > 0)
+            ProcessBranchStack(sample);
 
-                // 2 is the right value, since IP callchain contains invalid address ("stopper") on top
-                // and self as second record
-                for (uint64_t i = 2; i < sample->callchain->nr; i++)
-                {
-                    fet = GetFunctionByAddress(sample->callchain->ips[i], &childindex);
-                    // also exclude kernel calls for now
-                    if (fet && fet->functionType != FET_KERNEL)
-                        m_flatProfile[childindex].timeTotalInclusive += 1.0;
-                }
+        // preview misses samples between its chunks, so the deltas would cover them as well
+        if (sample->readCount > 0 && m_previewFraction >= 1.0)
+            ProcessCounterValues(sample, (ps.stackId != INVALID_STACK_ID) ? frames[0] : INVALID_FUNCTION_ID);
+
+        // records are sorted by time, so the sample table is sorted as well
+        sampleIndex = (uint32_t)m_samples.size();
+        m_samples.push_back(ps);
+
+        // secondary indexes are sorted by time as well
+        m_pidIndex[ps.pid].push_back(sampleIndex);
+        m_tidIndex[ps.tid].push_back(sampleIndex);
+        m_cpuIndex[ps.cpu].push_back(sampleIndex);
+        m_threadPids[ps.tid] = ps.pid;
+
+        // events are told apart just when there's more of them
+        if (m_eventAttr.size() > 1)
+        {
+            // samples stored while there was just one event belong to it
+            while (m_sampleEvents.size() < sampleIndex)
+            {
+                m_sampleEvents.push_back(0);
+                IndexSampleEvent((uint32_t)(m_sampleEvents.size() - 1));
             }
+
+            attr = FindEventAttribute(itr->id);
+            m_sampleEvents.push_back((attr >= 0) ? (uint32_t)attr : 0);
+            IndexSampleEvent(sampleIndex);
         }
     }
+}
 
-    LogFunc(LOG_VERBOSE, "Finalizing inclusive time calculation...");
+void PerfFile::IndexSampleEvent(uint32_t sampleIndex)
+{
+    const uint32_t event = m_sampleEvents[sampleIndex];
+    const uint32_t stackId = m_samples[sampleIndex].stackId;
 
-    double maxInclusiveTime = 0.01;
-    for (size_t i = 0; i < m_flatProfile.size(); i++)
-    {
-        if (m_flatProfile[i].timeTotalInclusive > maxInclusiveTime)
-            maxInclusiveTime = m_flatProfile[i].timeTotalInclusive;
-    }
+    m_eventIndex[event].push_back(sampleIndex);
 
-    for (size_t i = 0; i < m_flatProfile.size(); i++)
+    if (stackId != INVALID_STACK_ID)
     {
-        m_flatProfile[i].timeTotalInclusivePct = m_flatProfile[i].timeTotalInclusive / maxInclusiveTime;
+        std::vector<uint64_t> &counts = m_eventStackCounts[event];
+        std::vector<uint64_t> &periods = m_eventStackPeriods[event];
+        if (stackId >= counts.size())
+        {
+            counts.resize(stackId + 1, 0);
+            periods.resize(stackId + 1, 0);
+        }
+        counts[stackId]++;
+        periods[stackId] += m_samples[sampleIndex].period;
     }
 }
 
-void PerfFile::ProcessCallGraph()
+bool PerfFile::MatchesAllEvents(const std::set<uint32_t> &events) const
 {
-    FlatProfileRecord *fp;
-    record_sample* sample;
-    FunctionEntry* fet;
+    // single event recordings have all samples of event 0
+    return events.empty() || (m_sampleEvents.empty() && events.find(0) != events.end());
+}
 
-    LogFunc(LOG_INFO, "Processing call graph...");
+uint32_t PerfFile::GetSampleEvent(uint32_t sampleIndex) const
+{
+    return m_sampleEvents.empty() ? 0 : m_sampleEvents[sampleIndex];
+}
+
+uint32_t PerfFile::ResolveStack(uint64_t ip, uint64_t callchainIndex, uint32_t callchainCount, uint32_t kernelFrameCount, std::vector<uint32_t> &frames)
+{
+    uint32_t functionId = ResolveFunctionId(ip, (ip >= PERF_CALLCHAIN_KERNEL_START) ? FET_KERNEL : FET_MISC);
+    if (functionId == INVALID_FUNCTION_ID)
+        return INVALID_STACK_ID;
+
+    frames.clear();
+    frames.push_back(functionId);
 
-    // nullify call counts
-    for (int i = 0; i < m_functionTable.size(); i++)
+    const uint64_t* callchain = m_callchainPool.data() + callchainIndex;
+
+    // callchain starts with the sampled IP itself (unless its kernel part was not recorded); kernel frames
+    // were counted while copying, so they do not need to be told apart one by one
+    for (uint32_t i = (callchainCount > 0 && callchain[0] == ip) ? 1 : 0; i < callchainCount; i++)
     {
-        fp = &m_flatProfile[i];
-        fp->callCount = 0;
+        functionId = ResolveFunctionId(callchain[i], (i < kernelFrameCount) ? FET_KERNEL : FET_MISC);
+        if (functionId != INVALID_FUNCTION_ID)
+            frames.push_back(functionId);
     }
 
-    uint64_t tmpip;
-    uint32_t findex, srcIndex, dstIndex;
-    for (record_t* itr : m_records)
+    uint32_t stackId = m_stacks.Intern(frames.data(), (uint32_t)frames.size());
+
+    // stack counts cover the whole stack table, even the stacks used just outside of sample table
+    if (stackId >= m_stackCounts.size())
     {
-        if (itr->type == PERF_RECORD_SAMPLE)
-        {
-            sample = ((record_sample*)itr);
+        m_stackCounts.resize(stackId + 1, 0);
+        m_stackPeriods.resize(stackId + 1, 0);
+    }
 
-            fet = GetFunctionByAddress(sample->ip, &findex);
-            // for now, exclude kernel symbols from output (for sanity reasons)
-            if (fet /*&& fet->functionType != FET_KERNEL*/)
-            {
-                dstIndex = findex;
+    return stackId;
+}
 
-                // 2 is the right value, since IP callchain contains invalid address ("stopper") on top
-                // and self as second record
-                for (uint64_t i = 2; i < sample->callchain->nr; i++)
-                {
-                    tmpip = sample->callchain->ips[i];
-
-                    fet = GetFunctionByAddress(tmpip, &srcIndex);
-                    // also exclude kernel calls for now
-                    if (fet /*&& fet->functionType != FET_KERNEL*/)
-                    {
-                        if (m_callGraph.find(srcIndex) == m_callGraph.end() ||
-                            m_callGraph[srcIndex].find(dstIndex) == m_callGraph[srcIndex].end())
-                        {
-                            m_callGraph[srcIndex][dstIndex] = 0;
-                        }
-
-                        // rather than call count, we use something like "samples count" here
-                        m_callGraph[srcIndex][dstIndex] += 1;
-                        m_flatProfile[dstIndex].callCount++;
-
-                        dstIndex = srcIndex;
-                    }
-                }
-            }
+uint32_t PerfFile::ResolveFunctionId(uint64_t address, FunctionEntryType unresolvedType)
+{
+    // every distinct address is resolved just once
+    auto cached = m_addressFunctionIds.find(address);
+    if (cached != m_addressFunctionIds.end())
+        return cached->second;
+
+    // if the symbol is not within mapped region, fake the mapping with unresolved symbol
+    if (!IsWithinMemoryMapping(address))
+        AddUnresolvedSymbol(address, unresolvedType);
+
+    uint32_t functionId = INVALID_FUNCTION_ID;
+
+    FunctionEntry* fet = GetSymbolByAddress(address, nullptr);
+    if (fet)
+    {
+        // function IDs are assigned in order of first use, so they remain valid when more records arrive
+        auto itr = m_symbolFunctionIds.find(fet->address);
+        if (itr == m_symbolFunctionIds.end())
+        {
+            functionId = (uint32_t)m_functionTable.size();
+            m_functionTable.push_back(*fet);
+            m_symbolFunctionIds[fet->address] = functionId;
         }
+        else
+            functionId = itr->second;
     }
+
+    m_addressFunctionIds[address] = functionId;
+
+    return functionId;
 }
 
-CallTreeNode* PerfFile::CreateCallTreeNode(uint32_t functionId, CallTreeNode* childOf)
+bool PerfFile::FindSampleRange(uint64_t fromMs, uint64_t toMs, size_t &first, size_t &last)
 {
-    CallTreeNode* node = new CallTreeNode;
-    node->functionId = functionId;
-    node->timeTotal = 0.0;
-    node->timeTotalPct = 0.0;
-    node->sampleCount = 0;
-    node->parent = childOf;
-    return node;
+    first = 0;
+    last = 0;
+
+    if (m_samples.empty() || fromMs > toMs)
+        return false;
+
+    // window is relative to the first sample, the same way heat map is
+    const uint64_t base = m_samples.front().time;
+    const uint64_t maxMs = ((uint64_t)(-1) - base) / SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+
+    // open-ended windows are clamped to avoid overflow
+    const uint64_t fromTime = (fromMs > maxMs) ? (uint64_t)(-1) : base + fromMs * SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+    const uint64_t toTime = (toMs > maxMs) ? (uint64_t)(-1) : base + toMs * SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+
+    // sample table is sorted by time, so the binary search serves as time index
+    auto lo = std::lower_bound(m_samples.begin(), m_samples.end(), fromTime, PerfSampleTimeSortPredicate());
+    auto hi = std::upper_bound(lo, m_samples.end(), toTime, PerfSampleTimeSortPredicate());
+
+    first = lo - m_samples.begin();
+    last = hi - m_samples.begin();
+
+    return (first < last);
 }
 
-CallTreeNode* PerfFile::InsertIntoCallTree(std::vector<uint32_t> &path, uint32_t finalFunctionId)
+uint64_t PerfFile::GetRecordingDuration()
 {
-    // on zero-length path we have nothing to do
-    if (path.size() == 0)
-        return nullptr;
+    if (m_samples.empty())
+        return 0;
 
-    uint32_t i = path.size();
-    CallTreeNode* curNode = nullptr;
+    return (m_samples.back().time - m_samples.front().time) / SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+}
 
-    // traverse all points in path
-    do
+void PerfFile::SelectSamples(const PerfSampleFilter &filter, std::vector<uint32_t> &dst)
+{
+    size_t first, last;
+
+    dst.clear();
+
+    if (!FindSampleRange(filter.fromMs, filter.toMs, first, last))
+        return;
+
+    const bool allEvents = MatchesAllEvents(filter.events);
+    if (!allEvents && m_sampleEvents.empty())
+        return;
+
+    // no secondary constraint - the selection is just a contiguous range
+    if (filter.pids.empty() && filter.tids.empty() && filter.cpus.empty() && allEvents)
     {
-        // a loop in such form will allow us to iterate from end to beginning, not
-        // excluding zero and not subtract from zero (which would cause overflow)
+        dst.resize(last - first);
+        for (size_t i = first; i < last; i++)
+            dst[i - first] = (uint32_t)i;
+        return;
+    }
 
-        i--;
+    const std::set<uint32_t> noEvents;
+    const std::pair<const std::set<uint32_t>*, SampleIndexMap*> dimensions[] = {
+        { &filter.pids, &m_pidIndex },
+        { &filter.tids, &m_tidIndex },
+        { &filter.cpus, &m_cpuIndex },
+        { allEvents ? &noEvents : &filter.events, &m_eventIndex }
+    };
+
+    // select the most selective constrained dimension to drive the selection; the other
+    // dimensions are then just checked on every candidate sample
+    size_t bestSize = (size_t)(-1);
+    int best = -1;
+    for (int d = 0; d < 4; d++)
+    {
+        if (dimensions[d].first->empty())
+            continue;
 
-        // if no node selected yet, that means, we need to select root node
-        if (curNode == nullptr)
+        size_t dsize = 0;
+        for (uint32_t key : *dimensions[d].first)
         {
-            // find root node in calltree map of root nodes
-            auto itr = m_callTree.find(path[i]);
-            // if not found, create
-            if (itr == m_callTree.end())
-            {
-                curNode = CreateCallTreeNode(path[i], nullptr);
-                m_callTree[path[i]] = curNode;
-            }
-            else
-                curNode = itr->second;
+            auto itr = dimensions[d].second->find(key);
+            if (itr != dimensions[d].second->end())
+                dsize += itr->second.size();
         }
-        else // otherwise search in current node children map
+
+        if (dsize < bestSize)
         {
-            // find node in children map
-            auto itr = curNode->children.find(path[i]);
-            // if not found, create
-            if (itr == curNode->children.end())
-            {
-                curNode->children[path[i]] = CreateCallTreeNode(path[i], curNode);
-                curNode = curNode->children[path[i]];
-            }
-            else
-                curNode = itr->second;
+            bestSize = dsize;
+            best = d;
         }
     }
-    while (i != 0);
-
-    return curNode;
-}
 
-void PerfFile::AccumulateCallTreeTime(CallTreeNode* node, double addTime, bool addSample)
-{
-    // roll up to root node and add "inclusive" time
-    CallTreeNode* tmp = node;
-    while (tmp != nullptr)
+    // gather candidates within time range from all index lists of driving dimension
+    for (uint32_t key : *dimensions[best].first)
     {
-        tmp->timeTotal += addTime;
-        if (addSample)
-            tmp->sampleCount++;
-        tmp = tmp->parent;
+        auto itr = dimensions[best].second->find(key);
+        if (itr == dimensions[best].second->end())
+            continue;
+
+        const std::vector<uint32_t> &list = itr->second;
+        auto lo = std::lower_bound(list.begin(), list.end(), (uint32_t)first);
+        auto hi = std::lower_bound(lo, list.end(), (uint32_t)last);
+
+        for (; lo != hi; ++lo)
+        {
+            const PerfSample &ps = m_samples[*lo];
+
+            if ((!filter.pids.empty() && filter.pids.find(ps.pid) == filter.pids.end()) ||
+                (!filter.tids.empty() && filter.tids.find(ps.tid) == filter.tids.end()) ||
+                (!filter.cpus.empty() && filter.cpus.find(ps.cpu) == filter.cpus.end()) ||
+                (!allEvents && filter.events.find(GetSampleEvent(*lo)) == filter.events.end()))
+                continue;
+
+            dst.push_back(*lo);
+        }
     }
+
+    // lists of different keys are disjoint, but has to be merged back to time order
+    if (dimensions[best].first->size() > 1)
+        std::sort(dst.begin(), dst.end());
 }
 
-void PerfFile::ProcessCallTree()
+void PerfFile::CollectStackWeights(const PerfSampleFilter &filter, StackWeightVector &dst)
 {
-    record_sample* sample;
-    FunctionEntry* fet;
-    std::vector<uint32_t> callPath;
-    CallTreeNode* ctn;
+    const bool allEvents = MatchesAllEvents(filter.events);
+    size_t first, last;
 
-    LogFunc(LOG_INFO, "Processing call tree...");
+    // unconstrained selection does not need sample index list at all
+    if (filter.pids.empty() && filter.tids.empty() && filter.cpus.empty() && allEvents)
+    {
+        FindSampleRange(filter.fromMs, filter.toMs, first, last);
+        CollectStackWeights(first, last, dst);
+        return;
+    }
 
-    uint32_t findex, childindex;
-    for (record_t* itr : m_records)
+    // whole profiles of events are already counted as well
+    if (filter.pids.empty() && filter.tids.empty() && filter.cpus.empty()
+        && FindSampleRange(filter.fromMs, filter.toMs, first, last) && first == 0 && last == m_samples.size())
     {
-        if (itr->type == PERF_RECORD_SAMPLE)
+        std::vector<uint64_t> counts, periods;
+        for (uint32_t event : filter.events)
         {
-            sample = ((record_sample*)itr);
+            auto itr = m_eventStackCounts.find(event);
+            if (itr == m_eventStackCounts.end())
+                continue;
 
-            fet = GetFunctionByAddress(sample->ip, &findex);
-            // for now, exclude kernel symbols from output (for sanity reasons)
-            if (fet && fet->functionType != FET_KERNEL)
+            const std::vector<uint64_t> &eventPeriods = m_eventStackPeriods[event];
+            if (counts.size() < itr->second.size())
+            {
+                counts.resize(itr->second.size(), 0);
+                periods.resize(itr->second.size(), 0);
+            }
+            for (size_t i = 0; i < itr->second.size(); i++)
             {
-                callPath.clear();
+                counts[i] += itr->second[i];
+                periods[i] += eventPeriods[i];
+            }
+        }
 
-                callPath.push_back(findex);
+        dst.clear();
+        AppendStackWeights(counts, periods, dst);
+        return;
+    }
 
-                // 2 is the right value, since IP callchain contains invalid address ("stopper") on top
-                // and self as second record
-                for (uint64_t i = 2; i < sample->callchain->nr; i++)
-                {
-                    fet = GetFunctionByAddress(sample->callchain->ips[i], &childindex);
-                    if (fet)
-                        callPath.push_back(childindex);
-                }
+    std::vector<uint32_t> indices;
+    SelectSamples(filter, indices);
 
-                // insert path into call tree
-                ctn = InsertIntoCallTree(callPath, findex);
-                if (ctn)
-                    AccumulateCallTreeTime(ctn, 1.0, true);
-            }
-        }
+    std::vector<StackSample> samples;
+    samples.reserve(indices.size());
+    for (uint32_t idx : indices)
+    {
+        if (m_samples[idx].stackId != INVALID_STACK_ID)
+            samples.push_back(StackSample(m_samples[idx].stackId, m_samples[idx].period));
     }
 
-    // root nodes always have the largest inclusive time portions
-    double maxTime = 0.0;
-    for (auto itr : m_callTree)
-            maxTime += itr.second->timeTotal;
+    CountStackIds(samples, dst);
+}
 
-    LogFunc(LOG_VERBOSE, "Thresholding sampled paths...");
-    LogFunc(LOG_VERBOSE, "Total samples: %u, threshold: %u", (uint64_t)maxTime, (uint64_t)(maxTime*CALL_TREE_INCLUSIVE_TIME_THRESHOLD));
+void PerfFile::CountStackIds(std::vector<StackSample> &samples, StackWeightVector &dst)
+{
+    uint64_t period;
 
-    if (maxTime > 0.0)
+    dst.clear();
+
+    // sort and count runs of the same stack; this keeps the cost proportional to selection size
+    std::sort(samples.begin(), samples.end());
+
+    for (size_t i = 0; i < samples.size(); )
     {
-        // traverse using iterative DFS to count time precentages
+        size_t j = i;
+        period = 0;
+        while (j < samples.size() && samples[j].first == samples[i].first)
+            period += samples[j++].second;
 
-        CallTreeNode* curr;
-        std::stack<CallTreeNode*> dstack;
-        for (auto itr : m_callTree)
-            dstack.push(itr.second);
+        dst.push_back(StackWeight(samples[i].first, (uint64_t)(j - i), period));
+        i = j;
+    }
+}
 
-        while (!dstack.empty())
-        {
-            curr = dstack.top();
-            dstack.pop();
+void PerfFile::AppendStackWeights(const std::vector<uint64_t> &counts, const std::vector<uint64_t> &periods, StackWeightVector &dst)
+{
+    for (uint32_t i = 0; i < counts.size(); i++)
+    {
+        if (counts[i] > 0)
+            dst.push_back(StackWeight(i, counts[i], periods[i]));
+    }
+}
 
-            curr->timeTotalPct = curr->timeTotal / maxTime;
+uint64_t PerfFile::GetStackWeight(const StackWeight &sw) const
+{
+    return (m_weighting == PSW_PERIOD) ? sw.period : sw.samples;
+}
 
-            // exclude function calls with less than THRESHOLD percentage of inclusive time
-            if (curr->timeTotalPct < CALL_TREE_INCLUSIVE_TIME_THRESHOLD)
-            {
-                if (curr->parent)
-                    curr->parent->children.erase(curr->functionId);
-                else
-                    m_callTree.erase(curr->functionId);
-            }
+PerfSampleWeighting PerfFile::GetSampleWeighting() const
+{
+    return m_weighting;
+}
 
-            // it's a tree, we don't need to check traversal state
-            for (auto itr : curr->children)
-                dstack.push(itr.second);
-        }
-    }
+void PerfFile::SetSampleWeighting(PerfSampleWeighting weighting)
+{
+    if (weighting == m_weighting)
+        return;
+
+    m_weighting = weighting;
+
+    LogFunc(LOG_VERBOSE, "Sample weighting changed to %s", (weighting == PSW_PERIOD) ? "period" : "sample count");
+
+    // whole-recording profiles are aggregated from stack weights again on request; heat map carries both weights
+    m_flatProfileStale = true;
+    m_callGraphStale = true;
+    RetireCallTrees();
 }
 
-void PerfFile::AddFilenameForMapping(uint64_t address, uint64_t length, const char* filename)
+const std::vector<FunctionEntry>& PerfFile::GetFunctionTable() const
 {
-    m_mmapFiles.push_back({ address, length, filename });
+    return m_functionTable;
 }
 
-const char* PerfFile::RetrieveFilenameForMapping(uint64_t address)
+const std::vector<FlatProfileRecord>& PerfFile::GetFlatProfile()
 {
-    for (MemoryRegionFile &itr : m_mmapFiles)
-    {
-        if (address >= itr.base && address < itr.base+itr.length)
-            return itr.filename.c_str();
-    }
+    PrepareFlatProfile();
 
-    return nullptr;
+    return m_flatProfile;
 }
 
-void PerfFile::ProcessMemoryMapping()
+const StackTable& PerfFile::GetStackTable() const
 {
-    LogFunc(LOG_VERBOSE, "Processing memory mappings...");
+    return m_stacks;
+}
 
-    // automatically map all kernel addresses mapped via mmap
-    // the other symbols mapped via mmap2 are resolved later
-    record_mmap* mm;
-    record_mmap2* mm2;
-    char* tmp;
-    int i;
+void PerfFile::FillStackWeights(StackWeightVector &dst, const PerfSampleFilter &filter)
+{
+    CollectStackWeights(filter, dst);
+}
 
-    for (record_t* itr : m_records)
+uint32_t PerfFile::GetKernelFrameCount(const uint32_t* frames, uint32_t count) const
+{
+    // callchains are split at decode time, kernel frames always precede user frames
+    uint32_t i = 0;
+    while (i < count && m_functionTable[frames[i]].functionType == FET_KERNEL)
+        i++;
+
+    return i;
+}
+
+bool PerfFile::SelectStackFrames(const uint32_t* &frames, uint32_t &count) const
+{
+    const uint32_t kernelCount = GetKernelFrameCount(frames, count);
+
+    switch (m_stackMode)
+    {
+        case PSM_USER:
+            // time spent in kernel is not attributed to the user code which entered it
+            if (kernelCount > 0)
+                return false;
+            break;
+        case PSM_KERNEL:
+            if (kernelCount == 0)
+                return false;
+            count = kernelCount;
+            break;
+        case PSM_COMBINED:
+            break;
+    }
+
+    return (count > 0);
+}
+
+PerfStackMode PerfFile::GetStackMode() const
+{
+    return m_stackMode;
+}
+
+void PerfFile::SetStackMode(PerfStackMode mode)
+{
+    if (mode == m_stackMode)
+        return;
+
+    m_stackMode = mode;
+
+    LogFunc(LOG_VERBOSE, "Stack mode changed to %s", (mode == PSM_USER) ? "user" : ((mode == PSM_KERNEL) ? "kernel" : "combined"));
+
+    // unlike weighting, the heat map bins hold just the selected frames; call graph keeps whole stacks
+    m_flatProfileStale = true;
+    RetireCallTrees();
+    m_heatMap = HeatMapPyramid();
+    m_heatMapStale = false;
+}
+
+bool PerfFile::IsRecursionFolding() const
+{
+    return m_foldRecursion;
+}
+
+void PerfFile::SetRecursionFolding(bool enable)
+{
+    if (enable == m_foldRecursion)
+        return;
+
+    m_foldRecursion = enable;
+
+    LogFunc(LOG_VERBOSE, "Recursion folding %s", enable ? "enabled" : "disabled");
+
+    RetireCallTrees();
+}
+
+const uint32_t* PerfFile::GetTreeFrames(uint32_t stackId, uint32_t &count)
+{
+    if (!m_foldRecursion)
+        return m_stacks.GetFrames(stackId, count);
+
+    return m_foldedStacks.GetFrames(GetFoldedStackId(stackId), count);
+}
+
+uint32_t PerfFile::GetFoldedStackId(uint32_t stackId)
+{
+    // stack table only grows (live recordings), so do the folded IDs
+    if (stackId >= m_foldedStackIds.size())
+        m_foldedStackIds.resize(m_stacks.GetStackCount(), INVALID_STACK_ID);
+
+    if (m_foldedStackIds[stackId] != INVALID_STACK_ID)
+        return m_foldedStackIds[stackId];
+
+    if (m_foldPositions.size() < m_functionTable.size())
+        m_foldPositions.resize(m_functionTable.size(), INVALID_STACK_ID);
+
+    uint32_t count, pos;
+    const uint32_t* frames = m_stacks.GetFrames(stackId, count);
+    std::vector<uint32_t> path;
+
+    // walk from root to sampled function; when a function already on the path is called again, everything
+    // called from its outer instance is folded into it, so A->B->A->B->C becomes A->B->C
+    for (uint32_t i = count; i-- > 0; )
+    {
+        pos = m_foldPositions[frames[i]];
+        if (pos != INVALID_STACK_ID)
+        {
+            while (path.size() > pos + 1)
+            {
+                m_foldPositions[path.back()] = INVALID_STACK_ID;
+                path.pop_back();
+            }
+            continue;
+        }
+
+        m_foldPositions[frames[i]] = (uint32_t)path.size();
+        path.push_back(frames[i]);
+    }
+
+    for (uint32_t functionId : path)
+        m_foldPositions[functionId] = INVALID_STACK_ID;
+
+    // stacks are stored leaf first
+    std::reverse(path.begin(), path.end());
+
+    m_foldedStackIds[stackId] = m_foldedStacks.Intern(path.data(), (uint32_t)path.size());
+
+    return m_foldedStackIds[stackId];
+}
+
+void PerfFile::CollectStackWeights(size_t first, size_t last, StackWeightVector &dst)
+{
+    dst.clear();
+
+    // whole sample table is already counted
+    if (first == 0 && last == m_samples.size())
+    {
+        AppendStackWeights(m_stackCounts, m_stackPeriods, dst);
+        return;
+    }
+
+    // for large ranges, count directly into dense per-stack arrays
+    if (last - first >= m_stacks.GetStackCount())
+    {
+        std::vector<uint64_t> counts(m_stacks.GetStackCount(), 0);
+        std::vector<uint64_t> periods(m_stacks.GetStackCount(), 0);
+
+        for (size_t i = first; i < last; i++)
+        {
+            if (m_samples[i].stackId != INVALID_STACK_ID)
+            {
+                counts[m_samples[i].stackId]++;
+                periods[m_samples[i].stackId] += m_samples[i].period;
+            }
+        }
+
+        AppendStackWeights(counts, periods, dst);
+        return;
+    }
+
+    std::vector<StackSample> samples;
+
+    samples.reserve(last - first);
+    for (size_t i = first; i < last; i++)
+    {
+        if (m_samples[i].stackId != INVALID_STACK_ID)
+            samples.push_back(StackSample(m_samples[i].stackId, m_samples[i].period));
+    }
+
+    CountStackIds(samples, dst);
+}
+
+void PerfFile::AggregateFlatProfile(const StackWeightVector &stacks, std::vector<FlatProfileRecord> &dst)
+{
+    dst.clear();
+
+    AccumulateFlatProfile(stacks, dst);
+    FinalizeFlatProfile(dst);
+}
+
+void PerfFile::AccumulateFlatProfile(const StackWeightVector &stacks, std::vector<FlatProfileRecord> &dst)
+{
+    FlatProfileRecord *fp;
+    size_t prepared = dst.size();
+
+    dst.resize(m_functionTable.size());
+
+    // prepare records of functions not present in table yet, it will match function table at first stage of filling
+    for (size_t i = prepared; i < m_functionTable.size(); i++)
+    {
+        fp = &dst[i];
+
+        fp->functionId = (uint32_t)i;
+        fp->timeTotal = 0;
+        fp->timeTotalPct = 0.0f;
+        fp->timeTotalInclusive = 0;
+        fp->timeTotalInclusivePct = 0.0f;
+        fp->callCount = 0;
+    }
+
+    const uint32_t* frames;
+    uint32_t count;
+    uint64_t weight;
+
+    // weights are summed as integers, so large period sums do not lose precision on the way
+    std::vector<uint64_t> self(m_functionTable.size(), 0);
+    std::vector<uint64_t> inclusive(m_functionTable.size(), 0);
+    // last stack (index + 1) the function was counted in, so recursive functions add inclusive time just once
+    std::vector<uint32_t> counted(m_functionTable.size(), 0);
+    uint32_t stamp = 0;
+
+    for (const StackWeight &sw : stacks)
+    {
+        stamp++;
+
+        frames = m_stacks.GetFrames(sw.stackId, count);
+        weight = GetStackWeight(sw);
+
+        // rather than call count, we use something like "samples count" here; every resolved
+        // caller adds to count of its callee (regardless of stack mode, as in call graph)
+        for (uint32_t i = 1; i < count; i++)
+            dst[frames[i - 1]].callCount += sw.samples;
+
+        if (!SelectStackFrames(frames, count))
+            continue;
+
+        self[frames[0]] += weight;
+
+        // now calculate inclusive time
+        for (uint32_t i = 1; i < count; i++)
+        {
+            if (counted[frames[i]] != stamp)
+            {
+                counted[frames[i]] = stamp;
+                inclusive[frames[i]] += weight;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < dst.size(); i++)
+    {
+        dst[i].timeTotal += (double)self[i];
+        dst[i].timeTotalInclusive += (double)inclusive[i];
+    }
+}
+
+void PerfFile::FinalizeFlatProfile(std::vector<FlatProfileRecord> &dst)
+{
+    LogFunc(LOG_VERBOSE, "Finalizing inclusive time calculation...");
+
+    double maxInclusiveTime = 0.01;
+    for (size_t i = 0; i < dst.size(); i++)
+    {
+        if (dst[i].timeTotalInclusive > maxInclusiveTime)
+            maxInclusiveTime = dst[i].timeTotalInclusive;
+    }
+
+    for (size_t i = 0; i < dst.size(); i++)
+    {
+        dst[i].timeTotalInclusivePct = dst[i].timeTotalInclusive / maxInclusiveTime;
+    }
+}
+
+void PerfFile::AggregateCallGraph(const StackWeightVector &stacks, CallGraphMap &dst)
+{
+    const uint32_t* frames;
+    uint32_t count;
+    uint64_t weight;
+
+    for (const StackWeight &sw : stacks)
+    {
+        frames = m_stacks.GetFrames(sw.stackId, count);
+        weight = GetStackWeight(sw);
+
+        // every caller-callee pair in resolved stack forms an edge; kernel functions are
+        // intentionally kept in call graph
+        for (uint32_t i = 1; i < count; i++)
+            dst[frames[i]][frames[i - 1]] += weight;
+    }
+}
+
+void PerfFile::AggregateCallTree(const StackWeightVector &stacks, CallTreeMap* dst, CallTreeMap* inverted, ButterflyIndex* butterfly)
+{
+    const uint32_t* frames;
+    uint32_t count;
+    uint64_t weight;
+    CallTreeNode* ctn;
+    std::vector<uint32_t> reversed;
+
+    if (butterfly)
+        butterfly->Reset((uint32_t)m_functionTable.size());
+
+    for (const StackWeight &sw : stacks)
+    {
+        weight = GetStackWeight(sw);
+
+        // callers and callees are taken from stacks as they are, folding would hide some of them
+        if (butterfly)
+        {
+            frames = m_stacks.GetFrames(sw.stackId, count);
+            if (SelectStackFrames(frames, count))
+                butterfly->Add(frames, count, weight);
+        }
+
+        frames = GetTreeFrames(sw.stackId, count);
+
+        if (!SelectStackFrames(frames, count))
+            continue;
+
+        // insert path into call tree
+        if (dst)
+        {
+            ctn = InsertIntoCallTree(*dst, frames, count);
+            if (ctn)
+                AccumulateCallTreeTime(ctn, (double)weight, sw.samples);
+        }
+
+        // inverted tree is rooted at sampled function, so it's the same path, just inserted from the other end
+        if (inverted)
+        {
+            reversed.assign(frames, frames + count);
+            std::reverse(reversed.begin(), reversed.end());
+
+            ctn = InsertIntoCallTree(*inverted, reversed.data(), count);
+            if (ctn)
+                AccumulateCallTreeTime(ctn, (double)weight, sw.samples);
+        }
+    }
+
+    if (dst)
+        ThresholdCallTree(*dst);
+    if (inverted)
+        ThresholdCallTree(*inverted);
+    if (butterfly)
+        butterfly->Finish();
+}
+
+void PerfFile::ThresholdCallTree(CallTreeMap &dst)
+{
+    // root nodes always have the largest inclusive time portions
+    double maxTime = 0.0;
+    for (auto itr : dst)
+            maxTime += itr.second->timeTotal;
+
+    LogFunc(LOG_VERBOSE, "Thresholding sampled paths...");
+    LogFunc(LOG_VERBOSE, "Total time: %u, threshold: %u", (uint64_t)maxTime, (uint64_t)(maxTime*CALL_TREE_INCLUSIVE_TIME_THRESHOLD));
+
+    if (maxTime > 0.0)
+    {
+        // traverse using iterative DFS to count time precentages
+
+        CallTreeNode* curr;
+        std::stack<CallTreeNode*> dstack;
+        for (auto itr : dst)
+            dstack.push(itr.second);
+
+        while (!dstack.empty())
+        {
+            curr = dstack.top();
+            dstack.pop();
+
+            curr->timeTotalPct = curr->timeTotal / maxTime;
+
+            // exclude function calls with less than THRESHOLD percentage of inclusive time
+            if (curr->timeTotalPct < CALL_TREE_INCLUSIVE_TIME_THRESHOLD)
+            {
+                if (curr->parent)
+                    curr->parent->children.erase(curr->functionId);
+                else
+                    dst.erase(curr->functionId);
+
+                // children never have more time than their parent, so the whole subtree goes away
+                ReleaseCallTreeNode(curr);
+                continue;
+            }
+
+            // it's a tree, we don't need to check traversal state
+            for (auto itr : curr->children)
+                dstack.push(itr.second);
+        }
+    }
+}
+
+void PerfFile::ProcessFlatProfile()
+{
+    StackWeightVector stacks;
+
+    LogFunc(LOG_INFO, "Processing flat profile data...");
+
+    BeginPhase(PLP_FLAT_PROFILE);
+    CollectStackWeights(0, m_samples.size(), stacks);
+    AggregateFlatProfile(stacks, m_flatProfile);
+    m_flatProfileStale = false;
+    EndPhase();
+}
+
+void PerfFile::ProcessCallGraph()
+{
+    StackWeightVector stacks;
+
+    LogFunc(LOG_INFO, "Processing call graph...");
+
+    BeginPhase(PLP_CALL_GRAPH);
+    CollectStackWeights(0, m_samples.size(), stacks);
+    AggregateCallGraph(stacks, m_callGraph);
+    m_callGraphStale = false;
+    EndPhase();
+}
+
+void PerfFile::PrepareFlatProfile()
+{
+    if (m_flatProfileStale)
+        ProcessFlatProfile();
+}
+
+void PerfFile::PrepareCallGraph()
+{
+    if (m_callGraphStale)
+    {
+        m_callGraph.clear();
+        ProcessCallGraph();
+    }
+}
+
+CallTreeNode* PerfFile::CreateCallTreeNode(uint32_t functionId, CallTreeNode* childOf)
+{
+    CallTreeNode* node = new CallTreeNode;
+    node->functionId = functionId;
+    node->timeTotal = 0.0;
+    node->timeTotalPct = 0.0;
+    node->sampleCount = 0;
+    node->parent = childOf;
+    return node;
+}
+
+CallTreeNode* PerfFile::InsertIntoCallTree(CallTreeMap &roots, const uint32_t* path, uint32_t count)
+{
+    // on zero-length path we have nothing to do
+    if (count == 0)
+        return nullptr;
+
+    uint32_t i = count;
+    CallTreeNode* curNode = nullptr;
+
+    // traverse all points in path
+    do
+    {
+        // a loop in such form will allow us to iterate from end to beginning, not
+        // excluding zero and not subtract from zero (which would cause overflow)
+
+        i--;
+
+        // if no node selected yet, that means, we need to select root node
+        if (curNode == nullptr)
+        {
+            // find root node in calltree map of root nodes
+            auto itr = roots.find(path[i]);
+            // if not found, create
+            if (itr == roots.end())
+            {
+                curNode = CreateCallTreeNode(path[i], nullptr);
+                roots[path[i]] = curNode;
+            }
+            else
+                curNode = itr->second;
+        }
+        else // otherwise search in current node children map
+        {
+            // find node in children map
+            auto itr = curNode->children.find(path[i]);
+            // if not found, create
+            if (itr == curNode->children.end())
+            {
+                curNode->children[path[i]] = CreateCallTreeNode(path[i], curNode);
+                curNode = curNode->children[path[i]];
+            }
+            else
+                curNode = itr->second;
+        }
+    }
+    while (i != 0);
+
+    return curNode;
+}
+
+void PerfFile::ReleaseCallTreeNode(CallTreeNode* node)
+{
+    std::stack<CallTreeNode*> dstack;
+    dstack.push(node);
+
+    while (!dstack.empty())
+    {
+        node = dstack.top();
+        dstack.pop();
+
+        for (auto itr : node->children)
+            dstack.push(itr.second);
+
+        delete node;
+    }
+}
+
+void PerfFile::ReleaseCallTree(CallTreeMap &roots)
+{
+    for (auto itr : roots)
+        ReleaseCallTreeNode(itr.second);
+
+    roots.clear();
+}
+
+void PerfFile::AccumulateCallTreeTime(CallTreeNode* node, double addTime, uint64_t addSamples)
+{
+    // roll up to root node and add "inclusive" time
+    CallTreeNode* tmp = node;
+    while (tmp != nullptr)
+    {
+        tmp->timeTotal += addTime;
+        tmp->sampleCount += addSamples;
+        tmp = tmp->parent;
+    }
+}
+
+void PerfFile::ProcessCallTree()
+{
+    StackWeightVector stacks;
+
+    LogFunc(LOG_INFO, "Processing call tree...");
+
+    BeginPhase(PLP_CALL_TREE);
+    CollectStackWeights(0, m_samples.size(), stacks);
+
+    // the other views of the same stacks are built in the same pass
+    ReleaseCallTree(m_invertedCallTree);
+    AggregateCallTree(stacks, &m_callTree, &m_invertedCallTree, &m_butterfly);
+    m_callTreeViewsStale = false;
+    EndPhase();
+}
+
+void PerfFile::PrepareCallTree()
+{
+    // the tree is built on first request, and again when live recording or aggregation settings change
+    if (m_callTreeStale)
+    {
+        ReleaseCallTree(m_callTree);
+        ProcessCallTree();
+        m_callTreeStale = false;
+    }
+}
+
+void PerfFile::RetireCallTrees()
+{
+    // unlike live polls, settings changes do not invalidate nodes already handed out
+    if (!m_callTree.empty())
+    {
+        m_retiredCallTrees.push_back(CallTreeMap());
+        m_retiredCallTrees.back().swap(m_callTree);
+    }
+    if (!m_invertedCallTree.empty())
+    {
+        m_retiredCallTrees.push_back(CallTreeMap());
+        m_retiredCallTrees.back().swap(m_invertedCallTree);
+    }
+
+    m_callTreeStale = true;
+    m_callTreeViewsStale = true;
+}
+
+void PerfFile::PrepareCallTreeViews()
+{
+    StackWeightVector stacks;
+
+    PrepareCallTree();
+
+    if (!m_callTreeViewsStale)
+        return;
+
+    LogFunc(LOG_INFO, "Processing inverted call tree and callers of functions...");
+
+    BeginPhase(PLP_CALL_TREE);
+    CollectStackWeights(0, m_samples.size(), stacks);
+    AggregateCallTree(stacks, nullptr, &m_invertedCallTree, &m_butterfly);
+    m_callTreeViewsStale = false;
+    EndPhase();
+}
+
+void PerfFile::AddFilenameForMapping(uint64_t address, uint64_t length, const char* filename)
+{
+    m_mmapFiles.push_back({ address, length, filename });
+}
+
+const char* PerfFile::RetrieveFilenameForMapping(uint64_t address)
+{
+    for (MemoryRegionFile &itr : m_mmapFiles)
+    {
+        if (address >= itr.base && address < itr.base+itr.length)
+            return itr.filename.c_str();
+    }
+
+    return nullptr;
+}
+
+void PerfFile::ProcessMemoryMapping(size_t firstRecord)
+{
+    LogFunc(LOG_VERBOSE, "Processing memory mappings...");
+
+    // automatically map all kernel addresses mapped via mmap
+    // the other symbols mapped via mmap2 are resolved later
+    record_mmap* mm;
+    record_mmap2* mm2;
+    char* tmp;
+    int i;
+    record_t* itr;
+
+    for (size_t r = firstRecord; r < m_records.size(); r++)
     {
+        itr = m_records[r];
+
         if (itr->type == PERF_RECORD_MMAP)
         {
             mm = (record_mmap*)itr;
@@ -416,843 +1336,1403 @@ void PerfFile::ProcessMemoryMapping()
     }
 }
 
-void PerfFile::AddMemoryMapping(uint64_t start, uint64_t length)
+void PerfFile::AddMemoryMapping(uint64_t start, uint64_t length)
+{
+    m_memoryMappings.push_back(MemoryRegion(start, length));
+}
+
+bool PerfFile::IsWithinMemoryMapping(uint64_t address)
+{
+    for (MemoryRegion &itr : m_memoryMappings)
+    {
+        if (itr.first <= address && itr.first + itr.second > address)
+            return true;
+    }
+
+    return false;
+}
+
+void PerfFile::AddUnresolvedSymbol(uint64_t address, FunctionEntryType type)
+{
+    std::stringstream stream;
+
+    FunctionEntry nonexist;
+    nonexist.classId = NO_CLASS;
+    nonexist.functionType = type;
+
+    LogFunc(LOG_DEBUG, "Could not find symbol 0x%.16llX", address);
+    m_loadStats.unresolvedIps++;
+
+    // add fake mapping to <-100;100> address range around sampled IP
+    if (address >= 100)
+        nonexist.address = address - 100;
+    else
+        nonexist.address = 0;
+
+    stream << std::setfill('0') << std::setw(16) << std::hex << address;
+
+    const char* memname = RetrieveFilenameForMapping(address);
+    if (memname != nullptr)
+        nonexist.name = std::string(memname) + "::0x" + stream.str();
+    else
+        nonexist.name = std::string("0x") + stream.str();
+
+    AddMemoryMapping(nonexist.address, 200);
+    // and insert fake symbol at that position
+    auto pos = std::lower_bound(m_symbolTable.begin(), m_symbolTable.end(), nonexist, FunctionEntrySortPredicate());
+    m_symbolTable.insert(pos, FunctionEntry(nonexist));
+}
+
+void PerfFile::ResolveSymbols(const char* binaryFilename)
+{
+    LoadBinarySymbols(binaryFilename);
+    ResolveMappedSymbols(0);
+}
+
+void PerfFile::LoadBinarySymbols(const char* binaryFilename)
+{
+    int cnt = 0;
+    int ncnt;
+
+    struct stat binStat;
+
+    LogFunc(LOG_VERBOSE, "Loading debug symbols from application binary...");
+
+    binStat.st_ino = 0;
+    stat(binaryFilename, &binStat);
+
+    // remember the binary identity, libraries mapped later are compared to it
+    m_binaryInode = (uint64_t)binStat.st_ino;
+
+    // retrieve symbols from binary file
+    ncnt = LoadSymbols(PSRC_NM, binaryFilename);
+    if (ncnt >= 0)
+    {
+        LogFunc(LOG_VERBOSE, "Loaded %i symbols", ncnt);
+        cnt += ncnt;
+    }
+    else
+        LogFunc(LOG_ERROR, "Could not execute nm binary for symbol resolving, no symbols loaded");
+
+    LogFunc(LOG_VERBOSE, "Loading kernel debug symbols...");
+
+    // retrieve kernel symbols
+    ncnt = LoadSymbols(PSRC_KALLSYMS, "/proc/kallsyms", 0, FET_KERNEL);
+    if (ncnt >= 0)
+    {
+        LogFunc(LOG_VERBOSE, "Loaded %i symbols", ncnt);
+        cnt += ncnt;
+    }
+    else
+        LogFunc(LOG_ERROR, "Could not load kernel symbols from /proc/kallsyms");
+
+    // sort function entries to allow effective search
+    std::sort(m_symbolTable.begin(), m_symbolTable.end(), FunctionEntrySortPredicate());
+
+    LogFunc(LOG_VERBOSE, "Loaded %i symbols from application binary and kernel", cnt);
+}
+
+void PerfFile::ResolveMappedSymbols(size_t firstMmap2)
+{
+    int cnt = 0;
+    int ncnt;
+
+    struct stat tmpStat;
+
+    tmpStat.st_ino = 0;
+
+    LogFunc(LOG_VERBOSE, "Loading debug symbols from dynamically linked libraries...");
+
+    bool isOriginalBinary;
+    std::string libpath;
+    FunctionEntry* fet;
+    record_mmap2* itr;
+    // go through all mmap'd records (via mmap2) and try to load debug libraries connected with them
+    for (size_t m = firstMmap2; m < m_mmaps2.size(); m++)
+    {
+        itr = m_mmaps2[m];
+
+        // if it's already mapped, let it go - may be duplicate
+        if (IsWithinMemoryMapping(itr->start))
+            continue;
+
+        // sort to have relevant info every turn
+        std::stable_sort(m_symbolTable.begin(), m_symbolTable.end(), FunctionEntrySortPredicate());
+
+        const uint64_t memstart = itr->start - itr->pgoff;
+
+        // if there are some symbols inside this memory region, it's possible that it has been
+        // mapped previously, just find some symbol and if it falls into mapped region,
+        // mark this region as already mapped
+        fet = GetSymbolByAddress(memstart + itr->len - 1, nullptr);
+        if (fet && fet->address >= itr->start && fet->address < itr->start+itr->len)
+        {
+            AddMemoryMapping(itr->start, itr->len);
+            // do not resolve any further, collisions possible
+            continue;
+        }
+
+        // TODO: find more portable way to look for debug library path
+        // by default, Debian-based systems stores such libs in /usr/lib/debug
+        libpath = "/usr/lib/debug";
+        libpath += itr->filename;
+
+        bool useDynamic = false;
+        FILE* tst = fopen(libpath.c_str(), "r");
+        if (!tst)
+        {
+            tst = fopen(itr->filename, "r");
+            if (!tst)
+                continue;
+
+            useDynamic = true;
+            libpath = itr->filename;
+        }
+
+        fclose(tst);
+
+        // try to stat the file - if the i-nodes are equal with original binary, act like we're loading symbols from original binary
+        // this is important when considering directly mmapped binaries, which are not aligned in compile-time
+        stat(libpath.c_str(), &tmpStat);
+
+        isOriginalBinary = (m_binaryInode == (uint64_t)tmpStat.st_ino);
+        if (isOriginalBinary)
+            useDynamic = false;
+
+        LogFunc(LOG_VERBOSE, "Loading debug symbols from %s...", libpath.c_str());
+
+        // the base address is mandatory here, since the memory is mmap'd to
+        // another offset in virtual address space, thus all symbols are
+        // moved by this offset
+        ncnt = LoadSymbols(useDynamic ? PSRC_NM_DYNAMIC : PSRC_NM, libpath.c_str(), memstart, isOriginalBinary ? FET_DONTCARE : FET_MISC);
+        if (ncnt >= 0)
+        {
+            LogFunc(LOG_VERBOSE, "Loaded %i symbols", ncnt);
+            cnt += ncnt;
+
+            // add to successfully mapped memory region vector
+            AddMemoryMapping(itr->start, itr->len);
+        }
+    }
+
+    // sort function entries to allow effective search; the table is kept sorted, when nothing was added
+    if (cnt > 0)
+        std::sort(m_symbolTable.begin(), m_symbolTable.end(), FunctionEntrySortPredicate());
+
+    LogFunc(LOG_VERBOSE, "Loaded %i symbols from dynamically linked libraries", cnt);
+}
+
+int PerfFile::LoadSymbols(PerfSymbolSource source, const char* path, uint64_t baseAddress, FunctionEntryType overrideType)
+{
+    PerfSymbolList ownSymbols;
+    const PerfSymbolList* symbols;
+
+    // listings are shared, when loading more recordings at once
+    if (m_symbolCache)
+        symbols = m_symbolCache->GetSymbols(source, path);
+    else
+        symbols = PerfSymbolCache::ReadSymbols(source, path, ownSymbols) ? &ownSymbols : nullptr;
+
+    if (!symbols)
+        return -1;
+
+    char fncType;
+
+    for (const PerfSymbol &sym : *symbols)
+    {
+        if (overrideType == FET_DONTCARE)
+        {
+            if (sym.type == FET_TEXT || sym.type == FET_TEXT_2)
+                fncType = FET_TEXT;
+            else
+                fncType = FET_MISC;
+        }
+        else
+            fncType = overrideType;
+
+        m_symbolTable.push_back({ sym.address + baseAddress, 0, sym.name, NO_CLASS, (FunctionEntryType)fncType });
+    }
+
+    m_loadStats.dsoSymbols[path] += symbols->size();
+
+    return (int)symbols->size();
+}
+
+FunctionEntry* PerfFile::GetSymbolByAddress(uint64_t address, uint32_t* functionIndex)
+{
+    return GetSymbolRecordByAddress(m_symbolTable, address, functionIndex);
+}
+
+FunctionEntry* PerfFile::GetSymbolRecordByAddress(std::vector<FunctionEntry> &source, uint64_t address, uint32_t* functionIndex)
 {
-    m_memoryMappings.push_back(MemoryRegion(start, length));
+    if (functionIndex)
+        *functionIndex = 0;
+
+    // there's nothing below the lowest known address; this also keeps the search below from underflowing
+    if (source.empty() || address < source[0].address)
+        return nullptr;
+
+    // we assume that m_functionTable is sorted from lower address to higher
+    // so we are able to perform binary search in O(log(n)) complexity
+
+    uint64_t ilow, ihigh, imid;
+
+    ilow = 0;
+    ihigh = source.size() - 1;
+
+    imid = (ilow + ihigh) / 2;
+
+    // iterative binary search
+    while (ilow <= ihigh)
+    {
+        if (source[imid].address > address)
+            ihigh = imid - 1;
+        else
+            ilow = imid + 1;
+
+        imid = (ilow + ihigh) / 2;
+    }
+
+    // the outcome may be one step higher (depending from which side we arrived), than we would like to have - we are looking for
+    // "highest lower address", i.e. for addresses 2, 5, 10, and input address 7, we return entry with address 5
+
+    if (ilow < source.size() && source[ilow].address <= address)
+    {
+        if (functionIndex)
+            *functionIndex = ilow;
+        return &source[ilow];
+    }
+
+    if (functionIndex)
+        *functionIndex = ilow - 1;
+
+    return &source[ilow - 1];
 }
 
-bool PerfFile::IsWithinMemoryMapping(uint64_t address)
+bool PerfFile::ReadAndCheckHeader()
 {
-    for (MemoryRegion &itr : m_memoryMappings)
+    // read header
+    if (fread(&m_fileHeader, sizeof(perf_file_header), 1, m_file) != 1)
     {
-        if (itr.first <= address && itr.first + itr.second > address)
-            return true;
+        LogFunc(LOG_ERROR, "Couldn't read perf file header from supplied file");
+        return false;
     }
 
-    return false;
+    // verify magic
+    for (int i = 0; i < PERF_FILE_MAGIC_LENGTH; i++)
+    {
+        if (m_fileHeader.magic[i] != perfFileMagic[i])
+        {
+            LogFunc(LOG_ERROR, "Supplied file is not perf record file");
+            return false;
+        }
+    }
+
+    return true;
 }
 
-void PerfFile::FilterUsedSymbols()
+bool PerfFile::ReadAttributes()
 {
-    uint32_t findex;
-    uint64_t tmpip;
-    FunctionEntry* fet;
-    record_sample* sample;
-    std::stringstream stream;
+    LogFunc(LOG_VERBOSE, "Reading perf file attributes");
 
-    FunctionEntry nonexist;
-    nonexist.classId = NO_CLASS;
-    nonexist.functionType = FET_MISC;
-    nonexist.name = "<__unresolved_symbol__>";
+    LogFunc(LOG_DEBUG, "Attributes section size: %llu", m_fileHeader.attrs.size);
+
+    if (m_fileHeader.attrs.offset == 0 && m_fileHeader.attrs.size == 0)
+    {
+        // TODO: check if this is true (that it's not valid without attributes) and if this may happen at all
 
-    LogFunc(LOG_INFO, "Filtering symbols...");
+        return false;
+    }
+
+    // verify attribute struct length
+    if (m_fileHeader.attr_size != sizeof(perf_file_attr))
+    {
+        LogFunc(LOG_ERROR, "Supplied perf file does not have expected attribute section length! (expected: %u, actual: %u)", sizeof(perf_file_attr), m_fileHeader.attr_size);
+        // for now, allow different sizes, we need just small portion of it all
+        //return false;
+    }
+
+    // seek to attrs section
+    fseek(m_file, (long)m_fileHeader.attrs.offset, SEEK_SET);
+
+    uint8_t* tmpMem;
+    perf_file_attr f_attr;
+
+    // verify attributes size - it has to be divisible to attr structs
+    if ((m_fileHeader.attrs.size % sizeof(perf_file_attr)) != 0)
+    {
+        LogFunc(LOG_ERROR, "Supplied perf file does not have expected attribute section length according to perf_file_attr size!");
+        // for now, allow different sizes, we need just small portion of it all
+        //return false;
+    }
+
+    size_t allocSize = nmax(sizeof(perf_file_attr), m_fileHeader.attr_size);
+    size_t scaleSize = nmin(sizeof(perf_file_attr), m_fileHeader.attr_size);
+
+    uint32_t eventAttrCount = (uint32_t)(m_fileHeader.attrs.size / scaleSize);
+    m_eventAttr.clear();
+    m_eventParsers.clear();
+    m_eventAttrIds.clear();
 
-    std::set<uint64_t> usedIPs;
+    tmpMem = new uint8_t[allocSize];
 
-    for (record_t* itr : m_records)
+    std::vector<uint64_t> ids;
+    long cur = (long)m_fileHeader.attrs.offset;
+    // go through all attributes linked by header
+    for (uint32_t i = 0; i < eventAttrCount; i++)
     {
-        if (itr->type == PERF_RECORD_SAMPLE)
+        // read attribute (has to fit the structure)
+        if (fread(tmpMem, allocSize, 1, m_file) != 1)
         {
-            sample = ((record_sample*)itr);
+            LogFunc(LOG_ERROR, "Unexpected end of file while reading file attributes section");
+            delete[] tmpMem;
+            return false;
+        }
 
-            nonexist.name = "<__unresolved_symbol__>";
+        // copy memory to attribute struct
+        f_attr = *((perf_file_attr*)tmpMem);
 
-            // if the symbol is not within mapped region, fake the mapping with unresolved symbol
-            if (!IsWithinMemoryMapping(sample->ip))
-            {
-                LogFunc(LOG_DEBUG, "Could not find symbol 0x%.16llX", sample->ip);
-                // add fake mapping to <-100;100> address range around sampled IP
-                if (sample->ip >= 100)
-                    nonexist.address = sample->ip - 100;
-                else
-                    nonexist.address = 0;
+        uint64_t f_id;
+        uint32_t idcount = (uint32_t)(f_attr.ids.size / sizeof(f_id));
+        ids.clear();
 
-                const char* memname = RetrieveFilenameForMapping(sample->ip);
-                if (memname != nullptr)
-                {
-                    nonexist.name = std::string(memname);
-                    stream << std::setfill('0') << std::setw(16)
-                           << std::hex << sample->ip;
-                    nonexist.name += std::string("::0x") + stream.str().c_str();
-                    stream.str(std::string());
-                    stream.clear();
-                }
-                else
-                {
-                    stream << std::setfill('0') << std::setw(16)
-                           << std::hex << sample->ip;
-                    nonexist.name = std::string("0x") + stream.str().c_str();
-                    stream.str(std::string());
-                    stream.clear();
-                }
+        // go through all assigned IDs and read them
+        if (idcount > 0 && f_attr.ids.size != (uint32_t)(-1))
+        {
+            cur = ftell(m_file);
+            fseek(m_file, (long)f_attr.ids.offset, SEEK_SET);
 
-                AddMemoryMapping(nonexist.address, 200);
-                // and insert fake symbol at that position
-                auto pos = std::lower_bound(m_symbolTable.begin(), m_symbolTable.end(), nonexist, FunctionEntrySortPredicate());
-                m_symbolTable.insert(pos, FunctionEntry(nonexist));
+            for (uint32_t j = 0; j < idcount; j++)
+            {
+                if (fread(&f_id, sizeof(f_id), 1, m_file) == 1)
+                    ids.push_back(f_id);
             }
 
-            fet = GetSymbolByAddress(sample->ip, &findex);
-            if (fet && usedIPs.find(fet->address) == usedIPs.end())
-            {
-                m_functionTable.push_back(*fet);
-                usedIPs.insert(fet->address);
+            // seek back where we came from
+            fseek(m_file, cur, SEEK_SET);
+        }
 
-                for (uint64_t i = 0; i < sample->callchain->nr; i++)
-                {
-                    tmpip = sample->callchain->ips[i];
-
-                    nonexist.name = "<__unresolved_symbol__>";
-
-                    // the same magic as before - when the symbol is not within mapped region, fake the mapping
-                    if (!IsWithinMemoryMapping(tmpip))
-                    {
-                        LogFunc(LOG_DEBUG, "Could not find symbol 0x%.16llX", tmpip);
-                        if (tmpip >= 100)
-                            nonexist.address = tmpip - 100;
-                        else
-                            nonexist.address = 0;
-
-                        const char* memname = RetrieveFilenameForMapping(tmpip);
-                        if (memname != nullptr)
-                        {
-                            nonexist.name = std::string(memname);
-                            stream << std::setfill('0') << std::setw(16)
-                                   << std::hex << tmpip;
-                            nonexist.name += std::string("::0x") + stream.str().c_str();
-                            stream.str(std::string());
-                            stream.clear();
-                        }
-                        else
-                        {
-                            stream << std::setfill('0') << std::setw(16)
-                                   << std::hex << tmpip;
-                            nonexist.name = std::string("0x") + stream.str().c_str();
-                            stream.str(std::string());
-                            stream.clear();
-                        }
-
-                        AddMemoryMapping(nonexist.address, 200);
-                        auto pos = std::lower_bound(m_symbolTable.begin(), m_symbolTable.end(), nonexist, FunctionEntrySortPredicate());
-                        m_symbolTable.insert(pos, FunctionEntry(nonexist));
-                    }
-
-                    fet = GetSymbolByAddress(tmpip, &findex);
-                    if (fet && usedIPs.find(fet->address) == usedIPs.end())
-                    {
-                        m_functionTable.push_back(*fet);
-                        usedIPs.insert(fet->address);
-                    }
-                }
-            }
+        if (!AddEventAttribute(f_attr.attr, ids.data(), (uint32_t)ids.size()))
+        {
+            delete[] tmpMem;
+            return false;
         }
     }
 
-    std::sort(m_functionTable.begin(), m_functionTable.end(), FunctionEntrySortPredicate());
+    delete[] tmpMem;
 
-    LogFunc(LOG_VERBOSE, "Used symbols: %u", m_functionTable.size());
+    return true;
 }
 
-void PerfFile::ResolveSymbols(const char* binaryFilename)
+bool PerfFile::AddEventAttribute(const perf_event_attr &attr, const uint64_t* ids, uint32_t idCount)
 {
-    int cnt = 0;
-    int ncnt;
+    // this also may not be completely true to require such thing, but it appears
+    // to be fine for this case, when we need just regular profiling (for now)
+    if (!attr.sample_id_all)
+    {
+        LogFunc(LOG_ERROR, "We need sample_id_all for further parsing!");
+        return false;
+    }
 
-    struct stat binStat, tmpStat;
+    uint32_t samplePos, trailerPos;
+    bool hasId = GetIdPositions(attr, samplePos, trailerPos);
 
-    LogFunc(LOG_VERBOSE, "Loading debug symbols from application binary...");
+    // at first pass, store sampling type and ID position; events of other layouts could be then parsed
+    // just when they have the ID at the same position
+    if (m_eventAttr.empty())
+    {
+        m_samplingType = attr.sample_type;
+        m_sampleIdPosition = samplePos;
+        m_trailerIdPosition = trailerPos;
+    }
+    else if (!HasSameLayout(m_eventAttr[0].attr, attr))
+    {
+        uint32_t firstSamplePos, firstTrailerPos;
+        if (!hasId || !GetIdPositions(m_eventAttr[0].attr, firstSamplePos, firstTrailerPos)
+            || firstSamplePos != samplePos || firstTrailerPos != trailerPos)
+        {
+            LogFunc(LOG_ERROR, "Events of different sampling types cannot be told apart (no common ID position), cannot continue");
+            return false;
+        }
 
-    // build nm binary call parameters
-    const char *argv[] = {NM_BINARY_PATH, "-C", binaryFilename, 0};
-    // next argv set for resolving dynamic symbols
-    const char *argv_dyn[] = {NM_BINARY_PATH, "-C", "-D", binaryFilename, 0};
+        m_uniformLayout = false;
+    }
 
-    binStat.st_ino = 0;
-    tmpStat.st_ino = 0;
-    stat(binaryFilename, &binStat);
+    event_type_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.attr = attr;
 
-    // retrieve symbols from binary file
-    int readfd = ForkProcessForReading(argv);
-    if (readfd > 0)
+    // store to vector, along with parser of its layout picked just once
+    m_eventAttr.push_back(entry);
+    m_eventParsers.push_back(perf_event__select_sample_parser(&attr));
+    // link samples with attribute section
+    m_eventAttrIds.push_back(std::set<uint64_t>(ids, ids + idCount));
+
+    for (uint32_t i = 0; i < idCount; i++)
+        m_eventAttrIndex[ids[i]] = (uint32_t)(m_eventAttr.size() - 1);
+
+    // attribute kinds are determined again, when needed
+    m_schedSwitchAttrs.clear();
+    m_counterKinds.clear();
+
+    return true;
+}
+
+bool PerfFile::GetIdPositions(const perf_event_attr &attr, uint32_t &samplePos, uint32_t &trailerPos)
+{
+    samplePos = 0;
+    trailerPos = 0;
+
+    // identifier is always the first word of sample and the last one of other events
+    if (attr.sample_type & PERF_SAMPLE_IDENTIFIER)
+        return true;
+
+    if (!(attr.sample_type & PERF_SAMPLE_ID))
+        return false;
+
+    // ID follows IP, TID, TIME and ADDR in samples, and precedes STREAM_ID and CPU in trailer of other events
+    const uint64_t sampleBefore[] = { PERF_SAMPLE_IP, PERF_SAMPLE_TID, PERF_SAMPLE_TIME, PERF_SAMPLE_ADDR };
+    for (uint64_t flag : sampleBefore)
     {
-        ncnt = ResolveSymbolsUsingFD(readfd);
-        LogFunc(LOG_VERBOSE, "Loaded %i symbols", ncnt);
-        cnt += ncnt;
-        close(readfd);
+        if (attr.sample_type & flag)
+            samplePos++;
     }
-    else
-        LogFunc(LOG_ERROR, "Could not execute nm binary for symbol resolving, no symbols loaded");
-
-    LogFunc(LOG_VERBOSE, "Loading kernel debug symbols...");
 
-    // retrieve kernel symbols
-    FILE* kallsymfile = fopen("/proc/kallsyms", "r");
-    if (kallsymfile)
+    const uint64_t trailerAfter[] = { PERF_SAMPLE_STREAM_ID, PERF_SAMPLE_CPU };
+    for (uint64_t flag : trailerAfter)
     {
-        readfd = fileno(kallsymfile);
-        ncnt = ResolveSymbolsUsingFD(readfd, 0, FET_KERNEL);
-        LogFunc(LOG_VERBOSE, "Loaded %i symbols", ncnt);
-        cnt += ncnt;
-        fclose(kallsymfile);
+        if (attr.sample_type & flag)
+            trailerPos++;
     }
-    else
-        LogFunc(LOG_ERROR, "Could not load kernel symbols from /proc/kallsyms");
 
-    LogFunc(LOG_VERBOSE, "Loading debug symbols from dynamically linked libraries...");
+    return true;
+}
 
-    bool isOriginalBinary;
-    std::string libpath;
-    FunctionEntry* fet;
-    // go through all mmap'd records (via mmap2) and try to load debug libraries connected with them
-    for (record_mmap2* itr : m_mmaps2)
-    {
-        // if it's already mapped, let it go - may be duplicate
-        if (IsWithinMemoryMapping(itr->start))
-            continue;
+bool PerfFile::HasSameLayout(const perf_event_attr &a, const perf_event_attr &b)
+{
+    if (a.sample_type != b.sample_type)
+        return false;
 
-        // sort to have relevant info every turn
-        std::stable_sort(m_symbolTable.begin(), m_symbolTable.end(), FunctionEntrySortPredicate());
+    if ((a.sample_type & PERF_SAMPLE_BRANCH_STACK) && a.branch_sample_type != b.branch_sample_type)
+        return false;
 
-        const uint64_t memstart = itr->start - itr->pgoff;
+    if ((a.sample_type & PERF_SAMPLE_READ) && a.read_format != b.read_format)
+        return false;
 
-        // if there are some symbols inside this memory region, it's possible that it has been
-        // mapped previously, just find some symbol and if it falls into mapped region,
-        // mark this region as already mapped
-        fet = GetSymbolByAddress(memstart + itr->len - 1, nullptr);
-        if (fet && fet->address >= itr->start && fet->address < itr->start+itr->len)
+    return true;
+}
+
+int32_t PerfFile::FindRecordAttribute(const perf_event &evt) const
+{
+    if (m_eventAttr.empty())
+        return -1;
+
+    // the same layout of all events means any attribute will do for parsing
+    if (m_uniformLayout)
+        return 0;
+
+    const uint64_t* array = &evt.sample->array;
+    const uint32_t words = (evt.header.size - sizeof(perf_event_header)) / sizeof(uint64_t);
+
+    if (evt.header.type == PERF_RECORD_SAMPLE)
+        return (m_sampleIdPosition < words) ? FindEventAttribute(array[m_sampleIdPosition]) : -1;
+
+    // other records are needed regardless of their trailer, which just won't be read right without known ID
+    int32_t attr = (m_trailerIdPosition < words) ? FindEventAttribute(array[words - 1 - m_trailerIdPosition]) : -1;
+
+    return (attr >= 0) ? attr : 0;
+}
+
+int32_t PerfFile::FindEventAttribute(uint64_t id) const
+{
+    // with single attribute, the samples do not even need to carry ID
+    if (m_eventAttr.size() == 1)
+        return 0;
+
+    auto itr = m_eventAttrIndex.find(id);
+    if (itr == m_eventAttrIndex.end())
+        return -1;
+
+    return (int32_t)itr->second;
+}
+
+bool PerfFile::IsSchedSwitchAttribute(uint32_t index)
+{
+    if (m_schedSwitchAttrs.size() != m_eventAttr.size())
+    {
+        m_schedSwitchAttrs.assign(m_eventAttr.size(), false);
+
+        // tracepoint ID of this system, for recordings without event names
+        uint64_t localId = (uint64_t)(-1);
+        const char* idFiles[] = { "/sys/kernel/tracing/events/sched/sched_switch/id", "/sys/kernel/debug/tracing/events/sched/sched_switch/id" };
+        for (const char* idFile : idFiles)
         {
-            AddMemoryMapping(itr->start, itr->len);
-            // do not resolve any further, collisions possible
-            continue;
-        }
+            FILE* f = fopen(idFile, "r");
+            if (!f)
+                continue;
 
-        // TODO: find more portable way to look for debug library path
-        // by default, Debian-based systems stores such libs in /usr/lib/debug
-        libpath = "/usr/lib/debug";
-        libpath += itr->filename;
+            unsigned long long id;
+            if (fscanf(f, "%llu", &id) == 1)
+                localId = (uint64_t)id;
+            fclose(f);
+            break;
+        }
 
-        bool useDynamic = false;
-        FILE* tst = fopen(libpath.c_str(), "r");
-        if (!tst)
+        for (size_t i = 0; i < m_eventAttr.size(); i++)
         {
-            tst = fopen(itr->filename, "r");
-            if (!tst)
+            if (m_eventAttr[i].attr.type != PERF_TYPE_TRACEPOINT)
                 continue;
 
-            useDynamic = true;
-            libpath = itr->filename;
+            if (m_eventAttr[i].name[0] != '\0')
+                m_schedSwitchAttrs[i] = (strncmp(m_eventAttr[i].name, "sched:sched_switch", sizeof(m_eventAttr[i].name)) == 0);
+            else
+                m_schedSwitchAttrs[i] = (m_eventAttr[i].attr.config == localId);
         }
+    }
 
-        fclose(tst);
+    return (index < m_schedSwitchAttrs.size() && m_schedSwitchAttrs[index]);
+}
 
-        // try to stat the file - if the i-nodes are equal with original binary, act like we're loading symbols from original binary
-        // this is important when considering directly mmapped binaries, which are not aligned in compile-time
-        stat(libpath.c_str(), &tmpStat);
+bool PerfFile::ReadTypes()
+{
+    LogFunc(LOG_VERBOSE, "Reading perf file event types");
 
-        isOriginalBinary = (binStat.st_ino == tmpStat.st_ino);
-        if (isOriginalBinary)
-            useDynamic = false;
+    LogFunc(LOG_DEBUG, "Event types section size: %llu", m_fileHeader.event_types.size);
 
-        LogFunc(LOG_VERBOSE, "Loading debug symbols from %s...", libpath.c_str());
+    // when no event_types section specified, it's still valid
+    if (m_fileHeader.event_types.offset == 0 && m_fileHeader.event_types.size == 0)
+        return true;
+
+    // seek to event types
+
+    if ((m_fileHeader.event_types.size % sizeof(perf_trace_event_type)) != 0)
+    {
+        LogFunc(LOG_ERROR, "Supplied perf file does not have expected trace event type section length according to perf_trace_event_type size");
+        return false;
+    }
+
+    // count of trace blocks
+    uint32_t traceInfoCount = (uint32_t)(m_fileHeader.event_types.size / sizeof(perf_trace_event_type));
+    m_traceInfo.resize(traceInfoCount);
+
+    // seek there
+    fseek(m_file, (long)m_fileHeader.event_types.offset, SEEK_SET);
+
+    bool found;
 
-        // substitute binary parameter in "nm" command line
+    // read all trace blocks, one by one
+    for (uint32_t i = 0; i < traceInfoCount; i++)
+    {
+        fread(&m_traceInfo[i], sizeof(perf_trace_event_type), 1, m_file);
+
+        found = false;
 
-        if (useDynamic)
+        // try to match trace event type to event attribute
+        for (size_t j = 0; j < m_eventAttr.size(); j++)
         {
-            argv_dyn[3] = libpath.c_str();
-            readfd = ForkProcessForReading(argv_dyn);
+            if (m_eventAttr[j].attr.config == m_traceInfo[i].event_id)
+            {
+                memcpy(m_eventAttr[j].name, m_traceInfo[i].name, sizeof(m_eventAttr[j].name));
+                found = true;
+                break;
+            }
         }
-        else
+
+        // the link is mandatory
+        if (!found)
         {
-            argv[2] = libpath.c_str();
-            readfd = ForkProcessForReading(argv);
+            LogFunc(LOG_ERROR, "Couldn't find matching event attribute structure to trace info");
+            return false;
         }
+    }
+
+    return true;
+}
+
+void PerfFile::ReadEventDescriptions()
+{
+    // feature sections follow data section in order of feature bits
+    if (!(m_fileHeader.bits[HEADER_EVENT_DESC / 8] & (1 << (HEADER_EVENT_DESC % 8))))
+        return;
+
+    uint32_t featureIndex = 0;
+    for (uint32_t bit = 0; bit < HEADER_EVENT_DESC; bit++)
+    {
+        if (m_fileHeader.bits[bit / 8] & (1 << (bit % 8)))
+            featureIndex++;
+    }
+
+    perf_file_section section;
+    fseek(m_file, (long)(m_fileHeader.data.offset + m_fileHeader.data.size + featureIndex * sizeof(perf_file_section)), SEEK_SET);
+    if (fread(&section, sizeof(section), 1, m_file) != 1)
+        return;
 
-        if (readfd > 0)
+    fseek(m_file, (long)section.offset, SEEK_SET);
+
+    uint32_t eventCount, attrSize;
+    if (fread(&eventCount, sizeof(eventCount), 1, m_file) != 1 || fread(&attrSize, sizeof(attrSize), 1, m_file) != 1)
+        return;
+
+    uint32_t idCount, nameLength;
+    uint64_t id;
+    char name[MAX_PERF_EVENT_NAME];
+    int32_t index;
+
+    // every event: attribute, count of IDs, name (length-prefixed), IDs
+    for (uint32_t i = 0; i < eventCount; i++)
+    {
+        if (fseek(m_file, (long)attrSize, SEEK_CUR) != 0
+            || fread(&idCount, sizeof(idCount), 1, m_file) != 1
+            || fread(&nameLength, sizeof(nameLength), 1, m_file) != 1
+            || nameLength > section.size)
+            return;
+
+        memset(name, 0, sizeof(name));
+        if (fread(name, 1, std::min((size_t)nameLength, sizeof(name) - 1), m_file) != std::min((size_t)nameLength, sizeof(name) - 1))
+            return;
+        if (nameLength > sizeof(name) - 1)
+            fseek(m_file, (long)(nameLength - (sizeof(name) - 1)), SEEK_CUR);
+
+        // events without IDs are listed in the same order as attributes
+        index = (i < m_eventAttr.size()) ? (int32_t)i : -1;
+        for (uint32_t j = 0; j < idCount; j++)
         {
-            // the base address is mandatory here, since the memory is mmap'd to
-            // another offset in virtual address space, thus all symbols are
-            // moved by this offset
-            ncnt = ResolveSymbolsUsingFD(readfd, memstart, isOriginalBinary ? FET_DONTCARE : FET_MISC);
-            LogFunc(LOG_VERBOSE, "Loaded %i symbols", ncnt);
-            cnt += ncnt;
-            close(readfd);
+            if (fread(&id, sizeof(id), 1, m_file) != 1)
+                return;
 
-            // add to successfully mapped memory region vector
-            AddMemoryMapping(itr->start, itr->len);
+            if (j == 0 && m_eventAttrIndex.find(id) != m_eventAttrIndex.end())
+                index = (int32_t)m_eventAttrIndex[id];
         }
-    }
 
-    // sort function entries to allow effective search
-    std::sort(m_symbolTable.begin(), m_symbolTable.end(), FunctionEntrySortPredicate());
+        if (index >= 0)
+            memcpy(m_eventAttr[index].name, name, sizeof(m_eventAttr[index].name));
+    }
 
-    LogFunc(LOG_VERBOSE, "Loaded %i symbols from available sources", cnt);
+    m_schedSwitchAttrs.clear();
 }
 
-int PerfFile::ResolveSymbolsUsingFD(int fd, uint64_t baseAddress, FunctionEntryType overrideType)
+bool PerfFile::ReadData()
 {
-    // buffer for reading lines from nm stdout
-    char buffer[256];
+    LogFunc(LOG_VERBOSE, "Reading records from perf file");
 
-    // Read from child’s stdout
-    int res, pos, cnt;
-    char c;
-    uint64_t laddr, addrStart;
-    char* endptr;
-    char fncType;
+    LogFunc(LOG_DEBUG, "Data section size: %llu", m_fileHeader.data.size);
+
+    if (m_fileHeader.data.offset == 0 && m_fileHeader.data.size == 0)
+    {
+        LogFunc(LOG_ERROR, "Specified perf file does not contain any profiling data");
+        return false;
+    }
 
-    cnt = 0;
+    // Following lines are commented out since this is not necessarily true - we ARE able
+    // to collect sufficient data from information even without these sampling types,
+    // furthermore we will detect the absence of data in analysing phase, since it's not
+    // an error at all - just some data in output will be missing
+    /*
+    uint32_t samplingCriteria = PERF_SAMPLE_TID | PERF_SAMPLE_PERIOD | PERF_SAMPLE_IP;
 
-    // line reading loop - terminated by file end
-    while (true)
+    if ((m_samplingType & samplingCriteria) != samplingCriteria)
     {
-        pos = 0;
-        while ((res = read(fd, &c, sizeof(char))) == 1)
-        {
-            // stop reading line when end of line character is acquired
-            if (c == 10 || c == 13)
-                break;
+        LogFunc(LOG_ERROR, "Not enough information in perf record file to perform analysis");
+        return false;
+    }
+    */
 
-            // read only 255 characters, strip the rest
-            if (pos < 255)
-                buffer[pos++] = c;
-        }
+    ReadEvents(m_fileHeader.data.offset, m_fileHeader.data.offset + m_fileHeader.data.size, false);
 
-        // this both means end of file - eighter no character was read, or we reached zero character
-        if (res <= 0 || c == 0)
-            break;
+    LogFunc(LOG_VERBOSE, "Loaded %llu records from perf file", m_eventNumber);
 
-        // properly null-perminate string
-        buffer[pos] = 0;
+    return true;
+}
 
-        // require some minimal length, parsing would fail anyway
-        if (strlen(buffer) < 8)
-            continue;
+uint64_t PerfFile::ReadEvents(uint64_t offset, uint64_t end, bool untilSample)
+{
+    fseek(m_file, (long)offset, SEEK_SET);
+
+    perf_event evt;
+    uint32_t esize;
+    record_t* rec;
+
+    // while there's still something to be read from data section...
+    while ((uint64_t)(offset = ftell(m_file)) < end)
+    {
+        // read header
+        if (fread(&evt.header, sizeof(perf_event_header), 1, m_file) != 1 || evt.header.size < sizeof(perf_event_header))
+        {
+            LogFunc(LOG_ERROR, "Unexpected end of data section, event %llu", m_eventNumber + 1);
+            break;
+        }
 
-        // parse address
-        laddr = strtoull(buffer, &endptr, 16);
-        if (endptr - buffer + 2 > pos)
+        // leave the rest for the caller
+        if (untilSample && evt.header.type == PERF_RECORD_SAMPLE)
             break;
-        // some symbols may not have address
-        if (endptr - buffer < 3)
-            continue;
 
-        // resolve function type
-        fncType = *(endptr+1);
+        m_eventNumber++;
+        CountEvent(evt.header);
 
-        addrStart = baseAddress;
+        // size of data excluding header
+        esize = evt.header.size - sizeof(perf_event_header);
 
-        if (fncType != FET_TEXT && fncType != FET_TEXT_2 && fncType != FET_WEAK && fncType != FET_WEAK_2)
+        // unknown or NYI event types
+        if (!IsDecodedRecordType(evt.header.type))
+        {
+            // just log and seek to next event
+            LogFunc(LOG_DEBUG, "Unknown perf record, type: %u; skipped", evt.header.type);
+            fseek(m_file, esize, SEEK_CUR);
             continue;
+        }
 
-        if (overrideType == FET_DONTCARE)
+        // read data and assign them to event
+        evt._generic = PrepareEventBuffer(esize);
+        if (fread(evt._generic, 1, esize, m_file) != esize)
         {
-            if (fncType == FET_TEXT || fncType == FET_TEXT_2)
-                fncType = FET_TEXT;
-            else
-                fncType = FET_MISC;
+            LogFunc(LOG_ERROR, "Unexpected end of data section, event %llu", m_eventNumber);
+            break;
         }
-        else
-            fncType = overrideType;
 
-        // store "the rest of line" as function name to function table
-        m_symbolTable.push_back({ laddr + baseAddress, 0, endptr+3, NO_CLASS, (FunctionEntryType)fncType });
-        cnt++;
+        rec = DecodeRecord(evt, m_eventNumber - 1);
+        if (rec)
+            StoreRecord(rec);
     }
 
-    return cnt;
+    return offset;
 }
 
-FunctionEntry* PerfFile::GetFunctionByAddress(uint64_t address, uint32_t* functionIndex)
+bool PerfFile::IsDecodedRecordType(uint32_t type)
 {
-    return GetSymbolRecordByAddress(m_functionTable, address, functionIndex);
+    switch (type)
+    {
+        case PERF_RECORD_MMAP:    // mmap record
+        case PERF_RECORD_MMAP2:   // mmap record (second type)
+        case PERF_RECORD_COMM:    // command record
+        case PERF_RECORD_FORK:    // fork record
+        case PERF_RECORD_EXIT:    // exit record
+        case PERF_RECORD_SAMPLE:  // profiling sample record
+        case PERF_RECORD_SWITCH:  // context switch of traced thread
+        case PERF_RECORD_SWITCH_CPU_WIDE:  // context switch on traced CPU
+            return true;
+        default:
+            return false;
+    }
 }
 
-FunctionEntry* PerfFile::GetSymbolByAddress(uint64_t address, uint32_t* functionIndex)
+uint8_t* PerfFile::PrepareEventBuffer(uint32_t size)
 {
-    return GetSymbolRecordByAddress(m_symbolTable, address, functionIndex);
+    // record builders copy whole fixed-size structures (i.e. filename arrays), so the buffer is
+    // never smaller than the largest of them; 64-bit words keep the data aligned
+    size_t words = (std::max((size_t)size, sizeof(mmap2_event)) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    if (m_eventBuffer.size() < words)
+        m_eventBuffer.resize(words);
+
+    return (uint8_t*)m_eventBuffer.data();
 }
 
-FunctionEntry* PerfFile::GetSymbolRecordByAddress(std::vector<FunctionEntry> &source, uint64_t address, uint32_t* functionIndex)
+record_t* PerfFile::DecodeRecord(perf_event &evt, uint64_t eventNumber)
 {
-    if (functionIndex)
-        *functionIndex = 0;
+    perf_sample sample;
+    record_t* rec;
+    uint32_t type = evt.header.type;
+    int32_t attr;
+
+    // every event is parsed using layout of its own attribute
+    attr = FindRecordAttribute(evt);
+    if (attr < 0)
+    {
+        LogFunc(LOG_DEBUG, "Could not determine event of perf record %llu, type: %u; skipped", eventNumber, evt.header.type);
+        return nullptr;
+    }
 
-    if (source.empty())
+    // try to parse sample - extract PID, TID, times, generic stuff, and additionally, when
+    // it's profiling sample record, extract sample-related stuff like callchains, etc.
+    if (m_eventParsers[attr](&evt, &m_eventAttr[attr].attr, true, &sample) != 0)
+    {
+        LogFunc(LOG_DEBUG, "Could not parse perf record %llu, type: %u; skipped", eventNumber, evt.header.type);
         return nullptr;
+    }
 
-    // we assume that m_functionTable is sorted from lower address to higher
-    // so we are able to perform binary search in O(log(n)) complexity
+    // fill record structure according to specific type, and name for logging purposes
+    switch (evt.header.type)
+    {
+        case PERF_RECORD_MMAP:
+            rec = create_mmap_msg(evt.mmap);
+            LogFunc(LOG_DEBUG, "mmap, start: 0x%.16llX, length: %llu, file: %s", ((record_mmap*)rec)->start, ((record_mmap*)rec)->len, ((record_mmap*)rec)->filename);
+            break;
+        case PERF_RECORD_MMAP2:
+            rec = create_mmap2_msg(evt.mmap2);
+            LogFunc(LOG_DEBUG, "mmap2, start: 0x%.16llX, length: %llu, file: %s",
+                ((record_mmap2*)rec)->start, ((record_mmap2*)rec)->len, ((record_mmap2*)rec)->filename);
+            break;
+        case PERF_RECORD_COMM:
+            rec = create_comm_msg(evt.comm);
+            LogFunc(LOG_DEBUG, "comm: %s", ((record_comm*)rec)->comm);
+            break;
+        case PERF_RECORD_FORK:
+            rec = create_fork_msg(evt.fork);
+            LogFunc(LOG_DEBUG, "fork, ppid: %u", ((record_fork*)rec)->ppid);
+            break;
+        case PERF_RECORD_EXIT:
+            rec = create_exit_msg(evt.exitev);
+            LogFunc(LOG_DEBUG, "exit, ppid: %u", ((record_exit*)rec)->pid);
+            break;
+        case PERF_RECORD_SWITCH:
+        case PERF_RECORD_SWITCH_CPU_WIDE:
+            rec = create_switch_msg((evt.header.type == PERF_RECORD_SWITCH_CPU_WIDE) ? evt.switchev : nullptr, &sample, evt.header.misc);
+            LogFunc(LOG_DEBUG, "switch %s, tid: %u", (evt.header.misc & PERF_RECORD_MISC_SWITCH_OUT) ? "out" : "in", rec->tid);
+            break;
+        case PERF_RECORD_SAMPLE:
+            // sched_switch tracepoint samples are context switches with stack, not CPU samples
+            if (m_uniformLayout)
+                attr = FindEventAttribute(sample.id);
+            if (attr >= 0 && IsSchedSwitchAttribute((uint32_t)attr))
+            {
+                rec = create_sched_switch_msg(&sample);
+                type = PERF_RECORD_SWITCH_CPU_WIDE;
 
-    uint64_t ilow, ihigh, imid;
+                if (rec)
+                    StoreCallchain(sample, ((record_switch*)rec)->callchainIndex, ((record_switch*)rec)->callchainCount, ((record_switch*)rec)->kernelFrameCount);
+            }
+            else
+            {
+                rec = create_sample_msg(&sample);
+                StoreCallchain(sample, ((record_sample*)rec)->callchainIndex, ((record_sample*)rec)->callchainCount, ((record_sample*)rec)->kernelFrameCount);
 
-    ilow = 0;
-    ihigh = source.size() - 1;
+                // branch stacks of all samples share one pool instead of being allocated one by one
+                if (sample.branch_nr > 0)
+                {
+                    ((record_sample*)rec)->branchIndex = (uint32_t)m_branchPool.size();
+                    ((record_sample*)rec)->branchCount = (uint32_t)sample.branch_nr;
+                    m_branchPool.insert(m_branchPool.end(), sample.branch_entries, sample.branch_entries + sample.branch_nr);
+                }
 
-    imid = (ilow + ihigh) / 2;
+                if (sample.read_nr > 0)
+                {
+                    ((record_sample*)rec)->readIndex = (uint32_t)m_counterPool.size();
+                    ((record_sample*)rec)->readCount = (uint32_t)sample.read_nr;
+                    m_counterPool.insert(m_counterPool.end(), sample.read_values, sample.read_values + sample.read_nr);
+                }
+            }
+            delete[] sample.read_values;
+            if (!rec)
+            {
+                LogFunc(LOG_DEBUG, "Could not parse sched_switch data of perf record %llu; skipped", eventNumber);
+                return nullptr;
+            }
+            // commented out for sanity reasons (for now)
+            //LogFunc(LOG_DEBUG, "sample, ip: %.16llX, period: %llu", ((record_sample*)rec)->ip, ((record_sample*)rec)->period);
+            break;
+        default:
+            return nullptr;
+    }
 
-    // iterative binary search
-    while (ilow <= ihigh)
+    // store generic record info
+    rec->type = (perf_event_type)type;
+    rec->nr = eventNumber;
+    rec->time = sample.time;
+    rec->cpu = (uint32_t)sample.cpu;
+    rec->id = sample.id;
+
+    return rec;
+}
+
+void PerfFile::StoreCallchain(const perf_sample &sample, uint64_t &index, uint32_t &count, uint32_t &kernelCount)
+{
+    // callchains of all records share one pool; context markers are left out and kernel frames are counted
+    // while copying
+    index = m_callchainPool.size();
+    m_callchainPool.resize(index + sample.callchain_nr);
+    count = perf_callchain__copy(sample.callchain_ips, sample.callchain_nr, m_callchainPool.data() + index, &kernelCount);
+    m_callchainPool.resize(index + count);
+}
+
+void PerfFile::StoreRecord(record_t* rec)
+{
+    // store in object storage
+    m_records.push_back(rec);
+    m_recordMemory += GetRecordSize(rec);
+
+    // mmap2 events are used to resolve symbols later
+    if (rec->type == PERF_RECORD_MMAP2)
+        m_mmaps2.push_back((record_mmap2*)rec);
+
+    // samples with their callchains and branch stacks take most of the memory, so just they are counted to budget
+    if (rec->type == PERF_RECORD_SAMPLE && m_memoryBudget > 0)
     {
-        if (source[imid].address > address)
-            ihigh = imid - 1;
-        else
-            ilow = imid + 1;
+        const record_sample* sample = (const record_sample*)rec;
 
-        imid = (ilow + ihigh) / 2;
-    }
+        m_sampleMemory += sizeof(record_sample) + sizeof(record_t*) + sample->callchainCount * sizeof(uint64_t)
+            + sample->branchCount * sizeof(branch_entry) + sample->readCount * sizeof(read_value);
 
-    // the outcome may be one step higher (depending from which side we arrived), than we would like to have - we are looking for
-    // "highest lower address", i.e. for addresses 2, 5, 10, and input address 7, we return entry with address 5
+        if (m_sampleMemory > m_memoryBudget)
+            SpillSamples();
+    }
+}
 
-    if (ilow < source.size() && source[ilow].address <= address)
+void PerfFile::ReleaseRecord(record_t* rec)
+{
+    // records are allocated as their specific structures
+    switch (rec->type)
     {
-        if (functionIndex)
-            *functionIndex = ilow;
-        return &source[ilow];
+        case PERF_RECORD_MMAP:
+            delete (record_mmap*)rec;
+            break;
+        case PERF_RECORD_MMAP2:
+            delete (record_mmap2*)rec;
+            break;
+        case PERF_RECORD_COMM:
+            delete (record_comm*)rec;
+            break;
+        case PERF_RECORD_FORK:
+            delete (record_fork*)rec;
+            break;
+        case PERF_RECORD_EXIT:
+            delete (record_exit*)rec;
+            break;
+        case PERF_RECORD_SAMPLE:
+            delete (record_sample*)rec;
+            break;
+        case PERF_RECORD_SWITCH:
+        case PERF_RECORD_SWITCH_CPU_WIDE:
+            delete (record_switch*)rec;
+            break;
+        default:
+            break;
     }
+}
 
-    if (functionIndex)
-        *functionIndex = ilow - 1;
+void PerfFile::FillFunctionTable(std::vector<FunctionEntry> &dst)
+{
+    LogFunc(LOG_VERBOSE, "Passing function table from input module to core");
 
-    return &source[ilow - 1];
-}
-
-bool PerfFile::ReadAndCheckHeader()
-{
-    // read header
-    if (fread(&m_fileHeader, sizeof(perf_file_header), 1, m_file) != 1)
-    {
-        LogFunc(LOG_ERROR, "Couldn't read perf file header from supplied file");
-        return false;
-    }
+    dst.assign(m_functionTable.begin(), m_functionTable.end());
+}
+
+void PerfFile::FillFlatProfileTable(std::vector<FlatProfileRecord> &dst)
+{
+    LogFunc(LOG_VERBOSE, "Passing flat profile table from input module to core");
+
+    PrepareFlatProfile();
+
+    dst.assign(m_flatProfile.begin(), m_flatProfile.end());
+}
+
+void PerfFile::FillCallGraphMap(CallGraphMap &dst)
+{
+    LogFunc(LOG_VERBOSE, "Passing call graph from input module to core");
 
-    // verify magic
-    for (int i = 0; i < PERF_FILE_MAGIC_LENGTH; i++)
-    {
-        if (m_fileHeader.magic[i] != perfFileMagic[i])
-        {
-            LogFunc(LOG_ERROR, "Supplied file is not perf record file");
-            return false;
-        }
-    }
+    PrepareCallGraph();
 
-    return true;
+    // copying whole map at once clones the trees without any lookups
+    dst = m_callGraph;
 }
 
-bool PerfFile::ReadAttributes()
+void PerfFile::TakeFlatProfileTable(std::vector<FlatProfileRecord> &dst)
 {
-    LogFunc(LOG_VERBOSE, "Reading perf file attributes");
+    LogFunc(LOG_VERBOSE, "Moving flat profile table from input module to core");
 
-    LogFunc(LOG_DEBUG, "Attributes section size: %llu", m_fileHeader.attrs.size);
+    PrepareFlatProfile();
 
-    if (m_fileHeader.attrs.offset == 0 && m_fileHeader.attrs.size == 0)
-    {
-        // TODO: check if this is true (that it's not valid without attributes) and if this may happen at all
+    dst.swap(m_flatProfile);
+    std::vector<FlatProfileRecord>().swap(m_flatProfile);
+    m_flatProfileStale = true;
+}
 
-        return false;
-    }
+void PerfFile::TakeCallGraphMap(CallGraphMap &dst)
+{
+    LogFunc(LOG_VERBOSE, "Moving call graph from input module to core");
 
-    // verify attribute struct length
-    if (m_fileHeader.attr_size != sizeof(perf_file_attr))
-    {
-        LogFunc(LOG_ERROR, "Supplied perf file does not have expected attribute section length! (expected: %u, actual: %u)", sizeof(perf_file_attr), m_fileHeader.attr_size);
-        // for now, allow different sizes, we need just small portion of it all
-        //return false;
-    }
+    PrepareCallGraph();
 
-    // seek to attrs section
-    fseek(m_file, (long)m_fileHeader.attrs.offset, SEEK_SET);
+    dst.swap(m_callGraph);
+    m_callGraph.clear();
+    m_callGraphStale = true;
+}
 
-    uint8_t* tmpMem;
-    perf_file_attr f_attr;
+void PerfFile::FillFlatProfileTable(std::vector<FlatProfileRecord> &dst, const PerfSampleFilter &filter)
+{
+    StackWeightVector stacks;
 
-    // verify attributes size - it has to be divisible to attr structs
-    if ((m_fileHeader.attrs.size % sizeof(perf_file_attr)) != 0)
-    {
-        LogFunc(LOG_ERROR, "Supplied perf file does not have expected attribute section length according to perf_file_attr size!");
-        // for now, allow different sizes, we need just small portion of it all
-        //return false;
-    }
+    LogFunc(LOG_VERBOSE, "Passing filtered flat profile table from input module to core");
 
-    size_t allocSize = nmax(sizeof(perf_file_attr), m_fileHeader.attr_size);
-    size_t scaleSize = nmin(sizeof(perf_file_attr), m_fileHeader.attr_size);
+    CollectStackWeights(filter, stacks);
+    AggregateFlatProfile(stacks, dst);
+}
 
-    uint32_t eventAttrCount = (uint32_t)(m_fileHeader.attrs.size / scaleSize);
-    m_eventAttr.resize(eventAttrCount);
-    m_eventAttrIds.resize(eventAttrCount);
+void PerfFile::FillCallGraphMap(CallGraphMap &dst, const PerfSampleFilter &filter)
+{
+    StackWeightVector stacks;
 
-    tmpMem = new uint8_t[allocSize];
+    LogFunc(LOG_VERBOSE, "Passing filtered call graph from input module to core");
 
-    long cur = (long)m_fileHeader.attrs.offset;
-    // go through all attributes linked by header
-    for (uint32_t i = 0; i < eventAttrCount; i++)
-    {
-        // read attribute (has to fit the structure)
-        if (fread(tmpMem, allocSize, 1, m_file) != 1)
-        {
-            LogFunc(LOG_ERROR, "Unexpected end of file while reading file attributes section");
-            delete tmpMem;
-            return false;
-        }
+    CollectStackWeights(filter, stacks);
+    AggregateCallGraph(stacks, dst);
+}
 
-        // copy memory to attribute struct
-        f_attr = *((perf_file_attr*)tmpMem);
+void PerfFile::FillCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter)
+{
+    StackWeightVector stacks;
 
-        // store to vector
-        m_eventAttr[i].attr = f_attr.attr;
+    LogFunc(LOG_VERBOSE, "Passing filtered call tree from input module to core");
 
-        // this also may not be completely true to require such thing, but it appears
-        // to be fine for this case, when we need just regular profiling (for now)
-        if (!f_attr.attr.sample_id_all)
-        {
-            LogFunc(LOG_ERROR, "We need sample_id_all for further parsing!");
-            delete tmpMem;
-            return false;
-        }
+    // the tree is built just for the caller, it takes ownership of all nodes
+    CollectStackWeights(filter, stacks);
+    AggregateCallTree(stacks, &dst);
+}
 
-        // at first pass, store sampling type; the sampling type has to remain the same
-        if (i == 0)
-            m_samplingType = f_attr.attr.sample_type;
-        else if (m_samplingType != f_attr.attr.sample_type)
-        {
-            LogFunc(LOG_ERROR, "Sampling type changed during recording, cannot continue");
-            delete tmpMem;
-            return false;
-        }
+void PerfFile::FillInvertedCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter)
+{
+    StackWeightVector stacks;
 
-        uint64_t f_id;
-        uint32_t idcount = (uint32_t)(f_attr.ids.size / sizeof(f_id));
-        m_eventAttrIds[i].clear();
+    LogFunc(LOG_VERBOSE, "Passing filtered inverted call tree from input module to core");
 
-        // go through all assigned IDs and read them
-        if (idcount > 0 && f_attr.ids.size != (uint32_t)(-1))
-        {
-            cur = ftell(m_file);
-            fseek(m_file, (long)f_attr.ids.offset, SEEK_SET);
+    CollectStackWeights(filter, stacks);
+    AggregateCallTree(stacks, nullptr, &dst);
+}
 
-            for (uint32_t j = 0; j < idcount; j++)
-            {
-                fread(&f_id, sizeof(f_id), 1, m_file);
-                // link sample with attribute section
-                m_eventAttrIds[i].insert(f_id);
-            }
+bool PerfFile::FillButterfly(uint32_t functionId, PerfButterflyEntry &dst, const PerfSampleFilter &filter)
+{
+    StackWeightVector stacks;
+    ButterflyIndex butterfly;
 
-            // seek back where we came from
-            fseek(m_file, cur, SEEK_SET);
-        }
-    }
+    CollectStackWeights(filter, stacks);
+    AggregateCallTree(stacks, nullptr, nullptr, &butterfly);
 
-    delete tmpMem;
+    const PerfButterflyEntry* entry = butterfly.Get(functionId);
+    if (!entry)
+        return false;
 
+    dst = *entry;
     return true;
 }
 
-bool PerfFile::ReadTypes()
+void PerfFile::FillHeatMapData(TimeHistogramVector &dst, uint32_t binWidthMs, const PerfSampleFilter &filter)
 {
-    LogFunc(LOG_VERBOSE, "Reading perf file event types");
+    std::vector<uint32_t> indices;
+    HeatMapPyramid filtered;
 
-    LogFunc(LOG_DEBUG, "Event types section size: %llu", m_fileHeader.event_types.size);
+    LogFunc(LOG_VERBOSE, "Passing filtered heat map data from input module to core");
 
-    // when no event_types section specified, it's still valid
-    if (m_fileHeader.event_types.offset == 0 && m_fileHeader.event_types.size == 0)
-        return true;
+    // filtered heat map is built directly in requested resolution, just from selected samples
+    SelectSamples(filter, indices);
 
-    // seek to event types
+    filtered.Reset(binWidthMs);
+    BuildHeatMapBins(&indices, filtered.GetBaseBinWidth(), filtered.GetBaseBins());
+    filtered.Fill(dst, filtered.GetBaseBinWidth(), m_weighting);
+}
 
-    if ((m_fileHeader.event_types.size % sizeof(perf_trace_event_type)) != 0)
+void PerfFile::FillProcessList(std::vector<PerfProcessInfo> &dst)
+{
+    std::map<uint32_t, uint32_t> threadCounts;
+
+    dst.clear();
+
+    for (auto &itr : m_threadPids)
+        threadCounts[itr.second]++;
+
+    for (auto &itr : m_pidIndex)
     {
-        LogFunc(LOG_ERROR, "Supplied perf file does not have expected trace event type section length according to perf_trace_event_type size");
-        return false;
-    }
+        PerfProcessInfo info;
+        info.pid = itr.first;
+        info.sampleCount = itr.second.size();
+        info.threadCount = threadCounts[itr.first];
 
-    // count of trace blocks
-    uint32_t traceInfoCount = (uint32_t)(m_fileHeader.event_types.size / sizeof(perf_trace_event_type));
-    m_traceInfo.resize(traceInfoCount);
+        // process name is the name of its main thread
+        auto comm = m_threadComms.find(itr.first);
+        if (comm != m_threadComms.end())
+            info.comm = comm->second;
 
-    // seek there
-    fseek(m_file, (long)m_fileHeader.event_types.offset, SEEK_SET);
+        dst.push_back(info);
+    }
+}
 
-    bool found;
+void PerfFile::FillThreadList(std::vector<PerfThreadInfo> &dst)
+{
+    dst.clear();
 
-    // read all trace blocks, one by one
-    for (uint32_t i = 0; i < traceInfoCount; i++)
+    for (auto &itr : m_tidIndex)
     {
-        fread(&m_traceInfo[i], sizeof(perf_trace_event_type), 1, m_file);
+        PerfThreadInfo info;
+        info.tid = itr.first;
+        info.pid = m_threadPids[itr.first];
+        info.sampleCount = itr.second.size();
 
-        found = false;
+        auto comm = m_threadComms.find(itr.first);
+        if (comm != m_threadComms.end())
+            info.comm = comm->second;
 
-        // try to match trace event type to event attribute
-        for (size_t j = 0; j < m_eventAttr.size(); j++)
+        dst.push_back(info);
+    }
+}
+
+void PerfFile::FillEventList(std::vector<PerfEventInfo> &dst)
+{
+    // names of generic events, as perf tool names them
+    static const char* hardwareNames[] = { "cycles", "instructions", "cache-references", "cache-misses", "branches",
+        "branch-misses", "bus-cycles", "stalled-cycles-frontend", "stalled-cycles-backend", "ref-cycles" };
+    static const char* softwareNames[] = { "cpu-clock", "task-clock", "page-faults", "context-switches", "cpu-migrations",
+        "minor-faults", "major-faults", "alignment-faults", "emulation-faults", "dummy", "bpf-output", "cgroup-switches" };
+
+    char name[64];
+
+    dst.clear();
+
+    for (size_t i = 0; i < m_eventAttr.size(); i++)
+    {
+        const perf_event_attr &attr = m_eventAttr[i].attr;
+
+        PerfEventInfo info;
+        info.index = (uint32_t)i;
+        info.type = attr.type;
+        info.config = attr.config;
+
+        // name from event descriptions, if the recording has them
+        if (m_eventAttr[i].name[0] != '\0')
+            info.name = std::string(m_eventAttr[i].name, strnlen(m_eventAttr[i].name, sizeof(m_eventAttr[i].name)));
+        else if (attr.type == PERF_TYPE_HARDWARE && attr.config < sizeof(hardwareNames) / sizeof(hardwareNames[0]))
+            info.name = hardwareNames[attr.config];
+        else if (attr.type == PERF_TYPE_SOFTWARE && attr.config < sizeof(softwareNames) / sizeof(softwareNames[0]))
+            info.name = softwareNames[attr.config];
+        else
         {
-            if (m_eventAttr[j].attr.config == m_traceInfo[i].event_id)
-            {
-                memcpy(m_eventAttr[j].name, m_traceInfo[i].name, sizeof(m_eventAttr[j].name));
-                found = true;
-                break;
-            }
+            snprintf(name, sizeof(name), "%u:0x%llx", attr.type, (unsigned long long)attr.config);
+            info.name = name;
         }
 
-        // the link is mandatory
-        if (!found)
+        if (m_sampleEvents.empty())
+            info.sampleCount = (i == 0) ? m_samples.size() : 0;
+        else
         {
-            LogFunc(LOG_ERROR, "Couldn't find matching event attribute structure to trace info");
-            return false;
+            auto itr = m_eventIndex.find((uint32_t)i);
+            info.sampleCount = (itr != m_eventIndex.end()) ? itr->second.size() : 0;
         }
-    }
 
-    return true;
+        dst.push_back(info);
+    }
 }
 
-bool PerfFile::ReadData()
+void PerfFile::FillFunctionWeights(std::vector<PerfFunctionWeights> &dst, const PerfSampleFilter &filter)
 {
-    LogFunc(LOG_VERBOSE, "Reading records from perf file");
+    StackWeightVector stacks;
+    const uint32_t* frames;
+    uint32_t count;
 
-    LogFunc(LOG_DEBUG, "Data section size: %llu", m_fileHeader.data.size);
+    CollectStackWeights(filter, stacks);
 
-    if (m_fileHeader.data.offset == 0 && m_fileHeader.data.size == 0)
+    dst.resize(m_functionTable.size());
+    for (size_t i = 0; i < dst.size(); i++)
     {
-        LogFunc(LOG_ERROR, "Specified perf file does not contain any profiling data");
-        return false;
+        dst[i].functionId = (uint32_t)i;
+        dst[i].selfSamples = 0;
+        dst[i].inclusiveSamples = 0;
+        dst[i].selfPeriod = 0;
+        dst[i].inclusivePeriod = 0;
     }
 
-    // Following lines are commented out since this is not necessarily true - we ARE able
-    // to collect sufficient data from information even without these sampling types,
-    // furthermore we will detect the absence of data in analysing phase, since it's not
-    // an error at all - just some data in output will be missing
-    /*
-    uint32_t samplingCriteria = PERF_SAMPLE_TID | PERF_SAMPLE_PERIOD | PERF_SAMPLE_IP;
+    // recursive functions count just once per stack, as in flat profile
+    std::vector<uint32_t> counted(m_functionTable.size(), 0);
+    uint32_t stamp = 0;
 
-    if ((m_samplingType & samplingCriteria) != samplingCriteria)
+    // the same samples as in flat profile are considered
+    for (const StackWeight &sw : stacks)
     {
-        LogFunc(LOG_ERROR, "Not enough information in perf record file to perform analysis");
-        return false;
-    }
-    */
+        frames = m_stacks.GetFrames(sw.stackId, count);
+        stamp++;
 
-    fseek(m_file, m_fileHeader.data.offset, SEEK_SET);
-
-    perf_event evt;
-    uint8_t* loaded_data = nullptr;
-    perf_sample sample;
-    uint64_t event_number = 0;
-    uint32_t esize, prevsize = 0;
-    record_t* rec;
+        if (!SelectStackFrames(frames, count))
+            continue;
 
-    // while there's still something to be read from data section...
-    while (ftell(m_file) < m_fileHeader.data.offset + m_fileHeader.data.size)
-    {
-        event_number++;
+        dst[frames[0]].selfSamples += sw.samples;
+        dst[frames[0]].selfPeriod += sw.period;
 
-        // read header
-        fread(&evt.header, sizeof(perf_event_header), 1, m_file);
-        switch (evt.header.type)
+        for (uint32_t i = 1; i < count; i++)
         {
-            case PERF_RECORD_MMAP:    // mmap record
-            case PERF_RECORD_MMAP2:   // mmap record (second type)
-            case PERF_RECORD_COMM:    // command record
-            case PERF_RECORD_FORK:    // fork record
-            case PERF_RECORD_EXIT:    // exit record
-            case PERF_RECORD_SAMPLE:  // profiling sample record
-            {
-                // size of data excluding header
-                esize = evt.header.size - sizeof(perf_event_header);
+            if (counted[frames[i]] == stamp)
+                continue;
 
-                // if there's need for reallocating the temp space, delete old space
-                if (esize > prevsize)
-                {
-                    // deallocate old memory
-                    if (loaded_data != nullptr)
-                        delete loaded_data;
-                    loaded_data = nullptr;
-                }
+            counted[frames[i]] = stamp;
+            dst[frames[i]].inclusiveSamples += sw.samples;
+            dst[frames[i]].inclusivePeriod += sw.period;
+        }
+    }
+}
 
-                // reallocate space if needed
-                if (loaded_data == nullptr)
-                    loaded_data = new uint8_t[esize];
+void PerfFile::FillCallTreeMap(CallTreeMap &dst)
+{
+    LogFunc(LOG_VERBOSE, "Passing call tree from input module to core");
 
-                // read data
-                fread(loaded_data, 1, esize, m_file);
+    PrepareCallTree();
 
-                // assign data to event
-                evt._generic = loaded_data;
+    // copy just addressess - it will remain the same, do not copy memory contents
+    for (CallTreeMap::iterator itr = m_callTree.begin(); itr != m_callTree.end(); ++itr)
+        dst[itr->first] = itr->second;
+}
 
-                // try to parse sample - extract PID, TID, times, generic stuff, and additionally, when
-                // it's profiling sample record, extract sample-related stuff like callchains, etc.
-                perf_event__parse_sample(&evt, m_samplingType, true, &sample);
+void PerfFile::FillInvertedCallTreeMap(CallTreeMap &dst)
+{
+    LogFunc(LOG_VERBOSE, "Passing inverted call tree from input module to core");
 
-                // fill record structure according to specific type, and name for logging purposes
-                switch (evt.header.type)
-                {
-                    case PERF_RECORD_MMAP:
-                        rec = create_mmap_msg(evt.mmap);
-                        LogFunc(LOG_DEBUG, "mmap, start: 0x%.16llX, length: %llu, file: %s", ((record_mmap*)rec)->start, ((record_mmap*)rec)->len, ((record_mmap*)rec)->filename);
-                        break;
-                    case PERF_RECORD_MMAP2:
-                        rec = create_mmap_msg(evt.mmap);
-                        LogFunc(LOG_DEBUG, "mmap2, start: 0x%.16llX, length: %llu, file: %s",
-                            ((record_mmap2*)rec)->start, ((record_mmap2*)rec)->len, ((record_mmap2*)rec)->filename);
-                        m_mmaps2.push_back((record_mmap2*)rec);
-                        break;
-                    case PERF_RECORD_COMM:
-                        rec = create_comm_msg(evt.comm);
-                        LogFunc(LOG_DEBUG, "comm: %s", ((record_comm*)rec)->comm);
-                        break;
-                    case PERF_RECORD_FORK:
-                        rec = create_fork_msg(evt.fork);
-                        LogFunc(LOG_DEBUG, "fork, ppid: %u", ((record_fork*)rec)->ppid);
-                        break;
-                    case PERF_RECORD_EXIT:
-                        rec = create_exit_msg(evt.exitev);
-                        LogFunc(LOG_DEBUG, "exit, ppid: %u", ((record_exit*)rec)->pid);
-                        break;
-                    case PERF_RECORD_SAMPLE:
-                        rec = create_sample_msg(&sample);
-                        // commented out for sanity reasons (for now)
-                        //LogFunc(LOG_DEBUG, "sample, ip: %.16llX, period: %llu", ((record_sample*)rec)->ip, ((record_sample*)rec)->period);
-                        //for (uint32_t ji = 0; ji < sample.callchain->nr; ji++)
-                        //    LogFunc(LOG_DEBUG, "\t%.16llX", sample.callchain->ips[ji]);
-                        break;
-                }
+    PrepareCallTreeViews();
 
-                // store generic record info
-                rec->type = (perf_event_type)evt.header.type;
-                rec->nr = event_number - 1;
-                rec->time = sample.time;
-                rec->cpu = (uint32_t)sample.cpu;
-                rec->id = sample.id;
+    for (CallTreeMap::iterator itr = m_invertedCallTree.begin(); itr != m_invertedCallTree.end(); ++itr)
+        dst[itr->first] = itr->second;
+}
 
-                // store in object storage
-                m_records.push_back(rec);
+bool PerfFile::FillButterfly(uint32_t functionId, PerfButterflyEntry &dst)
+{
+    PrepareCallTreeViews();
 
-                break;
-            }
-            default: // unknown or NYI event types
-            {
-                // just log and seek to next event
-                LogFunc(LOG_DEBUG, "Unknown perf record, type: %u; skipped", evt.header.type);
-                fseek(m_file, ftell(m_file) + evt.header.size - sizeof(perf_event_header), SEEK_SET);
-                continue;
-            }
-        }
-    }
+    const PerfButterflyEntry* entry = m_butterfly.Get(functionId);
+    if (!entry)
+        return false;
 
-    // deallocate temp space
-    if (loaded_data != nullptr)
-        delete loaded_data;
+    dst = *entry;
+    return true;
+}
 
-    LogFunc(LOG_VERBOSE, "Loaded %llu records from perf file", event_number);
+void PerfFile::SetHeatMapBaseBinWidth(uint32_t binWidthMs)
+{
+    if (binWidthMs == 0)
+        binWidthMs = HEATMAP_GROUP_BY_MS_AMOUNT;
 
-    return true;
+    // changing finest resolution means the whole pyramid has to be rebuilt
+    if (binWidthMs != m_heatMapBaseWidth)
+    {
+        m_heatMapBaseWidth = binWidthMs;
+        m_heatMap = HeatMapPyramid();
+    }
 }
 
-void PerfFile::FillFunctionTable(std::vector<FunctionEntry> &dst)
+void PerfFile::GetHeatMapLevelWidths(std::vector<uint32_t> &dst)
 {
-    LogFunc(LOG_VERBOSE, "Passing function table from input module to core");
+    PrepareHeatMap();
 
-    dst.assign(m_functionTable.begin(), m_functionTable.end());
+    m_heatMap.GetLevelWidths(dst);
 }
 
-void PerfFile::FillFlatProfileTable(std::vector<FlatProfileRecord> &dst)
+void PerfFile::PrepareHeatMap()
 {
-    LogFunc(LOG_VERBOSE, "Passing flat profile table from input module to core");
+    if (!m_heatMap.IsBuilt())
+        BuildHeatMap();
+    else if (m_heatMapStale)
+        ExtendHeatMap();
 
-    dst.assign(m_flatProfile.begin(), m_flatProfile.end());
+    m_heatMapStale = false;
 }
 
-void PerfFile::FillCallGraphMap(CallGraphMap &dst)
+void PerfFile::BuildHeatMap()
 {
-    LogFunc(LOG_VERBOSE, "Passing call graph from input module to core");
+    LogFunc(LOG_INFO, "Building heat map (finest bin width: %u ms)...", m_heatMapBaseWidth);
+
+    BeginPhase(PLP_HEAT_MAP);
+    m_heatMap.Reset(m_heatMapBaseWidth);
+
+    BuildHeatMapBins(nullptr, m_heatMapBaseWidth, m_heatMap.GetBaseBins());
 
-    // perform deep copy
-    for (CallGraphMap::iterator itr = m_callGraph.begin(); itr != m_callGraph.end(); ++itr)
-        for (std::map<uint32_t, uint64_t>::iterator sitr = itr->second.begin(); sitr != itr->second.end(); ++sitr)
-            dst[itr->first][sitr->first] = sitr->second;
+    // derive coarser levels just by merging finest bins
+    m_heatMap.BuildLevels();
+    EndPhase();
 }
 
-void PerfFile::FillCallTreeMap(CallTreeMap &dst)
+void PerfFile::ExtendHeatMap()
 {
-    LogFunc(LOG_VERBOSE, "Passing call tree from input module to core");
+    std::vector<HeatMapBin> &bins = m_heatMap.GetBaseBins();
 
-    // copy just addressess - it will remain the same, do not copy memory contents
-    for (CallTreeMap::iterator itr = m_callTree.begin(); itr != m_callTree.end(); ++itr)
-        dst[itr->first] = itr->second;
+    LogFunc(LOG_VERBOSE, "Extending heat map with new samples...");
+
+    // the last bin may have been incomplete, so it's built again along with all the new ones
+    BeginPhase(PLP_HEAT_MAP);
+    BuildHeatMapBins(nullptr, m_heatMapBaseWidth, bins, bins.empty() ? 0 : bins.size() - 1);
+
+    // coarser levels are cheap to merge again
+    m_heatMap.BuildLevels();
+    EndPhase();
 }
 
-void PerfFile::FillHeatMapData(TimeHistogramVector &dst)
+void PerfFile::BuildHeatMapBins(const std::vector<uint32_t>* indices, uint32_t binWidthMs, std::vector<HeatMapBin> &bins, size_t firstBin)
 {
-    LogFunc(LOG_VERBOSE, "Passing heat map data from input module to core");
+    // bins before the first one are kept as they are
+    bins.resize(firstBin);
 
-    // determine time range to properly scale time segment vector
-    uint64_t minTime = (uint64_t)(-1);
-    uint64_t maxTime = 0;
+    // no samples, no heat map
+    if (m_samples.empty())
+        return;
 
-    for (record_t* itr : m_records)
-    {
-        if (itr->type == PERF_RECORD_SAMPLE)
-        {
-            if (itr->time > maxTime)
-                maxTime = itr->time;
-            if (itr->time < minTime)
-                minTime = itr->time;
-        }
-    }
+    // sample table is sorted by time, so the range is given by its boundaries; bins are
+    // always aligned to recording start, even for subset of samples
+    uint64_t minTime = m_samples.front().time;
+    uint64_t maxTime = m_samples.back().time;
 
     // scale down to milliseconds
     uint64_t timeRange = (maxTime - minTime) / SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
 
-    uint64_t binCount = 1 + (timeRange / HEATMAP_GROUP_BY_MS_AMOUNT);
+    uint64_t binCount = 1 + (timeRange / binWidthMs);
 
-    LogFunc(LOG_VERBOSE, "Heat map contains %llu bins", binCount);
+    LogFunc(LOG_VERBOSE, "Heat map level contains %llu bins", binCount);
 
-    dst.resize(binCount);
+    bins.resize(binCount);
 
-    record_sample* sample;
-    FunctionEntry* fet;
+    HeatMapBinAccumulator acc((uint32_t)m_functionTable.size());
+
+    // last sample (index + 1) the function was counted in, so recursive functions add inclusive time just once
+    std::vector<size_t> counted(m_functionTable.size(), 0);
+
+    const uint32_t* frames;
+    uint32_t count;
+
+    const size_t total = indices ? indices->size() : m_samples.size();
 
-    uint32_t findex, childindex;
-    uint64_t binidx;
-    for (record_t* itr : m_records)
+    // samples of kept bins are skipped using time index (when not selected by caller)
+    size_t k = 0;
+    if (firstBin > 0 && !indices)
     {
-        if (itr->type == PERF_RECORD_SAMPLE)
-        {
-            sample = ((record_sample*)itr);
+        const uint64_t firstTime = minTime + (uint64_t)firstBin * binWidthMs * SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+        k = std::lower_bound(m_samples.begin(), m_samples.end(), firstTime, PerfSampleTimeSortPredicate()) - m_samples.begin();
+    }
 
-            fet = GetFunctionByAddress(sample->ip, &findex);
-            // for now, exclude kernel symbols (for sanity reasons)
-            if (fet && fet->functionType != FET_KERNEL)
-            {
-                binidx = ((itr->time - minTime) / SAMPLE_TIMESTAMP_DIMENSION_TO_MS) / HEATMAP_GROUP_BY_MS_AMOUNT;
+    uint64_t binidx, curbin = firstBin;
+    for (; k < total; k++)
+    {
+        const PerfSample &ps = m_samples[indices ? (*indices)[k] : k];
 
-                if (dst[binidx].find(findex) == dst[binidx].end())
-                {
-                    dst[binidx][findex].timeTotal = 0;
-                    dst[binidx][findex].timeTotalInclusive = 0;
-                }
+        if (ps.stackId == INVALID_STACK_ID)
+            continue;
+
+        frames = m_stacks.GetFrames(ps.stackId, count);
 
-                dst[binidx][findex].timeTotal += 1.0;
-                dst[binidx][findex].timeTotalInclusive += 1.0;
+        if (!SelectStackFrames(frames, count))
+            continue;
 
-                // now calculate inclusive time
+        binidx = ((ps.time - minTime) / SAMPLE_TIMESTAMP_DIMENSION_TO_MS) / binWidthMs;
 
-                // 2 is the right value, since IP callchain contains invalid address ("stopper") on top
-                // and self as second record
-                for (uint64_t i = 2; i < sample->callchain->nr; i++)
-                {
-                    fet = GetFunctionByAddress(sample->callchain->ips[i], &childindex);
-                    // also exclude kernel calls for now
-                    if (fet && fet->functionType != FET_KERNEL)
-                    {
-                        if (dst[binidx].find(childindex) == dst[binidx].end())
-                        {
-                            dst[binidx][childindex].timeTotal = 0;
-                            dst[binidx][childindex].timeTotalInclusive = 0;
-                        }
-
-                        dst[binidx][childindex].timeTotalInclusive += 1.0;
-                    }
-                }
+        // samples are sorted by time, so once we leave the bin, it's complete
+        if (binidx != curbin)
+        {
+            acc.Flush(bins[curbin]);
+            curbin = binidx;
+        }
+
+        acc.Add(frames[0], 1, 1, ps.period, ps.period);
+        counted[frames[0]] = k + 1;
+
+        // now calculate inclusive time
+        for (uint32_t i = 1; i < count; i++)
+        {
+            if (counted[frames[i]] != k + 1)
+            {
+                counted[frames[i]] = k + 1;
+                acc.Add(frames[i], 0, 1, 0, ps.period);
             }
         }
     }
+
+    acc.Flush(bins[curbin]);
+}
+
+void PerfFile::FillHeatMapData(TimeHistogramVector &dst, uint32_t binWidthMs)
+{
+    LogFunc(LOG_VERBOSE, "Passing heat map data from input module to core");
+
+    // the finest level is built just once (and extended with live samples), every other resolution is derived from it
+    PrepareHeatMap();
+
+    m_heatMap.Fill(dst, binWidthMs, m_weighting);
 }
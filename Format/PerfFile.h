@@ -28,15 +28,43 @@
 #include "CallGraphStructs.h"
 #include "CallTreeStructs.h"
 #include "HeatMapStructs.h"
+#include "HeatMapPyramid.h"
+#include "StackTable.h"
+#include "ButterflyIndex.h"
+#include "PerfSampleSpill.h"
+#include "PerfQueryStructs.h"
+#include "PerfSnapshot.h"
+#include "PerfSymbolCache.h"
 
 #include <set>
+#include <unordered_map>
+#include <atomic>
 
 // nodes with less than this value of inclusive time percentage will be excluded
 #define CALL_TREE_INCLUSIVE_TIME_THRESHOLD 0.0001
 
 // constant used to convert timestamp to milliseconds (value / SAMPLE_TIMESTAMP_DIMENSION_TO_MS)
 #define SAMPLE_TIMESTAMP_DIMENSION_TO_MS 1000000
-// default heatmap grouping (group samples by X milliseconds)
+// size of data chunk read from live input at once
+#define LIVE_READ_CHUNK_SIZE (1024 * 1024)
+
+// preview chunks are never smaller than this (in bytes)
+#define PREVIEW_MIN_CHUNK_SIZE (64 * 1024)
+// preview is made of at least this count of chunks, so the error can be estimated
+#define PREVIEW_MIN_CHUNK_COUNT 8
+// count of consecutive valid event headers needed to synchronize to event stream in the middle of data section
+#define PREVIEW_RESYNC_CHAIN_LENGTH 4
+// normal distribution quantile of preview confidence interval (95%)
+#define PREVIEW_CONFIDENCE_Z 1.96
+// record not belonging to any preview chunk
+#define PREVIEW_NO_CHUNK ((uint32_t)(-1))
+
+// function ID of addresses, which could not be resolved at all
+#define INVALID_FUNCTION_ID ((uint32_t)(-1))
+// longer ranges between two taken branches are not considered basic blocks (missed branches, interrupts)
+#define BRANCH_MAX_BASIC_BLOCK_LENGTH 4096
+
+// default heatmap grouping (group samples by X milliseconds); also the default finest heat map level
 #define HEATMAP_GROUP_BY_MS_AMOUNT 100
 
 // currently supported perf file version is 2 (magic PERFILE2)
@@ -51,6 +79,84 @@ struct PerfRecordTimeSortPredicate
     }
 };
 
+// orders records by time, records of the same time as they were read
+struct PerfRecordOrderSortPredicate
+{
+    inline bool operator() (const record_t* a, const record_t* b)
+    {
+        if (a->time != b->time)
+            return (a->time < b->time);
+        return (a->nr < b->nr);
+    }
+};
+
+// record with preview chunk it was decoded from
+typedef std::pair<record_t*, uint32_t> PreviewRecord;
+
+// structure used for sorting preview records by time
+struct PreviewRecordTimeSortPredicate
+{
+    inline bool operator() (const PreviewRecord &a, const PreviewRecord &b)
+    {
+        return (a.first->time < b.first->time);
+    }
+};
+
+// sums of per-chunk sample counts (y) of a function, used to estimate its ratio to chunk sample counts (n)
+struct PreviewRatioSums
+{
+    PreviewRatioSums() : y(0.0), yy(0.0), yn(0.0) { };
+
+    double y;
+    double yy;
+    double yn;
+};
+
+// compact sample record with callchain resolved to interned stack
+struct PerfSample
+{
+    uint64_t time;
+    uint32_t pid;
+    uint32_t tid;
+    uint32_t cpu;
+    uint32_t stackId;
+    // events elapsed since previous sample of the same event
+    uint64_t period;
+};
+
+// structure used for binary search in time-sorted sample table
+struct PerfSampleTimeSortPredicate
+{
+    inline bool operator() (const PerfSample &a, uint64_t time) const
+    {
+        return (a.time < time);
+    }
+
+    inline bool operator() (uint64_t time, const PerfSample &b) const
+    {
+        return (time < b.time);
+    }
+};
+
+// stack ID with count and period sum of samples with such stack
+struct StackWeight
+{
+    StackWeight() : stackId(0), samples(0), period(0) { };
+    StackWeight(uint32_t id, uint64_t sampleCount, uint64_t periodSum) : stackId(id), samples(sampleCount), period(periodSum) { };
+
+    uint32_t stackId;
+    uint64_t samples;
+    uint64_t period;
+};
+
+typedef std::vector<StackWeight> StackWeightVector;
+
+// stack ID and period of single sample
+typedef std::pair<uint32_t, uint64_t> StackSample;
+
+// sample indexes (sorted by time) assigned to a key (pid, tid, cpu)
+typedef std::map<uint32_t, std::vector<uint32_t> > SampleIndexMap;
+
 // to have memory regions assigned with filenames even though the files weren't loaded
 struct MemoryRegionFile
 {
@@ -59,14 +165,124 @@ struct MemoryRegionFile
     std::string filename;
 };
 
+// interval of thread between two context switches; times are perf timestamps
+struct PerfSwitchInterval
+{
+    uint64_t start;
+    uint64_t end;
+    uint32_t pid;
+    uint32_t tid;
+    uint32_t cpu;
+    // PerfThreadState
+    uint32_t state;
+    // stack at switch-out (off-CPU intervals only), INVALID_STACK_ID if not known
+    uint32_t stackId;
+    uint32_t reserved;
+};
+
+// scheduling state of thread since its last context switch
+struct PerfThreadSwitchState
+{
+    // time of the last switch, 0 if no switch was seen yet
+    uint64_t since;
+    uint32_t state;
+    uint32_t cpu;
+    // stack at switch-out
+    uint32_t stackId;
+    // stack of the latest CPU sample of thread (switch-out stack of switch records without stack)
+    uint32_t lastSampleStackId;
+};
+
+// counter deltas attributed to function
+struct PerfCounterTotals
+{
+    uint64_t sampleCount;
+    uint64_t values[PCK_COUNT];
+};
+
+// hash of address pair (branch source and target, basic block range)
+struct PerfAddressPairHash
+{
+    inline size_t operator() (const std::pair<uint64_t, uint64_t> &p) const
+    {
+        return (size_t)(p.first * 0x9E3779B97F4A7C15ULL ^ p.second);
+    }
+};
+
+typedef std::unordered_map<std::pair<uint64_t, uint64_t>, uint32_t, PerfAddressPairHash> AddressPairIndexMap;
+
+// phase being timed; times are in milliseconds
+struct PerfPhaseTimer
+{
+    PerfLoadPhase phase;
+    double wallStart;
+    double cpuStart;
+    // time of nested phases, not counted to this one
+    double nestedWall;
+    double nestedCpu;
+};
+
 typedef std::pair<uint64_t, uint64_t> MemoryRegion;
 typedef std::vector<MemoryRegion> MemoryRegionVector;
 
+class PerfFile;
+
+// shared state of recordings loaded concurrently to be merged
+struct PerfMergeJob
+{
+    // recordings to be loaded
+    const std::vector<std::string>* filenames;
+    // application binary of all recordings
+    const char* binaryFilename;
+    // are profile snapshots used?
+    bool snapshotCache;
+    // symbol listings shared by all workers
+    PerfSymbolCache* symbolCache;
+    // memory budget of decoded samples of every worker (0 for unlimited)
+    uint64_t memoryBudget;
+    // index of next recording to be loaded
+    std::atomic<size_t> nextFile;
+    // count of recordings loaded and merged
+    std::atomic<size_t> mergedFiles;
+};
+
 class PerfFile
 {
     public:
-        // static factory method for loading perf recorded file
-        static PerfFile* Load(const char* filename, const char* binaryfilename);
+        // static factory method for loading perf recorded file; with preview options, just randomly selected
+        // chunks of data section are decoded; with snapshot cache, the computed profile is stored next to
+        // the recording and restored instead of loading the same recording again; symbol cache shares symbol
+        // listings with other recordings loaded at once; decoded samples exceeding memory budget (in bytes, 0 for
+        // unlimited) are spilled to temporary run files and merged back by time
+        static PerfFile* Load(const char* filename, const char* binaryfilename, const PerfPreviewOptions* preview = nullptr, bool snapshotCache = false,
+                              PerfSymbolCache* symbolCache = nullptr, uint64_t memoryBudget = 0);
+        // static factory method for tailing perf output still being written (file, or pipe-mode stream; "-" for stdin)
+        static PerfFile* OpenLive(const char* filename, const char* binaryfilename, PerfSymbolCache* symbolCache = nullptr);
+        // static factory method for loading more recordings concurrently and merging them by function name into single
+        // profile; the merged profile has no per-sample data (time windows, processes, threads, heat map); with zero
+        // worker count, all available cores are used; memory budget is split among workers
+        static PerfFile* LoadMerged(const std::vector<std::string> &filenames, const char* binaryfilename, uint32_t workerCount = 0, bool snapshotCache = false,
+                                    uint64_t memoryBudget = 0);
+        ~PerfFile();
+
+        // reads newly available live input and updates all outputs; returns true if anything new was incorporated
+        bool Poll();
+        // reads the rest of live input, and treats it as finished recording
+        void FinishLive();
+        // is the live input finished (pipe closed, or file finalized by perf)?
+        bool IsLiveFinished() const;
+
+        // is this just a preview of recording (not all data were decoded)?
+        bool IsPreview() const;
+        // retrieves fraction of data section decoded by preview (1.0 for full load)
+        double GetPreviewFraction() const;
+        // fills flat profile estimates with confidence intervals (empty for full load)
+        void FillPreviewErrorBounds(std::vector<PerfPreviewFunctionRecord> &dst);
+
+        // writes collapsed stacks of samples matching filter ("root;caller;leaf count" lines) to file descriptor
+        bool ExportFoldedStacks(int fd, const PerfSampleFilter &filter = PerfSampleFilter());
+        // writes samples matching filter as gzip-compressed pprof profile (profile.proto) to file descriptor
+        bool ExportPprof(int fd, const PerfSampleFilter &filter = PerfSampleFilter());
 
         // fills function table with symbol info resolved
         void FillFunctionTable(std::vector<FunctionEntry> &dst);
@@ -74,10 +290,99 @@ class PerfFile
         void FillFlatProfileTable(std::vector<FlatProfileRecord> &dst);
         // fills call graph map with gathered data
         void FillCallGraphMap(CallGraphMap &dst);
-        // fills call tree map with gathered data
+        // moves flat profile table to caller instead of copying it; it's aggregated again, if needed later
+        void TakeFlatProfileTable(std::vector<FlatProfileRecord> &dst);
+        // moves call graph map to caller instead of copying it; it's aggregated again, if needed later
+        void TakeCallGraphMap(CallGraphMap &dst);
+        // fills call tree map with gathered data; the nodes are valid until the file is released (in live mode, just
+        // until next poll)
         void FillCallTreeMap(CallTreeMap &dst);
-        // fills heat map sparse matrix histogram data
-        void FillHeatMapData(TimeHistogramVector &dst);
+        // fills bottom-up call tree map, rooted at sampled functions with their callers as children; the nodes are valid
+        // until the file is released (in live mode, just until next poll)
+        void FillInvertedCallTreeMap(CallTreeMap &dst);
+        // fills callers and callees of function; returns false if the function is not within any considered stack
+        bool FillButterfly(uint32_t functionId, PerfButterflyEntry &dst);
+
+        // fills flat profile table of samples matching filter
+        void FillFlatProfileTable(std::vector<FlatProfileRecord> &dst, const PerfSampleFilter &filter);
+        // fills call graph map of samples matching filter
+        void FillCallGraphMap(CallGraphMap &dst, const PerfSampleFilter &filter);
+        // fills call tree map of samples matching filter; caller takes ownership of nodes
+        void FillCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter);
+        // fills bottom-up call tree map of samples matching filter; caller takes ownership of nodes
+        void FillInvertedCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter);
+        // fills callers and callees of function within samples matching filter
+        bool FillButterfly(uint32_t functionId, PerfButterflyEntry &dst, const PerfSampleFilter &filter);
+        // fills call tree of time spent off CPU by threads matching filter (in milliseconds), attributed to stacks at
+        // switch-out; kernel frames are kept, as they tell the reason of blocking; caller takes ownership of nodes
+        void FillOffCpuCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter = PerfSampleFilter());
+        // fills on-CPU and off-CPU intervals of thread, sorted by time
+        void FillThreadTimeline(uint32_t tid, std::vector<PerfThreadInterval> &dst);
+        // fills heat map of samples matching filter with bins of given width
+        void FillHeatMapData(TimeHistogramVector &dst, uint32_t binWidthMs, const PerfSampleFilter &filter);
+        // fills list of sampled processes
+        void FillProcessList(std::vector<PerfProcessInfo> &dst);
+        // fills list of sampled threads
+        void FillThreadList(std::vector<PerfThreadInfo> &dst);
+        // fills list of sampled events
+        void FillEventList(std::vector<PerfEventInfo> &dst);
+        // fills sample counts and period sums of functions within samples matching filter
+        void FillFunctionWeights(std::vector<PerfFunctionWeights> &dst, const PerfSampleFilter &filter = PerfSampleFilter());
+        // retrieves time between first and last sample in milliseconds
+        uint64_t GetRecordingDuration();
+
+        // does the recording contain branch stacks?
+        bool HasBranchStacks() const;
+        // fills taken branches of all branch stacks, the most frequent first
+        void FillBranchEdges(std::vector<PerfBranchEdge> &dst);
+        // fills basic blocks executed within function (all functions for INVALID_FUNCTION_ID), the hottest first
+        void FillHotBasicBlocks(uint32_t functionId, std::vector<PerfBasicBlock> &dst);
+        // fills call graph made of call branches of branch stacks, as an alternative to callchain one
+        void FillBranchCallGraphMap(CallGraphMap &dst);
+        // does the recording contain counter values read with samples?
+        bool HasCounterValues() const;
+        // fills counter deltas and derived rates (IPC, cache and branch miss rates) of sampled functions
+        void FillFunctionCounters(std::vector<PerfFunctionCounters> &dst);
+
+        // retrieves resolved function table
+        const std::vector<FunctionEntry>& GetFunctionTable() const;
+        // retrieves whole-recording flat profile
+        const std::vector<FlatProfileRecord>& GetFlatProfile();
+        // retrieves table of unique resolved stacks
+        const StackTable& GetStackTable() const;
+        // fills sample counts and period sums of all unique stacks within samples matching filter
+        void FillStackWeights(StackWeightVector &dst, const PerfSampleFilter &filter = PerfSampleFilter());
+        // retrieves weight of stack according to selected weighting
+        uint64_t GetStackWeight(const StackWeight &sw) const;
+        // selects weight of samples in profiles; whole-recording profiles are aggregated again, if it changes
+        void SetSampleWeighting(PerfSampleWeighting weighting);
+        // retrieves selected weight of samples in profiles
+        PerfSampleWeighting GetSampleWeighting() const;
+        // selects part of stack considered in profiles; stack is left as is in combined stack mode, cut to kernel
+        // frames in kernel mode; returns false if the stack is left out entirely
+        bool SelectStackFrames(const uint32_t* &frames, uint32_t &count) const;
+        // retrieves count of kernel frames on top of (leaf first) stack, i.e. the kernel/user boundary
+        uint32_t GetKernelFrameCount(const uint32_t* frames, uint32_t count) const;
+        // selects stack segments considered in profiles; whole-recording profiles are aggregated again, if it changes
+        void SetStackMode(PerfStackMode mode);
+        // retrieves selected stack segments
+        PerfStackMode GetStackMode() const;
+        // enables folding of recursion (direct and mutual) in call tree stacks; the call tree is built again, if it changes
+        void SetRecursionFolding(bool enable);
+        // is recursion folded in call tree stacks?
+        bool IsRecursionFolding() const;
+        // retrieves frames of stack as considered in call tree, i.e. with recursion folded, if enabled
+        const uint32_t* GetTreeFrames(uint32_t stackId, uint32_t &count);
+        // fills heat map sparse matrix histogram data with bins of given width (in milliseconds)
+        void FillHeatMapData(TimeHistogramVector &dst, uint32_t binWidthMs = HEATMAP_GROUP_BY_MS_AMOUNT);
+        // sets finest heat map resolution; any multiple of it may be then requested
+        void SetHeatMapBaseBinWidth(uint32_t binWidthMs);
+        // retrieves bin widths of prebuilt heat map levels
+        void GetHeatMapLevelWidths(std::vector<uint32_t> &dst);
+        // fills timings of phases and counters of loading
+        void FillLoadStats(PerfLoadStats &dst) const;
+        // logs load stats as single line of key=value pairs
+        void LogLoadStats() const;
 
     protected:
         // private constructor; use PerfFile::Load to instantiate this class
@@ -92,36 +397,204 @@ class PerfFile
         // reads data section (needs to have header read first)
         bool ReadData();
 
+        // creates instance from snapshot file, if there's a valid one matching key
+        static PerfFile* LoadSnapshot(const char* path, const PerfSnapshotKey &key);
+        // restores computed state from snapshot; stack table keeps pointing to its mapping, so the snapshot has to
+        // stay open as long as this instance
+        bool RestoreSnapshot(const PerfSnapshot &snapshot);
+        // stores computed state to snapshot file
+        bool SaveSnapshot(const char* path, const PerfSnapshotKey &key);
+        // rebuilds per-process, per-thread and per-CPU sample indexes from sample table
+        void RebuildSampleIndexes();
+
+        // loads and merges recordings of job, until there's none left
+        static void MergeWorker(PerfMergeJob* job, PerfFile* partial);
+        // adds functions and weighted stacks of another profile; functions are matched by name
+        void MergeProfile(const PerfFile &src);
+
+        // reads events from given range of data section until its end (or first sample); returns offset where it stopped
+        uint64_t ReadEvents(uint64_t offset, uint64_t end, bool untilSample);
+        // reads randomly selected chunks of data section; preview chunk of every record is stored to recordChunks
+        bool ReadPreviewData(const PerfPreviewOptions &options, std::vector<uint32_t> &recordChunks);
+        // decodes events starting within chunk of data section; returns false if no event boundary was found
+        bool ReadPreviewChunk(uint64_t offset, uint64_t length, uint64_t dataEnd, uint32_t chunk, std::vector<uint32_t> &recordChunks);
+        // finds first position in buffer, where a chain of valid event headers starts; returns false if none
+        bool FindEventBoundary(const uint8_t* buffer, uint64_t length, bool atDataEnd, uint64_t &position);
+        // is the header valid perf event header?
+        static bool IsPlausibleEventHeader(const perf_event_header &header);
+        // sorts records by time, along with their preview chunks
+        void SortPreviewRecords(std::vector<uint32_t> &recordChunks);
+        // estimates flat profile error from variance among preview chunks
+        void ComputePreviewErrorBounds(const std::vector<uint32_t> &recordChunks);
+        // estimates ratio and half-width of its confidence interval from per-chunk sums
+        void EstimatePreviewRatio(const PreviewRatioSums &sums, double samples, double samplesSquared, double &ratio, double &error);
+        // reads event names from feature sections (needs to have attributes read first)
+        void ReadEventDescriptions();
+        // stores event attribute and IDs assigned to it
+        bool AddEventAttribute(const perf_event_attr &attr, const uint64_t* ids, uint32_t idCount);
+        // finds index of event attribute by sample ID; returns -1 if not known
+        int32_t FindEventAttribute(uint64_t id) const;
+        // finds index of event attribute, whose layout is used to parse event; returns -1 if not known
+        int32_t FindRecordAttribute(const perf_event &evt) const;
+        // retrieves position of ID within sample and within trailer of other events; returns false if there's no ID
+        static bool GetIdPositions(const perf_event_attr &attr, uint32_t &samplePos, uint32_t &trailerPos);
+        // do the event attributes produce events of the same layout?
+        static bool HasSameLayout(const perf_event_attr &a, const perf_event_attr &b);
+        // is the event attribute sched:sched_switch tracepoint?
+        bool IsSchedSwitchAttribute(uint32_t index);
+
+        // is the record type decoded to record structure?
+        static bool IsDecodedRecordType(uint32_t type);
+        // prepares buffer for event data of given size
+        uint8_t* PrepareEventBuffer(uint32_t size);
+        // decodes event (with data in event buffer) to newly allocated record; returns nullptr if not decoded
+        record_t* DecodeRecord(perf_event &evt, uint64_t eventNumber);
+        // copies callchain of parsed sample to callchain pool
+        void StoreCallchain(const perf_sample &sample, uint64_t &index, uint32_t &count, uint32_t &kernelCount);
+        // stores decoded record; samples are spilled to run file, when they exceed memory budget
+        void StoreRecord(record_t* rec);
+        // moves all stored samples to new run file, and releases them along with their callchains and branch stacks
+        void SpillSamples();
+        // deletes decoded record
+        static void ReleaseRecord(record_t* rec);
+
+        // reads and incorporates live input; with finish set, the input is closed afterwards
+        bool PollLive(bool finish);
+        // reads available live input; returns false when the input is finished
+        bool ReadLiveInput();
+        // decodes all complete events in live input buffer
+        bool DecodeLiveBuffer();
+        // processes single complete live event
+        bool ProcessLiveEvent(perf_event_header* header, uint8_t* data);
+        // stores pending live records, which can't be preceded by any record not read yet (or all of them)
+        void FlushLiveRecords(bool all);
+        // incorporates records stored from given position to all outputs
+        void IncorporateRecords(size_t firstRecord, size_t firstMmap2);
+
         // resolve symbols from supplied file
         void ResolveSymbols(const char* binaryFilename);
-        // use specified file descriptor to resolve symbols from (in nm format)
-        int ResolveSymbolsUsingFD(int fd, uint64_t baseAddress = 0x0, FunctionEntryType overrideType = FET_DONTCARE);
-        // filter symbols - use only sampled ones (the ones present in perf file)
-        void FilterUsedSymbols();
+        // resolve symbols of application binary and kernel
+        void LoadBinarySymbols(const char* binaryFilename);
+        // resolve symbols of libraries mapped via mmap2 records stored from given position
+        void ResolveMappedSymbols(size_t firstMmap2);
+        // adds function symbols of file (from symbol cache, if any) to symbol table; returns -1 if the file could not be listed
+        int LoadSymbols(PerfSymbolSource source, const char* path, uint64_t baseAddress = 0x0, FunctionEntryType overrideType = FET_DONTCARE);
+        // inserts fake symbol (and mapping) of given type around address outside of known regions
+        void AddUnresolvedSymbol(uint64_t address, FunctionEntryType type = FET_MISC);
+        // resolves function ID of address; functions are added to function table on first use, the ones outside
+        // of known regions as unresolved symbols of given type
+        uint32_t ResolveFunctionId(uint64_t address, FunctionEntryType unresolvedType = FET_MISC);
 
         // retrieves function entry based on input address
         FunctionEntry* GetSymbolRecordByAddress(std::vector<FunctionEntry> &source, uint64_t address, uint32_t* functionIndex);
         // retrieves function entry based on input address
-        FunctionEntry* GetFunctionByAddress(uint64_t address, uint32_t* functionIndex);
-        // retrieves function entry based on input address
         FunctionEntry* GetSymbolByAddress(uint64_t address, uint32_t* functionIndex);
 
+        // resolves callchains of samples stored from given position and appends them to time-sorted sample table
+        void BuildSampleTable(size_t firstRecord);
+        // adds record to sample table, thread names or switch timeline
+        void AddToSampleTable(const record_t* rec, std::vector<uint32_t> &frames);
+        // adds spilled samples merged with records stored from given position to sample table
+        void MergeSpilledSamples(size_t firstRecord, std::vector<uint32_t> &frames);
+        // resolves sampled IP and callchain (within callchain pool) to interned stack (frames vector is just reused);
+        // returns INVALID_STACK_ID if the IP is not resolved
+        uint32_t ResolveStack(uint64_t ip, uint64_t callchainIndex, uint32_t callchainCount, uint32_t kernelFrameCount, std::vector<uint32_t> &frames);
+        // adds taken branches and basic blocks of sample branch stack to histograms
+        void ProcessBranchStack(const record_sample* rec);
+        // adds taken branch to edge histogram
+        void AddBranchEdge(const PerfBranchEdge &edge);
+        // adds executed range to basic block histogram
+        void AddBasicBlock(const PerfBasicBlock &block);
+        // is the taken branch a function call?
+        bool IsCallBranch(const PerfBranchEdge &edge) const;
+        // attributes counter deltas since previous sample of the same counters to sampled function
+        void ProcessCounterValues(const record_sample* rec, uint32_t functionId);
+        // retrieves kind of counter of event attribute; returns -1 if it's not recognized
+        int32_t GetCounterKind(uint32_t index);
+        // adds context switch to thread states and timeline
+        void ProcessContextSwitch(const record_switch* rec);
+        // ends on-CPU interval of thread and starts off-CPU one
+        void SwitchThreadOut(uint32_t pid, uint32_t tid, uint32_t cpu, uint64_t time, bool preempted, uint32_t stackId);
+        // ends off-CPU interval of thread and starts on-CPU one
+        void SwitchThreadIn(uint32_t pid, uint32_t tid, uint32_t cpu, uint64_t time);
+        // retrieves perf timestamp the relative times are measured from
+        uint64_t GetTimeBase() const;
+        // finds range of sample table within time window; returns false if the range is empty
+        bool FindSampleRange(uint64_t fromMs, uint64_t toMs, size_t &first, size_t &last);
+        // adds sample to index and stack counts of its event
+        void IndexSampleEvent(uint32_t sampleIndex);
+        // does the event selection cover all samples?
+        bool MatchesAllEvents(const std::set<uint32_t> &events) const;
+        // retrieves event (attribute index) of sample
+        uint32_t GetSampleEvent(uint32_t sampleIndex) const;
+        // selects indexes of samples matching filter (sorted by time)
+        void SelectSamples(const PerfSampleFilter &filter, std::vector<uint32_t> &dst);
+        // counts samples and sums periods of each stack within sample table range
+        void CollectStackWeights(size_t first, size_t last, StackWeightVector &dst);
+        // counts samples and sums periods of each stack among samples matching filter
+        void CollectStackWeights(const PerfSampleFilter &filter, StackWeightVector &dst);
+        // counts occurences and sums periods of stack IDs (the input vector gets sorted)
+        void CountStackIds(std::vector<StackSample> &samples, StackWeightVector &dst);
+        // adds sample counts and period sums of stack vectors to weighted stacks
+        static void AppendStackWeights(const std::vector<uint64_t> &counts, const std::vector<uint64_t> &periods, StackWeightVector &dst);
+
+        // aggregates flat profile (including call counts) from weighted stacks
+        void AggregateFlatProfile(const StackWeightVector &stacks, std::vector<FlatProfileRecord> &dst);
+        // adds weighted stacks to flat profile
+        void AccumulateFlatProfile(const StackWeightVector &stacks, std::vector<FlatProfileRecord> &dst);
+        // calculates relative values of flat profile
+        void FinalizeFlatProfile(std::vector<FlatProfileRecord> &dst);
+        // aggregates call graph from weighted stacks
+        void AggregateCallGraph(const StackWeightVector &stacks, CallGraphMap &dst);
+        // aggregates and thresholds top-down call tree, bottom-up (inverted) call tree and butterfly index from weighted
+        // stacks in single pass; any of them may be nullptr
+        void AggregateCallTree(const StackWeightVector &stacks, CallTreeMap* dst, CallTreeMap* inverted = nullptr,
+                               ButterflyIndex* butterfly = nullptr);
+        // computes relative times of call tree nodes, and removes nodes below threshold
+        void ThresholdCallTree(CallTreeMap &dst);
+        // retrieves ID of stack with recursion folded (within folded stack table), folds it on first use
+        uint32_t GetFoldedStackId(uint32_t stackId);
+
         // processess flat profile from available data
         void ProcessFlatProfile();
         // creates call graph map
         void ProcessCallGraph();
         // creates call tree
         void ProcessCallTree();
+        // aggregates flat profile again, if it was moved to caller
+        void PrepareFlatProfile();
+        // aggregates call graph again, if it was moved to caller
+        void PrepareCallGraph();
+        // rebuilds call tree, if it does not cover all samples
+        void PrepareCallTree();
+        // keeps call trees handed out to caller until the file is released, and lets them be built again with changed
+        // aggregation settings
+        void RetireCallTrees();
+        // builds inverted call tree and butterfly index, if they are not built along with call tree (snapshots)
+        void PrepareCallTreeViews();
+        // builds or extends heat map, so it covers all samples
+        void PrepareHeatMap();
+        // builds finest heat map level from samples and derives coarser ones
+        void BuildHeatMap();
+        // adds samples appended since last build to heat map
+        void ExtendHeatMap();
+        // builds heat map bins of given width from selected samples (or all samples, if no selection given);
+        // bins before firstBin are kept untouched
+        void BuildHeatMapBins(const std::vector<uint32_t>* indices, uint32_t binWidthMs, std::vector<HeatMapBin> &bins, size_t firstBin = 0);
 
         // creates empty an nullified call tree node
         CallTreeNode* CreateCallTreeNode(uint32_t functionId, CallTreeNode* childOf = nullptr);
-        // inserts node (if needed) into call tree and returns CallTreeNode instance
-        CallTreeNode* InsertIntoCallTree(std::vector<uint32_t> &path, uint32_t finalFunctionId);
+        // inserts path (leaf first) into call tree (if needed) and returns CallTreeNode instance of leaf
+        CallTreeNode* InsertIntoCallTree(CallTreeMap &roots, const uint32_t* path, uint32_t count);
         // adds time to whole call chain
-        void AccumulateCallTreeTime(CallTreeNode* node, double addTime, bool addSample = false);
+        void AccumulateCallTreeTime(CallTreeNode* node, double addTime, uint64_t addSamples = 0);
+        // deletes call tree node with all its descendants
+        static void ReleaseCallTreeNode(CallTreeNode* node);
+        // deletes all nodes of call tree
+        static void ReleaseCallTree(CallTreeMap &roots);
 
-        // Process mmap and mmap2 samples and add appropriate ranges to search arrays
-        void ProcessMemoryMapping();
+        // Process mmap and mmap2 samples stored from given position and add appropriate ranges to search arrays
+        void ProcessMemoryMapping(size_t firstRecord);
         // adds memory mapping (mmap or mmap2) to known address ranges
         void AddMemoryMapping(uint64_t start, uint64_t length);
         // determines the presence of address in known region map
@@ -132,19 +605,45 @@ class PerfFile
         // retrieves filename for mapped region if any
         const char* RetrieveFilenameForMapping(uint64_t address);
 
+        // starts timing of phase; phases may be nested
+        void BeginPhase(PerfLoadPhase phase);
+        // ends timing of the innermost phase
+        void EndPhase();
+        // counts event read from input
+        void CountEvent(const perf_event_header &header);
+        // updates peak memory usage of all tracked structures
+        void UpdateMemoryStats();
+        // retrieves allocated size of decoded record
+        static size_t GetRecordSize(const record_t* rec);
+
     private:
         // perf file we read
         FILE* m_file;
 
-        // stored sampling type (which data we could extract from perf record file)
+        // stored sampling type of the first event (which data we could extract from perf record file)
         uint64_t m_samplingType;
+        // do all events share the same layout?
+        bool m_uniformLayout;
+        // position of ID within samples (words from start) and within other events (words from end), common to all events
+        uint32_t m_sampleIdPosition;
+        uint32_t m_trailerIdPosition;
 
         // header read from file
         perf_file_header m_fileHeader;
+        // count of events read so far
+        uint64_t m_eventNumber;
+        // event data buffer
+        std::vector<uint64_t> m_eventBuffer;
         // all event attributes
         std::vector<event_type_entry> m_eventAttr;
+        // parser of events of every attribute (specialized to its sample type, if it's a common one)
+        std::vector<perf_sample_parser> m_eventParsers;
         // assigned ids for each event attribute block
         std::vector< std::set<uint64_t> > m_eventAttrIds;
+        // index of event attribute of every assigned id
+        std::unordered_map<uint64_t, uint32_t> m_eventAttrIndex;
+        // is the event attribute sched:sched_switch tracepoint? (empty until determined)
+        std::vector<bool> m_schedSwitchAttrs;
         // trace info blocks
         std::vector<perf_trace_event_type> m_traceInfo;
         // stored loaded records (events from data section)
@@ -157,17 +656,161 @@ class PerfFile
         // vector of memory region mappings (via mmap or mmap2)
         MemoryRegionVector m_memoryMappings;
 
-        // table of addresses of functions
+        // table of used functions, in order of first use
         std::vector<FunctionEntry> m_functionTable;
         // table of symbols found
         std::vector<FunctionEntry> m_symbolTable;
+        // function ID of every used symbol (by symbol address)
+        std::unordered_map<uint64_t, uint32_t> m_symbolFunctionIds;
+        // function ID of every resolved address
+        std::unordered_map<uint64_t, uint32_t> m_addressFunctionIds;
+        // i-node of application binary
+        uint64_t m_binaryInode;
+        // symbol listings shared with other recordings (nullptr if not shared)
+        PerfSymbolCache* m_symbolCache;
+        // function ID of every function name (merged profile only)
+        std::unordered_map<std::string, uint32_t> m_mergedFunctionIds;
+
+        // fraction of data section decoded (less than 1.0 for preview)
+        double m_previewFraction;
+        // count of chunks decoded by preview
+        uint32_t m_previewChunkCount;
+        // flat profile estimates of preview
+        std::vector<PerfPreviewFunctionRecord> m_previewBounds;
+
+        // live input file descriptor (-1 if not reading live)
+        int m_liveFd;
+        // is the live input regular file (which may grow further after reaching its end)?
+        bool m_liveRegularFile;
+        // is the live input pipe-mode stream (attributes are transferred as events)?
+        bool m_liveStream;
+        // was pipe-mode header read already?
+        bool m_liveHeaderRead;
+        // is live input finished?
+        bool m_liveFinished;
+        // position of next byte to be read from live input
+        uint64_t m_liveOffset;
+        // end of data section of finalized file (0 while unknown)
+        uint64_t m_liveDataEnd;
+        // bytes to be skipped from live input (payload following some events)
+        uint64_t m_liveSkip;
+        // read, but not yet decoded live input
+        std::vector<uint8_t> m_liveBuffer;
+        // decoded records waiting for their round to be finished
+        std::vector<record_t*> m_livePending;
+        // pending records up to this time are safe to be stored
+        uint64_t m_liveFlushTime;
+        // highest time of pending records
+        uint64_t m_liveMaxTime;
+
+        // unique resolved call stacks
+        StackTable m_stacks;
+        // all samples in compact form, sorted by time
+        std::vector<PerfSample> m_samples;
+        // sample count of every unique stack
+        std::vector<uint64_t> m_stackCounts;
+        // period sum of every unique stack
+        std::vector<uint64_t> m_stackPeriods;
+        // unique stacks with recursion folded
+        StackTable m_foldedStacks;
+        // folded stack ID of every unique stack (INVALID_STACK_ID if not folded yet)
+        std::vector<uint32_t> m_foldedStackIds;
+        // position of every function within path being folded (scratch space of folding)
+        std::vector<uint32_t> m_foldPositions;
+        // sample indexes of every process
+        SampleIndexMap m_pidIndex;
+        // sample indexes of every thread
+        SampleIndexMap m_tidIndex;
+        // sample indexes of every CPU
+        SampleIndexMap m_cpuIndex;
+        // event (attribute index) of every sample; stays empty for recordings of single event
+        std::vector<uint32_t> m_sampleEvents;
+        // sample indexes of every event (recordings of multiple events only)
+        SampleIndexMap m_eventIndex;
+        // sample count of every unique stack within every event (recordings of multiple events only)
+        std::map<uint32_t, std::vector<uint64_t> > m_eventStackCounts;
+        // period sum of every unique stack within every event (recordings of multiple events only)
+        std::map<uint32_t, std::vector<uint64_t> > m_eventStackPeriods;
+        // process ID of every known thread
+        std::map<uint32_t, uint32_t> m_threadPids;
+        // names of known threads (from comm records)
+        std::map<uint32_t, std::string> m_threadComms;
+        // scheduling state of every thread seen in context switches
+        std::unordered_map<uint32_t, PerfThreadSwitchState> m_threadSwitchStates;
+        // finished on-CPU and off-CPU intervals of all threads, in order of their end
+        std::vector<PerfSwitchInterval> m_switchIntervals;
+        // time of the first context switch (0 if none)
+        uint64_t m_firstSwitchTime;
+        // callchain frames of all samples and switches with stack
+        std::vector<uint64_t> m_callchainPool;
+        // branch stack entries of all samples
+        std::vector<branch_entry> m_branchPool;
+
+        // timings and counters of loading (unique counts are filled on request)
+        PerfLoadStats m_loadStats;
+        // phases being timed, the innermost last
+        std::vector<PerfPhaseTimer> m_phaseTimers;
+        // allocated size of all decoded records
+        uint64_t m_recordMemory;
+        // memory budget of decoded samples (0 for unlimited)
+        uint64_t m_memoryBudget;
+        // memory taken by decoded samples kept in memory (tracked with memory budget only)
+        uint64_t m_sampleMemory;
+        // run files of samples exceeding memory budget (nullptr until the budget is exceeded)
+        PerfSampleSpill* m_spill;
+        // histogram of taken branches
+        std::vector<PerfBranchEdge> m_branchEdges;
+        // index of every taken branch (source and target) within histogram
+        AddressPairIndexMap m_branchEdgeIndex;
+        // histogram of executed basic blocks
+        std::vector<PerfBasicBlock> m_basicBlocks;
+        // index of every basic block (start and end) within histogram
+        AddressPairIndexMap m_basicBlockIndex;
+        // counter values of all samples
+        std::vector<read_value> m_counterPool;
+        // the latest value of every counter (by ID, or by attribute and thread if IDs are not recorded)
+        std::unordered_map<uint64_t, uint64_t> m_counterLastValues;
+        // counter kind of every event attribute (determined on first use)
+        std::vector<int32_t> m_counterKinds;
+        // counter deltas of every function, indexed by function ID (covers just functions with any)
+        std::vector<PerfCounterTotals> m_functionCounters;
 
         // table of flat profile records
         std::vector<FlatProfileRecord> m_flatProfile;
         // call graph map
         CallGraphMap m_callGraph;
+        // flat profile is not aggregated yet (or was moved to caller, or aggregation settings changed)
+        bool m_flatProfileStale;
+        // call graph is not aggregated yet (or was moved to caller, or weighting changed)
+        bool m_callGraphStale;
         // call tree set (root nodes)
         CallTreeMap m_callTree;
+        // call tree is not built yet, or does not cover live samples appended since it was built
+        bool m_callTreeStale;
+        // bottom-up call tree set (sampled functions as root nodes), built along with call tree
+        CallTreeMap m_invertedCallTree;
+        // callers and callees of functions, built along with call tree
+        ButterflyIndex m_butterfly;
+        // call trees and inverted call trees built before aggregation settings changed; caller may still hold their
+        // nodes, so they are released along with the file
+        std::vector<CallTreeMap> m_retiredCallTrees;
+        // mapped snapshot the profile was restored from (if any); stack table is read from it in place
+        PerfSnapshot* m_snapshot;
+        // inverted call tree and butterfly index are not built (they are built with call tree, but not restored from
+        // snapshot)
+        bool m_callTreeViewsStale;
+        // heat map levels (built on first request)
+        HeatMapPyramid m_heatMap;
+        // heat map does not cover live samples appended since it was built
+        bool m_heatMapStale;
+        // finest heat map bin width in milliseconds
+        uint32_t m_heatMapBaseWidth;
+        // weight of samples in profiles
+        PerfSampleWeighting m_weighting;
+        // stack segments considered in profiles
+        PerfStackMode m_stackMode;
+        // is recursion folded in call tree?
+        bool m_foldRecursion;
 };
 
 #endif
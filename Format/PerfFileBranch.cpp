@@ -0,0 +1,166 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "PerfRecords.h"
+#include "Log.h"
+
+#include <algorithm>
+
+// structure used for sorting branch edges (the most frequent first)
+struct PerfBranchEdgeCountSortPredicate
+{
+    inline bool operator() (const PerfBranchEdge &a, const PerfBranchEdge &b) const
+    {
+        if (a.count != b.count)
+            return (a.count > b.count);
+        return (a.from < b.from || (a.from == b.from && a.to < b.to));
+    }
+};
+
+// structure used for sorting basic blocks (the hottest first)
+struct PerfBasicBlockCountSortPredicate
+{
+    inline bool operator() (const PerfBasicBlock &a, const PerfBasicBlock &b) const
+    {
+        if (a.count != b.count)
+            return (a.count > b.count);
+        return (a.start < b.start || (a.start == b.start && a.end < b.end));
+    }
+};
+
+void PerfFile::ProcessBranchStack(const record_sample* rec)
+{
+    const branch_entry* entries = &m_branchPool[rec->branchIndex];
+    PerfBranchEdge edge;
+    PerfBasicBlock block;
+
+    edge.count = 1;
+    edge.reserved = 0;
+    block.count = 1;
+    block.reserved = 0;
+
+    for (uint32_t i = 0; i < rec->branchCount; i++)
+    {
+        edge.from = entries[i].from;
+        edge.to = entries[i].to;
+        edge.mispredicted = (entries[i].flags & PERF_BRANCH_FLAG_MISPRED) ? 1 : 0;
+        edge.fromFunctionId = ResolveFunctionId(edge.from);
+        edge.toFunctionId = ResolveFunctionId(edge.to);
+        edge.branchType = (uint32_t)PERF_BRANCH_FLAG_TYPE(entries[i].flags);
+
+        AddBranchEdge(edge);
+
+        // the most recent branch comes first, so the code from target of the older branch up to the source
+        // of the newer one was executed without any taken branch in between
+        if (i + 1 < rec->branchCount)
+        {
+            block.start = entries[i + 1].to;
+            block.end = entries[i].from;
+
+            if (block.start > block.end || block.end - block.start >= BRANCH_MAX_BASIC_BLOCK_LENGTH)
+                continue;
+
+            block.functionId = ResolveFunctionId(block.start);
+            if (block.functionId == INVALID_FUNCTION_ID || block.functionId != ResolveFunctionId(block.end))
+                continue;
+
+            AddBasicBlock(block);
+        }
+    }
+}
+
+void PerfFile::AddBranchEdge(const PerfBranchEdge &edge)
+{
+    auto ins = m_branchEdgeIndex.insert(std::make_pair(std::make_pair(edge.from, edge.to), (uint32_t)m_branchEdges.size()));
+    if (ins.second)
+    {
+        m_branchEdges.push_back(edge);
+        return;
+    }
+
+    PerfBranchEdge &dst = m_branchEdges[ins.first->second];
+    dst.count += edge.count;
+    dst.mispredicted += edge.mispredicted;
+    if (dst.branchType == PERF_BR_UNKNOWN)
+        dst.branchType = edge.branchType;
+}
+
+void PerfFile::AddBasicBlock(const PerfBasicBlock &block)
+{
+    auto ins = m_basicBlockIndex.insert(std::make_pair(std::make_pair(block.start, block.end), (uint32_t)m_basicBlocks.size()));
+    if (ins.second)
+        m_basicBlocks.push_back(block);
+    else
+        m_basicBlocks[ins.first->second].count += block.count;
+}
+
+bool PerfFile::IsCallBranch(const PerfBranchEdge &edge) const
+{
+    if (edge.fromFunctionId == INVALID_FUNCTION_ID || edge.toFunctionId == INVALID_FUNCTION_ID)
+        return false;
+
+    if (edge.branchType != PERF_BR_UNKNOWN)
+        return (edge.branchType == PERF_BR_CALL || edge.branchType == PERF_BR_IND_CALL || edge.branchType == PERF_BR_COND_CALL);
+
+    // without recorded branch type, a call is a branch to the very start of another function (returns land
+    // in the middle of caller, tail calls are indistinguishable from calls anyway)
+    return (edge.fromFunctionId != edge.toFunctionId && m_functionTable[edge.toFunctionId].address == edge.to);
+}
+
+bool PerfFile::HasBranchStacks() const
+{
+    return !m_branchEdges.empty();
+}
+
+void PerfFile::FillBranchEdges(std::vector<PerfBranchEdge> &dst)
+{
+    dst.assign(m_branchEdges.begin(), m_branchEdges.end());
+    std::sort(dst.begin(), dst.end(), PerfBranchEdgeCountSortPredicate());
+}
+
+void PerfFile::FillHotBasicBlocks(uint32_t functionId, std::vector<PerfBasicBlock> &dst)
+{
+    dst.clear();
+
+    for (const PerfBasicBlock &block : m_basicBlocks)
+    {
+        if (functionId == INVALID_FUNCTION_ID || block.functionId == functionId)
+            dst.push_back(block);
+    }
+
+    std::sort(dst.begin(), dst.end(), PerfBasicBlockCountSortPredicate());
+}
+
+void PerfFile::FillBranchCallGraphMap(CallGraphMap &dst)
+{
+    LogFunc(LOG_VERBOSE, "Passing branch stack call graph from input module to core");
+
+    // every call edge counts as many times as it was taken; unlike callchain call graph, it is not weighted by samples
+    for (const PerfBranchEdge &edge : m_branchEdges)
+    {
+        if (IsCallBranch(edge))
+            dst[edge.fromFunctionId][edge.toFunctionId] += edge.count;
+    }
+}
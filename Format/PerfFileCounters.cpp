@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "PerfRecords.h"
+#include "Log.h"
+
+int32_t PerfFile::GetCounterKind(uint32_t index)
+{
+    if (m_counterKinds.size() != m_eventAttr.size())
+    {
+        m_counterKinds.assign(m_eventAttr.size(), -1);
+
+        for (size_t i = 0; i < m_eventAttr.size(); i++)
+        {
+            const perf_event_attr &attr = m_eventAttr[i].attr;
+
+            if (attr.type == PERF_TYPE_HARDWARE)
+            {
+                switch (attr.config)
+                {
+                    case PERF_COUNT_HW_CPU_CYCLES:          m_counterKinds[i] = PCK_CYCLES; break;
+                    case PERF_COUNT_HW_INSTRUCTIONS:        m_counterKinds[i] = PCK_INSTRUCTIONS; break;
+                    case PERF_COUNT_HW_CACHE_REFERENCES:    m_counterKinds[i] = PCK_CACHE_REFERENCES; break;
+                    case PERF_COUNT_HW_CACHE_MISSES:        m_counterKinds[i] = PCK_CACHE_MISSES; break;
+                    case PERF_COUNT_HW_BRANCH_INSTRUCTIONS: m_counterKinds[i] = PCK_BRANCHES; break;
+                    case PERF_COUNT_HW_BRANCH_MISSES:       m_counterKinds[i] = PCK_BRANCH_MISSES; break;
+                }
+            }
+            // last level cache read accesses and misses (i.e. LLC-loads, LLC-load-misses)
+            else if (attr.type == PERF_TYPE_HW_CACHE)
+            {
+                if (attr.config == (PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16)))
+                    m_counterKinds[i] = PCK_CACHE_REFERENCES;
+                else if (attr.config == (PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)))
+                    m_counterKinds[i] = PCK_CACHE_MISSES;
+            }
+        }
+    }
+
+    return (index < m_counterKinds.size()) ? m_counterKinds[index] : -1;
+}
+
+void PerfFile::ProcessCounterValues(const record_sample* rec, uint32_t functionId)
+{
+    const read_value* values = &m_counterPool[rec->readIndex];
+    PerfCounterTotals* totals = nullptr;
+    int32_t attr, kind;
+    uint64_t key, delta;
+
+    // layout of values is given by attribute of the sampled event
+    const int32_t sampleAttr = FindEventAttribute(rec->header.id);
+    const uint64_t readFormat = m_eventAttr[(sampleAttr >= 0) ? sampleAttr : 0].attr.read_format;
+
+    if (functionId != INVALID_FUNCTION_ID)
+    {
+        if (functionId >= m_functionCounters.size())
+            m_functionCounters.resize(functionId + 1, PerfCounterTotals());
+
+        totals = &m_functionCounters[functionId];
+        totals->sampleCount++;
+    }
+
+    for (uint32_t i = 0; i < rec->readCount; i++)
+    {
+        // without IDs, group members follow the order of attributes, and the only one read otherwise is the sampled one
+        if (values[i].id != (uint64_t)(-1))
+            attr = FindEventAttribute(values[i].id);
+        else if (readFormat & PERF_FORMAT_GROUP)
+            attr = (i < m_eventAttr.size()) ? (int32_t)i : -1;
+        else
+            attr = sampleAttr;
+
+        if (attr < 0)
+            continue;
+
+        // values are cumulative, every counter instance (CPU or thread) counts on its own
+        key = (values[i].id != (uint64_t)(-1)) ? values[i].id : (((uint64_t)attr << 32) | rec->header.tid);
+
+        auto last = m_counterLastValues.insert(std::make_pair(key, (uint64_t)0)).first;
+        delta = (values[i].value >= last->second) ? values[i].value - last->second : values[i].value;
+        last->second = values[i].value;
+
+        kind = GetCounterKind((uint32_t)attr);
+        if (totals && kind >= 0)
+            totals->values[kind] += delta;
+    }
+}
+
+bool PerfFile::HasCounterValues() const
+{
+    return !m_functionCounters.empty();
+}
+
+void PerfFile::FillFunctionCounters(std::vector<PerfFunctionCounters> &dst)
+{
+    PerfFunctionCounters fc;
+    bool recorded[PCK_COUNT] = { false };
+
+    dst.clear();
+
+    // zero delta within function does not mean the counter was not recorded, so it's decided by all functions
+    for (const PerfCounterTotals &totals : m_functionCounters)
+    {
+        for (int k = 0; k < PCK_COUNT; k++)
+            recorded[k] = recorded[k] || (totals.values[k] > 0);
+    }
+
+    for (size_t i = 0; i < m_functionCounters.size(); i++)
+    {
+        const PerfCounterTotals &totals = m_functionCounters[i];
+        if (totals.sampleCount == 0)
+            continue;
+
+        fc.functionId = (uint32_t)i;
+        fc.sampleCount = totals.sampleCount;
+        memcpy(fc.values, totals.values, sizeof(fc.values));
+
+        fc.ipc = (totals.values[PCK_CYCLES] > 0 && totals.values[PCK_INSTRUCTIONS] > 0)
+            ? (double)totals.values[PCK_INSTRUCTIONS] / (double)totals.values[PCK_CYCLES] : PERF_COUNTER_RATE_UNAVAILABLE;
+        fc.cacheMissRate = (totals.values[PCK_CACHE_REFERENCES] > 0)
+            ? (double)totals.values[PCK_CACHE_MISSES] / (double)totals.values[PCK_CACHE_REFERENCES] : PERF_COUNTER_RATE_UNAVAILABLE;
+        fc.cacheMissesPerKiloInstruction = (totals.values[PCK_INSTRUCTIONS] > 0 && recorded[PCK_CACHE_MISSES])
+            ? (double)totals.values[PCK_CACHE_MISSES] * 1000.0 / (double)totals.values[PCK_INSTRUCTIONS] : PERF_COUNTER_RATE_UNAVAILABLE;
+        fc.branchMissRate = (totals.values[PCK_BRANCHES] > 0)
+            ? (double)totals.values[PCK_BRANCH_MISSES] / (double)totals.values[PCK_BRANCHES] : PERF_COUNTER_RATE_UNAVAILABLE;
+
+        dst.push_back(fc);
+    }
+}
@@ -0,0 +1,326 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "ExportStream.h"
+#include "ProtobufWriter.h"
+#include "Log.h"
+
+#include <algorithm>
+
+// field numbers of pprof profile.proto messages
+enum PprofProfileField
+{
+    PPF_SAMPLE_TYPE = 1,
+    PPF_SAMPLE = 2,
+    PPF_MAPPING = 3,
+    PPF_LOCATION = 4,
+    PPF_FUNCTION = 5,
+    PPF_STRING_TABLE = 6,
+    PPF_DURATION_NANOS = 10
+};
+
+enum PprofValueTypeField
+{
+    PVTF_TYPE = 1,
+    PVTF_UNIT = 2
+};
+
+enum PprofSampleField
+{
+    PSF_LOCATION_ID = 1,
+    PSF_VALUE = 2
+};
+
+enum PprofMappingField
+{
+    PMF_ID = 1,
+    PMF_MEMORY_START = 2,
+    PMF_MEMORY_LIMIT = 3,
+    PMF_FILENAME = 5,
+    PMF_HAS_FUNCTIONS = 7
+};
+
+enum PprofLocationField
+{
+    PLF_ID = 1,
+    PLF_MAPPING_ID = 2,
+    PLF_ADDRESS = 3,
+    PLF_LINE = 4
+};
+
+enum PprofLineField
+{
+    PLNF_FUNCTION_ID = 1
+};
+
+enum PprofFunctionField
+{
+    PFF_ID = 1,
+    PFF_NAME = 2,
+    PFF_SYSTEM_NAME = 3
+};
+
+// structure used for searching mapping containing address in base-sorted mappings
+struct MemoryRegionFileBaseSortPredicate
+{
+    inline bool operator() (const MemoryRegionFile* a, const MemoryRegionFile* b) const
+    {
+        return (a->base < b->base);
+    }
+
+    inline bool operator() (uint64_t address, const MemoryRegionFile* b) const
+    {
+        return (address < b->base);
+    }
+};
+
+// string table of pprof profile; index 0 is always the empty string
+struct PprofStringTable
+{
+    std::unordered_map<std::string, uint64_t> indexes;
+    std::vector<const std::string*> strings;
+
+    PprofStringTable()
+    {
+        Get(std::string());
+    }
+
+    uint64_t Get(const std::string &str)
+    {
+        std::unordered_map<std::string, uint64_t>::iterator itr = indexes.find(str);
+        if (itr != indexes.end())
+            return itr->second;
+
+        itr = indexes.insert(std::make_pair(str, (uint64_t)strings.size())).first;
+        strings.push_back(&itr->first);
+
+        return itr->second;
+    }
+};
+
+bool PerfFile::ExportFoldedStacks(int fd, const PerfSampleFilter &filter)
+{
+    LogFunc(LOG_INFO, "Exporting folded stacks...");
+
+    // identical stacks are already interned, so just their counts are needed
+    StackWeightVector stacks;
+    CollectStackWeights(filter, stacks);
+
+    // frame separator and line end within function name would break the format
+    std::vector<std::string> names(m_functionTable.size());
+    for (size_t i = 0; i < m_functionTable.size(); i++)
+    {
+        names[i] = m_functionTable[i].name;
+        for (char &c : names[i])
+        {
+            if (c == ';' || c == '\n' || c == '\r')
+                c = '_';
+        }
+    }
+
+    ExportStream out(fd, false);
+    std::string line;
+
+    const uint32_t* frames;
+    uint32_t count, kernelCount;
+    char num[24];
+
+    for (const StackWeight &sw : stacks)
+    {
+        frames = m_stacks.GetFrames(sw.stackId, count);
+        if (count == 0)
+            continue;
+
+        // stacks are stored leaf first, folded stacks start with root; kernel frames are suffixed with "_[k]",
+        // as flame graph tools expect
+        line.clear();
+        kernelCount = GetKernelFrameCount(frames, count);
+        for (uint32_t i = count; i > 0; i--)
+        {
+            line += names[frames[i - 1]];
+            if (i <= kernelCount)
+                line += "_[k]";
+            line += (i > 1) ? ';' : ' ';
+        }
+
+        snprintf(num, sizeof(num), "%llu\n", (unsigned long long)GetStackWeight(sw));
+        line += num;
+
+        if (!out.Write(line))
+            return false;
+    }
+
+    LogFunc(LOG_VERBOSE, "Exported %llu unique stacks", (uint64_t)stacks.size());
+
+    return out.Finish();
+}
+
+bool PerfFile::ExportPprof(int fd, const PerfSampleFilter &filter)
+{
+    LogFunc(LOG_INFO, "Exporting pprof profile...");
+
+    StackWeightVector stacks;
+    CollectStackWeights(filter, stacks);
+
+    ExportStream out(fd, true);
+    ProtobufWriter profile, message, submessage;
+    PprofStringTable strings;
+
+    // two values per sample - the sample count and the period sum
+    message.WriteUInt64(PVTF_TYPE, strings.Get("samples"));
+    message.WriteUInt64(PVTF_UNIT, strings.Get("count"));
+    profile.WriteMessage(PPF_SAMPLE_TYPE, message);
+    message.Clear();
+    message.WriteUInt64(PVTF_TYPE, strings.Get("events"));
+    message.WriteUInt64(PVTF_UNIT, strings.Get("count"));
+    profile.WriteMessage(PPF_SAMPLE_TYPE, message);
+
+    // samples are streamed right away, one per unique stack; location IDs equal function IDs + 1,
+    // as 0 is not a valid ID in pprof
+    std::vector<bool> usedFunctions(m_functionTable.size(), false);
+    std::vector<uint64_t> locations, values(2);
+    const uint32_t* frames;
+    uint32_t count;
+
+    for (const StackWeight &sw : stacks)
+    {
+        frames = m_stacks.GetFrames(sw.stackId, count);
+        if (count == 0)
+            continue;
+
+        // both perf and pprof store stacks leaf first
+        locations.resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            locations[i] = (uint64_t)frames[i] + 1;
+            usedFunctions[frames[i]] = true;
+        }
+
+        values[0] = sw.samples;
+        values[1] = sw.period;
+
+        message.Clear();
+        message.WritePackedUInt64(PSF_LOCATION_ID, locations);
+        message.WritePackedUInt64(PSF_VALUE, values);
+        profile.WriteMessage(PPF_SAMPLE, message);
+
+        if (profile.GetSize() >= EXPORT_BUFFER_SIZE)
+        {
+            if (!out.Write(profile.GetData()))
+                return false;
+            profile.Clear();
+        }
+    }
+
+    // the same file may be mapped more times at the same place (i.e. every process of the same binary)
+    std::vector<const MemoryRegionFile*> mappings;
+    for (const MemoryRegionFile &mf : m_mmapFiles)
+        mappings.push_back(&mf);
+
+    std::sort(mappings.begin(), mappings.end(), MemoryRegionFileBaseSortPredicate());
+
+    size_t uniqueCount = 0;
+    for (size_t i = 0; i < mappings.size(); i++)
+    {
+        if (uniqueCount > 0 && mappings[uniqueCount - 1]->base == mappings[i]->base
+            && mappings[uniqueCount - 1]->length == mappings[i]->length && mappings[uniqueCount - 1]->filename == mappings[i]->filename)
+            continue;
+
+        mappings[uniqueCount++] = mappings[i];
+    }
+    mappings.resize(uniqueCount);
+
+    // mapping IDs equal their index + 1
+    for (size_t i = 0; i < mappings.size(); i++)
+    {
+        message.Clear();
+        message.WriteUInt64(PMF_ID, i + 1);
+        message.WriteUInt64(PMF_MEMORY_START, mappings[i]->base);
+        message.WriteUInt64(PMF_MEMORY_LIMIT, mappings[i]->base + mappings[i]->length);
+        message.WriteUInt64(PMF_FILENAME, strings.Get(mappings[i]->filename));
+        message.WriteBool(PMF_HAS_FUNCTIONS, true);
+        profile.WriteMessage(PPF_MAPPING, message);
+    }
+
+    // every used function has exactly one location, at its start address
+    std::vector<const MemoryRegionFile*>::iterator mitr;
+    uint64_t address;
+
+    for (size_t i = 0; i < m_functionTable.size(); i++)
+    {
+        if (!usedFunctions[i])
+            continue;
+
+        address = m_functionTable[i].address;
+
+        message.Clear();
+        message.WriteUInt64(PLF_ID, i + 1);
+
+        // the last mapping starting at or before the address, if it contains the address
+        mitr = std::upper_bound(mappings.begin(), mappings.end(), address, MemoryRegionFileBaseSortPredicate());
+        if (mitr != mappings.begin() && address < (*(mitr - 1))->base + (*(mitr - 1))->length)
+            message.WriteUInt64(PLF_MAPPING_ID, (uint64_t)(mitr - mappings.begin()));
+
+        message.WriteUInt64(PLF_ADDRESS, address);
+
+        submessage.Clear();
+        submessage.WriteUInt64(PLNF_FUNCTION_ID, i + 1);
+        message.WriteMessage(PLF_LINE, submessage);
+
+        profile.WriteMessage(PPF_LOCATION, message);
+
+        message.Clear();
+        message.WriteUInt64(PFF_ID, i + 1);
+        message.WriteUInt64(PFF_NAME, strings.Get(m_functionTable[i].name));
+        message.WriteUInt64(PFF_SYSTEM_NAME, strings.Get(m_functionTable[i].name));
+        profile.WriteMessage(PPF_FUNCTION, message);
+
+        if (profile.GetSize() >= EXPORT_BUFFER_SIZE)
+        {
+            if (!out.Write(profile.GetData()))
+                return false;
+            profile.Clear();
+        }
+    }
+
+    if (!m_samples.empty())
+        profile.WriteInt64(PPF_DURATION_NANOS, (int64_t)(m_samples.back().time - m_samples.front().time));
+
+    // string table has to be the last, as all the other messages add to it
+    for (const std::string* str : strings.strings)
+    {
+        profile.WriteString(PPF_STRING_TABLE, *str);
+
+        if (profile.GetSize() >= EXPORT_BUFFER_SIZE)
+        {
+            if (!out.Write(profile.GetData()))
+                return false;
+            profile.Clear();
+        }
+    }
+
+    LogFunc(LOG_VERBOSE, "Exported %llu unique stacks, %llu strings", (uint64_t)stacks.size(), (uint64_t)strings.strings.size());
+
+    return out.Write(profile.GetData()) && out.Finish();
+}
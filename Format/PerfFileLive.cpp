@@ -0,0 +1,441 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "PerfRecords.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+PerfFile* PerfFile::OpenLive(const char* filename, const char* binaryfilename, PerfSymbolCache* symbolCache)
+{
+    LogFunc(LOG_DEBUG, "Opening live perf input %s", filename);
+
+    int fd;
+    if (strcmp(filename, "-") == 0)
+        fd = STDIN_FILENO;
+    else
+        fd = open(filename, O_RDONLY);
+
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        LogFunc(LOG_ERROR, "Couldn't open live perf input %s", filename);
+        if (fd > STDIN_FILENO)
+            close(fd);
+        return nullptr;
+    }
+
+    PerfFile* pfile = new PerfFile();
+    pfile->m_liveFd = fd;
+    pfile->m_symbolCache = symbolCache;
+    pfile->m_liveRegularFile = S_ISREG(st.st_mode);
+
+    if (pfile->m_liveRegularFile)
+    {
+        perf_pipe_file_header pipeHeader;
+
+        // perf writes the header as the very first thing, so it has to be there already
+        if (pread(fd, &pipeHeader, sizeof(pipeHeader), 0) != sizeof(pipeHeader))
+        {
+            LogFunc(LOG_ERROR, "Live perf input %s does not contain header", filename);
+            delete pfile;
+            return nullptr;
+        }
+
+        // pipe-mode output may also be redirected to regular file
+        if (pipeHeader.size == sizeof(perf_pipe_file_header))
+            pfile->m_liveStream = true;
+        else
+        {
+            // regular file has attributes written at start of recording, data section grows then
+            pfile->m_file = fopen(filename, "rb");
+            if (!pfile->m_file ||
+                !pfile->ReadAndCheckHeader() ||
+                !pfile->ReadAttributes() ||
+                !pfile->ReadTypes())
+            {
+                if (pfile->m_file)
+                    fclose(pfile->m_file);
+                delete pfile;
+                return nullptr;
+            }
+
+            fclose(pfile->m_file);
+            pfile->m_file = nullptr;
+
+            pfile->m_liveOffset = pfile->m_fileHeader.data.offset;
+            if (pfile->m_fileHeader.data.size != 0)
+                pfile->m_liveDataEnd = pfile->m_fileHeader.data.offset + pfile->m_fileHeader.data.size;
+        }
+
+        lseek(fd, (off_t)pfile->m_liveOffset, SEEK_SET);
+    }
+    else
+    {
+        // pipes carry pipe-mode output only; opening named pipe waited for the producer, but reading
+        // should not block, when the producer is slow
+        pfile->m_liveStream = true;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    pfile->BeginPhase(PLP_SYMBOLS);
+    pfile->LoadBinarySymbols(binaryfilename);
+    pfile->EndPhase();
+
+    return pfile;
+}
+
+bool PerfFile::Poll()
+{
+    return PollLive(false);
+}
+
+void PerfFile::FinishLive()
+{
+    PollLive(true);
+}
+
+bool PerfFile::IsLiveFinished() const
+{
+    return m_liveFinished;
+}
+
+bool PerfFile::PollLive(bool finish)
+{
+    if (m_liveFd < 0 || m_liveFinished)
+        return false;
+
+    const size_t firstRecord = m_records.size();
+    const size_t firstMmap2 = m_mmaps2.size();
+
+    BeginPhase(PLP_READ);
+    if (!ReadLiveInput() || finish)
+    {
+        LogFunc(LOG_INFO, "Live perf input finished");
+
+        // nothing else will come, so every pending record is safe to be stored
+        FlushLiveRecords(true);
+
+        m_liveFinished = true;
+        if (m_liveFd > STDIN_FILENO)
+            close(m_liveFd);
+        m_liveFd = -1;
+    }
+    EndPhase();
+
+    if (m_records.size() == firstRecord)
+        return false;
+
+    IncorporateRecords(firstRecord, firstMmap2);
+
+    return true;
+}
+
+bool PerfFile::ReadLiveInput()
+{
+    perf_file_header header;
+    size_t toRead, prevSize;
+    ssize_t res;
+
+    while (true)
+    {
+        // finalized file has data section size filled in; feature sections follow the data, so do not read beyond
+        if (m_liveRegularFile && !m_liveStream && m_liveDataEnd == 0)
+        {
+            if (pread(m_liveFd, &header, sizeof(header), 0) == sizeof(header) && header.data.size != 0)
+                m_liveDataEnd = header.data.offset + header.data.size;
+        }
+
+        toRead = LIVE_READ_CHUNK_SIZE;
+        if (m_liveDataEnd != 0)
+        {
+            if (m_liveOffset >= m_liveDataEnd)
+                return false;
+
+            toRead = (size_t)std::min<uint64_t>(toRead, m_liveDataEnd - m_liveOffset);
+        }
+
+        prevSize = m_liveBuffer.size();
+        m_liveBuffer.resize(prevSize + toRead);
+
+        res = read(m_liveFd, &m_liveBuffer[prevSize], toRead);
+
+        m_liveBuffer.resize(prevSize + ((res > 0) ? res : 0));
+
+        if (res < 0)
+        {
+            // nothing more for now
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return true;
+
+            LogFunc(LOG_ERROR, "Couldn't read live perf input (errno %i)", errno);
+            return false;
+        }
+
+        // end of regular file just means, that perf did not write anything else yet; closed pipe means finished recording
+        if (res == 0)
+            return m_liveRegularFile;
+
+        m_liveOffset += res;
+
+        // decode right away, so the buffer holds at most one incomplete event
+        if (!DecodeLiveBuffer())
+            return false;
+    }
+}
+
+bool PerfFile::DecodeLiveBuffer()
+{
+    perf_event_header header;
+    size_t pos = 0, avail, skip;
+    bool ok = true;
+
+    while (ok)
+    {
+        avail = m_liveBuffer.size() - pos;
+
+        // payload following previous event is not interesting for us
+        if (m_liveSkip > 0)
+        {
+            skip = (size_t)std::min<uint64_t>(m_liveSkip, avail);
+            pos += skip;
+            m_liveSkip -= skip;
+
+            if (m_liveSkip > 0)
+                break;
+            continue;
+        }
+
+        // pipe-mode output starts with shortened header, attributes are transferred as events
+        if (m_liveStream && !m_liveHeaderRead)
+        {
+            if (avail < sizeof(perf_pipe_file_header))
+                break;
+
+            const perf_pipe_file_header* pipeHeader = (const perf_pipe_file_header*)&m_liveBuffer[pos];
+            if (memcmp(pipeHeader->magic, perfFileMagic, PERF_FILE_MAGIC_LENGTH) != 0 || pipeHeader->size != sizeof(perf_pipe_file_header))
+            {
+                LogFunc(LOG_ERROR, "Live input is not perf pipe-mode output");
+                ok = false;
+                break;
+            }
+
+            pos += sizeof(perf_pipe_file_header);
+            m_liveHeaderRead = true;
+            continue;
+        }
+
+        if (avail < sizeof(perf_event_header))
+            break;
+
+        memcpy(&header, &m_liveBuffer[pos], sizeof(perf_event_header));
+
+        // every event has to contain at least its header, anything else means corrupted (or finished) data
+        if (header.size < sizeof(perf_event_header))
+        {
+            LogFunc(LOG_ERROR, "Invalid event in live perf input at offset %llu", m_liveOffset - avail);
+            ok = false;
+            break;
+        }
+
+        // wait for the rest of event
+        if (avail < header.size)
+            break;
+
+        ok = ProcessLiveEvent(&header, &m_liveBuffer[pos + sizeof(perf_event_header)]);
+        pos += header.size;
+    }
+
+    // keep just incomplete event for the next read
+    m_liveBuffer.erase(m_liveBuffer.begin(), m_liveBuffer.begin() + pos);
+
+    return ok;
+}
+
+bool PerfFile::ProcessLiveEvent(perf_event_header* header, uint8_t* data)
+{
+    const uint32_t esize = header->size - sizeof(perf_event_header);
+
+    m_eventNumber++;
+    CountEvent(*header);
+
+    switch (header->type)
+    {
+        case PERF_RECORD_HEADER_ATTR:
+        {
+            perf_event_attr attr;
+            uint32_t attrSize;
+
+            // attribute structure size differs between perf versions, the actual size is stored inside
+            attrSize = 0;
+            if (esize >= PERF_ATTR_SIZE_VER0)
+            {
+                memcpy(&attrSize, data + offsetof(perf_event_attr, size), sizeof(attrSize));
+                if (attrSize == 0)
+                    attrSize = PERF_ATTR_SIZE_VER0;
+            }
+
+            if (attrSize == 0 || attrSize > esize)
+            {
+                LogFunc(LOG_ERROR, "Invalid attribute event in live perf input");
+                return false;
+            }
+
+            memset(&attr, 0, sizeof(attr));
+            memcpy(&attr, data, std::min((size_t)attrSize, sizeof(attr)));
+
+            // assigned IDs follow the attribute
+            std::vector<uint64_t> ids((esize - attrSize) / sizeof(uint64_t));
+            if (!ids.empty())
+                memcpy(ids.data(), data + attrSize, ids.size() * sizeof(uint64_t));
+
+            return AddEventAttribute(attr, ids.data(), (uint32_t)ids.size());
+        }
+        case PERF_RECORD_FINISHED_ROUND:
+            FlushLiveRecords(false);
+            return true;
+        case PERF_RECORD_HEADER_TRACING_DATA:
+        {
+            tracing_data_event tracing;
+            if (esize < sizeof(tracing))
+                return false;
+
+            // tracing data follows the event, aligned to 8 bytes
+            memcpy(&tracing, data, sizeof(tracing));
+            m_liveSkip = ((uint64_t)tracing.size + 7) & ~7ULL;
+            return true;
+        }
+        case PERF_RECORD_AUXTRACE:
+        {
+            auxtrace_event auxtrace;
+            if (esize < sizeof(auxtrace))
+                return false;
+
+            // aux area data follows the event
+            memcpy(&auxtrace, data, sizeof(auxtrace));
+            m_liveSkip = auxtrace.size;
+            return true;
+        }
+    }
+
+    if (!IsDecodedRecordType(header->type))
+    {
+        LogFunc(LOG_DEBUG, "Unknown perf record, type: %u; skipped", header->type);
+        return true;
+    }
+
+    // records can't be decoded without knowing the sampling type
+    if (m_eventAttr.empty())
+    {
+        LogFunc(LOG_ERROR, "Perf record preceding any event attribute in live input");
+        return false;
+    }
+
+    perf_event evt;
+    evt.header = *header;
+    evt._generic = PrepareEventBuffer(esize);
+    memcpy(evt._generic, data, esize);
+
+    record_t* rec = DecodeRecord(evt, m_eventNumber - 1);
+    if (rec)
+    {
+        m_livePending.push_back(rec);
+        if (rec->time > m_liveMaxTime && rec->time != (uint64_t)(-1))
+            m_liveMaxTime = rec->time;
+    }
+
+    return true;
+}
+
+void PerfFile::FlushLiveRecords(bool all)
+{
+    std::stable_sort(m_livePending.begin(), m_livePending.end(), PerfRecordTimeSortPredicate());
+
+    // perf guarantees, that nothing written after the last finished round is older than anything
+    // written before the round preceding it; so everything up to the highest time seen before
+    // the previous round may be stored
+    size_t cnt = 0;
+    for (record_t* rec : m_livePending)
+    {
+        if (!all && rec->time > m_liveFlushTime)
+            break;
+
+        // keep stored records (and thus the sample table) sorted even if the guarantee does not hold
+        if (!m_records.empty() && rec->time < m_records.back()->time)
+            rec->time = m_records.back()->time;
+
+        StoreRecord(rec);
+        cnt++;
+    }
+
+    m_livePending.erase(m_livePending.begin(), m_livePending.begin() + cnt);
+
+    m_liveFlushTime = m_liveMaxTime;
+}
+
+void PerfFile::IncorporateRecords(size_t firstRecord, size_t firstMmap2)
+{
+    StackWeightVector stacks;
+    const size_t firstSample = m_samples.size();
+
+    BeginPhase(PLP_SYMBOLS);
+    ResolveMappedSymbols(firstMmap2);
+    EndPhase();
+
+    BeginPhase(PLP_SAMPLES);
+    ProcessMemoryMapping(firstRecord);
+    BuildSampleTable(firstRecord);
+
+    // flat profile and call graph are just updated with new samples (unless they were moved to core, then they are
+    // aggregated again on request)
+    CollectStackWeights(firstSample, m_samples.size(), stacks);
+    EndPhase();
+
+    if (!m_flatProfileStale)
+    {
+        BeginPhase(PLP_FLAT_PROFILE);
+        AccumulateFlatProfile(stacks, m_flatProfile);
+        FinalizeFlatProfile(m_flatProfile);
+        EndPhase();
+    }
+    if (!m_callGraphStale)
+    {
+        BeginPhase(PLP_CALL_GRAPH);
+        AggregateCallGraph(stacks, m_callGraph);
+        EndPhase();
+    }
+
+    // call tree thresholds depend on total time, so the tree is rebuilt from stack counts on request;
+    // heat map is extended on request as well
+    m_callTreeStale = true;
+    m_heatMapStale = true;
+
+    LogFunc(LOG_VERBOSE, "Incorporated %llu new records", (uint64_t)(m_records.size() - firstRecord));
+}
@@ -0,0 +1,222 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <thread>
+
+PerfFile* PerfFile::LoadMerged(const std::vector<std::string> &filenames, const char* binaryfilename, uint32_t workerCount, bool snapshotCache,
+                               uint64_t memoryBudget)
+{
+    if (filenames.empty())
+        return nullptr;
+
+    if (workerCount == 0)
+        workerCount = std::thread::hardware_concurrency();
+    if (workerCount == 0)
+        workerCount = 1;
+    if (workerCount > filenames.size())
+        workerCount = (uint32_t)filenames.size();
+
+    LogFunc(LOG_INFO, "Loading %llu perf record files using %u workers...", (uint64_t)filenames.size(), workerCount);
+
+    PerfSymbolCache symbolCache;
+
+    PerfMergeJob job;
+    job.filenames = &filenames;
+    job.binaryFilename = binaryfilename;
+    job.snapshotCache = snapshotCache;
+    job.symbolCache = &symbolCache;
+    // every worker holds one recording at a time
+    job.memoryBudget = memoryBudget / workerCount;
+    job.nextFile = 0;
+    job.mergedFiles = 0;
+
+    // every worker merges to its own partial profile, so the workers share just the symbol cache;
+    // each recording is released right after merging, so the memory does not grow with their count
+    std::vector<PerfFile*> partials(workerCount);
+    std::vector<std::thread> workers;
+
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+        partials[i] = new PerfFile();
+        workers.push_back(std::thread(MergeWorker, &job, partials[i]));
+    }
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    PerfFile* merged = partials[0];
+    for (uint32_t i = 1; i < workerCount; i++)
+    {
+        merged->MergeProfile(*partials[i]);
+        delete partials[i];
+    }
+
+    if (job.mergedFiles == 0)
+    {
+        LogFunc(LOG_ERROR, "None of perf record files could be loaded");
+        delete merged;
+        return nullptr;
+    }
+
+    LogFunc(LOG_VERBOSE, "Merged %llu of %llu perf record files, symbol listings reused %llu times",
+        (uint64_t)job.mergedFiles, (uint64_t)filenames.size(), symbolCache.GetHitCount());
+    LogFunc(LOG_VERBOSE, "Merged functions: %u, unique stacks: %u", (uint32_t)merged->m_functionTable.size(), merged->m_stacks.GetStackCount());
+
+    merged->LogLoadStats();
+
+    // profiles are aggregated from merged stacks on first request
+    return merged;
+}
+
+void PerfFile::MergeWorker(PerfMergeJob* job, PerfFile* partial)
+{
+    size_t index;
+    PerfFile* pfile;
+
+    while ((index = job->nextFile++) < job->filenames->size())
+    {
+        const char* filename = (*job->filenames)[index].c_str();
+
+        pfile = Load(filename, job->binaryFilename, nullptr, job->snapshotCache, job->symbolCache, job->memoryBudget);
+        if (!pfile)
+        {
+            LogFunc(LOG_ERROR, "Could not load perf record file %s, skipping it", filename);
+            continue;
+        }
+
+        partial->MergeProfile(*pfile);
+        delete pfile;
+
+        job->mergedFiles++;
+    }
+}
+
+void PerfFile::MergeProfile(const PerfFile &src)
+{
+    // the same function may reside at different addresses in every recording (or not be resolved at all in some),
+    // so the only common identity is its name
+    std::vector<uint32_t> functionIds(src.m_functionTable.size());
+
+    for (size_t i = 0; i < src.m_functionTable.size(); i++)
+    {
+        auto itr = m_mergedFunctionIds.find(src.m_functionTable[i].name);
+        if (itr == m_mergedFunctionIds.end())
+        {
+            functionIds[i] = (uint32_t)m_functionTable.size();
+            m_functionTable.push_back(src.m_functionTable[i]);
+            m_mergedFunctionIds[src.m_functionTable[i].name] = functionIds[i];
+        }
+        else
+            functionIds[i] = itr->second;
+    }
+
+    // stacks are translated to merged function IDs and interned again, so identical paths of all recordings
+    // share single stack
+    std::vector<uint32_t> frames;
+    const uint32_t* srcFrames;
+    uint32_t count, stackId;
+
+    for (uint32_t i = 0; i < src.m_stackCounts.size(); i++)
+    {
+        if (src.m_stackCounts[i] == 0)
+            continue;
+
+        srcFrames = src.m_stacks.GetFrames(i, count);
+
+        frames.resize(count);
+        for (uint32_t j = 0; j < count; j++)
+            frames[j] = functionIds[srcFrames[j]];
+
+        stackId = m_stacks.Intern(frames.data(), count);
+
+        if (stackId >= m_stackCounts.size())
+        {
+            m_stackCounts.resize(stackId + 1, 0);
+            m_stackPeriods.resize(stackId + 1, 0);
+        }
+        m_stackCounts[stackId] += src.m_stackCounts[i];
+        m_stackPeriods[stackId] += src.m_stackPeriods[i];
+    }
+
+    for (size_t i = 0; i < src.m_functionCounters.size(); i++)
+    {
+        if (src.m_functionCounters[i].sampleCount == 0)
+            continue;
+
+        if (functionIds[i] >= m_functionCounters.size())
+            m_functionCounters.resize(functionIds[i] + 1, PerfCounterTotals());
+
+        PerfCounterTotals &totals = m_functionCounters[functionIds[i]];
+        totals.sampleCount += src.m_functionCounters[i].sampleCount;
+        for (int k = 0; k < PCK_COUNT; k++)
+            totals.values[k] += src.m_functionCounters[i].values[k];
+    }
+
+    // branch histograms are keyed by addresses, which are the same for the same binary
+    PerfBranchEdge edge;
+    for (const PerfBranchEdge &srcEdge : src.m_branchEdges)
+    {
+        edge = srcEdge;
+        edge.fromFunctionId = (edge.fromFunctionId == INVALID_FUNCTION_ID) ? INVALID_FUNCTION_ID : functionIds[edge.fromFunctionId];
+        edge.toFunctionId = (edge.toFunctionId == INVALID_FUNCTION_ID) ? INVALID_FUNCTION_ID : functionIds[edge.toFunctionId];
+        AddBranchEdge(edge);
+    }
+
+    PerfBasicBlock block;
+    for (const PerfBasicBlock &srcBlock : src.m_basicBlocks)
+    {
+        block = srcBlock;
+        block.functionId = functionIds[block.functionId];
+        AddBasicBlock(block);
+    }
+
+    // phase times and counters are summed over all recordings (times of concurrently loaded ones included),
+    // peak memory is the one of the largest recording
+    PerfLoadStats srcStats;
+    src.FillLoadStats(srcStats);
+
+    for (int i = 0; i < PLP_COUNT; i++)
+    {
+        m_loadStats.phases[i].wallMs += srcStats.phases[i].wallMs;
+        m_loadStats.phases[i].cpuMs += srcStats.phases[i].cpuMs;
+        m_loadStats.phases[i].runs += srcStats.phases[i].runs;
+    }
+    for (int i = 0; i < PMS_COUNT; i++)
+        m_loadStats.peakMemory[i] = std::max(m_loadStats.peakMemory[i], srcStats.peakMemory[i]);
+
+    m_loadStats.bytesRead += srcStats.bytesRead;
+    m_loadStats.uniqueIps += srcStats.uniqueIps;
+    m_loadStats.unresolvedIps += srcStats.unresolvedIps;
+    m_loadStats.spilledSamples += srcStats.spilledSamples;
+    m_loadStats.spillRuns += srcStats.spillRuns;
+    m_loadStats.spilledBytes += srcStats.spilledBytes;
+    for (auto &itr : srcStats.recordCounts)
+        m_loadStats.recordCounts[itr.first] += itr.second;
+    for (auto &itr : srcStats.dsoSymbols)
+        m_loadStats.dsoSymbols[itr.first] += itr.second;
+}
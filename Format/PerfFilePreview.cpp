@@ -0,0 +1,323 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "PerfRecords.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+bool PerfFile::IsPreview() const
+{
+    return (m_previewFraction < 1.0);
+}
+
+double PerfFile::GetPreviewFraction() const
+{
+    return m_previewFraction;
+}
+
+void PerfFile::FillPreviewErrorBounds(std::vector<PerfPreviewFunctionRecord> &dst)
+{
+    dst.assign(m_previewBounds.begin(), m_previewBounds.end());
+}
+
+bool PerfFile::ReadPreviewData(const PerfPreviewOptions &options, std::vector<uint32_t> &recordChunks)
+{
+    LogFunc(LOG_VERBOSE, "Reading preview of records from perf file");
+
+    LogFunc(LOG_DEBUG, "Data section size: %llu", m_fileHeader.data.size);
+
+    if (m_fileHeader.data.offset == 0 && m_fileHeader.data.size == 0)
+    {
+        LogFunc(LOG_ERROR, "Specified perf file does not contain any profiling data");
+        return false;
+    }
+
+    const uint64_t dataEnd = m_fileHeader.data.offset + m_fileHeader.data.size;
+    const double fraction = std::min(std::max(options.fraction, 0.0), 1.0);
+    const uint64_t budget = (uint64_t)((double)m_fileHeader.data.size * fraction);
+
+    // chunks are aligned the same way as events are
+    uint64_t chunkSize = std::max<uint64_t>(options.chunkSize, PREVIEW_MIN_CHUNK_SIZE) & ~(uint64_t)(sizeof(uint64_t) - 1);
+
+    // rather use smaller chunks than too few of them
+    if (budget / chunkSize < PREVIEW_MIN_CHUNK_COUNT)
+        chunkSize = std::max<uint64_t>(budget / PREVIEW_MIN_CHUNK_COUNT, PREVIEW_MIN_CHUNK_SIZE) & ~(uint64_t)(sizeof(uint64_t) - 1);
+
+    // too small fraction is raised, so there's enough chunks to estimate the error from
+    const uint64_t chunkCount = std::max<uint64_t>(budget / chunkSize, PREVIEW_MIN_CHUNK_COUNT);
+
+    // preview of small recording (or of most of it) would not save anything
+    if (chunkCount * chunkSize * 2 > m_fileHeader.data.size)
+    {
+        LogFunc(LOG_INFO, "Recording is too small for preview, loading whole recording");
+        return ReadData();
+    }
+
+    // events synthesized at the beginning (mmaps and comms of processes running before the recording started)
+    // are needed to resolve samples from anywhere, so everything up to the first sample is read
+    const uint64_t sampledStart = ReadEvents(m_fileHeader.data.offset, dataEnd, true);
+    const uint64_t sampledSize = dataEnd - sampledStart;
+
+    recordChunks.assign(m_records.size(), PREVIEW_NO_CHUNK);
+
+    // the rest is split to equally sized strata, one randomly placed chunk is decoded from each of them
+    const uint64_t stratumSize = (sampledSize / chunkCount) & ~(uint64_t)(sizeof(uint64_t) - 1);
+    if (stratumSize < chunkSize)
+    {
+        LogFunc(LOG_INFO, "Most of the recording precedes first sample, loading whole recording");
+        ReadEvents(sampledStart, dataEnd, false);
+        recordChunks.clear();
+        return true;
+    }
+
+    std::mt19937_64 random(options.seed);
+    std::uniform_int_distribution<uint64_t> placement(0, (stratumSize - chunkSize) / sizeof(uint64_t));
+
+    uint64_t decoded = 0, offset;
+    for (uint64_t i = 0; i < chunkCount; i++)
+    {
+        offset = sampledStart + i * stratumSize + placement(random) * sizeof(uint64_t);
+
+        if (ReadPreviewChunk(offset, chunkSize, dataEnd, m_previewChunkCount, recordChunks))
+        {
+            m_previewChunkCount++;
+            decoded += chunkSize;
+        }
+    }
+
+    m_previewFraction = (double)decoded / (double)sampledSize;
+
+    LogFunc(LOG_VERBOSE, "Loaded %llu records from %u preview chunks (%.2f%% of data section)", (uint64_t)m_records.size(), m_previewChunkCount, m_previewFraction * 100.0);
+
+    return true;
+}
+
+bool PerfFile::ReadPreviewChunk(uint64_t offset, uint64_t length, uint64_t dataEnd, uint32_t chunk, std::vector<uint32_t> &recordChunks)
+{
+    // events starting within chunk may overlap its end by up to maximum event size
+    const uint64_t bufferSize = std::min<uint64_t>(length + UINT16_MAX, dataEnd - offset);
+    std::vector<uint8_t> buffer(bufferSize);
+
+    fseek(m_file, (long)offset, SEEK_SET);
+    if (fread(buffer.data(), 1, bufferSize, m_file) != bufferSize)
+    {
+        LogFunc(LOG_ERROR, "Unexpected end of data section, offset %llu", offset);
+        return false;
+    }
+
+    uint64_t pos;
+    if (!FindEventBoundary(buffer.data(), bufferSize, (offset + bufferSize == dataEnd), pos))
+    {
+        LogFunc(LOG_DEBUG, "No event boundary found in preview chunk at offset %llu; skipped", offset);
+        return false;
+    }
+
+    perf_event evt;
+    uint32_t esize;
+    record_t* rec;
+
+    while (pos < length && pos + sizeof(perf_event_header) <= bufferSize)
+    {
+        memcpy(&evt.header, &buffer[pos], sizeof(perf_event_header));
+
+        // wrong synchronization, or corrupted data; keep what was decoded so far
+        if (!IsPlausibleEventHeader(evt.header) || pos + evt.header.size > bufferSize)
+        {
+            LogFunc(LOG_DEBUG, "Lost event boundary in preview chunk at offset %llu", offset + pos);
+            break;
+        }
+
+        m_eventNumber++;
+        CountEvent(evt.header);
+
+        if (IsDecodedRecordType(evt.header.type))
+        {
+            esize = evt.header.size - sizeof(perf_event_header);
+
+            evt._generic = PrepareEventBuffer(esize);
+            memcpy(evt._generic, &buffer[pos + sizeof(perf_event_header)], esize);
+
+            rec = DecodeRecord(evt, m_eventNumber - 1);
+            if (rec)
+            {
+                StoreRecord(rec);
+                recordChunks.push_back(chunk);
+            }
+        }
+
+        pos += evt.header.size;
+    }
+
+    return true;
+}
+
+bool PerfFile::FindEventBoundary(const uint8_t* buffer, uint64_t length, bool atDataEnd, uint64_t &position)
+{
+    perf_event_header header;
+    uint64_t pos;
+    uint32_t chain;
+
+    // events are aligned to 8 bytes, so just aligned positions are tried
+    for (position = 0; position + sizeof(perf_event_header) <= length; position += sizeof(uint64_t))
+    {
+        pos = position;
+
+        for (chain = 0; chain < PREVIEW_RESYNC_CHAIN_LENGTH && pos + sizeof(perf_event_header) <= length; chain++)
+        {
+            memcpy(&header, buffer + pos, sizeof(perf_event_header));
+            if (!IsPlausibleEventHeader(header))
+                break;
+
+            pos += header.size;
+        }
+
+        // shorter chain is fine only if it ends exactly at the end of data section
+        if (chain == PREVIEW_RESYNC_CHAIN_LENGTH || (atDataEnd && pos == length))
+            return true;
+    }
+
+    return false;
+}
+
+bool PerfFile::IsPlausibleEventHeader(const perf_event_header &header)
+{
+    // every event is padded to 8 bytes
+    if (header.size < sizeof(perf_event_header) || (header.size % sizeof(uint64_t)) != 0)
+        return false;
+
+    return ((header.type > 0 && header.type < PERF_RECORD_MAX)
+        || (header.type >= PERF_RECORD_USER_TYPE_START && header.type < PERF_RECORD_HEADER_MAX));
+}
+
+void PerfFile::SortPreviewRecords(std::vector<uint32_t> &recordChunks)
+{
+    std::vector<PreviewRecord> records(m_records.size());
+
+    for (size_t i = 0; i < m_records.size(); i++)
+        records[i] = PreviewRecord(m_records[i], recordChunks[i]);
+
+    std::sort(records.begin(), records.end(), PreviewRecordTimeSortPredicate());
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        m_records[i] = records[i].first;
+        recordChunks[i] = records[i].second;
+    }
+}
+
+void PerfFile::ComputePreviewErrorBounds(const std::vector<uint32_t> &recordChunks)
+{
+    LogFunc(LOG_VERBOSE, "Estimating preview error bounds...");
+
+    std::vector< std::vector<StackSample> > chunkStacks(m_previewChunkCount);
+    std::vector<uint64_t> chunkSamples(m_previewChunkCount, 0);
+    size_t sampleIndex = 0;
+    uint32_t chunk;
+
+    // sample table holds samples in the same order as sample records are stored
+    for (size_t r = 0; r < m_records.size(); r++)
+    {
+        if (m_records[r]->type != PERF_RECORD_SAMPLE)
+            continue;
+
+        chunk = recordChunks[r];
+        const PerfSample &ps = m_samples[sampleIndex++];
+
+        if (chunk == PREVIEW_NO_CHUNK)
+            continue;
+
+        chunkSamples[chunk]++;
+        if (ps.stackId != INVALID_STACK_ID)
+            chunkStacks[chunk].push_back(StackSample(ps.stackId, ps.period));
+    }
+
+    std::vector<PreviewRatioSums> self(m_functionTable.size());
+    std::vector<PreviewRatioSums> inclusive(m_functionTable.size());
+    std::vector<FlatProfileRecord> chunkProfile;
+    StackWeightVector weights;
+    double samples = 0.0, samplesSquared = 0.0, n, y;
+
+    // every chunk gets its own flat profile; the spread among them tells the error
+    for (uint32_t c = 0; c < m_previewChunkCount; c++)
+    {
+        CountStackIds(chunkStacks[c], weights);
+        chunkProfile.clear();
+        AccumulateFlatProfile(weights, chunkProfile);
+
+        n = (double)chunkSamples[c];
+        samples += n;
+        samplesSquared += n * n;
+
+        for (size_t i = 0; i < chunkProfile.size(); i++)
+        {
+            y = chunkProfile[i].timeTotal;
+            self[i].y += y;
+            self[i].yy += y * y;
+            self[i].yn += y * n;
+
+            y = chunkProfile[i].timeTotalInclusive;
+            inclusive[i].y += y;
+            inclusive[i].yy += y * y;
+            inclusive[i].yn += y * n;
+        }
+    }
+
+    m_previewBounds.resize(m_functionTable.size());
+
+    for (size_t i = 0; i < m_functionTable.size(); i++)
+    {
+        PerfPreviewFunctionRecord &rec = m_previewBounds[i];
+
+        rec.functionId = (uint32_t)i;
+        EstimatePreviewRatio(self[i], samples, samplesSquared, rec.self, rec.selfError);
+        EstimatePreviewRatio(inclusive[i], samples, samplesSquared, rec.inclusive, rec.inclusiveError);
+    }
+}
+
+void PerfFile::EstimatePreviewRatio(const PreviewRatioSums &sums, double samples, double samplesSquared, double &ratio, double &error)
+{
+    const double k = (double)m_previewChunkCount;
+
+    ratio = (samples > 0.0) ? sums.y / samples : 0.0;
+
+    // the spread can't be estimated from single chunk
+    if (m_previewChunkCount < 2 || samples <= 0.0)
+    {
+        error = 1.0;
+        return;
+    }
+
+    // samples within chunk are not independent, so the chunks are treated as sampling units (ratio estimator
+    // of cluster sampling); the variance is lowered by finite population correction for decoded fraction
+    double variance = k * (sums.yy - 2.0 * ratio * sums.yn + ratio * ratio * samplesSquared) / ((k - 1.0) * samples * samples);
+    variance *= (1.0 - m_previewFraction);
+
+    // with just a few chunks, normal quantile is widened to approximate Student's t quantile
+    const double z = PREVIEW_CONFIDENCE_Z * (1.0 + (PREVIEW_CONFIDENCE_Z * PREVIEW_CONFIDENCE_Z + 1.0) / (4.0 * (k - 1.0)));
+
+    error = z * sqrt(std::max(variance, 0.0));
+}
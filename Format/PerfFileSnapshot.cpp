@@ -0,0 +1,444 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "PerfSnapshot.h"
+#include "Log.h"
+
+#include <stack>
+
+PerfFile* PerfFile::LoadSnapshot(const char* path, const PerfSnapshotKey &key)
+{
+    PerfSnapshot* snapshot = new PerfSnapshot();
+
+    if (!snapshot->Open(path, key))
+    {
+        delete snapshot;
+        return nullptr;
+    }
+
+    LogFunc(LOG_INFO, "Restoring profile from snapshot %s", path);
+
+    PerfFile* pfile = new PerfFile();
+
+    pfile->BeginPhase(PLP_SNAPSHOT);
+    if (!pfile->RestoreSnapshot(*snapshot))
+    {
+        LogFunc(LOG_ERROR, "Snapshot %s is corrupted, loading recording instead", path);
+        ReleaseCallTree(pfile->m_callTree);
+        delete pfile;
+        delete snapshot;
+        return nullptr;
+    }
+    pfile->EndPhase();
+
+    // keep the mapping for lifetime of the file, its stack table is used in place
+    pfile->m_snapshot = snapshot;
+
+    return pfile;
+}
+
+bool PerfFile::RestoreSnapshot(const PerfSnapshot &snapshot)
+{
+    uint64_t count, stringCount, frameCount, offsetCount;
+
+    // at first, retrieve and verify all sections
+    const PerfSnapshotProperties* props = (const PerfSnapshotProperties*)snapshot.GetSection(PSS_PROPERTIES, sizeof(PerfSnapshotProperties), count);
+    if (!props || count != 1 || props->weighting > PSW_PERIOD || props->stackMode > PSM_COMBINED)
+        return false;
+
+    const char* strings = (const char*)snapshot.GetSection(PSS_STRINGS, sizeof(char), stringCount);
+    const uint32_t* offsets = (const uint32_t*)snapshot.GetSection(PSS_STACK_OFFSETS, sizeof(uint32_t), offsetCount);
+    const uint32_t* frames = (const uint32_t*)snapshot.GetSection(PSS_STACK_FRAMES, sizeof(uint32_t), frameCount);
+    if (!strings || !offsets || !frames || offsetCount == 0 || offsets[offsetCount - 1] != frameCount)
+        return false;
+
+    const uint32_t stackCount = (uint32_t)(offsetCount - 1);
+
+    uint64_t functionCount;
+    const PerfSnapshotFunction* functions = (const PerfSnapshotFunction*)snapshot.GetSection(PSS_FUNCTIONS, sizeof(PerfSnapshotFunction), functionCount);
+    if (!functions)
+        return false;
+
+    // every stored ID has to point within its table
+    for (uint64_t i = 0; i < frameCount; i++)
+    {
+        if (frames[i] >= functionCount)
+            return false;
+    }
+
+    for (uint32_t i = 0; i < stackCount; i++)
+    {
+        if (offsets[i] > offsets[i + 1])
+            return false;
+    }
+
+    uint64_t sampleCount;
+    const PerfSample* samples = (const PerfSample*)snapshot.GetSection(PSS_SAMPLES, sizeof(PerfSample), sampleCount);
+    if (!samples)
+        return false;
+
+    for (uint64_t i = 0; i < sampleCount; i++)
+    {
+        if (samples[i].stackId != INVALID_STACK_ID && samples[i].stackId >= stackCount)
+            return false;
+    }
+
+    const uint64_t* stackCounts = (const uint64_t*)snapshot.GetSection(PSS_STACK_COUNTS, sizeof(uint64_t), count);
+    if (!stackCounts || count != stackCount)
+        return false;
+
+    const uint64_t* stackPeriods = (const uint64_t*)snapshot.GetSection(PSS_STACK_PERIODS, sizeof(uint64_t), count);
+    if (!stackPeriods || count != stackCount)
+        return false;
+
+    uint64_t flatCount, edgeCount, nodeCount, binCount, entryCount, threadCount, intervalCount, branchCount, blockCount, counterCount, attrCount, eventCount;
+
+    const FlatProfileRecord* flat = (const FlatProfileRecord*)snapshot.GetSection(PSS_FLAT_PROFILE, sizeof(FlatProfileRecord), flatCount);
+    const PerfSnapshotCallGraphEdge* edges = (const PerfSnapshotCallGraphEdge*)snapshot.GetSection(PSS_CALL_GRAPH, sizeof(PerfSnapshotCallGraphEdge), edgeCount);
+    const PerfSnapshotCallTreeNode* nodes = (const PerfSnapshotCallTreeNode*)snapshot.GetSection(PSS_CALL_TREE, sizeof(PerfSnapshotCallTreeNode), nodeCount);
+    const uint64_t* binEnds = (const uint64_t*)snapshot.GetSection(PSS_HEAT_MAP_BINS, sizeof(uint64_t), binCount);
+    const HeatMapBinEntry* entries = (const HeatMapBinEntry*)snapshot.GetSection(PSS_HEAT_MAP_ENTRIES, sizeof(HeatMapBinEntry), entryCount);
+    const PerfSnapshotThread* threads = (const PerfSnapshotThread*)snapshot.GetSection(PSS_THREADS, sizeof(PerfSnapshotThread), threadCount);
+    const PerfSwitchInterval* intervals = (const PerfSwitchInterval*)snapshot.GetSection(PSS_SWITCH_INTERVALS, sizeof(PerfSwitchInterval), intervalCount);
+    const PerfBranchEdge* branches = (const PerfBranchEdge*)snapshot.GetSection(PSS_BRANCH_EDGES, sizeof(PerfBranchEdge), branchCount);
+    const PerfBasicBlock* blocks = (const PerfBasicBlock*)snapshot.GetSection(PSS_BASIC_BLOCKS, sizeof(PerfBasicBlock), blockCount);
+    const PerfCounterTotals* counters = (const PerfCounterTotals*)snapshot.GetSection(PSS_FUNCTION_COUNTERS, sizeof(PerfCounterTotals), counterCount);
+    const event_type_entry* attrs = (const event_type_entry*)snapshot.GetSection(PSS_EVENT_ATTRIBUTES, sizeof(event_type_entry), attrCount);
+    const uint32_t* events = (const uint32_t*)snapshot.GetSection(PSS_SAMPLE_EVENTS, sizeof(uint32_t), eventCount);
+
+    if (!flat || ((props->products & PSP_FLAT_PROFILE) && flatCount != functionCount) || !edges || !nodes || !binEnds || !entries || !threads || !intervals || !branches || !blocks
+        || !counters || counterCount > functionCount || !attrs || !events || (eventCount != 0 && eventCount != sampleCount))
+        return false;
+
+    for (uint64_t i = 0; i < eventCount; i++)
+    {
+        if (events[i] >= attrCount)
+            return false;
+    }
+
+    for (uint64_t i = 0; i < intervalCount; i++)
+    {
+        if (intervals[i].stackId != INVALID_STACK_ID && intervals[i].stackId >= stackCount)
+            return false;
+    }
+
+    // bulk tables are copied as they are
+    // stack table is used right from the mapping; the rest is copied, as it's held in standard containers, which
+    // are indexed and extended further (live samples, merges)
+    m_stacks.AssignMapped(frames, (size_t)frameCount, offsets, stackCount);
+    m_stackCounts.assign(stackCounts, stackCounts + stackCount);
+    m_stackPeriods.assign(stackPeriods, stackPeriods + stackCount);
+    m_functionCounters.assign(counters, counters + counterCount);
+    m_eventAttr.assign(attrs, attrs + attrCount);
+    m_sampleEvents.assign(events, events + eventCount);
+    m_samples.assign(samples, samples + sampleCount);
+    m_flatProfile.assign(flat, flat + flatCount);
+
+    m_functionTable.resize((size_t)functionCount);
+    for (uint64_t i = 0; i < functionCount; i++)
+    {
+        const PerfSnapshotFunction &fnc = functions[i];
+        if (fnc.nameOffset > stringCount || fnc.nameLength > stringCount - fnc.nameOffset)
+            return false;
+
+        FunctionEntry &fe = m_functionTable[i];
+        fe.address = fnc.address;
+        fe.functionId = 0;
+        fe.name.assign(strings + fnc.nameOffset, fnc.nameLength);
+        fe.classId = fnc.classId;
+        fe.functionType = (FunctionEntryType)fnc.functionType;
+    }
+
+    for (uint64_t i = 0; i < edgeCount; i++)
+    {
+        if (edges[i].caller >= functionCount || edges[i].callee >= functionCount)
+            return false;
+
+        m_callGraph[edges[i].caller][edges[i].callee] = edges[i].count;
+    }
+
+    // parents are stored before their children, so every parent node exists already
+    std::vector<CallTreeNode*> treeNodes((size_t)nodeCount);
+    CallTreeNode* node;
+    for (uint64_t i = 0; i < nodeCount; i++)
+    {
+        if (nodes[i].functionId >= functionCount || (nodes[i].parent != PERF_SNAPSHOT_NO_PARENT && nodes[i].parent >= i))
+            return false;
+
+        node = CreateCallTreeNode(nodes[i].functionId, (nodes[i].parent == PERF_SNAPSHOT_NO_PARENT) ? nullptr : treeNodes[nodes[i].parent]);
+        node->timeTotal = nodes[i].timeTotal;
+        node->timeTotalPct = nodes[i].timeTotalPct;
+        node->sampleCount = nodes[i].sampleCount;
+
+        if (node->parent)
+            node->parent->children[node->functionId] = node;
+        else
+            m_callTree[node->functionId] = node;
+
+        treeNodes[i] = node;
+    }
+
+    // restored profiles were built with stored settings; changing them makes the profiles stale as usual
+    m_weighting = (PerfSampleWeighting)props->weighting;
+    m_stackMode = (PerfStackMode)props->stackMode;
+    m_foldRecursion = (props->foldRecursion != 0);
+
+    // restored profiles are complete, the ones not stored are aggregated from stacks when requested; the other views
+    // of call tree are never stored
+    m_flatProfileStale = !(props->products & PSP_FLAT_PROFILE);
+    m_callGraphStale = !(props->products & PSP_CALL_GRAPH);
+    m_callTreeStale = !(props->products & PSP_CALL_TREE);
+    m_callTreeViewsStale = true;
+
+    for (uint64_t i = 0; i < threadCount; i++)
+    {
+        m_threadPids[threads[i].tid] = threads[i].pid;
+
+        if (threads[i].nameOffset == PERF_SNAPSHOT_NO_NAME)
+            continue;
+
+        if (threads[i].nameOffset > stringCount || threads[i].nameLength > stringCount - threads[i].nameOffset)
+            return false;
+
+        m_threadComms[threads[i].tid] = std::string(strings + threads[i].nameOffset, threads[i].nameLength);
+    }
+
+    // just the finest heat map level is stored, coarser ones are cheap to merge
+    if (binCount > 0)
+    {
+        m_heatMapBaseWidth = props->heatMapBaseWidth;
+        m_heatMap.Reset(m_heatMapBaseWidth);
+
+        std::vector<HeatMapBin> &bins = m_heatMap.GetBaseBins();
+        bins.resize((size_t)binCount);
+
+        uint64_t start = 0;
+        for (uint64_t i = 0; i < binCount; i++)
+        {
+            if (binEnds[i] < start || binEnds[i] > entryCount)
+                return false;
+
+            bins[i].assign(entries + start, entries + binEnds[i]);
+            start = binEnds[i];
+        }
+
+        m_heatMap.BuildLevels();
+    }
+
+    for (uint64_t i = 0; i < branchCount; i++)
+    {
+        if ((branches[i].fromFunctionId != INVALID_FUNCTION_ID && branches[i].fromFunctionId >= functionCount)
+            || (branches[i].toFunctionId != INVALID_FUNCTION_ID && branches[i].toFunctionId >= functionCount))
+            return false;
+
+        AddBranchEdge(branches[i]);
+    }
+
+    for (uint64_t i = 0; i < blockCount; i++)
+    {
+        if (blocks[i].functionId >= functionCount)
+            return false;
+
+        AddBasicBlock(blocks[i]);
+    }
+
+    m_switchIntervals.assign(intervals, intervals + intervalCount);
+    for (const PerfSwitchInterval &pi : m_switchIntervals)
+    {
+        if (m_firstSwitchTime == 0 || pi.start < m_firstSwitchTime)
+            m_firstSwitchTime = pi.start;
+    }
+
+    RebuildSampleIndexes();
+
+    LogFunc(LOG_VERBOSE, "Restored %u functions, %llu samples, %u unique stacks", (uint32_t)functionCount, sampleCount, stackCount);
+
+    return true;
+}
+
+bool PerfFile::SaveSnapshot(const char* path, const PerfSnapshotKey &key)
+{
+    LogFunc(LOG_VERBOSE, "Saving profile snapshot to %s", path);
+
+    // snapshot cache is opt-in, so the whole-recording profiles are aggregated for it right away; restored snapshot
+    // then serves them without any aggregation
+    PrepareFlatProfile();
+    PrepareCallGraph();
+    PrepareCallTree();
+    PrepareHeatMap();
+
+    BeginPhase(PLP_SNAPSHOT);
+
+    PerfSnapshot snapshot;
+    std::string strings;
+
+    PerfSnapshotProperties props;
+    memset(&props, 0, sizeof(props));
+    props.heatMapBaseWidth = m_heatMapBaseWidth;
+    props.weighting = (uint32_t)m_weighting;
+    props.stackMode = (uint32_t)m_stackMode;
+    props.foldRecursion = m_foldRecursion ? 1 : 0;
+    if (!m_flatProfileStale)
+        props.products |= PSP_FLAT_PROFILE;
+    if (!m_callGraphStale)
+        props.products |= PSP_CALL_GRAPH;
+    if (!m_callTreeStale)
+        props.products |= PSP_CALL_TREE;
+
+    std::vector<PerfSnapshotFunction> functions(m_functionTable.size());
+    for (size_t i = 0; i < m_functionTable.size(); i++)
+    {
+        PerfSnapshotFunction &fnc = functions[i];
+        memset(&fnc, 0, sizeof(fnc));
+
+        fnc.address = m_functionTable[i].address;
+        fnc.nameOffset = strings.size();
+        fnc.nameLength = (uint32_t)m_functionTable[i].name.size();
+        fnc.classId = m_functionTable[i].classId;
+        fnc.functionType = (uint32_t)m_functionTable[i].functionType;
+
+        strings += m_functionTable[i].name;
+    }
+
+    std::vector<PerfSnapshotThread> threads;
+    PerfSnapshotThread thr;
+    for (auto &itr : m_threadPids)
+    {
+        memset(&thr, 0, sizeof(thr));
+        thr.tid = itr.first;
+        thr.pid = itr.second;
+        thr.nameOffset = PERF_SNAPSHOT_NO_NAME;
+
+        auto comm = m_threadComms.find(itr.first);
+        if (comm != m_threadComms.end())
+        {
+            thr.nameOffset = strings.size();
+            thr.nameLength = (uint32_t)comm->second.size();
+            strings += comm->second;
+        }
+
+        threads.push_back(thr);
+    }
+
+    std::vector<PerfSnapshotCallGraphEdge> edges;
+    PerfSnapshotCallGraphEdge edge;
+    if (props.products & PSP_CALL_GRAPH)
+    {
+        for (auto &caller : m_callGraph)
+        {
+            for (auto &callee : caller.second)
+            {
+                edge.caller = caller.first;
+                edge.callee = callee.first;
+                edge.count = callee.second;
+                edges.push_back(edge);
+            }
+        }
+    }
+
+    // depth-first traversal stores every node after its parent
+    std::vector<PerfSnapshotCallTreeNode> nodes;
+    std::stack<std::pair<CallTreeNode*, uint32_t> > dstack;
+    PerfSnapshotCallTreeNode snode;
+
+    if (props.products & PSP_CALL_TREE)
+    {
+        for (auto &root : m_callTree)
+            dstack.push(std::make_pair(root.second, PERF_SNAPSHOT_NO_PARENT));
+    }
+
+    while (!dstack.empty())
+    {
+        CallTreeNode* node = dstack.top().first;
+        snode.parent = dstack.top().second;
+        dstack.pop();
+
+        snode.functionId = node->functionId;
+        snode.sampleCount = node->sampleCount;
+        snode.timeTotal = node->timeTotal;
+        snode.timeTotalPct = node->timeTotalPct;
+        nodes.push_back(snode);
+
+        for (auto &child : node->children)
+            dstack.push(std::make_pair(child.second, (uint32_t)(nodes.size() - 1)));
+    }
+
+    std::vector<uint64_t> binEnds;
+    std::vector<HeatMapBinEntry> entries;
+    if (m_heatMap.IsBuilt() && !m_heatMapStale)
+    {
+        for (const HeatMapBin &bin : m_heatMap.GetBaseBins())
+        {
+            entries.insert(entries.end(), bin.begin(), bin.end());
+            binEnds.push_back(entries.size());
+        }
+    }
+
+    snapshot.SetSection(PSS_PROPERTIES, &props, sizeof(props), 1);
+    snapshot.SetSection(PSS_FUNCTIONS, functions.data(), sizeof(PerfSnapshotFunction), functions.size());
+    snapshot.SetSection(PSS_STRINGS, strings.data(), sizeof(char), strings.size());
+    snapshot.SetSection(PSS_STACK_OFFSETS, m_stacks.GetOffsetData(), sizeof(uint32_t), m_stacks.GetStackCount() + 1);
+    snapshot.SetSection(PSS_STACK_FRAMES, m_stacks.GetFrameData(), sizeof(uint32_t), m_stacks.GetFrameCount());
+    snapshot.SetSection(PSS_STACK_COUNTS, m_stackCounts.data(), sizeof(uint64_t), m_stackCounts.size());
+    snapshot.SetSection(PSS_STACK_PERIODS, m_stackPeriods.data(), sizeof(uint64_t), m_stackPeriods.size());
+    snapshot.SetSection(PSS_SAMPLES, m_samples.data(), sizeof(PerfSample), m_samples.size());
+    snapshot.SetSection(PSS_FLAT_PROFILE, m_flatProfile.data(), sizeof(FlatProfileRecord), (props.products & PSP_FLAT_PROFILE) ? m_flatProfile.size() : 0);
+    snapshot.SetSection(PSS_CALL_GRAPH, edges.data(), sizeof(PerfSnapshotCallGraphEdge), edges.size());
+    snapshot.SetSection(PSS_CALL_TREE, nodes.data(), sizeof(PerfSnapshotCallTreeNode), nodes.size());
+    snapshot.SetSection(PSS_HEAT_MAP_BINS, binEnds.data(), sizeof(uint64_t), binEnds.size());
+    snapshot.SetSection(PSS_HEAT_MAP_ENTRIES, entries.data(), sizeof(HeatMapBinEntry), entries.size());
+    snapshot.SetSection(PSS_THREADS, threads.data(), sizeof(PerfSnapshotThread), threads.size());
+    snapshot.SetSection(PSS_SWITCH_INTERVALS, m_switchIntervals.data(), sizeof(PerfSwitchInterval), m_switchIntervals.size());
+    snapshot.SetSection(PSS_BRANCH_EDGES, m_branchEdges.data(), sizeof(PerfBranchEdge), m_branchEdges.size());
+    snapshot.SetSection(PSS_BASIC_BLOCKS, m_basicBlocks.data(), sizeof(PerfBasicBlock), m_basicBlocks.size());
+    snapshot.SetSection(PSS_FUNCTION_COUNTERS, m_functionCounters.data(), sizeof(PerfCounterTotals), m_functionCounters.size());
+    snapshot.SetSection(PSS_EVENT_ATTRIBUTES, m_eventAttr.data(), sizeof(event_type_entry), m_eventAttr.size());
+    snapshot.SetSection(PSS_SAMPLE_EVENTS, m_sampleEvents.data(), sizeof(uint32_t), m_sampleEvents.size());
+
+    const bool written = snapshot.Write(path, key);
+    EndPhase();
+
+    return written;
+}
+
+void PerfFile::RebuildSampleIndexes()
+{
+    m_pidIndex.clear();
+    m_tidIndex.clear();
+    m_cpuIndex.clear();
+
+    for (uint32_t i = 0; i < m_samples.size(); i++)
+    {
+        m_pidIndex[m_samples[i].pid].push_back(i);
+        m_tidIndex[m_samples[i].tid].push_back(i);
+        m_cpuIndex[m_samples[i].cpu].push_back(i);
+    }
+
+    m_eventIndex.clear();
+    m_eventStackCounts.clear();
+    m_eventStackPeriods.clear();
+
+    for (uint32_t i = 0; i < m_sampleEvents.size(); i++)
+        IndexSampleEvent(i);
+}
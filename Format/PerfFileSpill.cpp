@@ -0,0 +1,196 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "PerfRecords.h"
+#include "Log.h"
+
+#include <algorithm>
+
+void PerfFile::SpillSamples()
+{
+    std::vector<record_t*> samples;
+    PerfSpilledSample spilled;
+
+    // peak memory is otherwise measured at the end of phase, when the pools are already released
+    UpdateMemoryStats();
+
+    for (record_t* rec : m_records)
+    {
+        if (rec->type == PERF_RECORD_SAMPLE)
+            samples.push_back(rec);
+    }
+
+    m_sampleMemory = 0;
+
+    if (samples.empty())
+        return;
+
+    if (!m_spill)
+    {
+        LogFunc(LOG_INFO, "Decoded samples exceed memory budget of %llu kB, spilling them to disk", m_memoryBudget / 1024);
+        m_spill = new PerfSampleSpill();
+    }
+
+    // every run is sorted on its own, the runs are merged when building sample table
+    std::sort(samples.begin(), samples.end(), PerfRecordOrderSortPredicate());
+
+    const bool started = m_spill->BeginRun();
+    bool ok = started;
+
+    memset(&spilled, 0, sizeof(spilled));
+    for (size_t i = 0; i < samples.size() && ok; i++)
+    {
+        const record_sample* sample = (const record_sample*)samples[i];
+
+        spilled.time = sample->header.time;
+        spilled.nr = sample->header.nr;
+        spilled.id = sample->header.id;
+        spilled.ip = sample->ip;
+        spilled.period = sample->period;
+        spilled.pid = sample->header.pid;
+        spilled.tid = sample->header.tid;
+        spilled.cpu = sample->header.cpu;
+        spilled.callchainCount = sample->callchainCount;
+        spilled.kernelFrameCount = sample->kernelFrameCount;
+        spilled.branchCount = sample->branchCount;
+        spilled.readCount = sample->readCount;
+
+        ok = m_spill->Append(spilled, m_callchainPool.data() + sample->callchainIndex,
+            (sample->branchCount > 0) ? &m_branchPool[sample->branchIndex] : nullptr,
+            (sample->readCount > 0) ? &m_counterPool[sample->readIndex] : nullptr);
+    }
+
+    ok = ok && m_spill->FinishRun();
+
+    // without the run, the samples just stay in memory
+    if (!ok)
+    {
+        LogFunc(LOG_ERROR, "Could not spill samples to disk, keeping them in memory");
+        if (started)
+            m_spill->DiscardRun();
+        m_memoryBudget = 0;
+        return;
+    }
+
+    // samples leave record storage, the other records stay in order
+    size_t kept = 0;
+    for (size_t i = 0; i < m_records.size(); i++)
+    {
+        if (m_records[i]->type == PERF_RECORD_SAMPLE)
+        {
+            m_recordMemory -= GetRecordSize(m_records[i]);
+            ReleaseRecord(m_records[i]);
+        }
+        else
+            m_records[kept++] = m_records[i];
+    }
+    m_records.resize(kept);
+
+    // switch-out stacks are the only other callchains, so the pool is rebuilt with just them
+    std::vector<uint64_t> callchains;
+    for (record_t* rec : m_records)
+    {
+        if ((rec->type != PERF_RECORD_SWITCH && rec->type != PERF_RECORD_SWITCH_CPU_WIDE) || !(((record_switch*)rec)->flags & RECORD_SWITCH_STACK))
+            continue;
+
+        record_switch* sw = (record_switch*)rec;
+        callchains.insert(callchains.end(), m_callchainPool.begin() + sw->callchainIndex, m_callchainPool.begin() + sw->callchainIndex + sw->callchainCount);
+        sw->callchainIndex = callchains.size() - sw->callchainCount;
+    }
+
+    m_callchainPool.swap(callchains);
+    std::vector<branch_entry>().swap(m_branchPool);
+    std::vector<read_value>().swap(m_counterPool);
+
+    LogFunc(LOG_VERBOSE, "Spilled %llu samples to run %u, %llu MB spilled so far", (uint64_t)samples.size(), m_spill->GetRunCount(),
+        m_spill->GetSize() / (1024 * 1024));
+}
+
+void PerfFile::MergeSpilledSamples(size_t firstRecord, std::vector<uint32_t> &frames)
+{
+    const PerfSpillRun* run;
+    record_sample sample;
+    size_t r = firstRecord;
+
+    LogFunc(LOG_VERBOSE, "Merging %llu spilled samples from %u runs", m_spill->GetSampleCount(), m_spill->GetRunCount());
+
+    if (!m_spill->StartMerge())
+        LogFunc(LOG_ERROR, "Could not read spilled samples back");
+
+    // payload of spilled sample is appended to pools just while the sample is being added
+    const size_t callchainEnd = m_callchainPool.size();
+    const size_t branchEnd = m_branchPool.size();
+    const size_t counterEnd = m_counterPool.size();
+
+    memset(&sample, 0, sizeof(sample));
+    sample.header.type = PERF_RECORD_SAMPLE;
+
+    // runs and records kept in memory are both sorted, so they are merged to the order of records of whole recording
+    while ((run = m_spill->Peek()) != nullptr || r < m_records.size())
+    {
+        if (!run || (r < m_records.size()
+            && (m_records[r]->time < run->head.time || (m_records[r]->time == run->head.time && m_records[r]->nr < run->head.nr))))
+        {
+            AddToSampleTable(m_records[r++], frames);
+            continue;
+        }
+
+        sample.header.time = run->head.time;
+        sample.header.nr = run->head.nr;
+        sample.header.id = run->head.id;
+        sample.header.pid = run->head.pid;
+        sample.header.tid = run->head.tid;
+        sample.header.cpu = run->head.cpu;
+        sample.ip = run->head.ip;
+        sample.period = run->head.period;
+        sample.callchainIndex = callchainEnd;
+        sample.callchainCount = run->head.callchainCount;
+        sample.kernelFrameCount = run->head.kernelFrameCount;
+        sample.branchIndex = (uint32_t)branchEnd;
+        sample.branchCount = run->head.branchCount;
+        sample.readIndex = (uint32_t)counterEnd;
+        sample.readCount = run->head.readCount;
+
+        m_callchainPool.insert(m_callchainPool.end(), run->callchain.begin(), run->callchain.end());
+        m_branchPool.insert(m_branchPool.end(), run->branches.begin(), run->branches.end());
+        m_counterPool.insert(m_counterPool.end(), run->reads.begin(), run->reads.end());
+
+        AddToSampleTable(&sample.header, frames);
+
+        m_callchainPool.resize(callchainEnd);
+        m_branchPool.resize(branchEnd);
+        m_counterPool.resize(counterEnd);
+
+        m_spill->Advance();
+    }
+
+    m_loadStats.spilledSamples += m_spill->GetSampleCount();
+    m_loadStats.spillRuns += m_spill->GetRunCount();
+    m_loadStats.spilledBytes += m_spill->GetSize();
+
+    // the runs are not needed anymore
+    delete m_spill;
+    m_spill = nullptr;
+    m_memoryBudget = 0;
+}
@@ -0,0 +1,215 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "PerfRecords.h"
+#include "Log.h"
+
+#include <sstream>
+#include <iomanip>
+
+#include <time.h>
+
+// names of phases in stats log line, indexed by PerfLoadPhase
+static const char* perfLoadPhaseNames[PLP_COUNT] = {
+    "read", "sort", "symbols", "samples", "flat_profile", "call_graph", "call_tree", "heat_map", "snapshot"
+};
+
+// names of structures in stats log line, indexed by PerfMemoryStructure
+static const char* perfMemoryStructureNames[PMS_COUNT] = {
+    "records", "callchains", "branches", "symbols", "functions", "stacks", "samples"
+};
+
+// retrieves time of clock in milliseconds
+static double GetClockMs(clockid_t clock)
+{
+    struct timespec ts;
+
+    if (clock_gettime(clock, &ts) != 0)
+        return 0.0;
+
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+// retrieves estimated memory of unordered map; nodes hold the value and a link, buckets hold a link each
+template<typename T>
+static uint64_t GetHashMapMemory(const T &map)
+{
+    return map.size() * (sizeof(typename T::value_type) + sizeof(void*)) + map.bucket_count() * sizeof(void*);
+}
+
+// retrieves estimated memory of function entries, including their names
+static uint64_t GetFunctionEntriesMemory(const std::vector<FunctionEntry> &entries)
+{
+    uint64_t total = entries.capacity() * sizeof(FunctionEntry);
+
+    for (const FunctionEntry &entry : entries)
+        total += entry.name.capacity();
+
+    return total;
+}
+
+void PerfFile::BeginPhase(PerfLoadPhase phase)
+{
+    m_phaseTimers.push_back({ phase, GetClockMs(CLOCK_MONOTONIC), GetClockMs(CLOCK_THREAD_CPUTIME_ID), 0.0, 0.0 });
+}
+
+void PerfFile::EndPhase()
+{
+    if (m_phaseTimers.empty())
+        return;
+
+    const PerfPhaseTimer timer = m_phaseTimers.back();
+    m_phaseTimers.pop_back();
+
+    const double wall = GetClockMs(CLOCK_MONOTONIC) - timer.wallStart;
+    const double cpu = GetClockMs(CLOCK_THREAD_CPUTIME_ID) - timer.cpuStart;
+
+    // nested phases are accounted on their own, so the time is exclusive
+    PerfPhaseStats &stats = m_loadStats.phases[timer.phase];
+    stats.wallMs += wall - timer.nestedWall;
+    stats.cpuMs += cpu - timer.nestedCpu;
+    stats.runs++;
+
+    if (!m_phaseTimers.empty())
+    {
+        m_phaseTimers.back().nestedWall += wall;
+        m_phaseTimers.back().nestedCpu += cpu;
+    }
+
+    UpdateMemoryStats();
+}
+
+void PerfFile::CountEvent(const perf_event_header &header)
+{
+    m_loadStats.bytesRead += header.size;
+    m_loadStats.recordCounts[header.type]++;
+}
+
+size_t PerfFile::GetRecordSize(const record_t* rec)
+{
+    switch (rec->type)
+    {
+        case PERF_RECORD_MMAP:
+            return sizeof(record_mmap);
+        case PERF_RECORD_MMAP2:
+            return sizeof(record_mmap2);
+        case PERF_RECORD_COMM:
+            return sizeof(record_comm);
+        case PERF_RECORD_FORK:
+            return sizeof(record_fork);
+        case PERF_RECORD_EXIT:
+            return sizeof(record_exit);
+        case PERF_RECORD_SAMPLE:
+            return sizeof(record_sample);
+        case PERF_RECORD_SWITCH:
+        case PERF_RECORD_SWITCH_CPU_WIDE:
+            return sizeof(record_switch);
+        default:
+            return sizeof(record_t);
+    }
+}
+
+void PerfFile::UpdateMemoryStats()
+{
+    uint64_t usage[PMS_COUNT];
+
+    usage[PMS_RECORDS] = m_recordMemory + (m_records.capacity() + m_livePending.capacity() + m_mmaps2.capacity()) * sizeof(record_t*);
+    usage[PMS_CALLCHAINS] = m_callchainPool.capacity() * sizeof(uint64_t);
+    usage[PMS_BRANCHES] = m_branchPool.capacity() * sizeof(branch_entry);
+    usage[PMS_SYMBOLS] = GetFunctionEntriesMemory(m_symbolTable);
+    usage[PMS_FUNCTIONS] = GetFunctionEntriesMemory(m_functionTable) + GetHashMapMemory(m_addressFunctionIds) + GetHashMapMemory(m_symbolFunctionIds);
+    usage[PMS_STACKS] = m_stacks.GetMemoryUsage() + m_foldedStacks.GetMemoryUsage()
+        + (m_stackCounts.capacity() + m_stackPeriods.capacity()) * sizeof(uint64_t) + m_foldedStackIds.capacity() * sizeof(uint32_t);
+    usage[PMS_SAMPLES] = m_samples.capacity() * sizeof(PerfSample) + m_sampleEvents.capacity() * sizeof(uint32_t);
+
+    // every sample is indexed by process, thread, CPU and event
+    const SampleIndexMap* indexes[] = { &m_pidIndex, &m_tidIndex, &m_cpuIndex, &m_eventIndex };
+    for (const SampleIndexMap* index : indexes)
+    {
+        for (auto &itr : *index)
+            usage[PMS_SAMPLES] += itr.second.capacity() * sizeof(uint32_t);
+    }
+
+    for (uint32_t i = 0; i < PMS_COUNT; i++)
+    {
+        if (usage[i] > m_loadStats.peakMemory[i])
+            m_loadStats.peakMemory[i] = usage[i];
+    }
+}
+
+void PerfFile::FillLoadStats(PerfLoadStats &dst) const
+{
+    dst = m_loadStats;
+
+    // merged profile carries counts of merged recordings, and has no addresses of its own
+    dst.uniqueIps += m_addressFunctionIds.size();
+    dst.uniqueStacks = m_stacks.GetStackCount();
+}
+
+void PerfFile::LogLoadStats() const
+{
+    PerfLoadStats stats;
+    std::stringstream line;
+    uint64_t total;
+
+    FillLoadStats(stats);
+
+    line << std::fixed << std::setprecision(1);
+
+    double wallMs = 0.0, cpuMs = 0.0;
+    for (uint32_t i = 0; i < PLP_COUNT; i++)
+    {
+        wallMs += stats.phases[i].wallMs;
+        cpuMs += stats.phases[i].cpuMs;
+    }
+    line << "wall_ms=" << wallMs << " cpu_ms=" << cpuMs;
+
+    for (uint32_t i = 0; i < PLP_COUNT; i++)
+    {
+        if (stats.phases[i].runs > 0)
+        {
+            line << " " << perfLoadPhaseNames[i] << "_wall_ms=" << stats.phases[i].wallMs
+                 << " " << perfLoadPhaseNames[i] << "_cpu_ms=" << stats.phases[i].cpuMs;
+        }
+    }
+
+    total = 0;
+    for (auto &itr : stats.recordCounts)
+        total += itr.second;
+    line << " bytes_read=" << stats.bytesRead << " records=" << total << " record_types=";
+    for (auto itr = stats.recordCounts.begin(); itr != stats.recordCounts.end(); ++itr)
+        line << (itr == stats.recordCounts.begin() ? "" : ",") << itr->first << ":" << itr->second;
+
+    total = 0;
+    for (auto &itr : stats.dsoSymbols)
+        total += itr.second;
+    line << " unique_ips=" << stats.uniqueIps << " unique_stacks=" << stats.uniqueStacks
+         << " dsos=" << stats.dsoSymbols.size() << " symbols=" << total << " unresolved_ips=" << stats.unresolvedIps;
+    line << " spilled_samples=" << stats.spilledSamples << " spill_runs=" << stats.spillRuns << " spilled_bytes=" << stats.spilledBytes;
+
+    for (uint32_t i = 0; i < PMS_COUNT; i++)
+        line << " " << perfMemoryStructureNames[i] << "_peak_bytes=" << stats.peakMemory[i];
+
+    LogFunc(LOG_INFO, "Load stats: %s", line.str().c_str());
+}
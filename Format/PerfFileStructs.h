@@ -25,6 +25,8 @@
 
 #define PERF_FILE_MAGIC_LENGTH 8
 #define HEADER_FEATURE_BITS 256
+// feature section with event names and their IDs
+#define HEADER_EVENT_DESC 12
 
 #include "linux/perf_event.h"
 
@@ -51,6 +53,13 @@ struct perf_file_header
     uint8_t bits[HEADER_FEATURE_BITS / 8];
 };
 
+// header of pipe-mode output; attributes are then transferred as events in data stream
+struct perf_pipe_file_header
+{
+    char magic[PERF_FILE_MAGIC_LENGTH];
+    uint64_t size;
+};
+
 struct event_type_entry
 {
     perf_event_attr attr;
@@ -124,6 +133,29 @@ struct exit_event
     uint64_t time;
 };
 
+// followed by sample_id; PERF_RECORD_SWITCH has just the sample_id
+struct switch_event
+{
+    uint32_t next_prev_pid;
+    uint32_t next_prev_tid;
+};
+
+// raw data of sched:sched_switch tracepoint sample
+struct sched_switch_tracepoint
+{
+    uint16_t common_type;
+    uint8_t common_flags;
+    uint8_t common_preempt_count;
+    int32_t common_pid;
+    char prev_comm[16];
+    int32_t prev_pid;
+    int32_t prev_prio;
+    int64_t prev_state;
+    char next_comm[16];
+    int32_t next_pid;
+    int32_t next_prio;
+};
+
 struct lost_event
 {
     uint64_t id;
@@ -145,12 +177,6 @@ struct sample_event
     uint64_t array; // this just serves as default start point for following data
 };
 
-struct ip_callchain
-{
-    uint64_t nr;
-    uint64_t* ips;
-};
-
 struct perf_sample
 {
     uint64_t ip;
@@ -164,7 +190,13 @@ struct perf_sample
     uint64_t cpu;
     uint64_t raw_size;
     void *raw_data;
-    ip_callchain *callchain;
+    // callchain frames within event data
+    uint64_t callchain_nr;
+    const uint64_t *callchain_ips;
+    uint64_t branch_nr;
+    branch_entry *branch_entries;
+    uint64_t read_nr;
+    read_value *read_values;
 };
 
 enum perf_user_event_type
@@ -175,6 +207,19 @@ enum perf_user_event_type
     PERF_RECORD_HEADER_TRACING_DATA = 66,
     PERF_RECORD_HEADER_BUILD_ID = 67,
     PERF_RECORD_FINISHED_ROUND = 68,
+    PERF_RECORD_ID_INDEX = 69,
+    PERF_RECORD_AUXTRACE_INFO = 70,
+    PERF_RECORD_AUXTRACE = 71,
+    PERF_RECORD_AUXTRACE_ERROR = 72,
+    PERF_RECORD_THREAD_MAP = 73,
+    PERF_RECORD_CPU_MAP = 74,
+    PERF_RECORD_STAT_CONFIG = 75,
+    PERF_RECORD_STAT = 76,
+    PERF_RECORD_STAT_ROUND = 77,
+    PERF_RECORD_EVENT_UPDATE = 78,
+    PERF_RECORD_TIME_CONV = 79,
+    PERF_RECORD_HEADER_FEATURE = 80,
+    PERF_RECORD_COMPRESSED = 81,
     PERF_RECORD_HEADER_MAX
 };
 
@@ -194,6 +239,18 @@ struct tracing_data_event
     uint32_t size;
 };
 
+// followed by size bytes of aux area data
+struct auxtrace_event
+{
+    uint64_t size;
+    uint64_t offset;
+    uint64_t reference;
+    uint32_t idx;
+    uint32_t tid;
+    uint32_t cpu;
+    uint32_t reserved__;
+};
+
 // generic perf_event structure
 struct perf_event
 {
@@ -208,6 +265,7 @@ struct perf_event
         fork_event *fork;
         exit_event *exitev;
         sample_event *sample;
+        switch_event *switchev;
 
         // Not yet supported:
 
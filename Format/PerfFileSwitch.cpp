@@ -0,0 +1,230 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfFile.h"
+#include "PerfRecords.h"
+#include "Log.h"
+
+#include <algorithm>
+
+void PerfFile::ProcessContextSwitch(const record_switch* rec)
+{
+    std::vector<uint32_t> frames;
+
+    if (m_firstSwitchTime == 0 || rec->header.time < m_firstSwitchTime)
+        m_firstSwitchTime = rec->header.time;
+
+    // idle task (TID 0) is not a real thread
+    if (!(rec->flags & RECORD_SWITCH_OUT))
+    {
+        if (rec->header.tid != 0)
+            SwitchThreadIn(rec->header.pid, rec->header.tid, rec->header.cpu, rec->header.time);
+        return;
+    }
+
+    if (rec->header.tid != 0)
+    {
+        uint32_t stackId = INVALID_STACK_ID;
+
+        // tracepoint carries the stack of blocking call, switch records rely on the latest sample of thread
+        if (rec->flags & RECORD_SWITCH_STACK)
+            stackId = ResolveStack(rec->ip, rec->callchainIndex, rec->callchainCount, rec->kernelFrameCount, frames);
+
+        if (stackId == INVALID_STACK_ID)
+        {
+            auto state = m_threadSwitchStates.find(rec->header.tid);
+            if (state != m_threadSwitchStates.end())
+                stackId = state->second.lastSampleStackId;
+        }
+
+        SwitchThreadOut(rec->header.pid, rec->header.tid, rec->header.cpu, rec->header.time, (rec->flags & RECORD_SWITCH_PREEMPT) != 0, stackId);
+    }
+
+    // sched_switch tracepoint describes both switched threads at once
+    if ((rec->flags & RECORD_SWITCH_NEXT_IN) && rec->nextPrevTid != 0 && rec->nextPrevTid != (uint32_t)(-1))
+    {
+        uint32_t pid = rec->nextPrevTid;
+        auto itr = m_threadPids.find(rec->nextPrevTid);
+        if (itr != m_threadPids.end())
+            pid = itr->second;
+        else if (rec->nextPrevPid != (uint32_t)(-1))
+            pid = rec->nextPrevPid;
+
+        SwitchThreadIn(pid, rec->nextPrevTid, rec->header.cpu, rec->header.time);
+    }
+}
+
+void PerfFile::SwitchThreadOut(uint32_t pid, uint32_t tid, uint32_t cpu, uint64_t time, bool preempted, uint32_t stackId)
+{
+    auto ins = m_threadSwitchStates.insert(std::make_pair(tid, PerfThreadSwitchState()));
+    PerfThreadSwitchState &state = ins.first->second;
+
+    if (ins.second)
+    {
+        state.since = 0;
+        state.lastSampleStackId = INVALID_STACK_ID;
+    }
+    // the thread was running since it was switched in (or since the recording started, which is not known)
+    else if (state.since != 0 && state.state == PTS_RUNNING && time >= state.since)
+    {
+        PerfSwitchInterval pi;
+        pi.start = state.since;
+        pi.end = time;
+        pi.pid = pid;
+        pi.tid = tid;
+        pi.cpu = state.cpu;
+        pi.state = PTS_RUNNING;
+        pi.stackId = INVALID_STACK_ID;
+        pi.reserved = 0;
+        m_switchIntervals.push_back(pi);
+    }
+
+    state.since = time;
+    state.state = preempted ? PTS_PREEMPTED : PTS_BLOCKED;
+    state.cpu = cpu;
+    state.stackId = stackId;
+}
+
+void PerfFile::SwitchThreadIn(uint32_t pid, uint32_t tid, uint32_t cpu, uint64_t time)
+{
+    auto ins = m_threadSwitchStates.insert(std::make_pair(tid, PerfThreadSwitchState()));
+    PerfThreadSwitchState &state = ins.first->second;
+
+    if (ins.second)
+    {
+        state.since = 0;
+        state.lastSampleStackId = INVALID_STACK_ID;
+    }
+    // off-CPU interval is attributed to the CPU the thread left
+    else if (state.since != 0 && state.state != PTS_RUNNING && time >= state.since)
+    {
+        PerfSwitchInterval pi;
+        pi.start = state.since;
+        pi.end = time;
+        pi.pid = pid;
+        pi.tid = tid;
+        pi.cpu = state.cpu;
+        pi.state = state.state;
+        pi.stackId = state.stackId;
+        pi.reserved = 0;
+        m_switchIntervals.push_back(pi);
+    }
+
+    state.since = time;
+    state.state = PTS_RUNNING;
+    state.cpu = cpu;
+    state.stackId = INVALID_STACK_ID;
+}
+
+uint64_t PerfFile::GetTimeBase() const
+{
+    // relative times are measured from the first sample, the same way heat map is
+    if (!m_samples.empty())
+        return m_samples.front().time;
+
+    return m_firstSwitchTime;
+}
+
+void PerfFile::FillOffCpuCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter)
+{
+    std::unordered_map<uint32_t, std::pair<uint64_t, uint64_t>> stackTimes;
+    const uint32_t* frames;
+    uint32_t count;
+    CallTreeNode* ctn;
+
+    LogFunc(LOG_VERBOSE, "Passing off-CPU call tree from input module to core");
+
+    if (filter.fromMs > filter.toMs)
+        return;
+
+    // window is clamped the same way as for samples
+    const uint64_t base = GetTimeBase();
+    const uint64_t maxMs = ((uint64_t)(-1) - base) / SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+    const uint64_t fromTime = (filter.fromMs > maxMs) ? (uint64_t)(-1) : base + filter.fromMs * SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+    const uint64_t toTime = (filter.toMs > maxMs) ? (uint64_t)(-1) : base + filter.toMs * SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+
+    // sum time spent off CPU at every switch-out stack; intervals are clipped to the window
+    for (const PerfSwitchInterval &pi : m_switchIntervals)
+    {
+        if (pi.state == PTS_RUNNING || pi.stackId == INVALID_STACK_ID)
+            continue;
+        if (pi.end < fromTime || pi.start > toTime)
+            continue;
+        if ((!filter.pids.empty() && filter.pids.find(pi.pid) == filter.pids.end())
+            || (!filter.tids.empty() && filter.tids.find(pi.tid) == filter.tids.end())
+            || (!filter.cpus.empty() && filter.cpus.find(pi.cpu) == filter.cpus.end()))
+            continue;
+
+        std::pair<uint64_t, uint64_t> &st = stackTimes[pi.stackId];
+        st.first += std::min(pi.end, toTime) - std::max(pi.start, fromTime);
+        st.second++;
+    }
+
+    // kernel frames stay in the tree - the innermost ones tell, what the thread waited for
+    for (auto &itr : stackTimes)
+    {
+        frames = m_stacks.GetFrames(itr.first, count);
+
+        ctn = InsertIntoCallTree(dst, frames, count);
+        if (ctn)
+            AccumulateCallTreeTime(ctn, (double)itr.second.first / (double)SAMPLE_TIMESTAMP_DIMENSION_TO_MS, itr.second.second);
+    }
+
+    ThresholdCallTree(dst);
+}
+
+void PerfFile::FillThreadTimeline(uint32_t tid, std::vector<PerfThreadInterval> &dst)
+{
+    const uint32_t* frames;
+    uint32_t count, kernelCount;
+    PerfThreadInterval ti;
+
+    dst.clear();
+
+    const uint64_t base = GetTimeBase();
+
+    // intervals of a thread are stored in order of their end, so they are sorted by time as well
+    for (const PerfSwitchInterval &pi : m_switchIntervals)
+    {
+        if (pi.tid != tid)
+            continue;
+
+        ti.fromMs = ((double)pi.start - (double)base) / (double)SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+        ti.toMs = ((double)pi.end - (double)base) / (double)SAMPLE_TIMESTAMP_DIMENSION_TO_MS;
+        ti.cpu = pi.cpu;
+        ti.state = (PerfThreadState)pi.state;
+        ti.functionId = PERF_THREAD_NO_FUNCTION;
+
+        // the innermost frames are usually scheduler internals, the first user frame tells more
+        if (pi.stackId != INVALID_STACK_ID)
+        {
+            frames = m_stacks.GetFrames(pi.stackId, count);
+            kernelCount = GetKernelFrameCount(frames, count);
+            if (kernelCount < count)
+                ti.functionId = frames[kernelCount];
+        }
+
+        dst.push_back(ti);
+    }
+}
@@ -0,0 +1,320 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef PIVO_PERF_QUERY_STRUCTS_H
+#define PIVO_PERF_QUERY_STRUCTS_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// selects subset of samples; empty sets match anything
+struct PerfSampleFilter
+{
+    PerfSampleFilter() : fromMs(0), toMs((uint64_t)(-1)) { };
+
+    // time window in milliseconds from recording start (both inclusive)
+    uint64_t fromMs;
+    uint64_t toMs;
+    // process IDs to be included
+    std::set<uint32_t> pids;
+    // thread IDs to be included
+    std::set<uint32_t> tids;
+    // CPUs to be included
+    std::set<uint32_t> cpus;
+    // events (indexes of event attributes) to be included
+    std::set<uint32_t> events;
+};
+
+// process present in recording
+struct PerfProcessInfo
+{
+    uint32_t pid;
+    std::string comm;
+    uint64_t sampleCount;
+    uint32_t threadCount;
+};
+
+// sampled event present in recording
+struct PerfEventInfo
+{
+    // index of event attribute; used in sample filter
+    uint32_t index;
+    std::string name;
+    uint32_t type;
+    uint64_t config;
+    uint64_t sampleCount;
+};
+
+// thread present in recording
+struct PerfThreadInfo
+{
+    uint32_t tid;
+    uint32_t pid;
+    std::string comm;
+    uint64_t sampleCount;
+};
+
+// function matched by name in baseline and candidate recordings
+struct PerfDiffFunctionRecord
+{
+    std::string name;
+    // function IDs in both recordings, PERF_DIFF_NO_FUNCTION if not present
+    uint32_t baselineFunctionId;
+    uint32_t candidateFunctionId;
+    // self and inclusive time as fraction of total sample count of each recording
+    double baselineSelf;
+    double candidateSelf;
+    double baselineInclusive;
+    double candidateInclusive;
+    // candidate minus baseline
+    double deltaSelf;
+    double deltaInclusive;
+};
+
+// call tree path node matched by function names; nodes are stored in preorder, children after parents
+struct PerfDiffPathRecord
+{
+    std::string name;
+    // index of parent node in output vector, PERF_DIFF_NO_PARENT for root nodes
+    uint32_t parent;
+    uint32_t depth;
+    // inclusive time of path as fraction of total sample count of each recording
+    double baseline;
+    double candidate;
+    // candidate minus baseline
+    double delta;
+};
+
+// selects part of recording decoded by preview load
+struct PerfPreviewOptions
+{
+    PerfPreviewOptions() : fraction(0.05), chunkSize(1024 * 1024), seed(0) { };
+
+    // approximate fraction of data section to be decoded
+    double fraction;
+    // size of contiguous data chunk decoded at once (in bytes)
+    uint64_t chunkSize;
+    // seed of random chunk selection; the same seed selects the same chunks
+    uint32_t seed;
+};
+
+// flat profile estimate of function made from preview load
+struct PerfPreviewFunctionRecord
+{
+    uint32_t functionId;
+    // self and inclusive time as fraction of total sample count of the recording
+    double self;
+    double inclusive;
+    // half-width of 95% confidence interval of the values above
+    double selfError;
+    double inclusiveError;
+};
+
+// scheduling state of thread within timeline interval
+enum PerfThreadState
+{
+    PTS_RUNNING = 0,        // on CPU
+    PTS_BLOCKED,            // off CPU, waiting (sleep, I/O, lock, ...)
+    PTS_PREEMPTED           // off CPU, runnable, but descheduled
+};
+
+// interval of thread timeline between two context switches
+struct PerfThreadInterval
+{
+    // start and end relative to recording start
+    double fromMs;
+    double toMs;
+    uint32_t cpu;
+    PerfThreadState state;
+    // innermost non-kernel function at switch-out (off-CPU intervals), PERF_THREAD_NO_FUNCTION if not known
+    uint32_t functionId;
+};
+
+// taken branch aggregated over all branch stacks (LBR)
+struct PerfBranchEdge
+{
+    uint64_t from;
+    uint64_t to;
+    // how many times the branch was taken, and how many times of it was mispredicted
+    uint64_t count;
+    uint64_t mispredicted;
+    // functions containing source and target (INVALID_FUNCTION_ID if not resolved)
+    uint32_t fromFunctionId;
+    uint32_t toFunctionId;
+    // PERF_BR_* type, if recorded (PERF_BR_UNKNOWN otherwise)
+    uint32_t branchType;
+    uint32_t reserved;
+};
+
+// straight-line code range executed between two taken branches
+struct PerfBasicBlock
+{
+    // the first and the last instruction address (both inclusive)
+    uint64_t start;
+    uint64_t end;
+    // how many times was the range executed
+    uint64_t count;
+    uint32_t functionId;
+    uint32_t reserved;
+};
+
+// hardware counters recognized among counter group members (PERF_SAMPLE_READ)
+enum PerfCounterKind
+{
+    PCK_CYCLES = 0,
+    PCK_INSTRUCTIONS,
+    PCK_CACHE_REFERENCES,   // cache-references, or LLC read accesses
+    PCK_CACHE_MISSES,       // cache-misses, or LLC read misses
+    PCK_BRANCHES,
+    PCK_BRANCH_MISSES,
+    PCK_COUNT
+};
+
+// counter deltas attributed to function as sampled (leaf) function, along with derived rates
+struct PerfFunctionCounters
+{
+    uint32_t functionId;
+    // count of samples carrying counter values
+    uint64_t sampleCount;
+    // sum of counter deltas, indexed by PerfCounterKind
+    uint64_t values[PCK_COUNT];
+    // instructions per cycle, cache misses per cache reference, cache misses per 1000 instructions and branch misses
+    // per branch; PERF_COUNTER_RATE_UNAVAILABLE if any of the counters was not recorded
+    double ipc;
+    double cacheMissRate;
+    double cacheMissesPerKiloInstruction;
+    double branchMissRate;
+};
+
+// weight of sample within profiles (flat profile and heat map times, call graph edges, call tree node times)
+enum PerfSampleWeighting
+{
+    PSW_SAMPLES = 0,        // every sample counts as one
+    PSW_PERIOD,             // every sample counts as its period (events elapsed since previous sample)
+};
+
+// segments of stacks (kernel frames on top of user frames) considered in flat profile, call tree and heat map
+enum PerfStackMode
+{
+    PSM_USER = 0,           // user frames only; samples taken in kernel are left out
+    PSM_KERNEL,             // kernel frames only; samples taken in user space are left out
+    PSM_COMBINED,           // whole stacks, kernel frames included
+};
+
+// sample counts and period sums of function, both as sampled (leaf) function and anywhere in stack
+struct PerfFunctionWeights
+{
+    uint32_t functionId;
+    uint64_t selfSamples;
+    uint64_t inclusiveSamples;
+    uint64_t selfPeriod;
+    uint64_t inclusivePeriod;
+};
+
+// direct caller or callee within butterfly view
+struct PerfButterflyEdge
+{
+    uint32_t functionId;
+    // weight of stacks with this call (counted once per stack)
+    uint64_t weight;
+};
+
+// function with its direct callers and callees; weights follow selected sample weighting
+struct PerfButterflyEntry
+{
+    uint32_t functionId;
+    uint64_t selfWeight;
+    // weight of stacks with the function above the leaf (counted once per stack); as in flat profile, stacks with
+    // the function just as the leaf are left out
+    uint64_t inclusiveWeight;
+    // callers and callees, the heaviest first
+    std::vector<PerfButterflyEdge> callers;
+    std::vector<PerfButterflyEdge> callees;
+};
+
+// phases of loading and aggregation, timed separately
+enum PerfLoadPhase
+{
+    PLP_READ = 0,           // reading and decoding of recording (and its headers)
+    PLP_SORT,               // sorting records by time
+    PLP_SYMBOLS,            // listing and sorting symbols of binaries and kernel
+    PLP_SAMPLES,            // memory mappings, stack resolution and sample table
+    PLP_FLAT_PROFILE,       // flat profile aggregation
+    PLP_CALL_GRAPH,         // call graph aggregation
+    PLP_CALL_TREE,          // call tree (and its other views) aggregation
+    PLP_HEAT_MAP,           // heat map building
+    PLP_SNAPSHOT,           // snapshot restoring or saving
+    PLP_COUNT
+};
+
+// structures, whose memory usage is tracked
+enum PerfMemoryStructure
+{
+    PMS_RECORDS = 0,        // decoded records
+    PMS_CALLCHAINS,         // callchain pool
+    PMS_BRANCHES,           // branch stack pool
+    PMS_SYMBOLS,            // symbol table
+    PMS_FUNCTIONS,          // function table and address lookup
+    PMS_STACKS,             // unique stacks (with folded ones) and their weights
+    PMS_SAMPLES,            // sample table and its indexes
+    PMS_COUNT
+};
+
+// time spent within phase; nested phases are not counted to the enclosing one
+struct PerfPhaseStats
+{
+    double wallMs;
+    double cpuMs;
+    // how many times the phase was entered
+    uint32_t runs;
+};
+
+// timings and counters of loading
+struct PerfLoadStats
+{
+    PerfPhaseStats phases[PLP_COUNT];
+    // bytes of events read from recording
+    uint64_t bytesRead;
+    // count of events of every record type (decoded or not)
+    std::map<uint32_t, uint64_t> recordCounts;
+    // unique resolved addresses (summed over recordings of merged profile)
+    uint64_t uniqueIps;
+    uint32_t uniqueStacks;
+    // count of symbols loaded from every binary (and kernel)
+    std::map<std::string, uint64_t> dsoSymbols;
+    // addresses outside of known symbols
+    uint64_t unresolvedIps;
+    // peak estimated memory of every structure in bytes, indexed by PerfMemoryStructure
+    uint64_t peakMemory[PMS_COUNT];
+    // samples spilled to run files to keep within memory budget, count and total size of the runs
+    uint64_t spilledSamples;
+    uint32_t spillRuns;
+    uint64_t spilledBytes;
+};
+
+#define PERF_DIFF_NO_FUNCTION ((uint32_t)(-1))
+#define PERF_DIFF_NO_PARENT ((uint32_t)(-1))
+#define PERF_THREAD_NO_FUNCTION ((uint32_t)(-1))
+#define PERF_COUNTER_RATE_UNAVAILABLE (-1.0)
+
+#endif
@@ -21,12 +21,22 @@
 #include "General.h"
 #include "PerfFileStructs.h"
 
-int perf_event__parse_id_sample(perf_event *event, uint64_t type, perf_sample *sample)
+// parsers are instantiated for sample type known at compile time, or for PERF_SAMPLE_TYPE_ANY, which takes it from
+// attribute; with the former, every field check is resolved by compiler and just the loads of present fields remain
+template <uint64_t SAMPLE_TYPE>
+static int perf_event__parse_id_sample_as(perf_event *event, uint64_t attr_type, perf_sample *sample)
 {
+    const uint64_t type = (SAMPLE_TYPE == PERF_SAMPLE_TYPE_ANY) ? attr_type : SAMPLE_TYPE;
     uint64_t *array = &event->sample->array;
 
     array += ((event->header.size - sizeof(event->header)) / sizeof(uint64_t)) - 1;
 
+    if (type & PERF_SAMPLE_IDENTIFIER)
+    {
+        sample->id = *array;
+        array--;
+    }
+
     if (type & PERF_SAMPLE_CPU)
     {
         uint32_t *p = (uint32_t*)array;
@@ -62,29 +72,61 @@ int perf_event__parse_id_sample(perf_event *event, uint64_t type, perf_sample *s
     return 0;
 }
 
-int perf_event__parse_sample(perf_event *event, uint64_t type, bool sample_id_all, perf_sample *data)
+int perf_event__parse_id_sample(perf_event *event, uint64_t type, perf_sample *sample)
+{
+    return perf_event__parse_id_sample_as<PERF_SAMPLE_TYPE_ANY>(event, type, sample);
+}
+
+// releases data allocated while parsing sample, which turned out to be malformed
+static void perf_sample__release(perf_sample *data)
+{
+    delete[] data->read_values;
+    data->read_values = nullptr;
+}
+
+template <uint64_t SAMPLE_TYPE>
+static int perf_event__parse_sample_as(perf_event *event, const perf_event_attr *attr, bool sample_id_all, perf_sample *data)
 {
     uint64_t *array;
 
+    // layout of sample is given by attribute of its event
+    const uint64_t type = (SAMPLE_TYPE == PERF_SAMPLE_TYPE_ANY) ? attr->sample_type : SAMPLE_TYPE;
+    const uint64_t branch_type = attr->branch_sample_type;
+    const uint64_t read_format = attr->read_format;
+
     data->cpu = -1;
     data->pid = -1;
     data->tid = -1;
     data->stream_id = -1;
     data->id = -1;
     data->time = -1;
+    data->period = 0;
+    data->callchain_nr = 0;
+    data->callchain_ips = nullptr;
+    data->read_nr = 0;
+    data->read_values = nullptr;
 
     if (event->header.type != PERF_RECORD_SAMPLE)
     {
         if (!sample_id_all)
             return 0;
-        return perf_event__parse_id_sample(event, type, data);
+        return perf_event__parse_id_sample_as<SAMPLE_TYPE>(event, type, data);
     }
 
     array = &event->sample->array;
 
+    data->id = (uint64_t)(-1);
+
+    // identifier is always the first, so the event could be matched without knowing its layout
+    if (type & PERF_SAMPLE_IDENTIFIER)
+    {
+        data->id = *array;
+        array++;
+    }
+
     if (type & PERF_SAMPLE_IP)
     {
-        data->ip = event->ip->ip;
+        data->ip = *array;
         array++;
     }
 
@@ -108,7 +150,6 @@ int perf_event__parse_sample(perf_event *event, uint64_t type, bool sample_id_al
         array++;
     }
 
-    data->id = (uint64_t)(-1);
     if (type & PERF_SAMPLE_ID)
     {
         data->id = *array;
@@ -134,41 +175,146 @@ int perf_event__parse_sample(perf_event *event, uint64_t type, bool sample_id_al
         array++;
     }
 
+    // lengths of variable parts come from data, so they have to be checked against event size
+    const uint64_t *array_end = (const uint64_t*)((uint8_t*)event->_generic + event->header.size - sizeof(perf_event_header));
+
     if (type & PERF_SAMPLE_READ)
     {
-        // unsupported
-        return -1;
+        const uint64_t times = ((read_format & PERF_FORMAT_TOTAL_TIME_ENABLED) ? 1 : 0) + ((read_format & PERF_FORMAT_TOTAL_TIME_RUNNING) ? 1 : 0);
+        const uint64_t stride = 1 + ((read_format & PERF_FORMAT_ID) ? 1 : 0) + ((read_format & PERF_FORMAT_LOST) ? 1 : 0);
+
+        if (read_format & PERF_FORMAT_GROUP)
+        {
+            // nr, times, and then value (with ID and lost count) of every group member
+            if (array + 1 + times > array_end || *array > (uint64_t)(array_end - array - 1 - times) / stride)
+                return -1;
+
+            data->read_nr = *array;
+            array += 1 + times;
+
+            data->read_values = new read_value[data->read_nr];
+            for (uint64_t i = 0; i < data->read_nr; i++)
+            {
+                data->read_values[i].value = array[i * stride];
+                data->read_values[i].id = (read_format & PERF_FORMAT_ID) ? array[i * stride + 1] : (uint64_t)(-1);
+            }
+
+            array += data->read_nr * stride;
+        }
+        else
+        {
+            // value, times, ID and lost count of the sampled event alone
+            if (array + stride + times > array_end)
+                return -1;
+
+            data->read_nr = 1;
+            data->read_values = new read_value[1];
+            data->read_values[0].value = array[0];
+            data->read_values[0].id = (read_format & PERF_FORMAT_ID) ? array[1 + times] : (uint64_t)(-1);
+
+            array += stride + times;
+        }
     }
-
-    data->callchain = new ip_callchain;
+
     if (type & PERF_SAMPLE_CALLCHAIN)
     {
-        uint32_t count = (uint32_t)((ip_callchain*)array)->nr;
+        if (array + 1 > array_end || *array > (uint64_t)(array_end - array - 1))
+        {
+            perf_sample__release(data);
+            return -1;
+        }
 
-        data->callchain->nr = count;
-        data->callchain->ips = new uint64_t[count];
-        for (uint64_t it = 0; it < count; it++)
-            data->callchain->ips[it] = ( (uint64_t*)&((ip_callchain*)array)->ips )[it];
+        // frames are left in event data, the caller copies them where needed
+        data->callchain_nr = *array;
+        data->callchain_ips = array + 1;
 
-        array += 1 + count;
-    }
-    else
-    {
-        data->callchain->nr = 0;
-        data->callchain->ips = nullptr;
+        array += 1 + data->callchain_nr;
     }
 
+    data->raw_size = 0;
+    data->raw_data = nullptr;
+
     if (type & PERF_SAMPLE_RAW)
     {
         uint32_t *p = (uint32_t*)array;
+
+        // raw data size comes from data as well
+        if (array + 1 > array_end || *p > (uint64_t)((uint8_t*)array_end - (uint8_t*)(p + 1)))
+        {
+            perf_sample__release(data);
+            return -1;
+        }
+
         data->raw_size = *p;
         p++;
         data->raw_data = p;
+
+        // size and data are padded to 8 bytes
+        array += (sizeof(uint32_t) + data->raw_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    }
+
+    data->branch_nr = 0;
+    data->branch_entries = nullptr;
+
+    if (type & PERF_SAMPLE_BRANCH_STACK)
+    {
+        uint64_t count = (array + 1 <= array_end) ? *array : (uint64_t)(-1);
+        array++;
+
+        // hardware index of the latest entry precedes the entries
+        if (branch_type & PERF_SAMPLE_BRANCH_HW_INDEX)
+            array++;
+
+        if (array > array_end || count > (uint64_t)(array_end - array) / (sizeof(branch_entry) / sizeof(uint64_t)))
+        {
+            perf_sample__release(data);
+            return -1;
+        }
+
+        data->branch_nr = count;
+        data->branch_entries = (branch_entry*)array;
     }
 
     return 0;
 }
 
+int perf_event__parse_sample(perf_event *event, const perf_event_attr *attr, bool sample_id_all, perf_sample *data)
+{
+    return perf_event__parse_sample_as<PERF_SAMPLE_TYPE_ANY>(event, attr, sample_id_all, data);
+}
+
+// sample types of perf record defaults: -g adds callchain, -a adds CPU, and more events add identifier
+#define PERF_SAMPLE_DEFAULT_TYPE (PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_PERIOD)
+#define PERF_SAMPLE_PARSER(type) { (type), &perf_event__parse_sample_as<(type)> }
+
+struct perf_sample_parser_entry
+{
+    uint64_t sample_type;
+    perf_sample_parser parser;
+};
+
+static const perf_sample_parser_entry perf_sample_parsers[] = {
+    PERF_SAMPLE_PARSER(PERF_SAMPLE_DEFAULT_TYPE),
+    PERF_SAMPLE_PARSER(PERF_SAMPLE_DEFAULT_TYPE | PERF_SAMPLE_CALLCHAIN),
+    PERF_SAMPLE_PARSER(PERF_SAMPLE_DEFAULT_TYPE | PERF_SAMPLE_CPU),
+    PERF_SAMPLE_PARSER(PERF_SAMPLE_DEFAULT_TYPE | PERF_SAMPLE_CPU | PERF_SAMPLE_CALLCHAIN),
+    PERF_SAMPLE_PARSER(PERF_SAMPLE_DEFAULT_TYPE | PERF_SAMPLE_IDENTIFIER),
+    PERF_SAMPLE_PARSER(PERF_SAMPLE_DEFAULT_TYPE | PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_CALLCHAIN),
+    PERF_SAMPLE_PARSER(PERF_SAMPLE_DEFAULT_TYPE | PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_CPU),
+    PERF_SAMPLE_PARSER(PERF_SAMPLE_DEFAULT_TYPE | PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_CPU | PERF_SAMPLE_CALLCHAIN),
+};
+
+perf_sample_parser perf_event__select_sample_parser(const perf_event_attr *attr)
+{
+    for (const perf_sample_parser_entry &entry : perf_sample_parsers)
+    {
+        if (entry.sample_type == attr->sample_type)
+            return entry.parser;
+    }
+
+    return &perf_event__parse_sample_as<PERF_SAMPLE_TYPE_ANY>;
+}
+
 record_t* create_mmap_msg(mmap_event *evt)
 {
     record_mmap* rec = new record_mmap;
@@ -179,7 +325,7 @@ record_t* create_mmap_msg(mmap_event *evt)
     rec->pgoff = evt->pgoff;
     memcpy(rec->filename, evt->filename, sizeof(rec->filename));
     return &rec->header;
-}
+}
 
 record_t* create_mmap2_msg(mmap2_event *evt)
 {
@@ -237,11 +383,60 @@ record_t* create_sample_msg(perf_sample *evt)
     rec->header.id = evt->id;
     rec->ip = evt->ip;
     rec->period = evt->period;
-    rec->callchain = new ip_callchain;
-
-    rec->callchain->nr = evt->callchain->nr;
-    rec->callchain->ips = new uint64_t[rec->callchain->nr];
-    memcpy(rec->callchain->ips, evt->callchain->ips, rec->callchain->nr * sizeof(uint64_t));
+    rec->branchIndex = 0;
+    rec->branchCount = 0;
+    rec->readIndex = 0;
+    rec->readCount = 0;
+    rec->callchainIndex = 0;
+    rec->callchainCount = 0;
+    rec->kernelFrameCount = 0;
+
+    return &rec->header;
+}
+
+record_t* create_switch_msg(switch_event *evt, perf_sample *sample, uint16_t misc)
+{
+    record_switch* rec = new record_switch;
+    rec->header.pid = sample->pid;
+    rec->header.tid = sample->tid;
+    rec->flags = 0;
+    if (misc & PERF_RECORD_MISC_SWITCH_OUT)
+        rec->flags |= RECORD_SWITCH_OUT;
+    if (misc & PERF_RECORD_MISC_SWITCH_OUT_PREEMPT)
+        rec->flags |= RECORD_SWITCH_PREEMPT;
+    // the other thread is known just for CPU-wide switches
+    rec->nextPrevPid = evt ? evt->next_prev_pid : (uint32_t)(-1);
+    rec->nextPrevTid = evt ? evt->next_prev_tid : (uint32_t)(-1);
+    rec->callchainIndex = 0;
+    rec->callchainCount = 0;
+    rec->kernelFrameCount = 0;
+    rec->ip = 0;
+    return &rec->header;
+}
+
+record_t* create_sched_switch_msg(perf_sample *evt)
+{
+    sched_switch_tracepoint tp;
+
+    if (!evt->raw_data || evt->raw_size < sizeof(tp))
+        return nullptr;
+
+    // raw data are not aligned
+    memcpy(&tp, evt->raw_data, sizeof(tp));
+
+    record_switch* rec = new record_switch;
+    rec->header.pid = evt->pid;
+    rec->header.tid = (uint32_t)tp.prev_pid;
+    rec->flags = RECORD_SWITCH_OUT | RECORD_SWITCH_NEXT_IN | RECORD_SWITCH_STACK;
+    // the lowest bits of state are zero for task still runnable (the rest are just flags)
+    if ((tp.prev_state & 0xFF) == 0)
+        rec->flags |= RECORD_SWITCH_PREEMPT;
+    rec->nextPrevPid = (uint32_t)(-1);
+    rec->nextPrevTid = (uint32_t)tp.next_pid;
+    rec->ip = evt->ip;
+    rec->callchainIndex = 0;
+    rec->callchainCount = 0;
+    rec->kernelFrameCount = 0;
 
     return &rec->header;
 }
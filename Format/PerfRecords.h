@@ -35,7 +35,7 @@ struct mmap2_event;
 struct comm_event;
 struct fork_event;
 struct exit_event;
-struct ip_callchain;
+struct switch_event;
 
 struct record_t
 {
@@ -92,16 +92,74 @@ struct record_exit
     uint32_t tid;
 };
 
+// taken branch of branch stack (LBR); layout matches perf_branch_entry
+struct branch_entry
+{
+    uint64_t from;
+    uint64_t to;
+    // PERF_BRANCH_FLAG_* bits and fields
+    uint64_t flags;
+};
+
+#define PERF_BRANCH_FLAG_MISPRED    0x1
+#define PERF_BRANCH_FLAG_TYPE(f)    (((f) >> 20) & 0xF)
+
+// counter value read with sample (PERF_SAMPLE_READ)
+struct read_value
+{
+    uint64_t value;
+    // ID of counter event, -1 if not recorded (PERF_FORMAT_ID)
+    uint64_t id;
+};
+
 struct record_sample
 {
     record_t header;
     uint64_t ip;
-    uint64_t period;
-    ip_callchain* callchain;
+    uint64_t period;
+    // callchain frames without context markers (the sampled IP first, kernel frames before user ones) within
+    // callchain pool of perf file
+    uint64_t callchainIndex;
+    uint32_t callchainCount;
+    uint32_t kernelFrameCount;
+    // branch stack entries (the most recent first) within branch pool of perf file
+    uint32_t branchIndex;
+    uint32_t branchCount;
+    // counter values (group leader first) within counter pool of perf file
+    uint32_t readIndex;
+    uint32_t readCount;
 };
 
+// context switch record flags
+#define RECORD_SWITCH_OUT       0x1     // the thread was switched out (switched in otherwise)
+#define RECORD_SWITCH_PREEMPT   0x2     // the thread was switched out while still runnable
+#define RECORD_SWITCH_NEXT_IN   0x4     // the next thread was switched in at the same time (sched_switch tracepoint)
+#define RECORD_SWITCH_STACK     0x8     // the record carries stack at switch-out (sched_switch tracepoint)
+
+// context switch (PERF_RECORD_SWITCH, PERF_RECORD_SWITCH_CPU_WIDE, or sched_switch tracepoint sample)
+struct record_switch
+{
+    record_t header;
+    uint32_t flags;
+    uint32_t nextPrevPid;
+    uint32_t nextPrevTid;
+    // stack at switch-out within callchain pool of perf file (RECORD_SWITCH_STACK only)
+    uint64_t callchainIndex;
+    uint32_t callchainCount;
+    uint32_t kernelFrameCount;
+    uint64_t ip;
+};
+
+// sample type of parser, which takes the sample layout from event attribute
+#define PERF_SAMPLE_TYPE_ANY ((uint64_t)(-1))
+
+// parses sample, or sample ID trailer of other event, using layout given by event attribute
+typedef int (*perf_sample_parser)(perf_event *event, const perf_event_attr *attr, bool sample_id_all, perf_sample *data);
+
 int perf_event__parse_id_sample(perf_event *event, uint64_t type, perf_sample *sample);
-int perf_event__parse_sample(perf_event *event, uint64_t type, bool sample_id_all, perf_sample *data);
+int perf_event__parse_sample(perf_event *event, const perf_event_attr *attr, bool sample_id_all, perf_sample *data);
+// selects parser for events of attribute; common sample types have their own parsers with the layout compiled in
+perf_sample_parser perf_event__select_sample_parser(const perf_event_attr *attr);
 
 record_t* create_mmap_msg(mmap_event *evt);
 record_t* create_mmap2_msg(mmap2_event *evt);
@@ -109,5 +167,7 @@ record_t* create_comm_msg(comm_event *evt);
 record_t* create_fork_msg(fork_event *evt);
 record_t* create_exit_msg(exit_event *evt);
 record_t* create_sample_msg(perf_sample *evt);
+record_t* create_switch_msg(switch_event *evt, perf_sample *sample, uint16_t misc);
+record_t* create_sched_switch_msg(perf_sample *evt);
 
 #endif
@@ -0,0 +1,217 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfSampleSpill.h"
+#include "Log.h"
+
+#include <algorithm>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+// orders runs as min-heap by time (and event number) of their head samples
+struct PerfSpillRunHeapPredicate
+{
+    inline bool operator() (const PerfSpillRun* a, const PerfSpillRun* b)
+    {
+        if (a->head.time != b->head.time)
+            return a->head.time > b->head.time;
+        return a->head.nr > b->head.nr;
+    }
+};
+
+PerfSampleSpill::PerfSampleSpill()
+{
+    m_failed = false;
+    m_sampleCount = 0;
+    m_size = 0;
+    m_runSampleCount = 0;
+    m_runSize = 0;
+}
+
+PerfSampleSpill::~PerfSampleSpill()
+{
+    // run files are unlinked right after creation, so closing them removes them
+    for (PerfSpillRun* run : m_runs)
+    {
+        if (run->file)
+            fclose(run->file);
+        delete run;
+    }
+}
+
+bool PerfSampleSpill::BeginRun()
+{
+    const char* tmpdir = getenv("TMPDIR");
+    std::string path = std::string((tmpdir && tmpdir[0] != '\0') ? tmpdir : "/tmp") + "/pivo-spill-XXXXXX";
+
+    int fd = mkstemp(&path[0]);
+    if (fd < 0)
+    {
+        LogFunc(LOG_ERROR, "Could not create sample run file in %s", path.c_str());
+        return false;
+    }
+
+    // nobody else needs the file, and it disappears even when the process crashes
+    unlink(path.c_str());
+
+    PerfSpillRun* run = new PerfSpillRun();
+    run->file = fdopen(fd, "w+b");
+    if (!run->file)
+    {
+        close(fd);
+        delete run;
+        return false;
+    }
+
+    run->buffer.resize(PERF_SPILL_BUFFER_SIZE);
+    setvbuf(run->file, run->buffer.data(), _IOFBF, run->buffer.size());
+
+    m_runs.push_back(run);
+    m_failed = false;
+    m_runSampleCount = 0;
+    m_runSize = 0;
+
+    return true;
+}
+
+bool PerfSampleSpill::Append(const PerfSpilledSample &sample, const uint64_t* callchain, const branch_entry* branches, const read_value* reads)
+{
+    FILE* f = m_runs.back()->file;
+
+    if (m_failed)
+        return false;
+
+    bool ok = (fwrite(&sample, sizeof(sample), 1, f) == 1);
+    if (ok && sample.callchainCount > 0)
+        ok = (fwrite(callchain, sizeof(uint64_t), sample.callchainCount, f) == sample.callchainCount);
+    if (ok && sample.branchCount > 0)
+        ok = (fwrite(branches, sizeof(branch_entry), sample.branchCount, f) == sample.branchCount);
+    if (ok && sample.readCount > 0)
+        ok = (fwrite(reads, sizeof(read_value), sample.readCount, f) == sample.readCount);
+
+    if (!ok)
+    {
+        m_failed = true;
+        return false;
+    }
+
+    m_runSampleCount++;
+    m_runSize += sizeof(sample) + sample.callchainCount * sizeof(uint64_t) + sample.branchCount * sizeof(branch_entry)
+        + sample.readCount * sizeof(read_value);
+
+    return true;
+}
+
+bool PerfSampleSpill::FinishRun()
+{
+    if (fflush(m_runs.back()->file) != 0)
+        m_failed = true;
+
+    if (m_failed)
+        return false;
+
+    m_sampleCount += m_runSampleCount;
+    m_size += m_runSize;
+
+    return true;
+}
+
+void PerfSampleSpill::DiscardRun()
+{
+    PerfSpillRun* run = m_runs.back();
+
+    fclose(run->file);
+    delete run;
+
+    m_runs.pop_back();
+    m_failed = false;
+}
+
+bool PerfSampleSpill::ReadHead(PerfSpillRun* run)
+{
+    if (fread(&run->head, sizeof(run->head), 1, run->file) != 1)
+        return false;
+
+    run->callchain.resize(run->head.callchainCount);
+    run->branches.resize(run->head.branchCount);
+    run->reads.resize(run->head.readCount);
+
+    return fread(run->callchain.data(), sizeof(uint64_t), run->callchain.size(), run->file) == run->callchain.size()
+        && fread(run->branches.data(), sizeof(branch_entry), run->branches.size(), run->file) == run->branches.size()
+        && fread(run->reads.data(), sizeof(read_value), run->reads.size(), run->file) == run->reads.size();
+}
+
+bool PerfSampleSpill::StartMerge()
+{
+    m_heap.clear();
+
+    for (PerfSpillRun* run : m_runs)
+    {
+        if (fseek(run->file, 0, SEEK_SET) != 0)
+            return false;
+
+        if (ReadHead(run))
+            m_heap.push_back(run);
+    }
+
+    std::make_heap(m_heap.begin(), m_heap.end(), PerfSpillRunHeapPredicate());
+
+    return true;
+}
+
+const PerfSpillRun* PerfSampleSpill::Peek() const
+{
+    return m_heap.empty() ? nullptr : m_heap.front();
+}
+
+bool PerfSampleSpill::Advance()
+{
+    if (m_heap.empty())
+        return false;
+
+    std::pop_heap(m_heap.begin(), m_heap.end(), PerfSpillRunHeapPredicate());
+
+    // exhausted run just leaves the heap
+    if (ReadHead(m_heap.back()))
+        std::push_heap(m_heap.begin(), m_heap.end(), PerfSpillRunHeapPredicate());
+    else
+        m_heap.pop_back();
+
+    return !m_heap.empty();
+}
+
+uint32_t PerfSampleSpill::GetRunCount() const
+{
+    return (uint32_t)m_runs.size();
+}
+
+uint64_t PerfSampleSpill::GetSampleCount() const
+{
+    return m_sampleCount;
+}
+
+uint64_t PerfSampleSpill::GetSize() const
+{
+    return m_size;
+}
@@ -0,0 +1,114 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef PIVO_PERF_SAMPLE_SPILL_H
+#define PIVO_PERF_SAMPLE_SPILL_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "PerfRecords.h"
+
+// run files are read and written through buffers of this size
+#define PERF_SPILL_BUFFER_SIZE (1024 * 1024)
+
+// sample in compact form within run file; callchain, branch stack entries and counter values follow it
+struct PerfSpilledSample
+{
+    uint64_t time;
+    // event number, to keep order of samples with the same time
+    uint64_t nr;
+    uint64_t id;
+    uint64_t ip;
+    uint64_t period;
+    uint32_t pid;
+    uint32_t tid;
+    uint32_t cpu;
+    uint32_t callchainCount;
+    uint32_t kernelFrameCount;
+    uint32_t branchCount;
+    uint32_t readCount;
+    uint32_t reserved;
+};
+
+// run file of samples sorted by time; the head sample is the next one to be merged
+struct PerfSpillRun
+{
+    FILE* file;
+    std::vector<char> buffer;
+    PerfSpilledSample head;
+    std::vector<uint64_t> callchain;
+    std::vector<branch_entry> branches;
+    std::vector<read_value> reads;
+};
+
+// samples spilled to temporary run files, when the decoded ones do not fit memory budget; every run is sorted by
+// time on its own, and all of them are merged to single time-ordered stream afterwards
+class PerfSampleSpill
+{
+    public:
+        PerfSampleSpill();
+        ~PerfSampleSpill();
+
+        // starts new run file in temporary directory (TMPDIR, or /tmp)
+        bool BeginRun();
+        // appends sample to current run; samples have to be appended sorted by time (and event number)
+        bool Append(const PerfSpilledSample &sample, const uint64_t* callchain, const branch_entry* branches, const read_value* reads);
+        // finishes current run; returns false if any of its samples could not be written
+        bool FinishRun();
+        // removes current run (e.g. when it could not be written whole)
+        void DiscardRun();
+
+        // rewinds all runs and reads their first samples
+        bool StartMerge();
+        // retrieves the earliest sample of all runs, nullptr if all of them are exhausted
+        const PerfSpillRun* Peek() const;
+        // moves to the next sample of the run retrieved by Peek
+        bool Advance();
+
+        // retrieves count of runs
+        uint32_t GetRunCount() const;
+        // retrieves count of all spilled samples
+        uint64_t GetSampleCount() const;
+        // retrieves size of all run files in bytes
+        uint64_t GetSize() const;
+
+    protected:
+        // reads next sample of run to its head; returns false at the end of run (or on read error)
+        static bool ReadHead(PerfSpillRun* run);
+
+    private:
+        // all runs; the last one is being written until finished
+        std::vector<PerfSpillRun*> m_runs;
+        // runs with samples left, ordered as binary heap by their head samples
+        std::vector<PerfSpillRun*> m_heap;
+        // did any write to current run fail?
+        bool m_failed;
+        // count and size of samples of all runs
+        uint64_t m_sampleCount;
+        uint64_t m_size;
+        // count and size of samples of current run
+        uint64_t m_runSampleCount;
+        uint64_t m_runSize;
+};
+
+#endif
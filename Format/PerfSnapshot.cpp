@@ -0,0 +1,268 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "PerfSnapshot.h"
+#include "PerfInputModule.h"
+#include "Log.h"
+
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+PerfSnapshot::PerfSnapshot()
+{
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+
+    memset(m_sectionData, 0, sizeof(m_sectionData));
+    memset(m_sections, 0, sizeof(m_sections));
+}
+
+PerfSnapshot::~PerfSnapshot()
+{
+    Close();
+}
+
+bool PerfSnapshot::ComputeKey(const char* filename, const char* binaryFilename, PerfSnapshotKey &key)
+{
+    struct stat st;
+
+    memset(&key, 0, sizeof(key));
+
+    if (stat(binaryFilename, &st) != 0)
+        return false;
+
+    key.binarySize = (uint64_t)st.st_size;
+    key.binaryModified = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+    key.binaryInode = (uint64_t)st.st_ino;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+
+    key.recordingSize = (uint64_t)st.st_size;
+
+    // hashing whole recording would take about as long as reading it, so just evenly spread blocks
+    // (always including the header and the end of file) are hashed; small recordings are hashed whole
+    std::vector<uint8_t> block(PERF_SNAPSHOT_HASH_BLOCK_SIZE);
+    uint64_t hash = 14695981039346656037ULL;
+    uint64_t stride = key.recordingSize / PERF_SNAPSHOT_HASH_BLOCKS;
+    if (stride < PERF_SNAPSHOT_HASH_BLOCK_SIZE)
+        stride = PERF_SNAPSHOT_HASH_BLOCK_SIZE;
+
+    uint64_t offset = 0;
+    ssize_t rd;
+    while (offset < key.recordingSize)
+    {
+        // the last block is aligned to the end of file
+        if (offset + stride >= key.recordingSize && key.recordingSize > PERF_SNAPSHOT_HASH_BLOCK_SIZE)
+            offset = key.recordingSize - PERF_SNAPSHOT_HASH_BLOCK_SIZE;
+
+        rd = pread(fd, block.data(), block.size(), (off_t)offset);
+        if (rd < 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        // FNV-1a
+        for (ssize_t i = 0; i < rd; i++)
+        {
+            hash ^= block[i];
+            hash *= 1099511628211ULL;
+        }
+
+        if (offset + PERF_SNAPSHOT_HASH_BLOCK_SIZE >= key.recordingSize)
+            break;
+
+        offset += stride;
+    }
+
+    close(fd);
+
+    key.recordingHash = hash;
+
+    return true;
+}
+
+bool PerfSnapshot::Open(const char* path, const PerfSnapshotKey &key)
+{
+    struct stat st;
+
+    Close();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PerfSnapshotHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        return false;
+
+    m_mapping = (uint8_t*)mapping;
+    m_mappingSize = (size_t)st.st_size;
+
+    const PerfSnapshotHeader* header = (const PerfSnapshotHeader*)m_mapping;
+
+    if (memcmp(header->magic, perfSnapshotMagic, sizeof(perfSnapshotMagic)) != 0
+        || header->version != PERF_SNAPSHOT_VERSION || header->sectionCount != PSS_COUNT)
+    {
+        LogFunc(LOG_VERBOSE, "Snapshot %s is not valid snapshot of current version", path);
+        Close();
+        return false;
+    }
+
+    if (memcmp(&header->key, &key, sizeof(PerfSnapshotKey)) != 0)
+    {
+        LogFunc(LOG_VERBOSE, "Snapshot %s was made from different recording or binary", path);
+        Close();
+        return false;
+    }
+
+    // every section has to be aligned and fit in the file
+    for (uint32_t i = 0; i < PSS_COUNT; i++)
+    {
+        const PerfSnapshotSectionEntry &sec = header->sections[i];
+
+        if ((sec.offset % sizeof(uint64_t)) != 0 || sec.offset > m_mappingSize
+            || (sec.recordSize > 0 && sec.count > (m_mappingSize - sec.offset) / sec.recordSize))
+        {
+            LogFunc(LOG_ERROR, "Snapshot %s is corrupted", path);
+            Close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void PerfSnapshot::Close()
+{
+    if (m_mapping)
+        munmap(m_mapping, m_mappingSize);
+
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+}
+
+const void* PerfSnapshot::GetSection(PerfSnapshotSection section, uint32_t recordSize, uint64_t &count) const
+{
+    count = 0;
+
+    if (!m_mapping)
+        return nullptr;
+
+    const PerfSnapshotSectionEntry &sec = ((const PerfSnapshotHeader*)m_mapping)->sections[section];
+
+    // different record size means different build layout of the structure
+    if (sec.recordSize != recordSize)
+        return nullptr;
+
+    count = sec.count;
+
+    return m_mapping + sec.offset;
+}
+
+void PerfSnapshot::SetSection(PerfSnapshotSection section, const void* data, uint32_t recordSize, uint64_t count)
+{
+    m_sectionData[section] = data;
+    m_sections[section].recordSize = recordSize;
+    m_sections[section].count = count;
+}
+
+bool PerfSnapshot::Write(const char* path, const PerfSnapshotKey &key)
+{
+    PerfSnapshotHeader header;
+    const uint64_t zero = 0;
+    uint64_t offset, size;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, perfSnapshotMagic, sizeof(perfSnapshotMagic));
+    header.version = PERF_SNAPSHOT_VERSION;
+    header.sectionCount = PSS_COUNT;
+    header.key = key;
+
+    // sections follow the header, every one of them aligned to 8 bytes
+    offset = (sizeof(header) + sizeof(uint64_t) - 1) & ~(uint64_t)(sizeof(uint64_t) - 1);
+    for (uint32_t i = 0; i < PSS_COUNT; i++)
+    {
+        header.sections[i] = m_sections[i];
+        header.sections[i].offset = offset;
+
+        size = m_sections[i].count * m_sections[i].recordSize;
+        offset += (size + sizeof(uint64_t) - 1) & ~(uint64_t)(sizeof(uint64_t) - 1);
+    }
+
+    // write to temporary file at first, so nobody could map half-written snapshot
+    std::string tmpPath = std::string(path) + ".tmp";
+
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f)
+    {
+        LogFunc(LOG_VERBOSE, "Could not create snapshot %s", path);
+        return false;
+    }
+
+    bool ok = (fwrite(&header, sizeof(header), 1, f) == 1);
+    ok = ok && fwrite(&zero, 1, header.sections[0].offset - sizeof(header), f) == header.sections[0].offset - sizeof(header);
+
+    for (uint32_t i = 0; i < PSS_COUNT && ok; i++)
+    {
+        size = m_sections[i].count * m_sections[i].recordSize;
+        if (size > 0)
+            ok = (fwrite(m_sectionData[i], 1, size, f) == size);
+
+        // pad to alignment
+        size = (sizeof(uint64_t) - (size % sizeof(uint64_t))) % sizeof(uint64_t);
+        if (ok && size > 0)
+            ok = (fwrite(&zero, 1, size, f) == size);
+    }
+
+    if (fclose(f) != 0)
+        ok = false;
+
+    if (!ok || rename(tmpPath.c_str(), path) != 0)
+    {
+        LogFunc(LOG_ERROR, "Could not write snapshot %s", path);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,192 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef PIVO_PERF_SNAPSHOT_H
+#define PIVO_PERF_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// snapshot is stored next to recording, with this suffix appended to its filename
+#define PERF_SNAPSHOT_SUFFIX ".pivo-snapshot"
+// snapshot format version; snapshots of any other version are ignored
+#define PERF_SNAPSHOT_VERSION 8
+// count of evenly spread blocks of recording hashed to snapshot key
+#define PERF_SNAPSHOT_HASH_BLOCKS 16
+// size of every hashed block
+#define PERF_SNAPSHOT_HASH_BLOCK_SIZE (64 * 1024)
+// parent of call tree root node
+#define PERF_SNAPSHOT_NO_PARENT ((uint32_t)(-1))
+// thread without known name
+#define PERF_SNAPSHOT_NO_NAME ((uint64_t)(-1))
+
+const char perfSnapshotMagic[8] = { 'P', 'I', 'V', 'O', 'S', 'N', 'A', 'P' };
+
+// sections of snapshot file
+enum PerfSnapshotSection
+{
+    PSS_PROPERTIES = 0,     // PerfSnapshotProperties (single record)
+    PSS_FUNCTIONS,          // PerfSnapshotFunction
+    PSS_STRINGS,            // char; function and thread names
+    PSS_STACK_OFFSETS,      // uint32_t; stack starts within frames
+    PSS_STACK_FRAMES,       // uint32_t; function IDs
+    PSS_STACK_COUNTS,       // uint64_t; sample count of every stack
+    PSS_STACK_PERIODS,      // uint64_t; period sum of every stack
+    PSS_SAMPLES,            // PerfSample
+    PSS_FLAT_PROFILE,       // FlatProfileRecord
+    PSS_CALL_GRAPH,         // PerfSnapshotCallGraphEdge
+    PSS_CALL_TREE,          // PerfSnapshotCallTreeNode; parents always precede children
+    PSS_HEAT_MAP_BINS,      // uint64_t; end of every finest heat map bin within entries
+    PSS_HEAT_MAP_ENTRIES,   // HeatMapBinEntry
+    PSS_THREADS,            // PerfSnapshotThread
+    PSS_SWITCH_INTERVALS,   // PerfSwitchInterval; on-CPU and off-CPU intervals from context switches
+    PSS_BRANCH_EDGES,       // PerfBranchEdge; taken branches of branch stacks
+    PSS_BASIC_BLOCKS,       // PerfBasicBlock
+    PSS_FUNCTION_COUNTERS,  // PerfCounterTotals; indexed by function ID
+    PSS_EVENT_ATTRIBUTES,   // event_type_entry
+    PSS_SAMPLE_EVENTS,      // uint32_t; event of every sample (empty for single event recordings)
+    PSS_COUNT
+};
+
+// profiles stored in snapshot; the ones not stored (e.g. moved to caller before the snapshot was written) are
+// aggregated from stacks on first request
+enum PerfSnapshotProduct
+{
+    PSP_FLAT_PROFILE = 0x1,
+    PSP_CALL_GRAPH = 0x2,
+    PSP_CALL_TREE = 0x4
+};
+
+// identity of recording and application binary the snapshot was made from
+struct PerfSnapshotKey
+{
+    uint64_t recordingSize;
+    uint64_t recordingHash;
+    uint64_t binarySize;
+    uint64_t binaryModified;
+    uint64_t binaryInode;
+};
+
+// location of section within snapshot file
+struct PerfSnapshotSectionEntry
+{
+    uint64_t offset;
+    uint64_t count;
+    uint32_t recordSize;
+    uint32_t reserved;
+};
+
+// snapshot file header
+struct PerfSnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionCount;
+    PerfSnapshotKey key;
+    PerfSnapshotSectionEntry sections[PSS_COUNT];
+};
+
+// values not belonging to any table
+struct PerfSnapshotProperties
+{
+    uint32_t heatMapBaseWidth;
+    // stored profiles (PerfSnapshotProduct flags); heat map is stored, when it has any bins
+    uint32_t products;
+    // aggregation settings the stored profiles were built with (PerfSampleWeighting, PerfStackMode, bool)
+    uint32_t weighting;
+    uint32_t stackMode;
+    uint32_t foldRecursion;
+    uint32_t reserved;
+};
+
+// function table entry; name is stored in strings section
+struct PerfSnapshotFunction
+{
+    uint64_t address;
+    uint64_t nameOffset;
+    uint32_t nameLength;
+    uint32_t classId;
+    uint32_t functionType;
+    uint32_t reserved;
+};
+
+struct PerfSnapshotCallGraphEdge
+{
+    uint32_t caller;
+    uint32_t callee;
+    uint64_t count;
+};
+
+struct PerfSnapshotCallTreeNode
+{
+    uint32_t functionId;
+    uint32_t parent;
+    uint64_t sampleCount;
+    double timeTotal;
+    double timeTotalPct;
+};
+
+// known thread; name is stored in strings section (PERF_SNAPSHOT_NO_NAME if not known)
+struct PerfSnapshotThread
+{
+    uint32_t tid;
+    uint32_t pid;
+    uint64_t nameOffset;
+    uint32_t nameLength;
+    uint32_t reserved;
+};
+
+// snapshot file of computed profile; read from memory mapped file, written from sections supplied by caller;
+// restored stack table points right to the mapping, other sections are copied out of it
+class PerfSnapshot
+{
+    public:
+        PerfSnapshot();
+        ~PerfSnapshot();
+
+        // computes key of recording and binary; returns false if any of them is not accessible
+        static bool ComputeKey(const char* filename, const char* binaryFilename, PerfSnapshotKey &key);
+
+        // maps snapshot file and verifies, that it's valid and matches key
+        bool Open(const char* path, const PerfSnapshotKey &key);
+        // retrieves section contents, nullptr if the records are not of expected size
+        const void* GetSection(PerfSnapshotSection section, uint32_t recordSize, uint64_t &count) const;
+
+        // adds section to be written; the data has to remain valid until written
+        void SetSection(PerfSnapshotSection section, const void* data, uint32_t recordSize, uint64_t count);
+        // writes all sections to snapshot file
+        bool Write(const char* path, const PerfSnapshotKey &key);
+
+    protected:
+        // unmaps snapshot file
+        void Close();
+
+    private:
+        // mapped snapshot file
+        uint8_t* m_mapping;
+        // size of mapped snapshot file
+        size_t m_mappingSize;
+
+        // sections to be written
+        const void* m_sectionData[PSS_COUNT];
+        PerfSnapshotSectionEntry m_sections[PSS_COUNT];
+};
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "General.h"
+#include "InputModule.h"
+#include "PerfInputModule.h"
+#include "PerfSymbolCache.h"
+#include "Log.h"
+#include "Helpers.h"
+#include "../config_perf.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+bool PerfSymbolCacheKey::operator<(const PerfSymbolCacheKey &other) const
+{
+    if (device != other.device)
+        return device < other.device;
+    if (inode != other.inode)
+        return inode < other.inode;
+    if (size != other.size)
+        return size < other.size;
+    if (modified != other.modified)
+        return modified < other.modified;
+    return source < other.source;
+}
+
+PerfSymbolCache::PerfSymbolCache()
+{
+    m_hits = 0;
+}
+
+const PerfSymbolList* PerfSymbolCache::GetSymbols(PerfSymbolSource source, const char* path)
+{
+    struct stat st;
+
+    // identical binaries are recognized by file identity, not by the path they were reached by
+    if (stat(path, &st) != 0)
+        return nullptr;
+
+    PerfSymbolCacheKey key;
+    key.device = (uint64_t)st.st_dev;
+    key.inode = (uint64_t)st.st_ino;
+    key.size = (uint64_t)st.st_size;
+    key.modified = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+    key.source = (uint32_t)source;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    auto itr = m_entries.find(key);
+    if (itr != m_entries.end())
+    {
+        // somebody else is listing the file right now, wait for it
+        while (!itr->second.ready)
+            m_ready.wait(lock);
+
+        m_hits++;
+        return itr->second.valid ? &itr->second.symbols : nullptr;
+    }
+
+    PerfSymbolCacheEntry &entry = m_entries[key];
+    entry.ready = false;
+    entry.valid = false;
+
+    // list without holding the lock, other files may be listed meanwhile
+    lock.unlock();
+
+    PerfSymbolList symbols;
+    bool valid = ReadSymbols(source, path, symbols);
+
+    lock.lock();
+
+    entry.symbols.swap(symbols);
+    entry.valid = valid;
+    entry.ready = true;
+
+    m_ready.notify_all();
+
+    return entry.valid ? &entry.symbols : nullptr;
+}
+
+bool PerfSymbolCache::ReadSymbols(PerfSymbolSource source, const char* path, PerfSymbolList &dst)
+{
+    int fd;
+
+    dst.clear();
+
+    if (source == PSRC_KALLSYMS)
+    {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        ReadSymbolsUsingFD(fd, dst);
+        close(fd);
+
+        return true;
+    }
+
+    // build nm binary call parameters
+    const char *argv[] = {NM_BINARY_PATH, "-C", path, 0};
+    const char *argv_dyn[] = {NM_BINARY_PATH, "-C", "-D", path, 0};
+
+    fd = ForkProcessForReading((source == PSRC_NM_DYNAMIC) ? argv_dyn : argv);
+    if (fd <= 0)
+        return false;
+
+    ReadSymbolsUsingFD(fd, dst);
+    close(fd);
+
+    return true;
+}
+
+void PerfSymbolCache::ReadSymbolsUsingFD(int fd, PerfSymbolList &dst)
+{
+    // buffer for reading lines from nm stdout
+    char buffer[256];
+
+    // Read from child’s stdout
+    int res, pos;
+    char c;
+    uint64_t laddr;
+    char* endptr;
+    char fncType;
+
+    // line reading loop - terminated by file end
+    while (true)
+    {
+        pos = 0;
+        while ((res = read(fd, &c, sizeof(char))) == 1)
+        {
+            // stop reading line when end of line character is acquired
+            if (c == 10 || c == 13)
+                break;
+
+            // read only 255 characters, strip the rest
+            if (pos < 255)
+                buffer[pos++] = c;
+        }
+
+        // this both means end of file - eighter no character was read, or we reached zero character
+        if (res <= 0 || c == 0)
+            break;
+
+        // properly null-perminate string
+        buffer[pos] = 0;
+
+        // require some minimal length, parsing would fail anyway
+        if (strlen(buffer) < 8)
+            continue;
+
+        // parse address
+        laddr = strtoull(buffer, &endptr, 16);
+        if (endptr - buffer + 2 > pos)
+            break;
+        // some symbols may not have address
+        if (endptr - buffer < 3)
+            continue;
+
+        // resolve function type
+        fncType = *(endptr+1);
+
+        if (fncType != FET_TEXT && fncType != FET_TEXT_2 && fncType != FET_WEAK && fncType != FET_WEAK_2)
+            continue;
+
+        // store "the rest of line" as function name
+        dst.push_back({ laddr, fncType, endptr+3 });
+    }
+}
+
+uint64_t PerfSymbolCache::GetHitCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_hits;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#ifndef PIVO_PERF_SYMBOL_CACHE_H
+#define PIVO_PERF_SYMBOL_CACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+// where the symbol listing comes from
+enum PerfSymbolSource
+{
+    PSRC_NM = 0,            // nm output of binary (debug symbols)
+    PSRC_NM_DYNAMIC,        // nm output of dynamic symbols of binary
+    PSRC_KALLSYMS           // kernel symbol file in nm format
+};
+
+// symbol as listed by nm; address is not relocated and type is the nm type character
+struct PerfSymbol
+{
+    uint64_t address;
+    char type;
+    std::string name;
+};
+
+typedef std::vector<PerfSymbol> PerfSymbolList;
+
+// identity of listed file and the way it's listed
+struct PerfSymbolCacheKey
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    uint64_t modified;
+    uint32_t source;
+
+    bool operator<(const PerfSymbolCacheKey &other) const;
+};
+
+// cached symbol listing; it's being listed by some worker while not ready
+struct PerfSymbolCacheEntry
+{
+    bool ready;
+    bool valid;
+    PerfSymbolList symbols;
+};
+
+// symbol listings shared among concurrently loaded recordings, so every distinct binary is listed just once
+class PerfSymbolCache
+{
+    public:
+        PerfSymbolCache();
+
+        // retrieves symbols of file, listing it when not cached yet; returns nullptr when the file could not be listed
+        const PerfSymbolList* GetSymbols(PerfSymbolSource source, const char* path);
+        // retrieves count of listings served from cache
+        uint64_t GetHitCount();
+
+        // lists symbols of file without caching
+        static bool ReadSymbols(PerfSymbolSource source, const char* path, PerfSymbolList &dst);
+
+    protected:
+        // parses nm-formatted text and stores function symbols found
+        static void ReadSymbolsUsingFD(int fd, PerfSymbolList &dst);
+
+    private:
+        // guards the entry map and readiness of entries
+        std::mutex m_mutex;
+        // signalled when any entry becomes ready
+        std::condition_variable m_ready;
+        // cached listings; map nodes stay in place, so the lists are valid for the cache lifetime
+        std::map<PerfSymbolCacheKey, PerfSymbolCacheEntry> m_entries;
+        // count of listings served from cache
+        uint64_t m_hits;
+};
+
+#endif
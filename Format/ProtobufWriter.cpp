@@ -0,0 +1,105 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ProtobufWriter.h"
+
+void ProtobufWriter::WriteVarint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        m_data += (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+
+    m_data += (char)value;
+}
+
+void ProtobufWriter::WriteTag(uint32_t field, ProtobufWireType type)
+{
+    WriteVarint(((uint64_t)field << 3) | (uint64_t)type);
+}
+
+void ProtobufWriter::WriteUInt64(uint32_t field, uint64_t value)
+{
+    WriteTag(field, PWT_VARINT);
+    WriteVarint(value);
+}
+
+void ProtobufWriter::WriteInt64(uint32_t field, int64_t value)
+{
+    // negative values are encoded as 10 byte two's complement varints
+    WriteTag(field, PWT_VARINT);
+    WriteVarint((uint64_t)value);
+}
+
+void ProtobufWriter::WriteBool(uint32_t field, bool value)
+{
+    WriteTag(field, PWT_VARINT);
+    WriteVarint(value ? 1 : 0);
+}
+
+void ProtobufWriter::WriteBytes(uint32_t field, const void* data, size_t size)
+{
+    WriteTag(field, PWT_LENGTH_DELIMITED);
+    WriteVarint(size);
+    m_data.append((const char*)data, size);
+}
+
+void ProtobufWriter::WriteString(uint32_t field, const std::string &value)
+{
+    WriteBytes(field, value.data(), value.size());
+}
+
+void ProtobufWriter::WriteMessage(uint32_t field, const ProtobufWriter &message)
+{
+    WriteBytes(field, message.m_data.data(), message.m_data.size());
+}
+
+void ProtobufWriter::WritePackedUInt64(uint32_t field, const std::vector<uint64_t> &values)
+{
+    // empty packed field is omitted as a whole
+    if (values.empty())
+        return;
+
+    // encode values on their own at first, as the length precedes them
+    m_packed.swap(m_data);
+    m_data.clear();
+    for (uint64_t value : values)
+        WriteVarint(value);
+    m_packed.swap(m_data);
+
+    WriteBytes(field, m_packed.data(), m_packed.size());
+}
+
+const std::string& ProtobufWriter::GetData() const
+{
+    return m_data;
+}
+
+size_t ProtobufWriter::GetSize() const
+{
+    return m_data.size();
+}
+
+void ProtobufWriter::Clear()
+{
+    m_data.clear();
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#ifndef PIVO_PROTOBUF_WRITER_H
+#define PIVO_PROTOBUF_WRITER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// protobuf wire types used by writer
+enum ProtobufWireType
+{
+    PWT_VARINT = 0,
+    PWT_LENGTH_DELIMITED = 2
+};
+
+// minimal protobuf message encoder; fields are appended to in-memory buffer in order of calls
+class ProtobufWriter
+{
+    public:
+        // appends unsigned integer field
+        void WriteUInt64(uint32_t field, uint64_t value);
+        // appends signed integer field (int64, not zigzag-encoded sint64)
+        void WriteInt64(uint32_t field, int64_t value);
+        // appends boolean field
+        void WriteBool(uint32_t field, bool value);
+        // appends bytes field
+        void WriteBytes(uint32_t field, const void* data, size_t size);
+        // appends string field
+        void WriteString(uint32_t field, const std::string &value);
+        // appends embedded message field
+        void WriteMessage(uint32_t field, const ProtobufWriter &message);
+        // appends packed repeated unsigned integer field
+        void WritePackedUInt64(uint32_t field, const std::vector<uint64_t> &values);
+
+        // retrieves encoded message
+        const std::string& GetData() const;
+        // retrieves size of encoded message
+        size_t GetSize() const;
+        // clears message, so the writer could be reused
+        void Clear();
+
+    protected:
+        // appends base 128 varint
+        void WriteVarint(uint64_t value);
+        // appends field key
+        void WriteTag(uint32_t field, ProtobufWireType type);
+
+    private:
+        // encoded message
+        std::string m_data;
+        // packed field contents (kept to avoid reallocation for every packed field)
+        std::string m_packed;
+};
+
+#endif
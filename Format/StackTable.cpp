@@ -0,0 +1,183 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "General.h"
+#include "StackTable.h"
+
+StackTable::StackTable()
+{
+    m_offsets.push_back(0);
+
+    m_mappedFrames = nullptr;
+    m_mappedOffsets = nullptr;
+    m_mappedFrameCount = 0;
+    m_mappedStackCount = 0;
+}
+
+uint64_t StackTable::HashFrames(const uint32_t* frames, uint32_t count)
+{
+    // FNV-1a over frame indexes
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        hash ^= frames[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool StackTable::Equals(uint32_t stackId, const uint32_t* frames, uint32_t count) const
+{
+    uint32_t stackCount;
+    const uint32_t* stackFrames = GetFrames(stackId, stackCount);
+
+    if (stackCount != count)
+        return false;
+
+    return (count == 0 || memcmp(stackFrames, frames, count * sizeof(uint32_t)) == 0);
+}
+
+void StackTable::AddToLookup(uint64_t hash, uint32_t stackId)
+{
+    // on hash collision, the next free hash value is used
+    while (m_lookup.find(hash) != m_lookup.end())
+        hash++;
+
+    m_lookup[hash] = stackId;
+}
+
+uint32_t StackTable::Intern(const uint32_t* frames, uint32_t count)
+{
+    // assigned stacks are not in lookup yet
+    if (m_lookup.size() < GetStackCount())
+    {
+        uint32_t frameCount;
+
+        for (uint32_t i = 0; i < GetStackCount(); i++)
+            AddToLookup(HashFrames(GetFrames(i, frameCount), frameCount), i);
+    }
+
+    uint64_t hash = HashFrames(frames, count);
+
+    // on hash collision, just move to next hash value until we find the stack or a free slot
+    auto itr = m_lookup.find(hash);
+    while (itr != m_lookup.end())
+    {
+        if (Equals(itr->second, frames, count))
+            return itr->second;
+
+        itr = m_lookup.find(++hash);
+    }
+
+    // stacks used in place are read-only
+    if (m_mappedOffsets)
+        CopyMapped();
+
+    uint32_t stackId = (uint32_t)(m_offsets.size() - 1);
+
+    m_frames.insert(m_frames.end(), frames, frames + count);
+    m_offsets.push_back((uint32_t)m_frames.size());
+    m_lookup[hash] = stackId;
+
+    return stackId;
+}
+
+const uint32_t* StackTable::GetFrames(uint32_t stackId, uint32_t &count) const
+{
+    const uint32_t* offsets = GetOffsetData();
+
+    count = offsets[stackId + 1] - offsets[stackId];
+    return (count > 0) ? GetFrameData() + offsets[stackId] : nullptr;
+}
+
+uint32_t StackTable::GetStackCount() const
+{
+    return m_mappedOffsets ? m_mappedStackCount : (uint32_t)(m_offsets.size() - 1);
+}
+
+size_t StackTable::GetFrameCount() const
+{
+    return m_mappedOffsets ? m_mappedFrameCount : m_frames.size();
+}
+
+size_t StackTable::GetMemoryUsage() const
+{
+    // lookup nodes hold the value and a link, buckets hold a link each; stacks used in place are not allocated
+    return (m_frames.capacity() + m_offsets.capacity()) * sizeof(uint32_t)
+        + m_lookup.size() * (sizeof(std::pair<const uint64_t, uint32_t>) + sizeof(void*))
+        + m_lookup.bucket_count() * sizeof(void*);
+}
+
+void StackTable::Clear()
+{
+    m_frames.clear();
+    m_offsets.clear();
+    m_offsets.push_back(0);
+    m_lookup.clear();
+
+    m_mappedFrames = nullptr;
+    m_mappedOffsets = nullptr;
+}
+
+const uint32_t* StackTable::GetFrameData() const
+{
+    return m_mappedOffsets ? m_mappedFrames : m_frames.data();
+}
+
+const uint32_t* StackTable::GetOffsetData() const
+{
+    return m_mappedOffsets ? m_mappedOffsets : m_offsets.data();
+}
+
+void StackTable::Assign(const uint32_t* frames, size_t frameCount, const uint32_t* offsets, uint32_t stackCount)
+{
+    m_frames.assign(frames, frames + frameCount);
+    m_offsets.assign(offsets, offsets + stackCount + 1);
+
+    m_mappedFrames = nullptr;
+    m_mappedOffsets = nullptr;
+
+    // lookup is built when first needed, assigned tables are usually just read
+    m_lookup.clear();
+}
+
+void StackTable::AssignMapped(const uint32_t* frames, size_t frameCount, const uint32_t* offsets, uint32_t stackCount)
+{
+    std::vector<uint32_t>().swap(m_frames);
+    std::vector<uint32_t>().swap(m_offsets);
+
+    m_mappedFrames = frames;
+    m_mappedOffsets = offsets;
+    m_mappedFrameCount = frameCount;
+    m_mappedStackCount = stackCount;
+
+    m_lookup.clear();
+}
+
+void StackTable::CopyMapped()
+{
+    m_frames.assign(m_mappedFrames, m_mappedFrames + m_mappedFrameCount);
+    m_offsets.assign(m_mappedOffsets, m_mappedOffsets + m_mappedStackCount + 1);
+
+    m_mappedFrames = nullptr;
+    m_mappedOffsets = nullptr;
+}
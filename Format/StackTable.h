@@ -0,0 +1,85 @@
+/**
+ * Copyright (C) 2016 Martin Ubl <http://pivo.kennny.cz>
+ *
+ * This file is part of PIVO perf input module.
+ *
+ * PIVO perf input module is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * PIVO perf input module is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PIVO perf input module. If not,
+ * see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef PIVO_STACK_TABLE_H
+#define PIVO_STACK_TABLE_H
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+// stack ID assigned to samples without resolvable sampled function
+#define INVALID_STACK_ID ((uint32_t)(-1))
+
+// table of unique call stacks; every stack is stored just once and referenced by ID
+// frames are function table indexes, the sampled function comes first, its callers follow
+class StackTable
+{
+    public:
+        StackTable();
+
+        // retrieves ID of stack with given frames, inserts it when not present yet
+        uint32_t Intern(const uint32_t* frames, uint32_t count);
+        // retrieves frames of stack with given ID
+        const uint32_t* GetFrames(uint32_t stackId, uint32_t &count) const;
+        // retrieves count of unique stacks
+        uint32_t GetStackCount() const;
+        // retrieves total count of stored frames
+        size_t GetFrameCount() const;
+        // retrieves estimated memory used by the table in bytes
+        size_t GetMemoryUsage() const;
+        // removes all stacks
+        void Clear();
+
+        // retrieves frames of all stacks, stored one after another
+        const uint32_t* GetFrameData() const;
+        // retrieves start of every stack within frames (with total frame count at the end)
+        const uint32_t* GetOffsetData() const;
+        // replaces all stacks with given frames and stack starts (stackCount + 1 values)
+        void Assign(const uint32_t* frames, size_t frameCount, const uint32_t* offsets, uint32_t stackCount);
+        // replaces all stacks with given frames and stack starts, which are used in place (e.g. within mapped snapshot);
+        // they have to stay valid as long as the table, until a new stack is interned (which copies them at first)
+        void AssignMapped(const uint32_t* frames, size_t frameCount, const uint32_t* offsets, uint32_t stackCount);
+
+    protected:
+        // calculates hash of frame sequence
+        static uint64_t HashFrames(const uint32_t* frames, uint32_t count);
+        // compares stored stack with frame sequence
+        bool Equals(uint32_t stackId, const uint32_t* frames, uint32_t count) const;
+        // inserts stack ID to lookup
+        void AddToLookup(uint64_t hash, uint32_t stackId);
+        // copies stacks used in place to own storage
+        void CopyMapped();
+
+    private:
+        // all frames of all stacks
+        std::vector<uint32_t> m_frames;
+        // frames of stack i are stored in range <m_offsets[i]; m_offsets[i+1])
+        std::vector<uint32_t> m_offsets;
+        // frames and stack starts used in place instead of the vectors above (nullptr if not assigned that way)
+        const uint32_t* m_mappedFrames;
+        const uint32_t* m_mappedOffsets;
+        size_t m_mappedFrameCount;
+        uint32_t m_mappedStackCount;
+        // hash to stack ID lookup
+        std::unordered_map<uint64_t, uint32_t> m_lookup;
+};
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "General.h"
 #include "PerfFile.h"
+#include "PerfDiff.h"
 #include "UnitIdentifiers.h"
 #include "FlatProfileStructs.h"
 #include "PerfInputModule.h"
@@ -42,12 +43,24 @@ extern "C"
 
 PerfInputModule::PerfInputModule()
 {
-    //
+    m_pfile = nullptr;
+    m_baseline = nullptr;
+    m_diff = nullptr;
+    m_snapshotCache = false;
+    m_memoryBudget = 0;
+    m_weighting = PSW_SAMPLES;
+    m_stackMode = PSM_USER;
+    m_foldRecursion = false;
+    m_heatMapResolution = HEATMAP_GROUP_BY_MS_AMOUNT;
 }
 
 PerfInputModule::~PerfInputModule()
 {
-    //
+    if (m_diff)
+        delete m_diff;
+
+    delete m_baseline;
+    delete m_pfile;
 }
 
 const char* PerfInputModule::ReportName()
@@ -83,9 +96,206 @@ void PerfInputModule::ReportFeatures(IMF_SET &set)
 
 bool PerfInputModule::LoadFile(const char* file, const char* binaryFile)
 {
-    m_pfile = PerfFile::Load(file, binaryFile);
+    PerfFile* pfile = PerfFile::Load(file, binaryFile, nullptr, m_snapshotCache, nullptr, m_memoryBudget);
+    if (!pfile)
+        return false;
+
+    // any previous comparison is not valid anymore
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+
+    delete m_pfile;
+    m_pfile = pfile;
+    m_fileName = file;
+    m_binaryFileName = binaryFile;
+    m_pfile->SetSampleWeighting(m_weighting);
+    m_pfile->SetStackMode(m_stackMode);
+    m_pfile->SetRecursionFolding(m_foldRecursion);
+    m_pfile->SetHeatMapBaseBinWidth(m_heatMapResolution);
+
+    return true;
+}
+
+void PerfInputModule::SetSnapshotCache(bool enabled)
+{
+    m_snapshotCache = enabled;
+}
+
+void PerfInputModule::SetMemoryBudget(uint64_t bytes)
+{
+    m_memoryBudget = bytes;
+}
+
+bool PerfInputModule::LoadPreviewFile(const char* file, const char* binaryFile, const PerfPreviewOptions &options)
+{
+    PerfFile* preview = PerfFile::Load(file, binaryFile, &options);
+    if (!preview)
+        return false;
+
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+
+    delete m_pfile;
+    m_pfile = preview;
+    m_fileName = file;
+    m_binaryFileName = binaryFile;
+    m_pfile->SetSampleWeighting(m_weighting);
+    m_pfile->SetStackMode(m_stackMode);
+    m_pfile->SetRecursionFolding(m_foldRecursion);
+    m_pfile->SetHeatMapBaseBinWidth(m_heatMapResolution);
+
+    return true;
+}
+
+bool PerfInputModule::LoadFiles(const std::vector<std::string> &files, const char* binaryFile, uint32_t workerCount)
+{
+    PerfFile* merged = PerfFile::LoadMerged(files, binaryFile, workerCount, m_snapshotCache, m_memoryBudget);
+    if (!merged)
+        return false;
+
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+
+    delete m_pfile;
+    m_pfile = merged;
+    // merged profile is not a preview to be loaded fully later
+    m_fileName.clear();
+    m_binaryFileName = binaryFile;
+    m_pfile->SetSampleWeighting(m_weighting);
+    m_pfile->SetStackMode(m_stackMode);
+    m_pfile->SetRecursionFolding(m_foldRecursion);
+    m_pfile->SetHeatMapBaseBinWidth(m_heatMapResolution);
+
+    return true;
+}
+
+bool PerfInputModule::IsPreview()
+{
+    return (m_pfile && m_pfile->IsPreview());
+}
+
+void PerfInputModule::GetPreviewErrorBounds(std::vector<PerfPreviewFunctionRecord> &dst)
+{
+    dst.clear();
+
+    if (m_pfile)
+        m_pfile->FillPreviewErrorBounds(dst);
+}
+
+bool PerfInputModule::LoadFullFile()
+{
+    if (!m_pfile || !m_pfile->IsPreview())
+        return (m_pfile != nullptr);
+
+    PerfFile* full = PerfFile::Load(m_fileName.c_str(), m_binaryFileName.c_str(), nullptr, m_snapshotCache, nullptr, m_memoryBudget);
+    if (!full)
+        return false;
+
+    // function IDs of preview and full recording differ, so nothing from preview remains valid
+    delete m_pfile;
+    m_pfile = full;
+    m_pfile->SetSampleWeighting(m_weighting);
+    m_pfile->SetStackMode(m_stackMode);
+    m_pfile->SetRecursionFolding(m_foldRecursion);
+    m_pfile->SetHeatMapBaseBinWidth(m_heatMapResolution);
+
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+
+    return true;
+}
+
+bool PerfInputModule::OpenLiveFile(const char* file, const char* binaryFile)
+{
+    PerfFile* live = PerfFile::OpenLive(file, binaryFile);
+    if (!live)
+        return false;
+
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+
+    delete m_pfile;
+    m_pfile = live;
+    m_pfile->SetSampleWeighting(m_weighting);
+    m_pfile->SetStackMode(m_stackMode);
+    m_pfile->SetRecursionFolding(m_foldRecursion);
+    m_pfile->SetHeatMapBaseBinWidth(m_heatMapResolution);
+
+    // incorporate everything written so far
+    m_pfile->Poll();
+
+    return true;
+}
+
+bool PerfInputModule::PollLiveFile()
+{
+    if (!m_pfile || !m_pfile->Poll())
+        return false;
+
+    // comparison has to be made again with new data
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+
+    return true;
+}
+
+bool PerfInputModule::IsLiveFileFinished()
+{
+    return (!m_pfile || m_pfile->IsLiveFinished());
+}
+
+bool PerfInputModule::LoadBaselineFile(const char* file, const char* binaryFile)
+{
+    LogFunc(LOG_INFO, "Loading baseline recording for comparison");
+
+    PerfFile* baseline = PerfFile::Load(file, binaryFile, nullptr, m_snapshotCache, nullptr, m_memoryBudget);
+    if (!baseline)
+        return false;
+
+    // comparison refers to the previous baseline
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+
+    delete m_baseline;
+    m_baseline = baseline;
+    m_baseline->SetSampleWeighting(m_weighting);
+    m_baseline->SetStackMode(m_stackMode);
+    m_baseline->SetRecursionFolding(m_foldRecursion);
 
-    return (m_pfile != nullptr);
+    return true;
+}
+
+void PerfInputModule::GetDiffFunctionData(std::vector<PerfDiffFunctionRecord> &dst)
+{
+    dst.clear();
+
+    if (!m_pfile || !m_baseline)
+        return;
+
+    if (!m_diff)
+        m_diff = new PerfDiff(m_baseline, m_pfile);
+
+    m_diff->FillFunctionDiff(dst);
+}
+
+void PerfInputModule::GetDiffCallTreeData(std::vector<PerfDiffPathRecord> &dst)
+{
+    dst.clear();
+
+    if (!m_pfile || !m_baseline)
+        return;
+
+    if (!m_diff)
+        m_diff = new PerfDiff(m_baseline, m_pfile);
+
+    m_diff->FillCallTreeDiff(dst);
 }
 
 void PerfInputModule::GetClassTable(std::vector<ClassEntry> &dst)
@@ -97,22 +307,17 @@ void PerfInputModule::GetClassTable(std::vector<ClassEntry> &dst)
 
 void PerfInputModule::GetFunctionTable(std::vector<FunctionEntry> &dst)
 {
-    dst.clear();
-
+    // the whole contents is replaced
     m_pfile->FillFunctionTable(dst);
 }
 
 void PerfInputModule::GetFlatProfileData(std::vector<FlatProfileRecord> &dst)
 {
-    dst.clear();
-
     m_pfile->FillFlatProfileTable(dst);
 }
 
 void PerfInputModule::GetCallGraphMap(CallGraphMap &dst)
 {
-    dst.clear();
-
     m_pfile->FillCallGraphMap(dst);
 }
 
@@ -129,3 +334,276 @@ void PerfInputModule::GetHeatMapData(TimeHistogramVector &dst)
 
     m_pfile->FillHeatMapData(dst);
 }
+
+const std::vector<FunctionEntry>& PerfInputModule::GetFunctionTableView()
+{
+    return m_pfile->GetFunctionTable();
+}
+
+void PerfInputModule::TakeFlatProfileData(std::vector<FlatProfileRecord> &dst)
+{
+    m_pfile->TakeFlatProfileTable(dst);
+}
+
+void PerfInputModule::TakeCallGraphMap(CallGraphMap &dst)
+{
+    m_pfile->TakeCallGraphMap(dst);
+}
+
+void PerfInputModule::GetLoadStats(PerfLoadStats &dst)
+{
+    m_pfile->FillLoadStats(dst);
+}
+
+uint64_t PerfInputModule::GetRecordingDuration()
+{
+    return m_pfile->GetRecordingDuration();
+}
+
+void PerfInputModule::GetFlatProfileData(std::vector<FlatProfileRecord> &dst, uint64_t fromMs, uint64_t toMs)
+{
+    PerfSampleFilter filter;
+    filter.fromMs = fromMs;
+    filter.toMs = toMs;
+
+    GetFlatProfileData(dst, filter);
+}
+
+void PerfInputModule::GetFlatProfileData(std::vector<FlatProfileRecord> &dst, const PerfSampleFilter &filter)
+{
+    dst.clear();
+
+    m_pfile->FillFlatProfileTable(dst, filter);
+}
+
+void PerfInputModule::GetFunctionWeights(std::vector<PerfFunctionWeights> &dst, const PerfSampleFilter &filter)
+{
+    dst.clear();
+
+    m_pfile->FillFunctionWeights(dst, filter);
+}
+
+void PerfInputModule::SetSampleWeighting(PerfSampleWeighting weighting)
+{
+    m_weighting = weighting;
+
+    if (m_pfile)
+        m_pfile->SetSampleWeighting(weighting);
+    if (m_baseline)
+        m_baseline->SetSampleWeighting(weighting);
+
+    // comparison has to be made again with new weights
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+}
+
+void PerfInputModule::SetStackMode(PerfStackMode mode)
+{
+    m_stackMode = mode;
+
+    if (m_pfile)
+        m_pfile->SetStackMode(mode);
+    if (m_baseline)
+        m_baseline->SetStackMode(mode);
+
+    // comparison considers the same frames as call tree
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+}
+
+void PerfInputModule::SetRecursionFolding(bool enable)
+{
+    m_foldRecursion = enable;
+
+    if (m_pfile)
+        m_pfile->SetRecursionFolding(enable);
+    if (m_baseline)
+        m_baseline->SetRecursionFolding(enable);
+
+    if (m_diff)
+        delete m_diff;
+    m_diff = nullptr;
+}
+
+void PerfInputModule::GetCallGraphMap(CallGraphMap &dst, uint64_t fromMs, uint64_t toMs)
+{
+    PerfSampleFilter filter;
+    filter.fromMs = fromMs;
+    filter.toMs = toMs;
+
+    GetCallGraphMap(dst, filter);
+}
+
+void PerfInputModule::GetCallGraphMap(CallGraphMap &dst, const PerfSampleFilter &filter)
+{
+    dst.clear();
+
+    m_pfile->FillCallGraphMap(dst, filter);
+}
+
+void PerfInputModule::GetCallTreeMap(CallTreeMap &dst, uint64_t fromMs, uint64_t toMs)
+{
+    PerfSampleFilter filter;
+    filter.fromMs = fromMs;
+    filter.toMs = toMs;
+
+    GetCallTreeMap(dst, filter);
+}
+
+void PerfInputModule::GetCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter)
+{
+    dst.clear();
+
+    m_pfile->FillCallTreeMap(dst, filter);
+}
+
+void PerfInputModule::GetHeatMapData(TimeHistogramVector &dst, uint32_t binWidthMs)
+{
+    dst.clear();
+
+    m_pfile->FillHeatMapData(dst, binWidthMs);
+}
+
+void PerfInputModule::GetHeatMapData(TimeHistogramVector &dst, uint32_t binWidthMs, const PerfSampleFilter &filter)
+{
+    dst.clear();
+
+    m_pfile->FillHeatMapData(dst, binWidthMs, filter);
+}
+
+void PerfInputModule::GetInvertedCallTreeMap(CallTreeMap &dst)
+{
+    dst.clear();
+
+    m_pfile->FillInvertedCallTreeMap(dst);
+}
+
+void PerfInputModule::GetInvertedCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter)
+{
+    dst.clear();
+
+    m_pfile->FillInvertedCallTreeMap(dst, filter);
+}
+
+bool PerfInputModule::GetButterflyData(uint32_t functionId, PerfButterflyEntry &dst)
+{
+    return m_pfile->FillButterfly(functionId, dst);
+}
+
+bool PerfInputModule::GetButterflyData(uint32_t functionId, PerfButterflyEntry &dst, const PerfSampleFilter &filter)
+{
+    return m_pfile->FillButterfly(functionId, dst, filter);
+}
+
+void PerfInputModule::GetOffCpuCallTreeMap(CallTreeMap &dst)
+{
+    GetOffCpuCallTreeMap(dst, PerfSampleFilter());
+}
+
+void PerfInputModule::GetOffCpuCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter)
+{
+    dst.clear();
+
+    m_pfile->FillOffCpuCallTreeMap(dst, filter);
+}
+
+void PerfInputModule::GetThreadTimeline(uint32_t tid, std::vector<PerfThreadInterval> &dst)
+{
+    m_pfile->FillThreadTimeline(tid, dst);
+}
+
+bool PerfInputModule::HasBranchStacks()
+{
+    return m_pfile->HasBranchStacks();
+}
+
+void PerfInputModule::GetBranchEdges(std::vector<PerfBranchEdge> &dst)
+{
+    m_pfile->FillBranchEdges(dst);
+}
+
+void PerfInputModule::GetHotBasicBlocks(std::vector<PerfBasicBlock> &dst)
+{
+    m_pfile->FillHotBasicBlocks(INVALID_FUNCTION_ID, dst);
+}
+
+void PerfInputModule::GetHotBasicBlocks(uint32_t functionId, std::vector<PerfBasicBlock> &dst)
+{
+    m_pfile->FillHotBasicBlocks(functionId, dst);
+}
+
+void PerfInputModule::GetBranchCallGraphMap(CallGraphMap &dst)
+{
+    dst.clear();
+
+    m_pfile->FillBranchCallGraphMap(dst);
+}
+
+bool PerfInputModule::HasCounterValues()
+{
+    return m_pfile->HasCounterValues();
+}
+
+void PerfInputModule::GetFunctionCounters(std::vector<PerfFunctionCounters> &dst)
+{
+    m_pfile->FillFunctionCounters(dst);
+}
+
+void PerfInputModule::GetProcessList(std::vector<PerfProcessInfo> &dst)
+{
+    m_pfile->FillProcessList(dst);
+}
+
+void PerfInputModule::GetThreadList(std::vector<PerfThreadInfo> &dst)
+{
+    m_pfile->FillThreadList(dst);
+}
+
+void PerfInputModule::GetEventList(std::vector<PerfEventInfo> &dst)
+{
+    m_pfile->FillEventList(dst);
+}
+
+void PerfInputModule::SetHeatMapResolution(uint32_t binWidthMs)
+{
+    m_heatMapResolution = (binWidthMs == 0) ? HEATMAP_GROUP_BY_MS_AMOUNT : binWidthMs;
+
+    if (m_pfile)
+        m_pfile->SetHeatMapBaseBinWidth(m_heatMapResolution);
+}
+
+void PerfInputModule::GetHeatMapLevels(std::vector<uint32_t> &dst)
+{
+    dst.clear();
+
+    if (m_pfile)
+        m_pfile->GetHeatMapLevelWidths(dst);
+}
+
+bool PerfInputModule::ExportFoldedStacks(int fd)
+{
+    return ExportFoldedStacks(fd, PerfSampleFilter());
+}
+
+bool PerfInputModule::ExportFoldedStacks(int fd, const PerfSampleFilter &filter)
+{
+    if (!m_pfile)
+        return false;
+
+    return m_pfile->ExportFoldedStacks(fd, filter);
+}
+
+bool PerfInputModule::ExportPprof(int fd)
+{
+    return ExportPprof(fd, PerfSampleFilter());
+}
+
+bool PerfInputModule::ExportPprof(int fd, const PerfSampleFilter &filter)
+{
+    if (!m_pfile)
+        return false;
+
+    return m_pfile->ExportPprof(fd, filter);
+}
@@ -23,8 +23,10 @@
 
 #include "InputModule.h"
 #include "InputModuleFeatures.h"
+#include "PerfQueryStructs.h"
 
 class PerfFile;
+class PerfDiff;
 
 extern void(*LogFunc)(int, const char*, ...);
 
@@ -45,11 +47,154 @@ class PerfInputModule : public InputModule
         virtual void GetCallTreeMap(CallTreeMap &dst);
         virtual void GetHeatMapData(TimeHistogramVector &dst);
 
+        // retrieves read-only view of function table instead of its copy; valid until another recording is loaded, or
+        // live recording polled
+        const std::vector<FunctionEntry>& GetFunctionTableView();
+        // moves flat profile to caller instead of copying it; the module aggregates it again, if needed later
+        void TakeFlatProfileData(std::vector<FlatProfileRecord> &dst);
+        // moves call graph to caller instead of copying it
+        void TakeCallGraphMap(CallGraphMap &dst);
+
+        // retrieves per-phase timings, counters and peak memory of loading (and aggregations done so far)
+        void GetLoadStats(PerfLoadStats &dst);
+
+        // retrieves time between first and last sample in milliseconds
+        uint64_t GetRecordingDuration();
+        // retrieves flat profile of time window <fromMs; toMs> (milliseconds from recording start)
+        void GetFlatProfileData(std::vector<FlatProfileRecord> &dst, uint64_t fromMs, uint64_t toMs);
+        // retrieves call graph of time window
+        void GetCallGraphMap(CallGraphMap &dst, uint64_t fromMs, uint64_t toMs);
+        // retrieves call tree of time window; the nodes are owned by caller
+        void GetCallTreeMap(CallTreeMap &dst, uint64_t fromMs, uint64_t toMs);
+
+        // opens perf output still being written (or pipe-mode stream, "-" for stdin) instead of finished file
+        bool OpenLiveFile(const char* file, const char* binaryFile);
+        // reads newly written live data; returns true if outputs changed since the last poll
+        bool PollLiveFile();
+        // is the live recording finished (no more data will come)?
+        bool IsLiveFileFinished();
+
+        // enables or disables storing computed profiles next to recordings (as <recording>.pivo-snapshot), and restoring
+        // them on next load; disabled by default, so nothing is written next to recordings unless asked for
+        void SetSnapshotCache(bool enabled);
+        // sets memory budget of decoded samples in bytes; samples over budget are spilled to temporary files (0 for unlimited)
+        void SetMemoryBudget(uint64_t bytes);
+
+        // loads just randomly selected chunks of recording for quick overview
+        bool LoadPreviewFile(const char* file, const char* binaryFile, const PerfPreviewOptions &options);
+        // is the loaded recording just a preview?
+        bool IsPreview();
+        // retrieves flat profile estimates of preview with confidence intervals
+        void GetPreviewErrorBounds(std::vector<PerfPreviewFunctionRecord> &dst);
+        // loads whole recording, which was previewed before
+        bool LoadFullFile();
+
+        // loads recordings (i.e. of all hosts running the same binary) concurrently and merges them by function
+        // name into single profile; zero worker count means all available cores
+        bool LoadFiles(const std::vector<std::string> &files, const char* binaryFile, uint32_t workerCount = 0);
+
+        // loads baseline recording to compare the loaded one (candidate) with
+        bool LoadBaselineFile(const char* file, const char* binaryFile);
+        // retrieves per-function differences between baseline and candidate recording
+        void GetDiffFunctionData(std::vector<PerfDiffFunctionRecord> &dst);
+        // retrieves per-path call tree differences between baseline and candidate recording
+        void GetDiffCallTreeData(std::vector<PerfDiffPathRecord> &dst);
+
+        // retrieves list of sampled processes with their sample counts
+        void GetProcessList(std::vector<PerfProcessInfo> &dst);
+        // retrieves list of sampled threads with their sample counts
+        void GetThreadList(std::vector<PerfThreadInfo> &dst);
+        // retrieves list of recorded events with their sample counts; select them using events of sample filter
+        void GetEventList(std::vector<PerfEventInfo> &dst);
+        // retrieves flat profile of samples matching filter
+        void GetFlatProfileData(std::vector<FlatProfileRecord> &dst, const PerfSampleFilter &filter);
+        // retrieves sample counts and period sums of functions within samples matching filter
+        void GetFunctionWeights(std::vector<PerfFunctionWeights> &dst, const PerfSampleFilter &filter);
+        // selects weight of samples in all profiles (sample count by default, or period for frequency-mode recordings)
+        void SetSampleWeighting(PerfSampleWeighting weighting);
+        // selects stack segments considered in all profiles (user frames by default, kernel frames or both)
+        void SetStackMode(PerfStackMode mode);
+        // enables folding of recursion in call trees (including differential one), keeping their depth bounded
+        void SetRecursionFolding(bool enable);
+        // retrieves call graph of samples matching filter
+        void GetCallGraphMap(CallGraphMap &dst, const PerfSampleFilter &filter);
+        // retrieves call tree of samples matching filter; the nodes are owned by caller
+        void GetCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter);
+        // retrieves heat map of samples matching filter
+        void GetHeatMapData(TimeHistogramVector &dst, uint32_t binWidthMs, const PerfSampleFilter &filter);
+
+        // retrieves bottom-up call tree, rooted at sampled functions with their callers as children
+        void GetInvertedCallTreeMap(CallTreeMap &dst);
+        // retrieves bottom-up call tree of samples matching filter; the nodes are owned by caller
+        void GetInvertedCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter);
+        // retrieves direct callers and callees of function; returns false if the function was not sampled
+        bool GetButterflyData(uint32_t functionId, PerfButterflyEntry &dst);
+        // retrieves direct callers and callees of function within samples matching filter
+        bool GetButterflyData(uint32_t functionId, PerfButterflyEntry &dst, const PerfSampleFilter &filter);
+
+        // retrieves call tree of time spent off CPU (in milliseconds) by stacks at switch-out; the nodes are owned by caller
+        void GetOffCpuCallTreeMap(CallTreeMap &dst);
+        // retrieves off-CPU call tree of threads matching filter
+        void GetOffCpuCallTreeMap(CallTreeMap &dst, const PerfSampleFilter &filter);
+        // retrieves running, blocked and preempted intervals of thread
+        void GetThreadTimeline(uint32_t tid, std::vector<PerfThreadInterval> &dst);
+
+        // does the recording contain branch stacks (perf record -b)?
+        bool HasBranchStacks();
+        // retrieves histogram of taken branches, the most frequent first
+        void GetBranchEdges(std::vector<PerfBranchEdge> &dst);
+        // retrieves the hottest basic blocks of all functions
+        void GetHotBasicBlocks(std::vector<PerfBasicBlock> &dst);
+        // retrieves the hottest basic blocks of function
+        void GetHotBasicBlocks(uint32_t functionId, std::vector<PerfBasicBlock> &dst);
+        // retrieves call graph made of call branches of branch stacks (call counts instead of sample counts)
+        void GetBranchCallGraphMap(CallGraphMap &dst);
+
+        // does the recording contain counter group values (perf record -e '{cycles,instructions,...}:S')?
+        bool HasCounterValues();
+        // retrieves counter deltas and IPC, cache and branch miss rates of sampled functions
+        void GetFunctionCounters(std::vector<PerfFunctionCounters> &dst);
+
+        // writes collapsed stacks (flame graph input) to file descriptor
+        bool ExportFoldedStacks(int fd);
+        // writes collapsed stacks of samples matching filter to file descriptor
+        bool ExportFoldedStacks(int fd, const PerfSampleFilter &filter);
+        // writes gzip-compressed pprof profile to file descriptor
+        bool ExportPprof(int fd);
+        // writes gzip-compressed pprof profile of samples matching filter to file descriptor
+        bool ExportPprof(int fd, const PerfSampleFilter &filter);
+
+        // retrieves heat map with bins of specified width (in milliseconds)
+        void GetHeatMapData(TimeHistogramVector &dst, uint32_t binWidthMs);
+        // sets finest heat map bin width; coarser widths are derived from it
+        void SetHeatMapResolution(uint32_t binWidthMs);
+        // retrieves bin widths, which are served without any further merging
+        void GetHeatMapLevels(std::vector<uint32_t> &dst);
+
     protected:
         //
 
     private:
         PerfFile* m_pfile;
+        // loaded recording and binary filenames, for loading full recording after preview
+        std::string m_fileName;
+        std::string m_binaryFileName;
+        // are profile snapshots used?
+        bool m_snapshotCache;
+        // memory budget of decoded samples of loaded recordings (0 for unlimited)
+        uint64_t m_memoryBudget;
+        // weight of samples in profiles of every loaded recording
+        PerfSampleWeighting m_weighting;
+        // stack segments considered in profiles of every loaded recording
+        PerfStackMode m_stackMode;
+        // is recursion folded in call trees of every loaded recording?
+        bool m_foldRecursion;
+        // finest heat map bin width of every loaded recording (in milliseconds)
+        uint32_t m_heatMapResolution;
+        // baseline recording for differential profiling
+        PerfFile* m_baseline;
+        // comparison of baseline and loaded recording
+        PerfDiff* m_diff;
 };
 
 #endif